@@ -1,3 +1,4 @@
+#define _GNU_SOURCE // Necesaria para copy_file_range y otras extensiones de Linux
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -12,12 +13,83 @@
 #include <errno.h> // Necesaria para manejar errores con errno
 #include <signal.h>
 #include <time.h>
+#include <sys/ioctl.h>
+#include <sys/sendfile.h>
+#include <linux/fs.h> // FICLONE
+#include <pthread.h>
+#include <stdatomic.h>
+#include <limits.h>
+#include <stdarg.h>
+#include <sys/uio.h>
+#include <spawn.h>
+#include <poll.h>
+#include <termios.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <fnmatch.h>
+#include <stdint.h>
+#include <sys/mman.h>
+#include <sys/file.h>
+#include <arpa/inet.h>
+#include <sys/epoll.h>
+#include <ftw.h>
+#if defined(__x86_64__)
+#include <nmmintrin.h> // _mm_crc32_u64 (SSE4.2, elegido al ejecutar)
+#endif
 
 #define MAX_LFS_INPUT 1024
 #define MAX_ARGS 100
 #define USER_DATA_FILE "/usr/local/bin/usuarios_data.txt" //Aca se guardan los datos de inicio de sesion del ususario
+#define USUARIOS_BD_FILE "/usr/local/bin/usuarios_data.db" // Registros fijos con indice por nombre
 #define HISTORIAL_FILE "/var/log/shell/historial.log" // Archivo para el historial
+#define HISTORIAL_INDICE_FILE "/var/log/shell/historial.idx" // Desplazamiento y segundo de cada linea del historial
+#define HISTORIAL_ANILLO 1000 // Lineas recientes en memoria
+#define HISTORIAL_MOSTRAR 20 // Lineas que muestra 'historial' sin opciones
+#define HISTORIAL_BLOQUE (1 << 20) // Lectura del log al ponerse al dia con el indice
+#define HISTORIAL_MARCA 21 // "YYYY-mm-dd HH:MM:SS: " al inicio de cada linea
 #define ERROR_LOG_FILE "/var/log/shell/sistema_error.log" // Archivo para errores
+#define SESIONES_FILE "/usr/local/bin/usuario_horarios.log" // Inicios y cierres de sesion
+#define LOG_GENERAL_FILE "/var/log/shell/Shell_transferencias"
+#define TRANSFERENCIAS_FILE "/var/log/shell/Shell_transferencias.log"
+#define LOG_REGISTRO_TAM 512 // Largo maximo de una linea de log
+#define LOG_ANILLO 4096 // Registros en el anillo en memoria (potencia de 2)
+#define LOG_ESPERA_MS 200 // Cada cuanto revisa el hilo escritor si hay pedidos pendientes
+#define LOG_BLOQUEO_MS 100 // Espera maxima con el anillo lleno antes de descartar
+#define HASH_RUTAS 256 // Cubetas de la cache de comandos externos
+#define MAX_ETAPAS 16 // Comandos por tuberia
+#define MAX_TRABAJOS 64 // Trabajos en segundo plano o detenidos
+#define LISTAR_BUFFER (1 << 20) // Buffer de getdents64
+#define LISTAR_SALIDA (256 << 10) // La salida se junta y se escribe de a bloques
+#define EDITOR_LISTADOS 8 // Directorios con el listado guardado para completar con Tab
+#define EDITOR_CANDIDATOS 200 // Posibilidades que se muestran con dos Tab
+#define GLOB_BUFFER (256 << 10) // Buffer de getdents64 por directorio recorrido con comodines
+#define GLOB_LOTE 4096 // Archivos por lote que reciben los comandos internos con comodines
+#define PARALELO_BUFFER (64 << 10) // Lectura de la salida de cada tarea de 'paralelo'
+#define LISTAR_LOTE_STAT 512 // Entradas por tarea de statx en paralelo
+#define CAMBIO_FDS_EN_COLA 256 // Directorios abiertos esperando en el pool de 'permisos -R'; luego se recorre en el hilo
+#define HASH_IDENTIDADES 128 // Cubetas de la cache de usuarios y grupos
+#define HASH_REGLAS 1024 // Cubetas de las reglas de acceso ya compiladas
+#define IDENTIDADES_TTL 300 // Segundos que vale una entrada de esa cache
+#define MAX_SERVICIOS 64 // Demonios bajo supervision
+#define DEMONIO_ESPERA_SCRIPT 30 // Segundos maximos para 'start' o 'stop' de un script
+#define DEMONIO_ESPERA_TERM 10 // Segundos tras SIGTERM antes de mandar SIGKILL
+#define DEMONIO_ESPERA_KILL 5
+#define REINICIO_MINIMO 1 // Espera inicial antes de reiniciar un demonio caido
+#define REINICIO_MAXIMO 60 // La espera se duplica en cada caida hasta este tope
+#define REINICIO_ESTABLE 30 // Tras correr este tiempo la espera vuelve al minimo
+#define HASH_TIEMPOS 64 // Cubetas de la tabla de tiempos por comando
+#define TIEMPOS_CUBETAS 312 // Histograma: 8 subcubetas por potencia de dos hasta ~12 dias en microsegundos
+#define COPIA_BUFFER_TAM (1 << 20) // Buffer del ultimo nivel de copia (1 MiB)
+#define COPIA_ALINEACION 4096
+#define COPIA_TRAMO (64 << 20) // Bytes pedidos al kernel por llamada
+#define COPIA_PEQUENO (256 << 10) // Archivos menores se copian en lotes
+#define COPIA_LOTE_ARCHIVOS 64
+#define COPIA_LOTE_BYTES (8 << 20)
+#define COPIA_TROZO (64 << 20) // Archivos mayores a dos trozos se dividen
+#define TRANSFERENCIA_TROZO (8 << 20) // Unidad de transferencia, verificacion y reanudacion
+#define TRANSFERENCIA_FLUJOS 4 // Trozos en vuelo a la vez por defecto
+#define VERIFICAR_TROZO (64 << 20) // Archivos mayores se verifican en trozos en paralelo
+#define VERIFICAR_BUFFER (256 << 10)
 // Estructura para datos de usuario
 typedef struct {
     char nombre[64];
@@ -27,45 +99,417 @@ typedef struct {
 } Usuario;
 
 
-// Funcion para obtener el timestamp actual
+// Tiempo monotono en segundos
+static double segundos_monotonicos() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// ---------------------------------------------------------------------------
+// Bitacora: subsistema de logs.
+// Los archivos de log quedan abiertos y cada registro se copia a un anillo en
+// memoria. Un hilo escritor vacia el anillo con writev agrupando los registros
+// consecutivos de un mismo archivo. La marca de tiempo se calcula una vez por segundo.
+// ---------------------------------------------------------------------------
+
+typedef enum {
+    LOG_ERRORES,
+    LOG_SESIONES,
+    LOG_GENERAL,
+    LOG_TRANSFERENCIAS,
+    LOG_DESTINOS
+} DestinoLog;
+
+static const char *rutas_log[LOG_DESTINOS] = {
+    ERROR_LOG_FILE, SESIONES_FILE, LOG_GENERAL_FILE, TRANSFERENCIAS_FILE
+};
+
+// Durabilidad: cuando se llama a fsync sobre los logs
+typedef enum {
+    DURABILIDAD_NINGUNA,   // Lo decide el kernel
+    DURABILIDAD_PERIODICA, // Una vez por segundo si hubo escrituras
+    DURABILIDAD_REGISTRO   // Cada registro espera su fsync antes de volver
+} Durabilidad;
+
+// Que hacer cuando el anillo esta lleno
+typedef enum {
+    POLITICA_DESCARTAR, // Se pierde el registro nuevo
+    POLITICA_BLOQUEAR   // Se espera hasta LOG_BLOQUEO_MS y luego se descarta
+} PoliticaLlena;
+
+// Formato de la marca de tiempo al inicio de cada linea, por archivo
+static const char *formatos_marca[LOG_DESTINOS] = {"%s", "%s", "[%s]", "%s"};
+
+static const char *nombres_durabilidad[] = {"ninguna", "periodica", "registro"};
+static const char *nombres_politica[] = {"descartar", "bloquear"};
+
+typedef struct {
+    DestinoLog destino;
+    size_t largo;
+    char texto[LOG_REGISTRO_TAM];
+} RegistroLog;
+
+static struct {
+    pthread_once_t una_vez;
+    pthread_mutex_t mutex;
+    pthread_cond_t hay_datos;
+    pthread_cond_t hay_espacio;
+    pthread_cond_t sincronizado;
+    RegistroLog *anillo;
+    unsigned long escritos;    // Registros puestos en el anillo
+    unsigned long vaciados;    // Registros ya escritos a disco
+    unsigned long persistidos; // Registros con fsync hecho
+    unsigned long descartados;
+    int fds[LOG_DESTINOS];
+    int fallo_aviso[LOG_DESTINOS];
+    Durabilidad durabilidad;
+    PoliticaLlena politica;
+    int cerrando;
+    int activo;
+    pid_t dueno; // Proceso que creo el hilo escritor
+    pthread_t hilo;
+    time_t segundo_cache;
+    char marca_cache[32];
+} bitacora = {.una_vez = PTHREAD_ONCE_INIT};
+
+// La pone el manejador de SIGINT; el hilo escritor la revisa cada LOG_ESPERA_MS
+static volatile sig_atomic_t bitacora_vaciar_ya = 0;
+
+static int modo_lote = 0; // Sin prompt ni mensajes de exito por comando
+
+// Muestra un mensaje informativo de exito; en modo lote no se muestra
+void informar(const char *formato, ...) {
+    if (modo_lote) {
+        return;
+    }
+    va_list ap;
+    va_start(ap, formato);
+    vprintf(formato, ap);
+    va_end(ap);
+}
+
+// Funcion para obtener el timestamp actual (cacheado por segundo)
 void obtener_timestamp(char *buffer, size_t size) {
     time_t now = time(NULL);
-    struct tm *t = localtime(&now);
-    if (t != NULL) {
-        strftime(buffer, size, "%Y-%m-%d %H:%M:%S", t);
-    } else {
-        snprintf(buffer, size, "Timestamp no disponible");
+    pthread_mutex_lock(&bitacora.mutex);
+    if (now != bitacora.segundo_cache) {
+        struct tm t;
+        if (localtime_r(&now, &t) != NULL) {
+            strftime(bitacora.marca_cache, sizeof(bitacora.marca_cache), "%Y-%m-%d %H:%M:%S", &t);
+        } else {
+            snprintf(bitacora.marca_cache, sizeof(bitacora.marca_cache), "Timestamp no disponible");
+        }
+        bitacora.segundo_cache = now;
     }
+    snprintf(buffer, size, "%s", bitacora.marca_cache);
+    pthread_mutex_unlock(&bitacora.mutex);
 }
 
-// Funcion para registrar en el historial
-void registrar_historial(const char *comando) {
-    FILE *archivo = fopen(HISTORIAL_FILE, "a");
-    if (archivo == NULL) {
-        perror("Error al abrir historial.log");
+static void bitacora_abrir(DestinoLog destino) {
+    if (bitacora.fds[destino] >= 0) {
         return;
     }
+    bitacora.fds[destino] = open(rutas_log[destino], O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0644);
+    if (bitacora.fds[destino] < 0 && !bitacora.fallo_aviso[destino]) {
+        fprintf(stderr, "Error al abrir %s: %s\n", rutas_log[destino], strerror(errno));
+        bitacora.fallo_aviso[destino] = 1;
+    }
+}
 
-    char timestamp[64];
-    obtener_timestamp(timestamp, sizeof(timestamp));
+// writev completo: reintenta si el kernel escribio solo una parte
+static void escribir_iov(int fd, struct iovec *iov, int cantidad) {
+    while (cantidad > 0) {
+        ssize_t n = writev(fd, iov, cantidad);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return;
+        }
+        while (cantidad > 0 && (size_t)n >= iov->iov_len) {
+            n -= iov->iov_len;
+            iov++;
+            cantidad--;
+        }
+        if (cantidad > 0) {
+            iov->iov_base = (char *)iov->iov_base + n;
+            iov->iov_len -= n;
+        }
+    }
+}
 
-    fprintf(archivo, "%s: %s\n", timestamp, comando);
-    fclose(archivo);
+// Escribe los registros [desde, hasta) del anillo. Se llama sin el mutex tomado:
+// los productores no tocan esos registros hasta que se avance 'vaciados'.
+static void bitacora_escribir(unsigned long desde, unsigned long hasta, int *tocados) {
+    struct iovec iov[IOV_MAX];
+    int cantidad = 0;
+    DestinoLog actual = LOG_DESTINOS;
+
+    for (unsigned long k = desde; k <= hasta; k++) {
+        RegistroLog *reg = k < hasta ? &bitacora.anillo[k & (LOG_ANILLO - 1)] : NULL;
+        if (cantidad > 0 && (reg == NULL || reg->destino != actual || cantidad == IOV_MAX)) {
+            if (bitacora.fds[actual] >= 0) {
+                escribir_iov(bitacora.fds[actual], iov, cantidad);
+                tocados[actual] = 1;
+            }
+            cantidad = 0;
+        }
+        if (reg == NULL) {
+            break;
+        }
+        if (cantidad == 0) {
+            actual = reg->destino;
+            bitacora_abrir(actual);
+        }
+        iov[cantidad].iov_base = reg->texto;
+        iov[cantidad].iov_len = reg->largo;
+        cantidad++;
+    }
 }
 
-// Funcion para registrar errores
-void registrar_error(const char *mensaje) {
-    FILE *archivo = fopen(ERROR_LOG_FILE, "a");
-    if (archivo == NULL) {
-        perror("Error al abrir sistema_error.log");
+static void bitacora_sincronizar(const int *tocados) {
+    for (int d = 0; d < LOG_DESTINOS; d++) {
+        if (tocados[d] && bitacora.fds[d] >= 0) {
+            fdatasync(bitacora.fds[d]);
+        }
+    }
+}
+
+// Hilo escritor: vacia el anillo cuando hay datos, en cada pedido de SIGINT y al cerrar
+static void *bitacora_hilo(void *arg) {
+    (void)arg;
+    int pendientes_sync[LOG_DESTINOS] = {0};
+    double ultimo_sync = segundos_monotonicos();
+
+    pthread_mutex_lock(&bitacora.mutex);
+    for (;;) {
+        while (bitacora.vaciados == bitacora.escritos && !bitacora.cerrando && !bitacora_vaciar_ya) {
+            struct timespec limite;
+            clock_gettime(CLOCK_REALTIME, &limite);
+            limite.tv_nsec += LOG_ESPERA_MS * 1000000L;
+            if (limite.tv_nsec >= 1000000000L) {
+                limite.tv_sec++;
+                limite.tv_nsec -= 1000000000L;
+            }
+            if (pthread_cond_timedwait(&bitacora.hay_datos, &bitacora.mutex, &limite) == ETIMEDOUT) {
+                break;
+            }
+        }
+        unsigned long desde = bitacora.vaciados, hasta = bitacora.escritos;
+        int cerrar = bitacora.cerrando && desde == hasta;
+        int forzar = bitacora_vaciar_ya || bitacora.cerrando;
+        Durabilidad durabilidad = bitacora.durabilidad;
+        pthread_mutex_unlock(&bitacora.mutex);
+
+        int tocados[LOG_DESTINOS] = {0};
+        if (desde != hasta) {
+            bitacora_escribir(desde, hasta, tocados);
+        }
+        for (int d = 0; d < LOG_DESTINOS; d++) {
+            pendientes_sync[d] |= tocados[d];
+        }
+
+        int sincronizar = 0;
+        if (durabilidad == DURABILIDAD_REGISTRO || forzar) {
+            sincronizar = 1;
+        } else if (durabilidad == DURABILIDAD_PERIODICA && segundos_monotonicos() - ultimo_sync >= 1.0) {
+            sincronizar = 1;
+        }
+        if (sincronizar) {
+            bitacora_sincronizar(pendientes_sync);
+            memset(pendientes_sync, 0, sizeof(pendientes_sync));
+            ultimo_sync = segundos_monotonicos();
+            bitacora_vaciar_ya = 0;
+        }
+
+        pthread_mutex_lock(&bitacora.mutex);
+        bitacora.vaciados = hasta;
+        if (sincronizar) {
+            bitacora.persistidos = hasta;
+        }
+        pthread_cond_broadcast(&bitacora.hay_espacio);
+        pthread_cond_broadcast(&bitacora.sincronizado);
+        if (cerrar) {
+            break;
+        }
+    }
+    pthread_mutex_unlock(&bitacora.mutex);
+    return NULL;
+}
+
+static Durabilidad durabilidad_desde_texto(const char *texto, Durabilidad defecto) {
+    for (int k = 0; texto != NULL && k <= DURABILIDAD_REGISTRO; k++) {
+        if (strcmp(texto, nombres_durabilidad[k]) == 0) {
+            return (Durabilidad)k;
+        }
+    }
+    return defecto;
+}
+
+static PoliticaLlena politica_desde_texto(const char *texto, PoliticaLlena defecto) {
+    for (int k = 0; texto != NULL && k <= POLITICA_BLOQUEAR; k++) {
+        if (strcmp(texto, nombres_politica[k]) == 0) {
+            return (PoliticaLlena)k;
+        }
+    }
+    return defecto;
+}
+
+void bitacora_cerrar();
+
+// fork desde un proceso con hilos: el mutex se toma antes y se libera en ambos lados
+static void bitacora_antes_fork() {
+    pthread_mutex_lock(&bitacora.mutex);
+}
+
+static void bitacora_despues_fork() {
+    pthread_mutex_unlock(&bitacora.mutex);
+}
+
+static void bitacora_iniciar_una_vez() {
+    pthread_mutex_init(&bitacora.mutex, NULL);
+    pthread_cond_init(&bitacora.hay_datos, NULL);
+    pthread_cond_init(&bitacora.hay_espacio, NULL);
+    pthread_cond_init(&bitacora.sincronizado, NULL);
+    for (int d = 0; d < LOG_DESTINOS; d++) {
+        bitacora.fds[d] = -1;
+    }
+    bitacora.durabilidad = durabilidad_desde_texto(getenv("LFS_LOG_DURABILIDAD"), DURABILIDAD_PERIODICA);
+    bitacora.politica = politica_desde_texto(getenv("LFS_LOG_POLITICA"), POLITICA_BLOQUEAR);
+    bitacora.dueno = getpid();
+    // Sin anillo o sin hilo la bitacora queda inactiva y registrar_en escribe directo
+    bitacora.anillo = malloc(LOG_ANILLO * sizeof(RegistroLog));
+    if (bitacora.anillo == NULL) {
+        perror("Error al reservar el anillo de la bitacora");
+        return;
+    }
+    if (pthread_create(&bitacora.hilo, NULL, bitacora_hilo, NULL) != 0) {
+        perror("Error al crear el hilo de la bitacora");
         return;
     }
+    bitacora.activo = 1;
+    pthread_atfork(bitacora_antes_fork, bitacora_despues_fork, bitacora_despues_fork);
+    atexit(bitacora_cerrar);
+}
+
+void bitacora_iniciar() {
+    pthread_once(&bitacora.una_vez, bitacora_iniciar_una_vez);
+}
+
+// Vacia el anillo, sincroniza y detiene el hilo escritor. Se registra con atexit.
+void bitacora_cerrar() {
+    if (!bitacora.activo || bitacora.dueno != getpid()) {
+        return; // Un hijo de fork no tiene hilo escritor
+    }
+    pthread_mutex_lock(&bitacora.mutex);
+    bitacora.cerrando = 1;
+    pthread_cond_signal(&bitacora.hay_datos);
+    pthread_mutex_unlock(&bitacora.mutex);
+    pthread_join(bitacora.hilo, NULL);
+    bitacora.activo = 0;
+    for (int d = 0; d < LOG_DESTINOS; d++) {
+        if (bitacora.fds[d] >= 0) {
+            close(bitacora.fds[d]);
+            bitacora.fds[d] = -1;
+        }
+    }
+}
 
+// Agrega una linea al anillo del destino indicado. No bloquea salvo con la politica
+// 'bloquear' (como maximo LOG_BLOQUEO_MS) o con durabilidad 'registro'.
+void registrar_en(DestinoLog destino, const char *formato, ...) {
+    bitacora_iniciar();
     char timestamp[64];
     obtener_timestamp(timestamp, sizeof(timestamp));
+
+    if (!bitacora.activo || bitacora.dueno != getpid()) {
+        // Sin hilo escritor (hijo de fork, bitacora sin anillo o ya cerrada) se escribe directo
+        char linea[LOG_REGISTRO_TAM];
+        va_list ap;
+        va_start(ap, formato);
+        int largo = snprintf(linea, sizeof(linea), formatos_marca[destino], timestamp);
+        largo += vsnprintf(linea + largo, sizeof(linea) - largo, formato, ap);
+        va_end(ap);
+        if (largo > (int)sizeof(linea) - 2) {
+            largo = sizeof(linea) - 2;
+        }
+        linea[largo++] = '\n';
+        int fd = open(rutas_log[destino], O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0644);
+        if (fd >= 0) {
+            if (write(fd, linea, largo) < 0) {
+                perror("Error al escribir el log");
+            }
+            close(fd);
+        }
+        return;
+    }
+
+    pthread_mutex_lock(&bitacora.mutex);
+    if (bitacora.escritos - bitacora.vaciados == LOG_ANILLO && bitacora.politica == POLITICA_BLOQUEAR) {
+        struct timespec limite;
+        clock_gettime(CLOCK_REALTIME, &limite);
+        limite.tv_nsec += LOG_BLOQUEO_MS * 1000000L;
+        if (limite.tv_nsec >= 1000000000L) {
+            limite.tv_sec++;
+            limite.tv_nsec -= 1000000000L;
+        }
+        pthread_cond_signal(&bitacora.hay_datos);
+        while (bitacora.escritos - bitacora.vaciados == LOG_ANILLO &&
+               pthread_cond_timedwait(&bitacora.hay_espacio, &bitacora.mutex, &limite) != ETIMEDOUT) {
+        }
+    }
+    if (bitacora.escritos - bitacora.vaciados == LOG_ANILLO || bitacora.cerrando) {
+        bitacora.descartados++;
+        pthread_mutex_unlock(&bitacora.mutex);
+        return;
+    }
+
+    RegistroLog *reg = &bitacora.anillo[bitacora.escritos & (LOG_ANILLO - 1)];
+    reg->destino = destino;
+    va_list ap;
+    va_start(ap, formato);
+    int largo = snprintf(reg->texto, sizeof(reg->texto), formatos_marca[destino], timestamp);
+    largo += vsnprintf(reg->texto + largo, sizeof(reg->texto) - largo, formato, ap);
+    va_end(ap);
+    if (largo > (int)sizeof(reg->texto) - 2) {
+        largo = sizeof(reg->texto) - 2; // Linea truncada
+    }
+    reg->texto[largo++] = '\n';
+    reg->largo = largo;
+    unsigned long mio = ++bitacora.escritos;
+    pthread_cond_signal(&bitacora.hay_datos);
+
+    if (bitacora.durabilidad == DURABILIDAD_REGISTRO) {
+        while (bitacora.persistidos < mio && bitacora.activo) {
+            pthread_cond_wait(&bitacora.sincronizado, &bitacora.mutex);
+        }
+    }
+    pthread_mutex_unlock(&bitacora.mutex);
+}
+
+// Implementación del comando 'bitacora': muestra el estado y cambia la configuracion
+void comando_bitacora(const char *opcion, const char *valor) {
+    bitacora_iniciar();
+    pthread_mutex_lock(&bitacora.mutex);
+    if (opcion != NULL && strcmp(opcion, "durabilidad") == 0 && valor != NULL) {
+        bitacora.durabilidad = durabilidad_desde_texto(valor, bitacora.durabilidad);
+    } else if (opcion != NULL && strcmp(opcion, "politica") == 0 && valor != NULL) {
+        bitacora.politica = politica_desde_texto(valor, bitacora.politica);
+    } else if (opcion != NULL) {
+        printf("Uso: bitacora [durabilidad ninguna|periodica|registro] [politica descartar|bloquear]\n");
+    }
+    printf("Durabilidad: %s, politica: %s\n", nombres_durabilidad[bitacora.durabilidad],
+           nombres_politica[bitacora.politica]);
+    printf("Registros: %lu en el anillo, %lu escritos, %lu descartados\n",
+           bitacora.escritos - bitacora.vaciados, bitacora.vaciados, bitacora.descartados);
+    pthread_mutex_unlock(&bitacora.mutex);
+}
+
+// Funcion para registrar errores
+void registrar_error(const char *mensaje) {
     perror(mensaje);
-    fprintf(archivo, "%s: ERROR: %s\n", timestamp, mensaje);
-    fclose(archivo);
+    registrar_en(LOG_ERRORES, ": ERROR: %s", mensaje);
 }
 
 // Función para dividir el comando en argumentos
@@ -82,573 +526,9175 @@ void parse_command(char *input, char **args) {
     args[i] = NULL; // Terminar la lista de argumentos
 }
 
+int ejecutar_linea(const char *linea);
+
+// Ejecuta una linea completa (tuberias y redirecciones) sin pasar por /bin/sh -c
 void ejecutar_comando(const char *comando) {
-    pid_t pid = fork();
-    if (pid == 0) {
-        // Proceso hijo para ejecutar el comando
-        char *argv[] = {"/bin/sh", "-c", (char *)comando, NULL};
-        execvp(argv[0], argv);
-        perror("Error al ejecutar el comando");
-        exit(EXIT_FAILURE);
-    } else if (pid > 0) {
-        // Proceso padre espera
-        waitpid(pid, NULL, 0);
-        printf("Comando ejecutado: %s\n", comando);
-    } else {
-        registrar_error("Error al ejecutar comando genérico");
-    }
+    ejecutar_linea(comando);
+    informar("Comando ejecutado: %s\n", comando);
 }
 
 
 // Función para mostrar el prompt
+static const char *texto_prompt = "lfs-shell> ";
+
 void prompt() {
-    printf("lfs-shell> ");
+    printf("%s", texto_prompt);
      fflush(stdout);
 }
 
-// Implementación del comando 'copiar'
-void copiar(const char *origen, const char *destino) {
-    registrar_historial(origen);
-    int origen_fd = open(origen, O_RDONLY);
-    if (origen_fd < 0) {
-        perror("Error al abrir el archivo origen");
-        return;
+// ---------------------------------------------------------------------------
+// Control de E/S de 'copiar' y 'transferencia': limite de velocidad con una
+// cubeta de fichas, clase de prioridad de E/S y nice, y progreso en vivo. El
+// comando lo activa en su hilo (control_es_del_hilo) y los pools que crea lo
+// heredan. Sin opciones el puntero queda en NULL y los puntos de copia solo
+// hacen esa comparacion. La prioridad y nice nunca se tocan en el hilo de la
+// shell: el trabajo corre en un hilo propio (control_es_ejecutar).
+// ---------------------------------------------------------------------------
+
+#define IOPRIO_CLASE_RT 1
+#define IOPRIO_CLASE_BE 2
+#define IOPRIO_CLASE_IDLE 3
+#define IOPRIO_VALOR(clase, nivel) (((clase) << 13) | (nivel))
+
+typedef struct {
+    double limite;          // Bytes por segundo; 0 = sin limite
+    int progreso;
+    int clase_es;           // IOPRIO_CLASE_*; 0 = no cambiar
+    int nivel_es;
+    int cambiar_nice;
+    int nice;
+    int verificar;          // --verificar de 'copiar': CRC32C al pasar y releer el destino
+
+    pthread_mutex_t mutex;
+    double fichas;          // Negativo: bytes adelantados que hay que esperar
+    double ultimo;
+    atomic_ullong hechos;
+    unsigned long long total; // 0 si no se conoce de antemano
+    double inicio;
+    double proximo_informe;
+} ControlEs;
+
+static __thread ControlEs *control_es_del_hilo = NULL;
+
+// Bytes a pedir por llamada: con limite, trozos de ~50 ms para que la espera sea pareja
+static size_t control_es_tramo(size_t normal) {
+    ControlEs *c = control_es_del_hilo;
+    if (c == NULL || c->limite <= 0) {
+        return normal;
     }
+    size_t tramo = (size_t)(c->limite / 20);
+    return tramo < (64 << 10) ? (64 << 10) : tramo > normal ? normal : tramo;
+}
 
-    int destino_fd = open(destino, O_WRONLY | O_CREAT | O_TRUNC, 0644);
-    if (destino_fd < 0) {
-        perror("Error al crear el archivo destino");
-        close(origen_fd);
-        return;
+static void control_es_informar(ControlEs *c, int final) {
+    double ahora = segundos_monotonicos(), duracion = ahora - c->inicio;
+    unsigned long long hechos = atomic_load(&c->hechos);
+    double velocidad = duracion > 0 ? hechos / duracion : 0;
+    char eta[32] = "";
+    if (!final && c->total > 0 && velocidad > 0 && hechos < c->total) {
+        snprintf(eta, sizeof(eta), ", ETA %.0f s", (c->total - hechos) / velocidad);
+    }
+    if (c->total > 0) {
+        fprintf(stderr, "\r%.1f / %.1f MiB (%.0f%%), %.1f MiB/s%s   ", hechos / 1048576.0, c->total / 1048576.0,
+                hechos >= c->total ? 100.0 : 100.0 * hechos / c->total, velocidad / 1048576.0, eta);
+    } else {
+        fprintf(stderr, "\r%.1f MiB, %.1f MiB/s   ", hechos / 1048576.0, velocidad / 1048576.0);
+    }
+    if (final) {
+        fprintf(stderr, "\n");
     }
+}
 
-    char buffer[MAX_LFS_INPUT];
-    ssize_t bytes_leidos;
-    int exito = 1; // Variable para rastrear si ocurre un error
-    while ((bytes_leidos = read(origen_fd, buffer, sizeof(buffer))) > 0) {
-        if (write(destino_fd, buffer, bytes_leidos) < 0) {
-            perror("Error al escribir en el archivo destino");
-            exito = 0; // Marca como fallido si hay un error
-            break;
+// Anota bytes hechos sin pasar por el limite (por ejemplo un reflink)
+static void control_es_avanzar(unsigned long long bytes) {
+    ControlEs *c = control_es_del_hilo;
+    if (c == NULL) {
+        return;
+    }
+    atomic_fetch_add(&c->hechos, bytes);
+    if (c->progreso && segundos_monotonicos() >= c->proximo_informe) {
+        pthread_mutex_lock(&c->mutex);
+        double ahora = segundos_monotonicos();
+        if (ahora >= c->proximo_informe) {
+            c->proximo_informe = ahora + 0.5;
+            control_es_informar(c, 0);
         }
+        pthread_mutex_unlock(&c->mutex);
     }
+}
 
-    if (bytes_leidos < 0) {
-        perror("Error al leer el archivo origen");
-        exito = 0; // Marca como fallido si hay un error
+// Descuenta bytes de la cubeta y duerme lo necesario para no pasar el limite
+static void control_es_consumir(unsigned long long bytes) {
+    ControlEs *c = control_es_del_hilo;
+    if (c == NULL) {
+        return;
+    }
+    if (c->limite > 0) {
+        pthread_mutex_lock(&c->mutex);
+        double ahora = segundos_monotonicos();
+        double rafaga = c->limite / 4; // Como mucho 250 ms de credito acumulado
+        c->fichas += (ahora - c->ultimo) * c->limite;
+        if (c->fichas > rafaga) {
+            c->fichas = rafaga;
+        }
+        c->ultimo = ahora;
+        c->fichas -= bytes;
+        double espera = c->fichas < 0 ? -c->fichas / c->limite : 0;
+        pthread_mutex_unlock(&c->mutex);
+        if (espera > 0) {
+            struct timespec ts = {(time_t)espera, (long)((espera - (time_t)espera) * 1e9)};
+            while (nanosleep(&ts, &ts) != 0 && errno == EINTR) {
+            }
+        }
     }
+    control_es_avanzar(bytes);
+}
 
-    close(origen_fd);
-    close(destino_fd);
+// Lee "200M", "1.5G", "512K" o bytes
+static double leer_tamano(const char *texto) {
+    char *fin;
+    double valor = strtod(texto, &fin);
+    switch (*fin) {
+    case 'k': case 'K': valor *= 1024.0; fin++; break;
+    case 'm': case 'M': valor *= 1048576.0; fin++; break;
+    case 'g': case 'G': valor *= 1073741824.0; fin++; break;
+    }
+    return fin == texto || *fin != '\0' ? -1 : valor;
+}
 
-        // Mensaje de éxito si no hubo errores
-    if (exito) {
-        registrar_historial(origen);
-        printf("Archivo '%s' copiado exitosamente a '%s'\n", origen, destino);
+// Reconoce una opcion de control de E/S en args[*k]. Devuelve 1 si la tomo,
+// 0 si no es una de estas opciones y -1 si esta mal escrita.
+static int leer_opcion_es(int argc, char **args, int *k, ControlEs *c) {
+    const char *opcion = args[*k];
+    if (strcmp(opcion, "--progreso") == 0) {
+        c->progreso = 1;
+        return 1;
+    }
+    if (strcmp(opcion, "--limite") != 0 && strcmp(opcion, "--prioridad-es") != 0 && strcmp(opcion, "--nice") != 0) {
+        return 0;
+    }
+    if (*k + 1 >= argc) {
+        return -1;
+    }
+    const char *valor = args[++*k];
+    if (strcmp(opcion, "--limite") == 0) {
+        c->limite = leer_tamano(valor);
+        return c->limite > 0 ? 1 : -1;
+    }
+    if (strcmp(opcion, "--nice") == 0) {
+        char *fin;
+        c->nice = strtol(valor, &fin, 10);
+        c->cambiar_nice = 1;
+        return *fin == '\0' && c->nice >= -20 && c->nice <= 19 ? 1 : -1;
+    }
+    // --prioridad-es idle | be[:0-7] | rt[:0-7]
+    c->nivel_es = 4;
+    const char *dos_puntos = strchr(valor, ':');
+    size_t largo = dos_puntos != NULL ? (size_t)(dos_puntos - valor) : strlen(valor);
+    if (dos_puntos != NULL) {
+        c->nivel_es = atoi(dos_puntos + 1);
+    }
+    if (largo == 4 && strncmp(valor, "idle", 4) == 0) {
+        c->clase_es = IOPRIO_CLASE_IDLE;
+        c->nivel_es = 0;
+    } else if (largo == 2 && strncmp(valor, "be", 2) == 0) {
+        c->clase_es = IOPRIO_CLASE_BE;
+    } else if (largo == 2 && strncmp(valor, "rt", 2) == 0) {
+        c->clase_es = IOPRIO_CLASE_RT;
+    } else {
+        return -1;
     }
+    return c->nivel_es >= 0 && c->nivel_es <= 7 ? 1 : -1;
 }
 
-// Implementación del comando 'mover'
-void mover(const char *origen, const char *destino) {
-    printf("Moviendo archivo de: %s a: %s\n", origen, destino); // Verifica las rutas
-    registrar_historial(origen);
-    if (rename(origen, destino) != 0) {
-        perror("Error al mover el archivo");
+// Activa el control en el hilo actual si se pidio alguna opcion
+static void control_es_iniciar(ControlEs *c, unsigned long long total) {
+    if (c->limite <= 0 && !c->progreso && !c->clase_es && !c->cambiar_nice && !c->verificar) {
+        return;
     }
+    pthread_mutex_init(&c->mutex, NULL);
+    atomic_init(&c->hechos, 0);
+    c->total = total;
+    c->inicio = c->ultimo = segundos_monotonicos();
+    c->fichas = 0;
+    c->proximo_informe = c->inicio + 0.5;
+    control_es_del_hilo = c;
 }
 
-// Implementación del comando 'renombrar'
-void renombrar(const char *archivo, const char *nuevo_nombre) {
-    registrar_historial(archivo);
-    if (rename(archivo, nuevo_nombre) != 0) {
-        perror("Error al renombrar el archivo");
+// Aplica la prioridad de E/S y nice pedidas al hilo actual. Son por hilo y los
+// hilos que se creen despues las heredan.
+static void control_es_prioridad(ControlEs *c) {
+    pid_t tid = syscall(SYS_gettid);
+    if (c->clase_es && syscall(SYS_ioprio_set, 1, tid, IOPRIO_VALOR(c->clase_es, c->nivel_es)) != 0) {
+        perror("Error al cambiar la prioridad de E/S");
+    }
+    if (c->cambiar_nice && setpriority(PRIO_PROCESS, tid, c->nice) != 0) {
+        perror("Error al cambiar nice");
     }
 }
 
-// Implementación del comando 'listar'
-void listar(const char *directorio) {
-    registrar_historial(directorio);
-    DIR *dir = opendir(directorio);
-    if (dir == NULL) {
-        registrar_error(directorio);
-        perror("Error al abrir el directorio");
+static void control_es_terminar(ControlEs *c) {
+    if (control_es_del_hilo != c) {
         return;
     }
+    if (c->progreso) {
+        control_es_informar(c, 1);
+    }
+    control_es_del_hilo = NULL;
+    pthread_mutex_destroy(&c->mutex);
+}
 
-    struct dirent *entrada;
-    while ((entrada = readdir(dir)) != NULL) {
-        printf("%s\n", entrada->d_name);
+// ---------------------------------------------------------------------------
+// CRC32C (Castagnoli). Con SSE4.2 se usa la instruccion crc32 de a 8 bytes en
+// tres flujos intercalados: cada instruccion tarda 3 ciclos pero el procesador
+// acepta una por ciclo, y los tres resultados se juntan con una tabla que
+// desplaza el registro CRC32C_FLUJO bytes. Sin SSE4.2 (u otra arquitectura) se
+// calcula por software, ocho bytes por vuelta con tablas de 8x256. La eleccion
+// se hace una vez, al primer uso; LFS_CRC32C=software la fuerza por software.
+// ---------------------------------------------------------------------------
+
+#define CRC32C_POLINOMIO 0x82F63B78u // Reflejado
+#define CRC32C_FLUJO 4096 // Bytes de cada uno de los tres flujos por vuelta
+
+static uint32_t tablas_crc32c[8][256];
+static uint32_t tablas_crc32c_salto[4][256]; // Multiplican el registro por x^(8 * CRC32C_FLUJO)
+static uint32_t crc32c_software(uint32_t crc, const void *datos, size_t largo);
+static uint32_t (*crc32c_elegida)(uint32_t crc, const void *datos, size_t largo) = crc32c_software;
+static const char *crc32c_implementacion = "software";
+static pthread_once_t tablas_crc32c_listas = PTHREAD_ONCE_INIT;
+
+// a * b modulo el polinomio, con los bits reflejados (x^0 es el bit 31)
+static uint32_t crc32c_multiplicar(uint32_t a, uint32_t b) {
+    uint32_t producto = 0;
+    for (uint32_t bit = 1u << 31; bit != 0; bit >>= 1) {
+        if (a & bit) {
+            producto ^= b;
+        }
+        b = b & 1 ? (b >> 1) ^ CRC32C_POLINOMIO : b >> 1;
     }
+    return producto;
+}
 
-    closedir(dir);
+// x^(8 * bytes) modulo el polinomio: lo que avanza el registro con 'bytes' ceros
+static uint32_t crc32c_potencia(uint64_t bytes) {
+    uint32_t resultado = 1u << 31, cuadrado = 1u << 23; // x^0 y x^8
+    while (bytes > 0) {
+        if (bytes & 1) {
+            resultado = crc32c_multiplicar(cuadrado, resultado);
+        }
+        cuadrado = crc32c_multiplicar(cuadrado, cuadrado);
+        bytes >>= 1;
+    }
+    return resultado;
 }
 
-// Implementación del comando 'creardir'
-void creardir(const char *directorio) {
-    if (mkdir(directorio, 0755) != 0) {
-        perror("Error al crear el directorio");
-    } else {
-        registrar_historial(directorio);
-        printf("Directorio '%s' creado exitosamente\n", directorio);
+// CRC32C de A seguido de B, a partir de los de cada parte y el largo de B
+uint32_t crc32c_combinar(uint32_t crc_a, uint32_t crc_b, uint64_t largo_b) {
+    return crc32c_multiplicar(crc32c_potencia(largo_b), crc_a) ^ crc_b;
+}
+
+// Continua el CRC32C 'crc' con 'largo' ceros sin recorrerlos (huecos de un archivo)
+uint32_t crc32c_ceros(uint32_t crc, uint64_t largo) {
+    return ~crc32c_multiplicar(crc32c_potencia(largo), ~crc);
+}
+
+static uint32_t crc32c_saltar(uint32_t registro) {
+    return tablas_crc32c_salto[0][registro & 0xFF] ^ tablas_crc32c_salto[1][(registro >> 8) & 0xFF] ^
+           tablas_crc32c_salto[2][(registro >> 16) & 0xFF] ^ tablas_crc32c_salto[3][registro >> 24];
+}
+
+#if defined(__x86_64__)
+__attribute__((target("sse4.2")))
+static uint32_t crc32c_sse42(uint32_t crc, const void *datos, size_t largo) {
+    const unsigned char *p = datos;
+    uint64_t c0 = (uint32_t)~crc;
+    while (largo > 0 && ((uintptr_t)p & 7) != 0) {
+        c0 = _mm_crc32_u8((uint32_t)c0, *p++);
+        largo--;
+    }
+    while (largo >= 3 * CRC32C_FLUJO) {
+        uint64_t c1 = 0, c2 = 0, w0, w1, w2;
+        for (size_t k = 0; k < CRC32C_FLUJO; k += 8) {
+            memcpy(&w0, p + k, 8);
+            memcpy(&w1, p + CRC32C_FLUJO + k, 8);
+            memcpy(&w2, p + 2 * CRC32C_FLUJO + k, 8);
+            c0 = _mm_crc32_u64(c0, w0);
+            c1 = _mm_crc32_u64(c1, w1);
+            c2 = _mm_crc32_u64(c2, w2);
+        }
+        c0 = crc32c_saltar(crc32c_saltar((uint32_t)c0) ^ (uint32_t)c1) ^ (uint32_t)c2;
+        p += 3 * CRC32C_FLUJO;
+        largo -= 3 * CRC32C_FLUJO;
+    }
+    while (largo >= 8) {
+        uint64_t palabra;
+        memcpy(&palabra, p, 8);
+        c0 = _mm_crc32_u64(c0, palabra);
+        p += 8;
+        largo -= 8;
     }
+    while (largo-- > 0) {
+        c0 = _mm_crc32_u8((uint32_t)c0, *p++);
+    }
+    return ~(uint32_t)c0;
 }
+#endif
 
-// Función para cambiar de directorio
-void ir(const char *directorio) {
-    if (chdir(directorio) == 0) {
-        registrar_historial(directorio);
-        registrar_error("Error: No se pudo ir al dorectorio sugerido");
-        printf("Directorio cambiado a: %s\n", directorio);
-    } else {
-        registrar_error("Error: No se pudo ir al dorectorio sugerido");
+static void crc32c_armar_tablas() {
+    for (uint32_t n = 0; n < 256; n++) {
+        uint32_t crc = n;
+        for (int k = 0; k < 8; k++) {
+            crc = crc & 1 ? (crc >> 1) ^ CRC32C_POLINOMIO : crc >> 1;
+        }
+        tablas_crc32c[0][n] = crc;
+    }
+    for (uint32_t n = 0; n < 256; n++) {
+        for (int t = 1; t < 8; t++) {
+            tablas_crc32c[t][n] = (tablas_crc32c[t - 1][n] >> 8) ^ tablas_crc32c[0][tablas_crc32c[t - 1][n] & 0xFF];
+        }
+    }
+    uint32_t salto = crc32c_potencia(CRC32C_FLUJO);
+    for (int t = 0; t < 4; t++) {
+        for (uint32_t n = 0; n < 256; n++) {
+            tablas_crc32c_salto[t][n] = crc32c_multiplicar(salto, n << (8 * t));
+        }
+    }
+#if defined(__x86_64__)
+    const char *forzar = getenv("LFS_CRC32C");
+    if (__builtin_cpu_supports("sse4.2") && (forzar == NULL || strcmp(forzar, "software") != 0)) {
+        crc32c_elegida = crc32c_sse42;
+        crc32c_implementacion = "SSE4.2";
     }
+#endif
 }
 
-//Comando para obtener el directorio actual.
-void mostrar() {
-    char cwd[MAX_LFS_INPUT]; // Buffer para almacenar el directorio actual
-    if (getcwd(cwd, sizeof(cwd)) != NULL) { // getcwd obtiene el directorio actual
-        //registrar_historial();
-        printf("%s\n", cwd); // Imprime el directorio actual
-    } else {
-        perror("Error al obtener el directorio actual");
+// Por software: ocho bytes por vuelta con las tablas de 8x256
+static uint32_t crc32c_software(uint32_t crc, const void *datos, size_t largo) {
+    const unsigned char *p = datos;
+    crc = ~crc;
+    while (largo > 0 && ((uintptr_t)p & 7) != 0) {
+        crc = (crc >> 8) ^ tablas_crc32c[0][(crc ^ *p++) & 0xFF];
+        largo--;
+    }
+    while (largo >= 8) {
+        uint64_t palabra;
+        memcpy(&palabra, p, 8);
+        palabra ^= crc;
+        crc = tablas_crc32c[7][palabra & 0xFF] ^ tablas_crc32c[6][(palabra >> 8) & 0xFF] ^
+              tablas_crc32c[5][(palabra >> 16) & 0xFF] ^ tablas_crc32c[4][(palabra >> 24) & 0xFF] ^
+              tablas_crc32c[3][(palabra >> 32) & 0xFF] ^ tablas_crc32c[2][(palabra >> 40) & 0xFF] ^
+              tablas_crc32c[1][(palabra >> 48) & 0xFF] ^ tablas_crc32c[0][palabra >> 56];
+        p += 8;
+        largo -= 8;
+    }
+    while (largo-- > 0) {
+        crc = (crc >> 8) ^ tablas_crc32c[0][(crc ^ *p++) & 0xFF];
     }
+    return ~crc;
 }
 
+// Continua el CRC32C 'crc' (0 para empezar) con 'largo' bytes de 'datos'
+uint32_t crc32c(uint32_t crc, const void *datos, size_t largo) {
+    pthread_once(&tablas_crc32c_listas, crc32c_armar_tablas);
+    return crc32c_elegida(crc, datos, largo);
+}
 
-// Función para cambiar permisos
-void permisos(const char *modo, const char **archivos, int cantidad) {
-    mode_t permisos = strtol(modo, NULL, 8); // Convierte el modo (octal) a un valor numérico
-    for (int i = 0; i < cantidad; i++) {
-        if (chmod(archivos[i], permisos) == 0) {                    //chmod en este caso es una función del sistema incluida en la biblioteca estándar de C <sys/stat.h>
-            registrar_historial(modo);
-            printf("Permisos cambiados para: %s\n", archivos[i]);
-        } else {
-            perror("Error al cambiar permisos");
+static int leer_completo(int fd, void *buffer, size_t largo, off_t desde) {
+    size_t hecho = 0;
+    while (hecho < largo) {
+        ssize_t n = pread(fd, (char *)buffer + hecho, largo - hecho, desde + hecho);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            if (n == 0) {
+                errno = EIO; // El archivo se acorto
+            }
+            return -1;
         }
+        hecho += n;
     }
+    return 0;
 }
 
-// Función para cambiar el propietario y el grupo de los archivos
-void cambiar_propietario(const char *nuevo_propietario, const char *nuevo_grupo, const char *archivos[], int cantidad_archivos) {
-    struct passwd *propietario_info;
-    struct group *grupo_info;
-    int i;
-    registrar_historial(nuevo_propietario);
+static int escribir_completo(int fd, const void *buffer, size_t largo, off_t desde) {
+    size_t hecho = 0;
+    while (hecho < largo) {
+        ssize_t n = pwrite(fd, (const char *)buffer + hecho, largo - hecho, desde + hecho);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n < 0) {
+            return -1;
+        }
+        hecho += n;
+    }
+    return 0;
+}
 
-    // Obtener la información del nuevo propietario
-    propietario_info = getpwnam(nuevo_propietario);
-    if (propietario_info == NULL) {
-        printf("Error: El propietario '%s' no existe.\n", nuevo_propietario);
-        return;
+// Baja a disco lo escrito y saca de la cache las paginas de [desde, desde + largo),
+// para que una relectura de verificacion venga del dispositivo y no de memoria
+static int soltar_cache(int fd, off_t desde, off_t largo) {
+    if (fdatasync(fd) != 0) {
+        return -1;
+    }
+    int error = posix_fadvise(fd, desde, largo, POSIX_FADV_DONTNEED);
+    if (error != 0) {
+        errno = error;
+        return -1;
     }
+    return 0;
+}
 
-    // Obtener la información del nuevo grupo
-    grupo_info = getgrnam(nuevo_grupo);
-    if (grupo_info == NULL) {
-        printf("Error: El grupo '%s' no existe.\n", nuevo_grupo);
-        return;
+// Niveles del motor de copia, del mas rapido al mas lento
+typedef enum {
+    COPIA_REFLINK,   // El sistema de archivos comparte los bloques (FICLONE)
+    COPIA_RANGO,     // copy_file_range: el kernel copia sin pasar por espacio de usuario
+    COPIA_SENDFILE,  // sendfile: igual, para kernels o sistemas sin copy_file_range
+    COPIA_BUFFER     // read/write con un buffer grande y alineado
+} NivelCopia;
+
+static const char *nombres_nivel_copia[] = {"reflink", "copy_file_range", "sendfile", "buffer alineado"};
+
+// Errores con los que un nivel no esta disponible y hay que bajar al siguiente
+static int nivel_no_soportado(int err) {
+    return err == ENOSYS || err == EXDEV || err == EINVAL || err == EOPNOTSUPP ||
+           err == ENOTTY || err == EBADF || err == EPERM || err == ETXTBSY;
+}
+
+// Ultimo nivel: pread/pwrite con un buffer de COPIA_BUFFER_TAM alineado a pagina
+static int copiar_con_buffer(int origen_fd, int destino_fd, off_t desde, off_t longitud, off_t *copiados) {
+    char *buffer;
+    if (posix_memalign((void **)&buffer, COPIA_ALINEACION, COPIA_BUFFER_TAM) != 0) {
+        perror("Error al reservar el buffer de copia");
+        return -1;
     }
 
-    // Iterar sobre los archivos y cambiar el propietario y el grupo
-    for (i = 0; i < cantidad_archivos; i++) {
-        if (chown(archivos[i], propietario_info->pw_uid, grupo_info->gr_gid) == -1) {
-            perror("Error al cambiar propietario y grupo");
-        } else {
-            printf("Propietario y grupo de '%s' cambiados a '%s' y '%s'.\n", archivos[i], nuevo_propietario, nuevo_grupo);
+    off_t fin = desde + longitud;
+    size_t tramo = control_es_tramo(COPIA_BUFFER_TAM);
+    while (desde < fin) {
+        size_t pedir = (fin - desde) < (off_t)tramo ? (size_t)(fin - desde) : tramo;
+        ssize_t bytes_leidos = pread(origen_fd, buffer, pedir, desde);
+        if (bytes_leidos < 0 && errno == EINTR) {
+            continue;
+        }
+        if (bytes_leidos < 0) {
+            perror("Error al leer el archivo origen");
+            free(buffer);
+            return -1;
+        }
+        if (bytes_leidos == 0) {
+            break; // El origen se acorto mientras se copiaba
+        }
+        ssize_t escritos = 0;
+        while (escritos < bytes_leidos) {
+            ssize_t n = pwrite(destino_fd, buffer + escritos, bytes_leidos - escritos, desde + escritos);
+            if (n < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                perror("Error al escribir en el archivo destino");
+                free(buffer);
+                return -1;
+            }
+            escritos += n;
+        }
+        desde += bytes_leidos;
+        *copiados += bytes_leidos;
+        control_es_consumir(bytes_leidos);
+    }
+    free(buffer);
+    return 0;
+}
+
+// Copia el rango [desde, desde + longitud) del origen al mismo offset del destino.
+// Empieza en el nivel *nivel y baja de nivel si el actual no esta disponible;
+// el nivel alcanzado queda en *nivel para los rangos siguientes.
+static int copiar_rango(int origen_fd, int destino_fd, off_t desde, off_t longitud,
+                        NivelCopia *nivel, off_t *copiados) {
+    off_t fin = desde + longitud;
+    size_t tramo = control_es_tramo(COPIA_TRAMO);
+
+    if (*nivel <= COPIA_RANGO) {
+        *nivel = COPIA_RANGO;
+        off_t off_in = desde, off_out = desde;
+        ssize_t n = 1;
+        while (off_in < fin) {
+            size_t pedir = (fin - off_in) < (off_t)tramo ? (size_t)(fin - off_in) : tramo;
+            n = copy_file_range(origen_fd, &off_in, destino_fd, &off_out, pedir, 0);
+            if (n <= 0) {
+                break;
+            }
+            *copiados += n;
+            control_es_consumir(n);
+        }
+        if (off_in >= fin || n == 0) {
+            return 0;
+        }
+        if (errno != EINTR && !nivel_no_soportado(errno)) {
+            perror("Error al escribir en el archivo destino");
+            return -1;
+        }
+        desde = off_in;
+        *nivel = COPIA_SENDFILE;
+    }
+
+    if (*nivel == COPIA_SENDFILE) {
+        // sendfile escribe en la posicion actual del destino
+        off_t off_in = desde;
+        ssize_t n = 1;
+        if (lseek(destino_fd, desde, SEEK_SET) == (off_t)-1) {
+            n = -1;
+        }
+        while (n > 0 && off_in < fin) {
+            size_t pedir = (fin - off_in) < (off_t)tramo ? (size_t)(fin - off_in) : tramo;
+            n = sendfile(destino_fd, origen_fd, &off_in, pedir);
+            if (n > 0) {
+                *copiados += n;
+                control_es_consumir(n);
+            }
+        }
+        if (off_in >= fin || n == 0) {
+            return 0;
+        }
+        if (errno != EINTR && !nivel_no_soportado(errno)) {
+            perror("Error al escribir en el archivo destino");
+            return -1;
+        }
+        desde = off_in;
+        *nivel = COPIA_BUFFER;
+    }
+
+    return copiar_con_buffer(origen_fd, destino_fd, desde, fin - desde, copiados);
+}
+
+// Copia secuencial para origenes que no son archivos regulares (tuberias, dispositivos)
+static int copiar_secuencial(int origen_fd, int destino_fd, off_t *copiados) {
+    char *buffer;
+    if (posix_memalign((void **)&buffer, COPIA_ALINEACION, COPIA_BUFFER_TAM) != 0) {
+        perror("Error al reservar el buffer de copia");
+        return -1;
+    }
+
+    ssize_t bytes_leidos;
+    int resultado = 0;
+    size_t tramo = control_es_tramo(COPIA_BUFFER_TAM);
+    while ((bytes_leidos = read(origen_fd, buffer, tramo)) > 0) {
+        ssize_t escritos = 0;
+        while (escritos < bytes_leidos) {
+            ssize_t n = write(destino_fd, buffer + escritos, bytes_leidos - escritos);
+            if (n < 0 && errno == EINTR) {
+                continue;
+            }
+            if (n < 0) {
+                perror("Error al escribir en el archivo destino");
+                free(buffer);
+                return -1;
+            }
+            escritos += n;
+        }
+        *copiados += bytes_leidos;
+        control_es_consumir(bytes_leidos);
+    }
+
+    if (bytes_leidos < 0) {
+        perror("Error al leer el archivo origen");
+        resultado = -1;
+    }
+    free(buffer);
+    return resultado;
+}
+
+// Resultado de una copia, para informar al usuario
+typedef struct {
+    NivelCopia nivel;
+    off_t datos;   // Bytes de datos copiados
+    off_t huecos;  // Bytes de huecos que no se escribieron
+    int verificado; // Con --verificar: el destino releido coincide con el origen
+    uint32_t crc;   // CRC32C del contenido (valido si verificado)
+} ResultadoCopia;
+
+// Copia los extents de datos dentro de [desde, hasta) con SEEK_DATA/SEEK_HOLE.
+// Cada extent se preasigna con fallocate y los huecos no se escriben.
+static int copiar_extents(int origen_fd, int destino_fd, off_t desde, off_t hasta,
+                          NivelCopia *nivel, off_t *copiados) {
+    off_t pos = desde;
+    while (pos < hasta) {
+        off_t inicio = lseek(origen_fd, pos, SEEK_DATA);
+        if (inicio == (off_t)-1) {
+            if (errno == ENXIO) {
+                break; // Solo queda un hueco hasta el final
+            }
+            inicio = pos; // Sin soporte de SEEK_DATA: todo es datos
+        }
+        if (inicio >= hasta) {
+            break;
+        }
+        off_t fin = lseek(origen_fd, inicio, SEEK_HOLE);
+        if (fin == (off_t)-1 || fin > hasta) {
+            fin = hasta;
+        }
+
+        // Preasignar el extent; si no hay espacio se falla antes de copiar
+        if (fallocate(destino_fd, 0, inicio, fin - inicio) != 0 && errno == ENOSPC) {
+            perror("Error al escribir en el archivo destino");
+            return -1;
+        }
+        if (copiar_rango(origen_fd, destino_fd, inicio, fin - inicio, nivel, copiados) != 0) {
+            return -1;
+        }
+        pos = fin;
+    }
+    return 0;
+}
+
+// CRC32C de [desde, hasta) de un archivo; los huecos entran como ceros sin leerlos
+static int crc_rango(int fd, off_t desde, off_t hasta, char *buffer, size_t tam, uint32_t *crc) {
+    off_t pos = desde;
+    while (pos < hasta) {
+        off_t inicio = lseek(fd, pos, SEEK_DATA);
+        if (inicio == (off_t)-1) {
+            inicio = errno == ENXIO ? hasta : pos;
+        }
+        if (inicio > hasta) {
+            inicio = hasta;
+        }
+        *crc = crc32c_ceros(*crc, inicio - pos);
+        off_t fin = inicio < hasta ? lseek(fd, inicio, SEEK_HOLE) : hasta;
+        if (fin == (off_t)-1 || fin > hasta) {
+            fin = hasta;
+        }
+        for (pos = inicio; pos < fin;) {
+            size_t pedir = fin - pos < (off_t)tam ? (size_t)(fin - pos) : tam;
+            if (leer_completo(fd, buffer, pedir, pos) != 0) {
+                return -1;
+            }
+            *crc = crc32c(*crc, buffer, pedir);
+            pos += pedir;
+        }
+    }
+    return 0;
+}
+
+// Con --verificar el destino se relee por el mismo fd
+static int modo_destino() {
+    return control_es_del_hilo != NULL && control_es_del_hilo->verificar ? O_RDWR : O_WRONLY;
+}
+
+// Copia con --verificar: [desde, hasta) pasa por el buffer y el CRC32C se
+// calcula mientras los datos estan en memoria, sin otra lectura del origen.
+// Despues se relee el destino desde el disco (soltar_cache) y se compara. Los
+// huecos no se escriben pero cuentan como ceros. Deja el CRC32C del rango en *crc.
+static int copiar_verificando(int origen_fd, int destino_fd, off_t desde, off_t hasta, off_t *copiados,
+                              uint32_t *crc) {
+    char *buffer;
+    if (posix_memalign((void **)&buffer, COPIA_ALINEACION, COPIA_BUFFER_TAM) != 0) {
+        perror("Error al reservar el buffer de copia");
+        return -1;
+    }
+    size_t tramo = control_es_tramo(COPIA_BUFFER_TAM);
+    uint32_t origen_crc = 0, destino_crc = 0;
+    off_t pos = desde;
+    int resultado = 0;
+    while (resultado == 0 && pos < hasta) {
+        off_t inicio = lseek(origen_fd, pos, SEEK_DATA);
+        if (inicio == (off_t)-1) {
+            inicio = errno == ENXIO ? hasta : pos;
+        }
+        if (inicio > hasta) {
+            inicio = hasta;
+        }
+        origen_crc = crc32c_ceros(origen_crc, inicio - pos);
+        off_t fin = inicio < hasta ? lseek(origen_fd, inicio, SEEK_HOLE) : hasta;
+        if (fin == (off_t)-1 || fin > hasta) {
+            fin = hasta;
+        }
+        for (pos = inicio; pos < fin;) {
+            size_t pedir = fin - pos < (off_t)tramo ? (size_t)(fin - pos) : tramo;
+            if (leer_completo(origen_fd, buffer, pedir, pos) != 0) {
+                perror("Error al leer el archivo origen");
+                resultado = -1;
+                break;
+            }
+            origen_crc = crc32c(origen_crc, buffer, pedir);
+            if (escribir_completo(destino_fd, buffer, pedir, pos) != 0) {
+                perror("Error al escribir en el archivo destino");
+                resultado = -1;
+                break;
+            }
+            pos += pedir;
+            *copiados += pedir;
+            control_es_consumir(pedir);
+        }
+    }
+
+    if (resultado == 0 && (soltar_cache(destino_fd, desde, hasta - desde) != 0 ||
+                           crc_rango(destino_fd, desde, hasta, buffer, COPIA_BUFFER_TAM, &destino_crc) != 0)) {
+        perror("Error al releer el archivo destino");
+        resultado = -1;
+    } else if (resultado == 0 && destino_crc != origen_crc) {
+        fprintf(stderr, "Error: el destino no coincide con el origen (CRC32C %08x, releido %08x)\n", origen_crc,
+                destino_crc);
+        resultado = -1;
+    }
+    free(buffer);
+    *crc = origen_crc;
+    return resultado;
+}
+
+// Copia todo el contenido de origen_fd a destino_fd.
+// Los archivos regulares se recorren por extents: solo se copian los datos
+// y los huecos del origen quedan como huecos en el destino.
+// Devuelve 0 si tuvo exito.
+int copiar_datos(int origen_fd, int destino_fd, ResultadoCopia *res) {
+    struct stat st;
+    res->datos = 0;
+    res->huecos = 0;
+    res->verificado = 0;
+
+    if (fstat(origen_fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+        res->nivel = COPIA_BUFFER;
+        return copiar_secuencial(origen_fd, destino_fd, &res->datos);
+    }
+
+    // Con --verificar los datos tienen que pasar por memoria: nada de reflink ni copia en el kernel
+    if (control_es_del_hilo != NULL && control_es_del_hilo->verificar) {
+        res->nivel = COPIA_BUFFER;
+        if (ftruncate(destino_fd, st.st_size) != 0) {
+            perror("Error al escribir en el archivo destino");
+            return -1;
+        }
+        if (copiar_verificando(origen_fd, destino_fd, 0, st.st_size, &res->datos, &res->crc) != 0) {
+            return -1;
+        }
+        res->huecos = st.st_size - res->datos;
+        res->verificado = 1;
+        return 0;
+    }
+
+    // Nivel 1: reflink, comparte los bloques y conserva los huecos por si solo
+    if (ioctl(destino_fd, FICLONE, origen_fd) == 0) {
+        res->nivel = COPIA_REFLINK;
+        res->datos = st.st_size;
+        control_es_avanzar(st.st_size);
+        return 0;
+    }
+    if (!nivel_no_soportado(errno)) {
+        perror("Error al escribir en el archivo destino");
+        return -1;
+    }
+
+    res->nivel = COPIA_RANGO;
+    if (copiar_extents(origen_fd, destino_fd, 0, st.st_size, &res->nivel, &res->datos) != 0) {
+        return -1;
+    }
+
+    // Fija el tamano final; un hueco al final del origen queda como hueco
+    if (ftruncate(destino_fd, st.st_size) != 0) {
+        perror("Error al escribir en el archivo destino");
+        return -1;
+    }
+    res->huecos = st.st_size - res->datos;
+    return 0;
+}
+
+// Copia el modo y las fechas de acceso/modificacion del origen al destino
+static void conservar_metadatos(int origen_fd, int destino_fd) {
+    struct stat st;
+    if (fstat(origen_fd, &st) != 0) {
+        return;
+    }
+    if (fchmod(destino_fd, st.st_mode & 07777) != 0) {
+        perror("Error al conservar los permisos");
+    }
+    struct timespec tiempos[2] = {st.st_atim, st.st_mtim};
+    if (futimens(destino_fd, tiempos) != 0) {
+        perror("Error al conservar las fechas");
+    }
+}
+
+// Copia un archivo completo conservando modo y fechas. Devuelve 0 si tuvo exito.
+static int copiar_archivo(const char *origen, const char *destino, ResultadoCopia *res) {
+    int origen_fd = open(origen, O_RDONLY);
+    if (origen_fd < 0) {
+        perror("Error al abrir el archivo origen");
+        return -1;
+    }
+
+    int destino_fd = open(destino, modo_destino() | O_CREAT | O_TRUNC, 0644);
+    if (destino_fd < 0) {
+        perror("Error al crear el archivo destino");
+        close(origen_fd);
+        return -1;
+    }
+
+    int resultado = copiar_datos(origen_fd, destino_fd, res);
+    if (resultado == 0) {
+        conservar_metadatos(origen_fd, destino_fd);
+    }
+
+    close(origen_fd);
+    close(destino_fd);
+    return resultado;
+}
+
+// Implementación del comando 'copiar'
+int copiar(const char *origen, const char *destino) {
+
+    ResultadoCopia res;
+    double inicio = segundos_monotonicos();
+    int exito = copiar_archivo(origen, destino, &res) == 0;
+    double duracion = segundos_monotonicos() - inicio;
+
+        // Mensaje de éxito si no hubo errores
+    if (exito) {
+        informar("Archivo '%s' copiado exitosamente a '%s'\n", origen, destino);
+        double mib = res.datos / (1024.0 * 1024.0);
+        char huecos[64] = "";
+        if (res.huecos > 0) {
+            snprintf(huecos, sizeof(huecos), ", %.1f MiB de huecos omitidos", res.huecos / (1024.0 * 1024.0));
+        }
+        informar("Método: %s, %.1f MiB en %.3f s (%.1f MiB/s)%s\n", nombres_nivel_copia[res.nivel],
+                 mib, duracion, duracion > 0 ? mib / duracion : 0.0, huecos);
+        if (res.verificado) {
+            informar("Verificado: CRC32C %08x igual en origen y destino\n", res.crc);
+        }
+    }
+    return exito ? 0 : -1;
+}
+
+// ---------------------------------------------------------------------------
+// Pool de hilos con robo de trabajo.
+// Cada hilo tiene su propia cola: saca tareas del final (LIFO, datos calientes en
+// cache) y cuando se queda sin trabajo roba del principio de las colas ajenas.
+// Las tareas pueden enviar nuevas tareas, que van a la cola del hilo que las crea.
+// ---------------------------------------------------------------------------
+
+typedef struct {
+    void (*funcion)(void *arg);
+    void *arg;
+} Tarea;
+
+typedef struct {
+    pthread_mutex_t mutex;
+    Tarea *tareas;       // Arreglo circular
+    size_t capacidad;
+    size_t inicio;
+    size_t cantidad;
+} ColaHilo;
+
+typedef struct PoolHilos PoolHilos;
+
+typedef struct {
+    PoolHilos *pool;
+    int indice;
+} ArgTrabajador;
+
+struct PoolHilos {
+    int hilos;
+    pthread_t *ids;
+    ArgTrabajador *args;
+    ColaHilo *colas;
+    pthread_mutex_t mutex;
+    pthread_cond_t hay_trabajo;
+    pthread_cond_t sin_pendientes;
+    size_t encoladas;   // Tareas que estan en alguna cola
+    size_t pendientes;  // Tareas enviadas que todavia no terminaron
+    unsigned siguiente; // Reparto round-robin de tareas enviadas desde fuera del pool
+    int cerrando;
+    ControlEs *control; // Control de E/S del hilo que creo el pool
+};
+
+static __thread PoolHilos *pool_del_hilo = NULL;
+static __thread int indice_del_hilo = -1;
+
+// Devuelve -1 si no hay memoria para agrandar la cola; la cola queda como estaba
+static int cola_meter(ColaHilo *cola, Tarea tarea) {
+    pthread_mutex_lock(&cola->mutex);
+    if (cola->cantidad == cola->capacidad) {
+        size_t nueva = cola->capacidad ? cola->capacidad * 2 : 64;
+        Tarea *tareas = malloc(nueva * sizeof(Tarea));
+        if (tareas == NULL) {
+            pthread_mutex_unlock(&cola->mutex);
+            return -1;
+        }
+        for (size_t k = 0; k < cola->cantidad; k++) {
+            tareas[k] = cola->tareas[(cola->inicio + k) % cola->capacidad];
+        }
+        free(cola->tareas);
+        cola->tareas = tareas;
+        cola->capacidad = nueva;
+        cola->inicio = 0;
+    }
+    cola->tareas[(cola->inicio + cola->cantidad) % cola->capacidad] = tarea;
+    cola->cantidad++;
+    pthread_mutex_unlock(&cola->mutex);
+    return 0;
+}
+
+// Saca una tarea del final (propia) o del principio (robo) de la cola
+static int cola_sacar(ColaHilo *cola, Tarea *tarea, int robar) {
+    int hay = 0;
+    pthread_mutex_lock(&cola->mutex);
+    if (cola->cantidad > 0) {
+        if (robar) {
+            *tarea = cola->tareas[cola->inicio];
+            cola->inicio = (cola->inicio + 1) % cola->capacidad;
+        } else {
+            *tarea = cola->tareas[(cola->inicio + cola->cantidad - 1) % cola->capacidad];
+        }
+        cola->cantidad--;
+        hay = 1;
+    }
+    pthread_mutex_unlock(&cola->mutex);
+    return hay;
+}
+
+static int pool_tomar_tarea(PoolHilos *pool, int indice, Tarea *tarea) {
+    int hay = cola_sacar(&pool->colas[indice], tarea, 0);
+    for (int k = 1; !hay && k < pool->hilos; k++) {
+        hay = cola_sacar(&pool->colas[(indice + k) % pool->hilos], tarea, 1);
+    }
+    if (hay) {
+        pthread_mutex_lock(&pool->mutex);
+        pool->encoladas--;
+        pthread_mutex_unlock(&pool->mutex);
+    }
+    return hay;
+}
+
+static void *pool_trabajador(void *arg) {
+    ArgTrabajador *yo = arg;
+    PoolHilos *pool = yo->pool;
+    pool_del_hilo = pool;
+    indice_del_hilo = yo->indice;
+    control_es_del_hilo = pool->control;
+
+    for (;;) {
+        Tarea tarea;
+        if (pool_tomar_tarea(pool, yo->indice, &tarea)) {
+            tarea.funcion(tarea.arg);
+            pthread_mutex_lock(&pool->mutex);
+            if (--pool->pendientes == 0) {
+                pthread_cond_broadcast(&pool->sin_pendientes);
+            }
+            pthread_mutex_unlock(&pool->mutex);
+            continue;
+        }
+
+        pthread_mutex_lock(&pool->mutex);
+        while (pool->encoladas == 0 && !pool->cerrando) {
+            pthread_cond_wait(&pool->hay_trabajo, &pool->mutex);
+        }
+        int salir = pool->cerrando && pool->encoladas == 0;
+        pthread_mutex_unlock(&pool->mutex);
+        if (salir) {
+            break;
+        }
+    }
+    return NULL;
+}
+
+PoolHilos *pool_crear(int hilos) {
+    if (hilos < 1) {
+        hilos = 1;
+    }
+    PoolHilos *pool = calloc(1, sizeof(PoolHilos));
+    if (pool == NULL) {
+        return NULL;
+    }
+    pool->hilos = hilos;
+    pool->control = control_es_del_hilo;
+    pool->ids = calloc(hilos, sizeof(pthread_t));
+    pool->args = calloc(hilos, sizeof(ArgTrabajador));
+    pool->colas = calloc(hilos, sizeof(ColaHilo));
+    if (pool->ids == NULL || pool->args == NULL || pool->colas == NULL) {
+        free(pool->ids);
+        free(pool->args);
+        free(pool->colas);
+        free(pool);
+        return NULL;
+    }
+    pthread_mutex_init(&pool->mutex, NULL);
+    pthread_cond_init(&pool->hay_trabajo, NULL);
+    pthread_cond_init(&pool->sin_pendientes, NULL);
+    for (int k = 0; k < hilos; k++) {
+        pthread_mutex_init(&pool->colas[k].mutex, NULL);
+    }
+    for (int k = 0; k < hilos; k++) {
+        pool->args[k].pool = pool;
+        pool->args[k].indice = k;
+        if (pthread_create(&pool->ids[k], NULL, pool_trabajador, &pool->args[k]) != 0) {
+            perror("Error al crear hilo de trabajo");
+            pool->hilos = k; // Trabajar con los hilos que se pudieron crear
+            break;
+        }
+    }
+    if (pool->hilos == 0) {
+        // Sin hilos no hay quien ejecute las tareas
+        free(pool->ids);
+        free(pool->args);
+        free(pool->colas);
+        free(pool);
+        return NULL;
+    }
+    return pool;
+}
+
+void pool_enviar(PoolHilos *pool, void (*funcion)(void *), void *arg) {
+    Tarea tarea = {funcion, arg};
+    int indice;
+
+    pthread_mutex_lock(&pool->mutex);
+    pool->pendientes++;
+    indice = (pool_del_hilo == pool) ? indice_del_hilo : (int)(pool->siguiente++ % pool->hilos);
+    pthread_mutex_unlock(&pool->mutex);
+
+    if (cola_meter(&pool->colas[indice], tarea) != 0) {
+        // Sin memoria para encolar: la tarea corre en el hilo que la envia
+        funcion(arg);
+        pthread_mutex_lock(&pool->mutex);
+        if (--pool->pendientes == 0) {
+            pthread_cond_broadcast(&pool->sin_pendientes);
+        }
+        pthread_mutex_unlock(&pool->mutex);
+        return;
+    }
+
+    pthread_mutex_lock(&pool->mutex);
+    pool->encoladas++;
+    pthread_cond_signal(&pool->hay_trabajo);
+    pthread_mutex_unlock(&pool->mutex);
+}
+
+// Espera a que terminen todas las tareas enviadas, incluidas las que crearon otras tareas
+void pool_esperar(PoolHilos *pool) {
+    pthread_mutex_lock(&pool->mutex);
+    while (pool->pendientes > 0) {
+        pthread_cond_wait(&pool->sin_pendientes, &pool->mutex);
+    }
+    pthread_mutex_unlock(&pool->mutex);
+}
+
+void pool_destruir(PoolHilos *pool) {
+    pthread_mutex_lock(&pool->mutex);
+    pool->cerrando = 1;
+    pthread_cond_broadcast(&pool->hay_trabajo);
+    pthread_mutex_unlock(&pool->mutex);
+    for (int k = 0; k < pool->hilos; k++) {
+        pthread_join(pool->ids[k], NULL);
+    }
+    for (int k = 0; k < pool->hilos; k++) {
+        pthread_mutex_destroy(&pool->colas[k].mutex);
+        free(pool->colas[k].tareas);
+    }
+    pthread_mutex_destroy(&pool->mutex);
+    pthread_cond_destroy(&pool->hay_trabajo);
+    pthread_cond_destroy(&pool->sin_pendientes);
+    free(pool->colas);
+    free(pool->args);
+    free(pool->ids);
+    free(pool);
+}
+
+// Cantidad de hilos por defecto: uno por CPU en linea
+static int hilos_por_defecto() {
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    return cpus > 0 ? (int)cpus : 1;
+}
+
+// Une un directorio y un nombre en una ruta nueva reservada con malloc (NULL sin memoria)
+static char *unir_ruta(const char *directorio, const char *nombre) {
+    size_t largo = strlen(directorio) + strlen(nombre) + 2;
+    char *ruta = malloc(largo);
+    if (ruta != NULL) {
+        snprintf(ruta, largo, "%s/%s", directorio, nombre);
+    }
+    return ruta;
+}
+
+// ---------------------------------------------------------------------------
+// Copia recursiva de arboles ('copiar -r')
+// ---------------------------------------------------------------------------
+
+// Metadatos de un directorio destino, que se aplican al final de la copia
+typedef struct {
+    char *ruta;
+    mode_t modo;
+    struct timespec tiempos[2];
+} DirectorioPendiente;
+
+typedef struct {
+    PoolHilos *pool;
+    atomic_long archivos;
+    atomic_long bytes;
+    atomic_long errores;
+    pthread_mutex_t mutex; // Protege la lista de directorios
+    DirectorioPendiente *directorios;
+    size_t cant_directorios;
+    size_t cap_directorios;
+} CopiaArbol;
+
+typedef struct {
+    CopiaArbol *copia;
+    char *origen;
+    char *destino;
+} TareaDirectorio;
+
+typedef struct {
+    CopiaArbol *copia;
+    int cantidad;
+    off_t bytes;
+    char *origen[COPIA_LOTE_ARCHIVOS];
+    char *destino[COPIA_LOTE_ARCHIVOS];
+} TareaLote;
+
+// Archivo grande dividido en trozos; el ultimo trozo en terminar fija los metadatos
+typedef struct {
+    CopiaArbol *copia;
+    char *origen;
+    char *destino;
+    atomic_int restantes;
+    atomic_int fallo;
+    struct TareaTrozo *trozos; // Se reservan juntos y se liberan con el archivo
+} ArchivoGrande;
+
+typedef struct TareaTrozo {
+    ArchivoGrande *archivo;
+    off_t desde;
+    off_t hasta;
+} TareaTrozo;
+
+static void copia_arbol_error(CopiaArbol *copia, const char *ruta, const char *mensaje) {
+    fprintf(stderr, "%s '%s': %s\n", mensaje, ruta, strerror(errno));
+    atomic_fetch_add(&copia->errores, 1);
+}
+
+static void tarea_lote(void *arg) {
+    TareaLote *lote = arg;
+    for (int k = 0; k < lote->cantidad; k++) {
+        ResultadoCopia res;
+        if (copiar_archivo(lote->origen[k], lote->destino[k], &res) == 0) {
+            atomic_fetch_add(&lote->copia->archivos, 1);
+            atomic_fetch_add(&lote->copia->bytes, res.datos);
+        } else {
+            fprintf(stderr, "No se pudo copiar '%s'\n", lote->origen[k]);
+            atomic_fetch_add(&lote->copia->errores, 1);
+        }
+        free(lote->origen[k]);
+        free(lote->destino[k]);
+    }
+    free(lote);
+}
+
+static void tarea_trozo(void *arg) {
+    TareaTrozo *trozo = arg;
+    ArchivoGrande *archivo = trozo->archivo;
+    CopiaArbol *copia = archivo->copia;
+
+    int origen_fd = open(archivo->origen, O_RDONLY);
+    int destino_fd = open(archivo->destino, modo_destino());
+    if (origen_fd < 0 || destino_fd < 0) {
+        copia_arbol_error(copia, archivo->origen, "Error al abrir");
+        atomic_store(&archivo->fallo, 1);
+    } else {
+        // Un reflink parcial si el sistema de archivos lo permite; si no, el motor normal
+        struct file_clone_range rango = {origen_fd, trozo->desde, trozo->hasta - trozo->desde, trozo->desde};
+        off_t copiados = 0;
+        uint32_t crc;
+        if (control_es_del_hilo != NULL && control_es_del_hilo->verificar) {
+            // Cada trozo se verifica por su cuenta
+            if (copiar_verificando(origen_fd, destino_fd, trozo->desde, trozo->hasta, &copiados, &crc) != 0) {
+                fprintf(stderr, "No se pudo copiar '%s'\n", archivo->origen);
+                atomic_store(&archivo->fallo, 1);
+            }
+        } else if (ioctl(destino_fd, FICLONERANGE, &rango) == 0) {
+            copiados = trozo->hasta - trozo->desde;
+            control_es_avanzar(copiados);
+        } else {
+            NivelCopia nivel = COPIA_RANGO;
+            if (copiar_extents(origen_fd, destino_fd, trozo->desde, trozo->hasta, &nivel, &copiados) != 0) {
+                fprintf(stderr, "No se pudo copiar '%s'\n", archivo->origen);
+                atomic_store(&archivo->fallo, 1);
+            }
+        }
+        atomic_fetch_add(&copia->bytes, copiados);
+    }
+
+    if (atomic_fetch_sub(&archivo->restantes, 1) == 1) {
+        if (atomic_load(&archivo->fallo)) {
+            atomic_fetch_add(&copia->errores, 1);
+        } else {
+            if (origen_fd >= 0 && destino_fd >= 0) {
+                conservar_metadatos(origen_fd, destino_fd);
+            }
+            atomic_fetch_add(&copia->archivos, 1);
+        }
+        free(archivo->origen);
+        free(archivo->destino);
+        free(archivo->trozos);
+        free(archivo);
+    }
+    if (origen_fd >= 0) {
+        close(origen_fd);
+    }
+    if (destino_fd >= 0) {
+        close(destino_fd);
+    }
+}
+
+// Crea el destino de un archivo grande con su tamano final y envia un trozo por tarea
+static void enviar_archivo_grande(CopiaArbol *copia, char *origen, char *destino, off_t tamano) {
+    int destino_fd = open(destino, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (destino_fd < 0 || ftruncate(destino_fd, tamano) != 0) {
+        copia_arbol_error(copia, destino, "Error al crear el archivo destino");
+        if (destino_fd >= 0) {
+            close(destino_fd);
+        }
+        free(origen);
+        free(destino);
+        return;
+    }
+    close(destino_fd);
+
+    int trozos = (int)((tamano + COPIA_TROZO - 1) / COPIA_TROZO);
+    ArchivoGrande *archivo = malloc(sizeof(ArchivoGrande));
+    TareaTrozo *tareas = malloc(trozos * sizeof(TareaTrozo));
+    if (archivo == NULL || tareas == NULL) {
+        copia_arbol_error(copia, origen, "Error al copiar");
+        free(archivo);
+        free(tareas);
+        free(origen);
+        free(destino);
+        return;
+    }
+    archivo->copia = copia;
+    archivo->origen = origen;
+    archivo->destino = destino;
+    archivo->trozos = tareas;
+    atomic_init(&archivo->restantes, trozos);
+    atomic_init(&archivo->fallo, 0);
+    for (int k = 0; k < trozos; k++) {
+        TareaTrozo *trozo = &tareas[k];
+        trozo->archivo = archivo;
+        trozo->desde = (off_t)k * COPIA_TROZO;
+        trozo->hasta = trozo->desde + COPIA_TROZO < tamano ? trozo->desde + COPIA_TROZO : tamano;
+        pool_enviar(copia->pool, tarea_trozo, trozo);
+    }
+}
+
+// Devuelve -1 (y cuenta el error) si no hay memoria para anotarlo
+static int anotar_directorio(CopiaArbol *copia, const char *destino, const struct stat *st) {
+    pthread_mutex_lock(&copia->mutex);
+    char *ruta = strdup(destino);
+    if (ruta != NULL && copia->cant_directorios == copia->cap_directorios) {
+        size_t nueva = copia->cap_directorios ? copia->cap_directorios * 2 : 64;
+        DirectorioPendiente *directorios = realloc(copia->directorios, nueva * sizeof(DirectorioPendiente));
+        if (directorios == NULL) {
+            free(ruta);
+            ruta = NULL;
+        } else {
+            copia->directorios = directorios;
+            copia->cap_directorios = nueva;
+        }
+    }
+    if (ruta == NULL) {
+        pthread_mutex_unlock(&copia->mutex);
+        copia_arbol_error(copia, destino, "No se conservaran los metadatos del directorio");
+        return -1;
+    }
+    DirectorioPendiente *dir = &copia->directorios[copia->cant_directorios++];
+    dir->ruta = ruta;
+    dir->modo = st->st_mode & 07777;
+    dir->tiempos[0] = st->st_atim;
+    dir->tiempos[1] = st->st_mtim;
+    pthread_mutex_unlock(&copia->mutex);
+    return 0;
+}
+
+static void tarea_directorio(void *arg);
+
+// Toma 'origen' y 'destino' (reservados con malloc). Devuelve -1 si no se pudo enviar.
+static int enviar_directorio(CopiaArbol *copia, char *origen, char *destino) {
+    TareaDirectorio *tarea = origen != NULL && destino != NULL ? malloc(sizeof(TareaDirectorio)) : NULL;
+    if (tarea == NULL) {
+        errno = ENOMEM;
+        copia_arbol_error(copia, origen != NULL ? origen : "?", "Error al recorrer el directorio");
+        free(origen);
+        free(destino);
+        return -1;
+    }
+    tarea->copia = copia;
+    tarea->origen = origen;
+    tarea->destino = destino;
+    pool_enviar(copia->pool, tarea_directorio, tarea);
+    return 0;
+}
+
+// Recorre un directorio: crea los subdirectorios y reparte los archivos en lotes,
+// tareas individuales o trozos segun su tamano
+static void tarea_directorio(void *arg) {
+    TareaDirectorio *tarea = arg;
+    CopiaArbol *copia = tarea->copia;
+    DIR *dir = opendir(tarea->origen);
+    if (dir == NULL) {
+        copia_arbol_error(copia, tarea->origen, "Error al abrir el directorio");
+        goto fin;
+    }
+
+    TareaLote *lote = NULL;
+    struct dirent *entrada;
+    while ((entrada = readdir(dir)) != NULL) {
+        if (strcmp(entrada->d_name, ".") == 0 || strcmp(entrada->d_name, "..") == 0) {
+            continue;
+        }
+        struct stat st;
+        if (fstatat(dirfd(dir), entrada->d_name, &st, AT_SYMLINK_NOFOLLOW) != 0) {
+            copia_arbol_error(copia, entrada->d_name, "Error al leer");
+            continue;
+        }
+        char *origen = unir_ruta(tarea->origen, entrada->d_name);
+        char *destino = unir_ruta(tarea->destino, entrada->d_name);
+        if (origen == NULL || destino == NULL) {
+            copia_arbol_error(copia, entrada->d_name, "Error al copiar");
+            free(origen);
+            free(destino);
+            continue;
+        }
+
+        if (S_ISDIR(st.st_mode)) {
+            if (mkdir(destino, (st.st_mode & 07777) | S_IRWXU) != 0 && errno != EEXIST) {
+                copia_arbol_error(copia, destino, "Error al crear el directorio");
+                free(origen);
+                free(destino);
+                continue;
+            }
+            anotar_directorio(copia, destino, &st);
+            enviar_directorio(copia, origen, destino);
+        } else if (S_ISLNK(st.st_mode)) {
+            char enlace[PATH_MAX];
+            ssize_t largo = readlink(origen, enlace, sizeof(enlace) - 1);
+            if (largo >= 0) {
+                enlace[largo] = '\0';
+            }
+            if (largo < 0 || symlink(enlace, destino) != 0) {
+                copia_arbol_error(copia, origen, "Error al copiar el enlace");
+            } else {
+                atomic_fetch_add(&copia->archivos, 1);
+            }
+            free(origen);
+            free(destino);
+        } else if (!S_ISREG(st.st_mode)) {
+            fprintf(stderr, "Se omite '%s': no es un archivo regular\n", origen);
+            atomic_fetch_add(&copia->errores, 1);
+            free(origen);
+            free(destino);
+        } else if (st.st_size > 2 * (off_t)COPIA_TROZO) {
+            enviar_archivo_grande(copia, origen, destino, st.st_size);
+        } else {
+            // Los archivos pequenos se agrupan; los medianos van en un lote propio
+            if (lote == NULL && (lote = calloc(1, sizeof(TareaLote))) == NULL) {
+                copia_arbol_error(copia, origen, "Error al copiar");
+                free(origen);
+                free(destino);
+                continue;
+            }
+            lote->copia = copia;
+            lote->origen[lote->cantidad] = origen;
+            lote->destino[lote->cantidad] = destino;
+            lote->cantidad++;
+            lote->bytes += st.st_size;
+            if (st.st_size >= COPIA_PEQUENO || lote->cantidad == COPIA_LOTE_ARCHIVOS ||
+                lote->bytes >= COPIA_LOTE_BYTES) {
+                pool_enviar(copia->pool, tarea_lote, lote);
+                lote = NULL;
+            }
+        }
+    }
+    if (lote != NULL) {
+        pool_enviar(copia->pool, tarea_lote, lote);
+    }
+    closedir(dir);
+
+fin:
+    free(tarea->origen);
+    free(tarea->destino);
+    free(tarea);
+}
+
+// Devuelve 1 si 'destino' (o su directorio padre, si todavia no existe) es el
+// directorio 'origen' o esta dentro de el. Sube por ".." comparando dispositivo
+// e inodo, asi que no lo engañan enlaces simbolicos ni rutas relativas.
+static int destino_dentro_de(const struct stat *origen, const char *destino) {
+    int fd = open(destino, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0) {
+        char padre[PATH_MAX];
+        snprintf(padre, sizeof(padre), "%s", destino);
+        char *barra = strrchr(padre, '/');
+        while (barra != NULL && barra > padre && barra[1] == '\0') { // "dir/" -> "dir"
+            *barra = '\0';
+            barra = strrchr(padre, '/');
+        }
+        if (barra == NULL) {
+            strcpy(padre, ".");
+        } else {
+            barra[barra == padre] = '\0';
+        }
+        fd = open(padre, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    }
+    int dentro = 0;
+    while (fd >= 0 && !dentro) {
+        struct stat actual, arriba;
+        if (fstat(fd, &actual) != 0 || fstatat(fd, "..", &arriba, 0) != 0) {
+            break;
+        }
+        dentro = actual.st_dev == origen->st_dev && actual.st_ino == origen->st_ino;
+        if (actual.st_dev == arriba.st_dev && actual.st_ino == arriba.st_ino) {
+            break; // Raiz
+        }
+        int siguiente = openat(fd, "..", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        close(fd);
+        fd = siguiente;
+    }
+    if (fd >= 0) {
+        close(fd);
+    }
+    return dentro;
+}
+
+// Implementación de 'copiar -r': copia un arbol completo con un pool de hilos
+int copiar_recursivo(const char *origen, const char *destino, int hilos) {
+    struct stat st;
+    if (stat(origen, &st) != 0) {
+        perror("Error al abrir el archivo origen");
+        return -1;
+    }
+    if (!S_ISDIR(st.st_mode)) {
+        return copiar(origen, destino);
+    }
+    if (destino_dentro_de(&st, destino)) {
+        fprintf(stderr, "Error: no se puede copiar '%s' dentro de si mismo ('%s')\n", origen, destino);
+        return -1;
+    }
+    if (mkdir(destino, (st.st_mode & 07777) | S_IRWXU) != 0 && errno != EEXIST) {
+        perror("Error al crear el directorio destino");
+        return -1;
+    }
+
+    CopiaArbol copia;
+    memset(&copia, 0, sizeof(copia));
+    pthread_mutex_init(&copia.mutex, NULL);
+    copia.pool = pool_crear(hilos);
+    if (copia.pool == NULL) {
+        pthread_mutex_destroy(&copia.mutex);
+        return -1;
+    }
+    anotar_directorio(&copia, destino, &st);
+
+    double inicio = segundos_monotonicos();
+    enviar_directorio(&copia, strdup(origen), strdup(destino));
+    pool_esperar(copia.pool);
+    hilos = copia.pool->hilos;
+    pool_destruir(copia.pool);
+
+    // Los directorios reciben su modo y fechas al final, cuando ya no se escribe en ellos
+    for (size_t k = 0; k < copia.cant_directorios; k++) {
+        DirectorioPendiente *dir = &copia.directorios[k];
+        if (chmod(dir->ruta, dir->modo) != 0 || utimensat(AT_FDCWD, dir->ruta, dir->tiempos, 0) != 0) {
+            perror("Error al conservar los metadatos del directorio");
+        }
+        free(dir->ruta);
+    }
+    free(copia.directorios);
+    pthread_mutex_destroy(&copia.mutex);
+    double duracion = segundos_monotonicos() - inicio;
+
+    long archivos = atomic_load(&copia.archivos);
+    double mib = atomic_load(&copia.bytes) / (1024.0 * 1024.0);
+    long errores = atomic_load(&copia.errores);
+    informar("Árbol '%s' copiado a '%s' con %d hilos: %ld archivos, %.1f MiB en %.3f s\n",
+             origen, destino, hilos, archivos, mib, duracion);
+    informar("Rendimiento: %.1f archivos/s, %.1f MiB/s, %ld errores\n",
+             duracion > 0 ? archivos / duracion : 0.0, duracion > 0 ? mib / duracion : 0.0, errores);
+    return errores == 0 ? 0 : -1;
+}
+
+// ---------------------------------------------------------------------------
+// 'mover' y 'renombrar'. Primero se intenta renameat2, que es atomico y acepta
+// RENAME_NOREPLACE (no pisar el destino) y RENAME_EXCHANGE (intercambiar dos
+// rutas). Si origen y destino estan en distintos sistemas de archivos (EXDEV)
+// se copia con el motor de copia a un temporal junto al destino, se sincroniza,
+// se pone en su lugar con un rename y recien entonces se borra el origen.
+// ---------------------------------------------------------------------------
+
+static int borrar_entrada(const char *ruta, const struct stat *st, int tipo, struct FTW *ftw) {
+    (void)st;
+    (void)ftw;
+    if ((tipo == FTW_DP ? rmdir(ruta) : unlink(ruta)) != 0) {
+        perror(ruta);
+        return -1;
+    }
+    return 0;
+}
+
+// Prefijos de la pasada de metadatos (nftw no acepta contexto)
+static __thread const char *mover_origen = NULL;
+static __thread const char *mover_temporal = NULL;
+static __thread int mover_error = 0; // errno de la entrada que fallo
+
+// Da a la copia de 'ruta' el dueno, modo y fechas del original y la deja en
+// disco con fsync. nftw recorre en orden posterior, asi que un directorio recibe
+// sus fechas y su fsync despues de que se escribieron sus hijos.
+static int fijar_metadatos_movido(const char *ruta, const struct stat *st, int tipo, struct FTW *ftw) {
+    (void)ftw;
+    if (tipo == FTW_NS || tipo == FTW_DNR) {
+        mover_error = errno ? errno : EACCES;
+        fprintf(stderr, "No se pudo leer '%s'\n", ruta);
+        return -1;
+    }
+    char copia[PATH_MAX];
+    if (snprintf(copia, sizeof(copia), "%s%s", mover_temporal, ruta + strlen(mover_origen)) >= (int)sizeof(copia)) {
+        mover_error = ENAMETOOLONG;
+        fprintf(stderr, "Ruta demasiado larga: '%s'\n", ruta);
+        return -1;
+    }
+    struct timespec tiempos[2] = {st->st_atim, st->st_mtim};
+    if (S_ISLNK(st->st_mode)) {
+        if ((lchown(copia, st->st_uid, st->st_gid) != 0 && errno != EPERM) ||
+            utimensat(AT_FDCWD, copia, tiempos, AT_SYMLINK_NOFOLLOW) != 0) {
+            mover_error = errno;
+            perror(copia);
+            return -1;
+        }
+        return 0;
+    }
+    int fd = open(copia, O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+    if (fd < 0) {
+        mover_error = errno;
+        perror(copia);
+        return -1;
+    }
+    // Sin ser root el dueno no se puede conservar; chown borra setuid, asi que el modo va despues
+    int resultado = 0;
+    if ((fchown(fd, st->st_uid, st->st_gid) != 0 && errno != EPERM) || fchmod(fd, st->st_mode & 07777) != 0 ||
+        futimens(fd, tiempos) != 0 || fsync(fd) != 0) {
+        resultado = -1;
+        mover_error = errno;
+        perror(copia);
+    }
+    close(fd);
+    return resultado;
+}
+
+// Deja en disco la entrada de 'ruta' en su directorio
+static int sincronizar_padre(const char *ruta) {
+    char padre[PATH_MAX];
+    snprintf(padre, sizeof(padre), "%s", ruta);
+    char *barra = strrchr(padre, '/');
+    if (barra == NULL) {
+        strcpy(padre, ".");
+    } else if (barra == padre) {
+        padre[1] = '\0';
+    } else {
+        *barra = '\0';
+    }
+    int fd = open(padre, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    int resultado = fd >= 0 ? fsync(fd) : -1;
+    if (fd >= 0) {
+        close(fd);
+    }
+    return resultado;
+}
+
+// Copia 'origen' a un temporal en el sistema de archivos del destino
+static int copiar_entre_dispositivos(const char *origen, const char *temporal, const struct stat *st, int hilos) {
+    if (S_ISLNK(st->st_mode)) {
+        char enlace[PATH_MAX];
+        ssize_t largo = readlink(origen, enlace, sizeof(enlace) - 1);
+        if (largo < 0) {
+            return -1;
+        }
+        enlace[largo] = '\0';
+        return symlink(enlace, temporal);
+    }
+    if (S_ISDIR(st->st_mode)) {
+        return copiar_recursivo(origen, temporal, hilos);
+    }
+    if (!S_ISREG(st->st_mode)) {
+        errno = EXDEV; // Dispositivos, sockets y fifos no se copian
+        return -1;
+    }
+    ResultadoCopia res;
+    return copiar_archivo(origen, temporal, &res);
+}
+
+static int mover_entre_dispositivos(const char *origen, const char *destino, unsigned flags, int hilos) {
+    struct stat st;
+    if (lstat(origen, &st) != 0) {
+        return -1;
+    }
+    if (flags & RENAME_EXCHANGE) {
+        printf("No se puede intercambiar de forma atomica entre sistemas de archivos distintos.\n");
+        errno = EXDEV;
+        return -1;
+    }
+    if ((flags & RENAME_NOREPLACE) && faccessat(AT_FDCWD, destino, F_OK, AT_SYMLINK_NOFOLLOW) == 0) {
+        errno = EEXIST;
+        return -1;
+    }
+
+    char temporal[PATH_MAX];
+    snprintf(temporal, sizeof(temporal), "%s.lfsmover.%d", destino, (int)getpid());
+    double inicio = segundos_monotonicos();
+    if (copiar_entre_dispositivos(origen, temporal, &st, hilos) != 0) {
+        int error = errno;
+        nftw(temporal, borrar_entrada, 64, FTW_DEPTH | FTW_PHYS);
+        errno = error ? error : EIO;
+        return -1;
+    }
+
+    // Metadatos de todo el arbol, y los datos en disco antes de borrar el origen.
+    // nftw quita las barras finales de la raiz, asi que el prefijo tambien.
+    char raiz[PATH_MAX];
+    snprintf(raiz, sizeof(raiz), "%s", origen);
+    for (size_t largo = strlen(raiz); largo > 1 && raiz[largo - 1] == '/'; largo--) {
+        raiz[largo - 1] = '\0';
+    }
+    mover_origen = raiz;
+    mover_temporal = temporal;
+    mover_error = 0;
+    int metadatos = nftw(raiz, fijar_metadatos_movido, 64, FTW_DEPTH | FTW_PHYS);
+    if (metadatos != 0 || renameat2(AT_FDCWD, temporal, AT_FDCWD, destino, flags) != 0) {
+        int error = metadatos == 0 ? errno : mover_error ? mover_error : errno;
+        nftw(temporal, borrar_entrada, 64, FTW_DEPTH | FTW_PHYS);
+        errno = error;
+        return -1;
+    }
+    if (sincronizar_padre(destino) != 0) { // Deja en disco la entrada del rename
+        perror("Error al sincronizar el directorio destino");
+        return -1;
+    }
+
+    if (S_ISDIR(st.st_mode) ? nftw(origen, borrar_entrada, 64, FTW_DEPTH | FTW_PHYS) != 0 : unlink(origen) != 0) {
+        perror("Copiado, pero no se pudo borrar el origen");
+        return -1;
+    }
+    informar("Movido entre sistemas de archivos en %.3f s (copia, sincronizacion y borrado del origen).\n",
+             segundos_monotonicos() - inicio);
+    return 0;
+}
+
+// Mueve o renombra con renameat2 y, entre sistemas de archivos, copiando
+static int mover_ruta(const char *origen, const char *destino, unsigned flags, int hilos) {
+    if (renameat2(AT_FDCWD, origen, AT_FDCWD, destino, flags) == 0) {
+        return 0;
+    }
+    if (errno != EXDEV) {
+        return -1;
+    }
+    return mover_entre_dispositivos(origen, destino, flags, hilos);
+}
+
+// Implementación del comando 'mover'
+int mover(const char *origen, const char *destino, unsigned flags, int hilos) {
+    informar("Moviendo archivo de: %s a: %s\n", origen, destino); // Verifica las rutas
+    if (mover_ruta(origen, destino, flags, hilos) != 0) {
+        perror("Error al mover el archivo");
+        return -1;
+    }
+    return 0;
+}
+
+// Implementación del comando 'renombrar'
+int renombrar(const char *archivo, const char *nuevo_nombre, unsigned flags, int hilos) {
+    if (mover_ruta(archivo, nuevo_nombre, flags, hilos) != 0) {
+        perror("Error al renombrar el archivo");
+        return -1;
+    }
+    return 0;
+}
+
+// ---------------------------------------------------------------------------
+// 'listar': lee el directorio con getdents64 en bloques de LISTAR_BUFFER y junta
+// la salida en un buffer que se escribe de una vez. Sin orden la lista se
+// procesa bloque por bloque (memoria acotada); con -o se juntan todas las
+// entradas para ordenarlas. Los metadatos (-l u orden por tamano/fecha) salen de
+// statx relativo al fd del directorio, repartido en lotes entre hilos.
+// ---------------------------------------------------------------------------
+
+struct linux_dirent64 {
+    unsigned long long d_ino;
+    long long d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[];
+};
+
+typedef enum {
+    ORDEN_NINGUNO,
+    ORDEN_NOMBRE,
+    ORDEN_TAMANO,
+    ORDEN_FECHA
+} OrdenListado;
+
+typedef struct {
+    int largo;             // -l: formato largo
+    OrdenListado orden;    // -o nombre|tamano|fecha
+    int inverso;           // -r
+    const char *filtro;    // -f patron (fnmatch)
+} OpcionesListado;
+
+typedef struct {
+    size_t nombre;         // Offset del nombre en la base del bloque o del arena
+    unsigned char tipo;
+    unsigned char stat_ok;
+    unsigned short modo;
+    unsigned enlaces;
+    unsigned uid;
+    unsigned gid;
+    unsigned long long tamano;
+    long long mtime;
+    unsigned mtime_nsec;
+} EntradaListado;
+
+typedef struct {
+    int dir_fd;
+    const char *base;
+    EntradaListado *entradas;
+    size_t cantidad;
+} LoteStat;
+
+static void tarea_stat_listado(void *arg) {
+    LoteStat *lote = arg;
+    for (size_t k = 0; k < lote->cantidad; k++) {
+        EntradaListado *e = &lote->entradas[k];
+        struct statx st;
+        if (statx(lote->dir_fd, lote->base + e->nombre, AT_SYMLINK_NOFOLLOW | AT_STATX_DONT_SYNC,
+                  STATX_TYPE | STATX_MODE | STATX_NLINK | STATX_UID | STATX_GID | STATX_SIZE | STATX_MTIME, &st) == 0) {
+            e->stat_ok = 1;
+            e->modo = st.stx_mode;
+            e->enlaces = st.stx_nlink;
+            e->uid = st.stx_uid;
+            e->gid = st.stx_gid;
+            e->tamano = st.stx_size;
+            e->mtime = st.stx_mtime.tv_sec;
+            e->mtime_nsec = st.stx_mtime.tv_nsec;
+        }
+    }
+}
+
+// statx de todas las entradas; en paralelo si son muchas
+static void stat_entradas(int dir_fd, const char *base, EntradaListado *entradas, size_t cantidad, PoolHilos **pool) {
+    size_t lotes = (cantidad + LISTAR_LOTE_STAT - 1) / LISTAR_LOTE_STAT;
+    LoteStat *todos = lotes > 1 ? malloc(lotes * sizeof(LoteStat)) : NULL;
+    if (todos == NULL) {
+        // Pocas entradas, o sin memoria para repartirlas: todas en este hilo
+        LoteStat lote = {dir_fd, base, entradas, cantidad};
+        tarea_stat_listado(&lote);
+        return;
+    }
+    if (*pool == NULL) {
+        *pool = pool_crear(hilos_por_defecto());
+    }
+    for (size_t k = 0; k < lotes; k++) {
+        size_t desde = k * LISTAR_LOTE_STAT;
+        todos[k].dir_fd = dir_fd;
+        todos[k].base = base;
+        todos[k].entradas = entradas + desde;
+        todos[k].cantidad = cantidad - desde < LISTAR_LOTE_STAT ? cantidad - desde : LISTAR_LOTE_STAT;
+        if (*pool != NULL) {
+            pool_enviar(*pool, tarea_stat_listado, &todos[k]);
+        } else {
+            tarea_stat_listado(&todos[k]);
+        }
+    }
+    if (*pool != NULL) {
+        pool_esperar(*pool);
+    }
+    free(todos);
+}
+
+// Salida acumulada que se escribe con write() al llenarse. Si el lector de la
+// tuberia se fue (EPIPE) queda cerrada y el resto se descarta.
+typedef struct {
+    char datos[LISTAR_SALIDA];
+    size_t usado;
+    int cerrada;
+} SalidaListado;
+
+static void salida_vaciar(SalidaListado *salida) {
+    size_t escrito = 0;
+    while (escrito < salida->usado && !salida->cerrada) {
+        ssize_t n = write(STDOUT_FILENO, salida->datos + escrito, salida->usado - escrito);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n < 0 && errno == EPIPE) {
+            salida->cerrada = 1;
+        }
+        if (n <= 0) {
+            break;
+        }
+        escrito += n;
+    }
+    salida->usado = 0;
+}
+
+static void salida_agregar(SalidaListado *salida, const char *texto, size_t largo) {
+    if (salida->usado + largo > sizeof(salida->datos)) {
+        salida_vaciar(salida);
+    }
+    if (largo > sizeof(salida->datos)) {
+        largo = sizeof(salida->datos);
+    }
+    memcpy(salida->datos + salida->usado, texto, largo);
+    salida->usado += largo;
+}
+
+static void modo_texto(unsigned modo, char texto[11]) {
+    char tipo = '?';
+    switch (modo & S_IFMT) {
+        case S_IFREG: tipo = '-'; break;
+        case S_IFDIR: tipo = 'd'; break;
+        case S_IFLNK: tipo = 'l'; break;
+        case S_IFCHR: tipo = 'c'; break;
+        case S_IFBLK: tipo = 'b'; break;
+        case S_IFIFO: tipo = 'p'; break;
+        case S_IFSOCK: tipo = 's'; break;
+    }
+    const char *rwx = "rwxrwxrwx";
+    texto[0] = tipo;
+    for (int k = 0; k < 9; k++) {
+        texto[k + 1] = (modo & (0400 >> k)) ? rwx[k] : '-';
+    }
+    texto[10] = '\0';
+}
+
+static void imprimir_entrada(SalidaListado *salida, const char *base, const EntradaListado *e, int largo) {
+    const char *nombre = base + e->nombre;
+    if (!largo) {
+        salida_agregar(salida, nombre, strlen(nombre));
+        salida_agregar(salida, "\n", 1);
+        return;
+    }
+    char linea[PATH_MAX + 128];
+    int n;
+    if (e->stat_ok) {
+        char modo[11], fecha[32];
+        time_t mtime = e->mtime;
+        struct tm t;
+        modo_texto(e->modo, modo);
+        localtime_r(&mtime, &t);
+        strftime(fecha, sizeof(fecha), "%Y-%m-%d %H:%M", &t);
+        n = snprintf(linea, sizeof(linea), "%s %3u %5u %5u %12llu %s %s\n", modo, e->enlaces, e->uid, e->gid,
+                     e->tamano, fecha, nombre);
+    } else {
+        n = snprintf(linea, sizeof(linea), "?????????? ? ? ? ? ? %s\n", nombre);
+    }
+    salida_agregar(salida, linea, n < (int)sizeof(linea) ? (size_t)n : sizeof(linea) - 1);
+}
+
+static int comparar_entradas(const void *a, const void *b, void *arg) {
+    const EntradaListado *x = a, *y = b;
+    const char *base = ((const char **)arg)[0];
+    OrdenListado orden = (OrdenListado)(intptr_t)((const char **)arg)[1];
+    int r = 0;
+    if (orden == ORDEN_TAMANO) {
+        r = (x->tamano < y->tamano) - (x->tamano > y->tamano); // Mayor primero
+    } else if (orden == ORDEN_FECHA) {
+        r = (x->mtime < y->mtime) - (x->mtime > y->mtime); // Mas nuevo primero
+        if (r == 0) {
+            r = (x->mtime_nsec < y->mtime_nsec) - (x->mtime_nsec > y->mtime_nsec);
+        }
+    }
+    return r != 0 ? r : strcmp(base + x->nombre, base + y->nombre);
+}
+
+// Implementación del comando 'listar'
+int listar(const char *directorio, const OpcionesListado *op) {
+    int dir_fd = open(directorio, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (dir_fd < 0) {
+        registrar_error(directorio);
+        perror("Error al abrir el directorio");
+        return -1;
+    }
+
+    char *buffer = malloc(LISTAR_BUFFER);
+    SalidaListado *salida = malloc(sizeof(SalidaListado));
+    if (buffer == NULL || salida == NULL) {
+        perror("Error al listar el directorio");
+        free(buffer);
+        free(salida);
+        close(dir_fd);
+        return -1;
+    }
+    salida->usado = 0;
+    salida->cerrada = 0;
+    int necesita_stat = op->largo || op->orden == ORDEN_TAMANO || op->orden == ORDEN_FECHA;
+    int ordenar = op->orden != ORDEN_NINGUNO;
+    PoolHilos *pool = NULL;
+
+    // Entradas del bloque actual (sin orden) o de todo el directorio (con orden)
+    EntradaListado *entradas = NULL;
+    size_t cantidad = 0, capacidad = 0;
+    char *arena = NULL; // Nombres copiados, solo cuando hay que ordenar
+    size_t arena_usado = 0, arena_cap = 0;
+    int resultado = 0;
+
+    fflush(stdout); // La salida va directo al fd 1
+    while (!salida->cerrada) {
+        long leidos = syscall(SYS_getdents64, dir_fd, buffer, LISTAR_BUFFER);
+        if (leidos < 0) {
+            perror("Error al leer el directorio");
+            resultado = -1;
+            break;
+        }
+        if (leidos == 0) {
+            break;
+        }
+        if (!ordenar) {
+            cantidad = 0;
+        }
+        for (long pos = 0; pos < leidos;) {
+            struct linux_dirent64 *d = (struct linux_dirent64 *)(buffer + pos);
+            pos += d->d_reclen;
+            if (op->filtro != NULL && fnmatch(op->filtro, d->d_name, 0) != 0) {
+                continue;
+            }
+            if (!ordenar && !necesita_stat) {
+                // Camino rapido: el nombre va directo a la salida
+                salida_agregar(salida, d->d_name, strlen(d->d_name));
+                salida_agregar(salida, "\n", 1);
+                continue;
+            }
+            if (cantidad == capacidad) {
+                size_t nueva = capacidad ? capacidad * 2 : 1024;
+                EntradaListado *mas = realloc(entradas, nueva * sizeof(EntradaListado));
+                if (mas == NULL) {
+                    resultado = -1;
+                    break;
+                }
+                entradas = mas;
+                capacidad = nueva;
+            }
+            EntradaListado *e = &entradas[cantidad++];
+            memset(e, 0, sizeof(*e));
+            e->tipo = d->d_type;
+            if (ordenar) {
+                size_t largo = strlen(d->d_name) + 1;
+                if (arena_usado + largo > arena_cap) {
+                    size_t nueva = arena_cap ? arena_cap * 2 : LISTAR_BUFFER;
+                    char *mas = realloc(arena, nueva);
+                    if (mas == NULL) {
+                        cantidad--; // La entrada recien agregada queda sin nombre
+                        resultado = -1;
+                        break;
+                    }
+                    arena = mas;
+                    arena_cap = nueva;
+                }
+                memcpy(arena + arena_usado, d->d_name, largo);
+                e->nombre = arena_usado;
+                arena_usado += largo;
+            } else {
+                e->nombre = d->d_name - buffer;
+            }
+        }
+        if (resultado != 0) {
+            perror("Error al listar el directorio");
+            break;
+        }
+        if (!ordenar && cantidad > 0) {
+            // Modo continuo: este bloque se completa e imprime antes de leer el siguiente
+            stat_entradas(dir_fd, buffer, entradas, cantidad, &pool);
+            for (size_t k = 0; k < cantidad; k++) {
+                imprimir_entrada(salida, buffer, &entradas[k], op->largo);
+            }
+        }
+    }
+
+    if (ordenar && resultado == 0) {
+        if (necesita_stat) {
+            stat_entradas(dir_fd, arena, entradas, cantidad, &pool);
+        }
+        const char *contexto[2] = {arena, (const char *)(intptr_t)op->orden};
+        qsort_r(entradas, cantidad, sizeof(EntradaListado), comparar_entradas, contexto);
+        for (size_t k = 0; k < cantidad && !salida->cerrada; k++) {
+            size_t i = op->inverso ? cantidad - 1 - k : k;
+            imprimir_entrada(salida, arena, &entradas[i], op->largo);
+        }
+    }
+    salida_vaciar(salida);
+
+    if (pool != NULL) {
+        pool_destruir(pool);
+    }
+    free(arena);
+    free(entradas);
+    free(salida);
+    free(buffer);
+    close(dir_fd);
+    return resultado;
+}
+
+// Implementación del comando 'creardir'
+int creardir(const char *directorio) {
+    if (mkdir(directorio, 0755) != 0) {
+        perror("Error al crear el directorio");
+        return -1;
+    }
+    informar("Directorio '%s' creado exitosamente\n", directorio);
+    return 0;
+}
+
+// Función para cambiar de directorio
+int ir(const char *directorio) {
+    if (chdir(directorio) == 0) {
+        registrar_error("Error: No se pudo ir al dorectorio sugerido");
+        informar("Directorio cambiado a: %s\n", directorio);
+    } else {
+        registrar_error("Error: No se pudo ir al dorectorio sugerido");
+        return -1;
+    }
+    return 0;
+}
+
+//Comando para obtener el directorio actual.
+int mostrar() {
+    char cwd[MAX_LFS_INPUT]; // Buffer para almacenar el directorio actual
+    if (getcwd(cwd, sizeof(cwd)) != NULL) { // getcwd obtiene el directorio actual
+        printf("%s\n", cwd); // Imprime el directorio actual
+    } else {
+        perror("Error al obtener el directorio actual");
+        return -1;
+    }
+    return 0;
+}
+
+
+// Función para cambiar permisos
+int permisos(const char *modo, const char **archivos, int cantidad) {
+    mode_t permisos = strtol(modo, NULL, 8); // Convierte el modo (octal) a un valor numérico
+    int resultado = 0;
+    for (int i = 0; i < cantidad; i++) {
+        if (chmod(archivos[i], permisos) == 0) {                    //chmod en este caso es una función del sistema incluida en la biblioteca estándar de C <sys/stat.h>
+            informar("Permisos cambiados para: %s\n", archivos[i]);
+        } else {
+            perror("Error al cambiar permisos");
+            resultado = -1;
+        }
+    }
+    return resultado;
+}
+
+// ---------------------------------------------------------------------------
+// Cache de nombres de usuario y grupo. Cada busqueda en NSS recorre /etc/passwd
+// o /etc/group completos; aqui se guarda el id por IDENTIDADES_TTL segundos y se
+// vacia la tabla si cambia el mtime del archivo correspondiente.
+// ---------------------------------------------------------------------------
+
+typedef struct EntradaIdentidad {
+    char *nombre;
+    unsigned id;
+    double vence;
+    struct EntradaIdentidad *siguiente;
+} EntradaIdentidad;
+
+typedef struct {
+    const char *archivo;        // Archivo cuyo mtime invalida la cache
+    struct timespec mtime;
+    EntradaIdentidad *cubetas[HASH_IDENTIDADES];
+    unsigned long aciertos;
+    unsigned long fallos;
+    unsigned long numericos;    // Ids escritos como numero: no se buscan
+    unsigned long invalidaciones;
+} CacheIdentidades;
+
+static pthread_mutex_t mutex_identidades = PTHREAD_MUTEX_INITIALIZER;
+static CacheIdentidades cache_usuarios = {.archivo = "/etc/passwd"};
+static CacheIdentidades cache_grupos = {.archivo = "/etc/group"};
+
+static unsigned hash_cadena(const char *texto);
+
+static void cache_identidades_vaciar(CacheIdentidades *cache) {
+    for (int k = 0; k < HASH_IDENTIDADES; k++) {
+        EntradaIdentidad *e = cache->cubetas[k];
+        while (e != NULL) {
+            EntradaIdentidad *sig = e->siguiente;
+            free(e->nombre);
+            free(e);
+            e = sig;
+        }
+        cache->cubetas[k] = NULL;
+    }
+}
+
+// Vacia la cache si el archivo de cuentas cambio. Se llama con el mutex tomado.
+static void cache_identidades_revisar(CacheIdentidades *cache) {
+    struct stat st;
+    if (stat(cache->archivo, &st) != 0) {
+        return;
+    }
+    if (st.st_mtim.tv_sec != cache->mtime.tv_sec || st.st_mtim.tv_nsec != cache->mtime.tv_nsec) {
+        if (cache->mtime.tv_sec != 0) {
+            cache->invalidaciones++;
+        }
+        cache_identidades_vaciar(cache);
+        cache->mtime = st.st_mtim;
+    }
+}
+
+static int es_numero(const char *texto) {
+    if (*texto == '\0') {
+        return 0;
+    }
+    for (; *texto; texto++) {
+        if (*texto < '0' || *texto > '9') {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// Busca el id en NSS, fuera del mutex
+static int buscar_identidad_nss(CacheIdentidades *cache, const char *nombre, unsigned *id) {
+    if (cache == &cache_usuarios) {
+        struct passwd pw, *info;
+        char buf[4096]; // Versiones _r: el modo lote ejecuta lineas en paralelo
+        if (getpwnam_r(nombre, &pw, buf, sizeof(buf), &info) != 0 || info == NULL) {
+            return -1;
+        }
+        *id = info->pw_uid;
+    } else {
+        struct group gr, *info;
+        char buf[16384];
+        if (getgrnam_r(nombre, &gr, buf, sizeof(buf), &info) != 0 || info == NULL) {
+            return -1;
+        }
+        *id = info->gr_gid;
+    }
+    return 0;
+}
+
+// Traduce un nombre (o un id numerico) de usuario o grupo. Devuelve 0 si existe.
+static int resolver_identidad(CacheIdentidades *cache, const char *nombre, unsigned *id) {
+    if (es_numero(nombre)) {
+        pthread_mutex_lock(&mutex_identidades);
+        cache->numericos++;
+        pthread_mutex_unlock(&mutex_identidades);
+        *id = (unsigned)strtoul(nombre, NULL, 10);
+        return 0;
+    }
+
+    unsigned cubeta = hash_cadena(nombre) & (HASH_IDENTIDADES - 1);
+    double ahora = segundos_monotonicos();
+    pthread_mutex_lock(&mutex_identidades);
+    cache_identidades_revisar(cache);
+    EntradaIdentidad **enlace = &cache->cubetas[cubeta];
+    while (*enlace != NULL && strcmp((*enlace)->nombre, nombre) != 0) {
+        enlace = &(*enlace)->siguiente;
+    }
+    if (*enlace != NULL) {
+        EntradaIdentidad *e = *enlace;
+        if (e->vence > ahora) {
+            cache->aciertos++;
+            *id = e->id;
+            pthread_mutex_unlock(&mutex_identidades);
+            return 0;
+        }
+        *enlace = e->siguiente; // Vencida
+        free(e->nombre);
+        free(e);
+    }
+    cache->fallos++;
+    pthread_mutex_unlock(&mutex_identidades);
+
+    if (buscar_identidad_nss(cache, nombre, id) != 0) {
+        return -1; // Los nombres inexistentes no se guardan
+    }
+
+    pthread_mutex_lock(&mutex_identidades);
+    // Otro hilo pudo haber fallado en el mismo nombre y guardarlo mientras tanto
+    for (EntradaIdentidad *otra = cache->cubetas[cubeta]; otra != NULL; otra = otra->siguiente) {
+        if (strcmp(otra->nombre, nombre) == 0) {
+            otra->id = *id;
+            otra->vence = ahora + IDENTIDADES_TTL;
+            pthread_mutex_unlock(&mutex_identidades);
+            return 0;
+        }
+    }
+    EntradaIdentidad *e = malloc(sizeof(EntradaIdentidad));
+    e->nombre = strdup(nombre);
+    e->id = *id;
+    e->vence = ahora + IDENTIDADES_TTL;
+    e->siguiente = cache->cubetas[cubeta];
+    cache->cubetas[cubeta] = e;
+    pthread_mutex_unlock(&mutex_identidades);
+    return 0;
+}
+
+// Obtiene el uid y el gid de un usuario y un grupo. Devuelve 0 si ambos existen.
+static int resolver_dueno(const char *nuevo_propietario, const char *nuevo_grupo, uid_t *uid, gid_t *gid) {
+    unsigned id;
+    if (resolver_identidad(&cache_usuarios, nuevo_propietario, &id) != 0) {
+        printf("Error: El propietario '%s' no existe.\n", nuevo_propietario);
+        return -1;
+    }
+    *uid = id;
+    if (resolver_identidad(&cache_grupos, nuevo_grupo, &id) != 0) {
+        printf("Error: El grupo '%s' no existe.\n", nuevo_grupo);
+        return -1;
+    }
+    *gid = id;
+    return 0;
+}
+
+static void mostrar_cache_identidades(const char *titulo, CacheIdentidades *cache) {
+    int entradas = 0;
+    for (int k = 0; k < HASH_IDENTIDADES; k++) {
+        for (EntradaIdentidad *e = cache->cubetas[k]; e != NULL; e = e->siguiente) {
+            entradas++;
+        }
+    }
+    printf("%-9s entradas: %d, aciertos: %lu, fallos: %lu, numericos: %lu, invalidaciones: %lu\n", titulo,
+           entradas, cache->aciertos, cache->fallos, cache->numericos, cache->invalidaciones);
+}
+
+// Función para cambiar el propietario y el grupo de los archivos
+int cambiar_propietario(const char *nuevo_propietario, const char *nuevo_grupo, const char *archivos[], int cantidad_archivos) {
+    uid_t uid;
+    gid_t gid;
+    int i;
+
+    if (resolver_dueno(nuevo_propietario, nuevo_grupo, &uid, &gid) != 0) {
+        return -1;
+    }
+
+    // Iterar sobre los archivos y cambiar el propietario y el grupo
+    int resultado = 0;
+    for (i = 0; i < cantidad_archivos; i++) {
+        if (chown(archivos[i], uid, gid) == -1) {
+            perror("Error al cambiar propietario y grupo");
+            resultado = -1;
+        } else {
+            informar("Propietario y grupo de '%s' cambiados a '%s' y '%s'.\n", archivos[i], nuevo_propietario, nuevo_grupo);
+        }
+    }
+    return resultado;
+}
+
+// ---------------------------------------------------------------------------
+// 'permisos -R' y 'propietario -R': recorren arboles en el pool de hilos.
+// Cada directorio es una tarea: se abre una vez y todas sus entradas se tratan
+// con statx/fchmodat/fchownat relativos a su fd. Una entrada que ya tiene el
+// modo o el dueno pedido no se toca. Los subdirectorios se abren con openat y
+// O_NOFOLLOW desde el fd del padre y se cambian por su propio fd, asi que un
+// directorio reemplazado por un enlace simbolico a mitad del recorrido no saca
+// el cambio fuera del arbol.
+// ---------------------------------------------------------------------------
+
+typedef struct {
+    int cambiar_modo;
+    mode_t modo;
+    int cambiar_dueno;
+    uid_t uid;
+    gid_t gid;
+    PoolHilos *pool;
+    atomic_long cambiados;
+    atomic_long omitidos;
+    atomic_long fallidos;
+    atomic_int en_cola;   // Tareas encoladas, cada una con un directorio abierto
+} CambioArbol;
+
+typedef struct {
+    CambioArbol *cambio;
+    int fd;
+    char *ruta;           // Solo para los mensajes
+} TareaCambio;
+
+static void cambio_fallo(CambioArbol *cambio, const char *directorio, const char *nombre) {
+    if (directorio != NULL) {
+        fprintf(stderr, "Error al cambiar '%s/%s': %s\n", directorio, nombre, strerror(errno));
+    } else {
+        fprintf(stderr, "Error al cambiar '%s': %s\n", nombre, strerror(errno));
+    }
+    atomic_fetch_add(&cambio->fallidos, 1);
+}
+
+// Aplica el cambio a una entrada ya leida con statx: por su fd si esta abierta
+// (fd >= 0) y si no sin seguir enlaces. Los enlaces simbolicos no tienen modo
+// propio: solo se les cambia el dueno.
+static void aplicar_cambio(CambioArbol *cambio, int dir_fd, const char *directorio, const char *nombre,
+                           int fd, const struct statx *st) {
+    int cambio_hecho = 0;
+    if (cambio->cambiar_modo && !S_ISLNK(st->stx_mode) && (st->stx_mode & 07777) != cambio->modo) {
+        if ((fd >= 0 ? fchmod(fd, cambio->modo) : fchmodat(dir_fd, nombre, cambio->modo, AT_SYMLINK_NOFOLLOW)) != 0) {
+            cambio_fallo(cambio, directorio, nombre);
+            return;
+        }
+        cambio_hecho = 1;
+    }
+    if (cambio->cambiar_dueno && (st->stx_uid != cambio->uid || st->stx_gid != cambio->gid)) {
+        if ((fd >= 0 ? fchown(fd, cambio->uid, cambio->gid)
+                     : fchownat(dir_fd, nombre, cambio->uid, cambio->gid, AT_SYMLINK_NOFOLLOW)) != 0) {
+            cambio_fallo(cambio, directorio, nombre);
+            return;
+        }
+        cambio_hecho = 1;
+    }
+    atomic_fetch_add(cambio_hecho ? &cambio->cambiados : &cambio->omitidos, 1);
+}
+
+static void tarea_cambio_directorio(void *arg);
+static void cambiar_directorio(CambioArbol *cambio, int dir_fd, const char *ruta);
+
+// Recorre un directorio ya abierto (y ya cambiado): en otra tarea o, si hay
+// demasiados abiertos esperando en la cola, aca mismo, para no agotar los fds
+static void enviar_cambio_directorio(CambioArbol *cambio, int fd, char *ruta) {
+    if (ruta == NULL) {
+        perror("Error al recorrer el directorio");
+        atomic_fetch_add(&cambio->fallidos, 1);
+        close(fd);
+        return;
+    }
+    TareaCambio *tarea = NULL;
+    if (atomic_fetch_add(&cambio->en_cola, 1) >= CAMBIO_FDS_EN_COLA ||
+        (tarea = malloc(sizeof(TareaCambio))) == NULL) {
+        atomic_fetch_sub(&cambio->en_cola, 1);
+        cambiar_directorio(cambio, fd, ruta);
+        free(ruta);
+        return;
+    }
+    tarea->cambio = cambio;
+    tarea->fd = fd;
+    tarea->ruta = ruta;
+    pool_enviar(cambio->pool, tarea_cambio_directorio, tarea);
+}
+
+static void tarea_cambio_directorio(void *arg) {
+    TareaCambio *tarea = arg;
+    atomic_fetch_sub(&tarea->cambio->en_cola, 1);
+    cambiar_directorio(tarea->cambio, tarea->fd, tarea->ruta);
+    free(tarea->ruta);
+    free(tarea);
+}
+
+// Cambia las entradas de un directorio abierto y cierra su fd
+static void cambiar_directorio(CambioArbol *cambio, int dir_fd, const char *ruta) {
+    DIR *dir = fdopendir(dir_fd);
+    if (dir == NULL) {
+        cambio_fallo(cambio, NULL, ruta);
+        close(dir_fd);
+        return;
+    }
+
+    struct dirent *entrada;
+    while ((entrada = readdir(dir)) != NULL) {
+        const char *nombre = entrada->d_name;
+        if (strcmp(nombre, ".") == 0 || strcmp(nombre, "..") == 0) {
+            continue;
+        }
+        struct statx st;
+        if (statx(dir_fd, nombre, AT_SYMLINK_NOFOLLOW, STATX_TYPE | STATX_MODE | STATX_UID | STATX_GID, &st) != 0) {
+            cambio_fallo(cambio, ruta, nombre);
+            continue;
+        }
+        if (!S_ISDIR(st.stx_mode)) {
+            aplicar_cambio(cambio, dir_fd, ruta, nombre, -1, &st);
+            continue;
+        }
+        // Se vuelve a leer por el fd: es el directorio que se abrio, no lo que hay ahora en ese nombre
+        int sub_fd = openat(dir_fd, nombre, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+        if (sub_fd < 0 || statx(sub_fd, "", AT_EMPTY_PATH, STATX_TYPE | STATX_MODE | STATX_UID | STATX_GID, &st) != 0) {
+            cambio_fallo(cambio, ruta, nombre);
+            if (sub_fd >= 0) {
+                close(sub_fd);
+            }
+            continue;
+        }
+        aplicar_cambio(cambio, dir_fd, ruta, nombre, sub_fd, &st);
+        enviar_cambio_directorio(cambio, sub_fd, unir_ruta(ruta, nombre));
+    }
+    closedir(dir);
+}
+
+// Aplica el cambio a cada ruta y, si es un directorio, a todo su contenido
+static int cambiar_arbol(CambioArbol *cambio, const char **rutas, int cantidad, int hilos, const char *que) {
+    atomic_init(&cambio->cambiados, 0);
+    atomic_init(&cambio->omitidos, 0);
+    atomic_init(&cambio->fallidos, 0);
+    atomic_init(&cambio->en_cola, 0);
+    cambio->pool = pool_crear(hilos);
+    if (cambio->pool == NULL) {
+        return -1;
+    }
+
+    double inicio = segundos_monotonicos();
+    for (int k = 0; k < cantidad; k++) {
+        struct statx st;
+        if (statx(AT_FDCWD, rutas[k], AT_SYMLINK_NOFOLLOW, STATX_TYPE | STATX_MODE | STATX_UID | STATX_GID, &st) != 0) {
+            cambio_fallo(cambio, NULL, rutas[k]);
+            continue;
+        }
+        if (!S_ISDIR(st.stx_mode)) {
+            aplicar_cambio(cambio, AT_FDCWD, NULL, rutas[k], -1, &st);
+            continue;
+        }
+        int fd = open(rutas[k], O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+        if (fd < 0) {
+            cambio_fallo(cambio, NULL, rutas[k]);
+            continue;
+        }
+        aplicar_cambio(cambio, AT_FDCWD, NULL, rutas[k], fd, &st);
+        enviar_cambio_directorio(cambio, fd, strdup(rutas[k]));
+    }
+    pool_esperar(cambio->pool);
+    pool_destruir(cambio->pool);
+    double duracion = segundos_monotonicos() - inicio;
+
+    long fallidos = atomic_load(&cambio->fallidos);
+    printf("%s: %ld cambiados, %ld sin cambios, %ld con error (%.3f s, %d hilos)\n", que,
+           atomic_load(&cambio->cambiados), atomic_load(&cambio->omitidos), fallidos, duracion, hilos);
+    return fallidos == 0 ? 0 : -1;
+}
+
+// Implementación de 'permisos -R'
+int permisos_recursivo(const char *modo, const char **rutas, int cantidad, int hilos) {
+    CambioArbol cambio;
+    memset(&cambio, 0, sizeof(cambio));
+    cambio.cambiar_modo = 1;
+    cambio.modo = strtol(modo, NULL, 8) & 07777;
+    return cambiar_arbol(&cambio, rutas, cantidad, hilos, "Permisos");
+}
+
+// Implementación de 'propietario -R'
+int propietario_recursivo(const char *nuevo_propietario, const char *nuevo_grupo, const char **rutas, int cantidad, int hilos) {
+    CambioArbol cambio;
+    memset(&cambio, 0, sizeof(cambio));
+    cambio.cambiar_dueno = 1;
+    if (resolver_dueno(nuevo_propietario, nuevo_grupo, &cambio.uid, &cambio.gid) != 0) {
+        return -1;
+    }
+    return cambiar_arbol(&cambio, rutas, cantidad, hilos, "Propietario");
+}
+
+//Función para cambiar la contraseña de un usuario
+int cambiar_clave(const char *usuario) {
+    if (usuario == NULL || strlen(usuario) == 0) {
+        printf("Error: Usuario no especificado.\n");
+        return -1;
+    }
+
+    // Construir el comando para cambiar la contraseña
+    char comando[MAX_LFS_INPUT];
+    snprintf(comando, sizeof(comando), "passwd %s", usuario);
+
+    // Ejecutar el comando
+    int resultado = system(comando);
+    if (resultado == -1) {
+        perror("Error al intentar cambiar la clave");
+        return -1;
+    } else if (resultado == 0) {
+        informar("La clave para el usuario '%s' se cambió exitosamente.\n", usuario);
+    } else {
+        printf("Error: El comando 'passwd' devolvió un código de salida %d.\n", resultado);
+        return -1;
+    }
+    return 0;
+}
+
+//Funcion para agregar usuario con su ip y horario laboral
+// ---------------------------------------------------------------------------
+// Base de usuarios: USUARIOS_BD_FILE guarda una cabecera, una tabla hash por
+// nombre (direccionamiento abierto, indice de registro + 1, 0 = libre) y los
+// registros Usuario de largo fijo. Se lee con mmap, asi que buscar un usuario
+// al iniciar sesion no recorre el archivo. Cada cambio reescribe el archivo en
+// uno temporal y lo reemplaza con rename.
+// ---------------------------------------------------------------------------
+
+#define BD_USUARIOS_MAGIA "LFSUSR1"
+
+typedef struct {
+    char magia[8];
+    uint32_t cantidad;   // Registros
+    uint32_t cubetas;    // Potencia de 2, al menos el doble de registros
+} CabeceraUsuarios;
+
+static struct {
+    pthread_mutex_t mutex;
+    void *mapa;
+    size_t tam;
+    dev_t dispositivo;
+    ino_t inodo;         // rename cambia el inodo: asi se nota un reemplazo
+    struct timespec mtime;
+} bd_usuarios = {.mutex = PTHREAD_MUTEX_INITIALIZER};
+
+static uint32_t *bd_indice(const CabeceraUsuarios *cab) {
+    return (uint32_t *)(cab + 1);
+}
+
+static Usuario *bd_registros(const CabeceraUsuarios *cab) {
+    return (Usuario *)(bd_indice(cab) + cab->cubetas);
+}
+
+// Comprueba que el archivo mapeado tenga el formato esperado
+static int bd_valida(const void *mapa, size_t tam) {
+    const CabeceraUsuarios *cab = mapa;
+    if (tam < sizeof(CabeceraUsuarios) || memcmp(cab->magia, BD_USUARIOS_MAGIA, sizeof(cab->magia)) != 0) {
+        return 0;
+    }
+    if (cab->cubetas == 0 || (cab->cubetas & (cab->cubetas - 1)) != 0 || cab->cantidad >= cab->cubetas) {
+        return 0;
+    }
+    return tam == sizeof(CabeceraUsuarios) + (size_t)cab->cubetas * sizeof(uint32_t) +
+                  (size_t)cab->cantidad * sizeof(Usuario);
+}
+
+// Vuelve a mapear la base si el archivo fue reemplazado. Se llama con el mutex tomado.
+static int bd_usuarios_mapear() {
+    struct stat st;
+    if (stat(USUARIOS_BD_FILE, &st) != 0) {
+        return -1;
+    }
+    if (bd_usuarios.mapa != NULL && st.st_ino == bd_usuarios.inodo && st.st_dev == bd_usuarios.dispositivo &&
+        st.st_mtim.tv_sec == bd_usuarios.mtime.tv_sec && st.st_mtim.tv_nsec == bd_usuarios.mtime.tv_nsec) {
+        return 0;
+    }
+    if (bd_usuarios.mapa != NULL) {
+        munmap(bd_usuarios.mapa, bd_usuarios.tam);
+        bd_usuarios.mapa = NULL;
+    }
+
+    int fd = open(USUARIOS_BD_FILE, O_RDONLY | O_CLOEXEC);
+    if (fd < 0 || fstat(fd, &st) != 0) {
+        if (fd >= 0) {
+            close(fd);
+        }
+        return -1;
+    }
+    void *mapa = st.st_size > 0 ? mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0) : MAP_FAILED;
+    close(fd);
+    if (mapa == MAP_FAILED) {
+        return -1;
+    }
+    if (!bd_valida(mapa, st.st_size)) {
+        fprintf(stderr, "Error: %s esta dañado.\n", USUARIOS_BD_FILE);
+        munmap(mapa, st.st_size);
+        return -1;
+    }
+    bd_usuarios.mapa = mapa;
+    bd_usuarios.tam = st.st_size;
+    bd_usuarios.dispositivo = st.st_dev;
+    bd_usuarios.inodo = st.st_ino;
+    bd_usuarios.mtime = st.st_mtim;
+    return 0;
+}
+
+// Devuelve el indice del registro con ese nombre, o -1
+static long bd_buscar(const CabeceraUsuarios *cab, const char *nombre) {
+    const uint32_t *indice = bd_indice(cab);
+    const Usuario *registros = bd_registros(cab);
+    uint32_t mascara = cab->cubetas - 1;
+    for (uint32_t k = hash_cadena(nombre) & mascara;; k = (k + 1) & mascara) {
+        uint32_t r = indice[k];
+        if (r == 0 || r > cab->cantidad) {
+            return -1;
+        }
+        if (strncmp(registros[r - 1].nombre, nombre, sizeof(registros[r - 1].nombre)) == 0) {
+            return r - 1;
+        }
+    }
+}
+
+// Escribe la base completa en un temporal y lo pone en su lugar con rename
+static int bd_usuarios_escribir(const Usuario *registros, uint32_t cantidad) {
+    uint32_t cubetas = 64;
+    while (cubetas < 2 * (cantidad + 1)) {
+        cubetas <<= 1;
+    }
+    size_t tam = sizeof(CabeceraUsuarios) + (size_t)cubetas * sizeof(uint32_t) + (size_t)cantidad * sizeof(Usuario);
+    CabeceraUsuarios *cab = calloc(1, tam);
+    if (cab == NULL) {
+        return -1;
+    }
+    memcpy(cab->magia, BD_USUARIOS_MAGIA, sizeof(cab->magia));
+    cab->cantidad = cantidad;
+    cab->cubetas = cubetas;
+    uint32_t *indice = bd_indice(cab);
+    if (cantidad > 0) {
+        memcpy(bd_registros(cab), registros, (size_t)cantidad * sizeof(Usuario));
+    }
+    for (uint32_t r = 0; r < cantidad; r++) {
+        uint32_t k = hash_cadena(registros[r].nombre) & (cubetas - 1);
+        while (indice[k] != 0) {
+            k = (k + 1) & (cubetas - 1);
+        }
+        indice[k] = r + 1;
+    }
+
+    char temporal[PATH_MAX];
+    snprintf(temporal, sizeof(temporal), "%s.tmp.%d", USUARIOS_BD_FILE, (int)getpid());
+    // Legible por todos, como el archivo de texto: la shell de cada usuario la
+    // consulta al iniciar sin privilegios
+    int fd = open(temporal, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        free(cab);
+        return -1;
+    }
+    int resultado = fchmod(fd, 0644);
+    const char *p = (const char *)cab;
+    size_t pendiente = tam;
+    while (pendiente > 0) {
+        ssize_t n = write(fd, p, pendiente);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            resultado = -1;
+            break;
+        }
+        p += n;
+        pendiente -= n;
+    }
+    if (resultado == 0 && fsync(fd) != 0) {
+        resultado = -1;
+    }
+    close(fd);
+    free(cab);
+    if (resultado == 0 && rename(temporal, USUARIOS_BD_FILE) != 0) {
+        resultado = -1;
+    }
+    if (resultado != 0) {
+        unlink(temporal);
+    }
+    return resultado;
+}
+
+// Copia un campo de texto a un arreglo de largo fijo, cortandolo si no entra
+static void copiar_campo(char *destino, size_t tam, const char *texto) {
+    size_t largo = strnlen(texto, tam - 1);
+    memcpy(destino, texto, largo);
+    destino[largo] = '\0';
+}
+
+// Lee los bloques "Usuario:/Horario:/IPs permitidas:" del archivo de texto anterior.
+// Devuelve -1 si el archivo no se puede abrir y -2 si no hay memoria para leerlo.
+static int bd_leer_texto(const char *ruta, Usuario **salida, uint32_t *cantidad) {
+    FILE *archivo = fopen(ruta, "r");
+    if (archivo == NULL) {
+        return -1;
+    }
+    Usuario *registros = NULL;
+    uint32_t cant = 0, capacidad = 0;
+    char linea[256];
+    while (fgets(linea, sizeof(linea), archivo) != NULL) {
+        linea[strcspn(linea, "\n")] = '\0';
+        if (strncmp(linea, "Usuario: ", 9) == 0) {
+            if (cant == capacidad) {
+                uint32_t nueva = capacidad ? capacidad * 2 : 16;
+                Usuario *mas = realloc(registros, (size_t)nueva * sizeof(Usuario));
+                if (mas == NULL) {
+                    fclose(archivo);
+                    free(registros);
+                    return -2;
+                }
+                registros = mas;
+                capacidad = nueva;
+            }
+            memset(&registros[cant], 0, sizeof(Usuario));
+            copiar_campo(registros[cant].nombre, sizeof(registros[cant].nombre), linea + 9);
+            cant++;
+        } else if (cant > 0 && strncmp(linea, "Horario: ", 9) == 0) {
+            copiar_campo(registros[cant - 1].horario, sizeof(registros[cant - 1].horario), linea + 9);
+        } else if (cant > 0 && strncmp(linea, "IPs permitidas: ", 16) == 0) {
+            copiar_campo(registros[cant - 1].ips, sizeof(registros[cant - 1].ips), linea + 16);
+        }
+    }
+    fclose(archivo);
+
+    // Si un usuario aparece varias veces vale el ultimo bloque. Los repetidos se
+    // encuentran con un indice como el de la base (1 + posicion, 0 = libre).
+    uint32_t cubetas = 64;
+    while (cubetas < 2 * (cant + 1)) {
+        cubetas <<= 1;
+    }
+    uint32_t *indice = cant > 1 ? calloc(cubetas, sizeof(uint32_t)) : NULL;
+    if (cant > 1 && indice == NULL) {
+        free(registros);
+        return -2;
+    }
+    uint32_t unicos = 0;
+    for (uint32_t r = 0; r < cant; r++) {
+        uint32_t k = cant > 1 ? hash_cadena(registros[r].nombre) & (cubetas - 1) : 0;
+        while (indice != NULL && indice[k] != 0 && strcmp(registros[indice[k] - 1].nombre, registros[r].nombre) != 0) {
+            k = (k + 1) & (cubetas - 1);
+        }
+        if (indice != NULL && indice[k] != 0) {
+            registros[indice[k] - 1] = registros[r];
+        } else {
+            registros[unicos] = registros[r];
+            if (indice != NULL) {
+                indice[k] = unicos + 1;
+            }
+            unicos++;
+        }
+    }
+    free(indice);
+    *salida = registros;
+    *cantidad = unicos;
+    return 0;
+}
+
+// Toma el lock de escritura de la base y la crea desde el archivo de texto si
+// todavia no existe (migracion de una sola vez). Devuelve el fd del lock.
+static int bd_usuarios_bloquear() {
+    int lock = open(USUARIOS_BD_FILE ".lock", O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    if (lock < 0) {
+        return -1;
+    }
+    while (flock(lock, LOCK_EX) != 0 && errno == EINTR) {
+    }
+    if (access(USUARIOS_BD_FILE, F_OK) == 0) {
+        return lock;
+    }
+
+    Usuario *registros = NULL;
+    uint32_t cantidad = 0;
+    int leido = bd_leer_texto(USER_DATA_FILE, &registros, &cantidad);
+    int migrado = leido == 0;
+    if (leido == -2) {
+        fprintf(stderr, "Error: sin memoria para migrar %s\n", USER_DATA_FILE);
+        close(lock);
+        return -1;
+    }
+    if (bd_usuarios_escribir(registros, cantidad) != 0) {
+        free(registros);
+        close(lock);
+        return -1;
+    }
+    if (migrado) {
+        informar("%u usuarios migrados de %s a %s.\n", cantidad, USER_DATA_FILE, USUARIOS_BD_FILE);
+    }
+    free(registros);
+    return lock;
+}
+
+// Mapea la base para leerla, migrandola primero si hace falta. Devuelve la
+// cabecera con el mutex tomado, o NULL.
+static const CabeceraUsuarios *bd_usuarios_abrir() {
+    if (access(USUARIOS_BD_FILE, F_OK) != 0) {
+        int lock = bd_usuarios_bloquear();
+        if (lock < 0) {
+            return NULL;
+        }
+        close(lock);
+    }
+    pthread_mutex_lock(&bd_usuarios.mutex);
+    if (bd_usuarios_mapear() != 0) {
+        pthread_mutex_unlock(&bd_usuarios.mutex);
+        return NULL;
+    }
+    return bd_usuarios.mapa;
+}
+
+static void bd_usuarios_soltar() {
+    pthread_mutex_unlock(&bd_usuarios.mutex);
+}
+
+// Busca un usuario en la base. Devuelve 0 y copia el registro si existe, -1
+// si no esta y -2 si la base no se pudo abrir o esta dañada.
+int buscar_usuario(const char *nombre, Usuario *usuario) {
+    const CabeceraUsuarios *cab = bd_usuarios_abrir();
+    if (cab == NULL) {
+        return -2;
+    }
+    long r = bd_buscar(cab, nombre);
+    if (r >= 0) {
+        *usuario = bd_registros(cab)[r];
+    }
+    bd_usuarios_soltar();
+    return r >= 0 ? 0 : -1;
+}
+
+// Agrega un registro o reemplaza el que tiene el mismo nombre
+static int guardar_usuario(const Usuario *usuario) {
+    int lock = bd_usuarios_bloquear();
+    if (lock < 0) {
+        return -1;
+    }
+    pthread_mutex_lock(&bd_usuarios.mutex);
+    int resultado = -1;
+    if (bd_usuarios_mapear() == 0) {
+        const CabeceraUsuarios *cab = bd_usuarios.mapa;
+        uint32_t cantidad = cab->cantidad;
+        Usuario *registros = malloc((cantidad + 1) * sizeof(Usuario));
+        if (registros != NULL) {
+            memcpy(registros, bd_registros(cab), cantidad * sizeof(Usuario));
+            long r = bd_buscar(cab, usuario->nombre);
+            if (r >= 0) {
+                registros[r] = *usuario;
+            } else {
+                registros[cantidad++] = *usuario;
+            }
+            resultado = bd_usuarios_escribir(registros, cantidad);
+            free(registros);
+        }
+    }
+    pthread_mutex_unlock(&bd_usuarios.mutex);
+    close(lock);
+    return resultado;
+}
+
+// Implementación de 'usuario listar'
+int listar_usuarios() {
+    const CabeceraUsuarios *cab = bd_usuarios_abrir();
+    if (cab == NULL) {
+        registrar_error("Error al abrir la base de usuarios");
+        return -1;
+    }
+    const Usuario *registros = bd_registros(cab);
+    printf("%-20s %-20s %s\n", "Usuario", "Horario", "IPs permitidas");
+    for (uint32_t r = 0; r < cab->cantidad; r++) {
+        printf("%-20.64s %-20.64s %.128s\n", registros[r].nombre, registros[r].horario, registros[r].ips);
+    }
+    bd_usuarios_soltar();
+    return 0;
+}
+
+// Implementación de 'usuario ver <nombre>'
+int ver_usuario(const char *nombre) {
+    Usuario usuario;
+    int encontrado = buscar_usuario(nombre, &usuario);
+    if (encontrado == -2) {
+        printf("Error: No se pudo leer la base de usuarios %s.\n", USUARIOS_BD_FILE);
+        return -1;
+    }
+    if (encontrado != 0) {
+        printf("Error: El usuario '%s' no esta registrado.\n", nombre);
+        return -1;
+    }
+    printf("Usuario: %.64s\n", usuario.nombre);
+    printf("Horario: %.64s\n", usuario.horario);
+    printf("IPs permitidas: %.128s\n", usuario.ips);
+    return 0;
+}
+
+// ---------------------------------------------------------------------------
+// Control de acceso al iniciar sesion. El horario y las IPs de cada usuario se
+// compilan la primera vez que se consultan: el horario en un mapa de bits con
+// un bit por minuto de cada dia de la semana y las IPs en intervalos ordenados
+// y fusionados. Verificar un acceso es leer un bit y una busqueda binaria.
+//
+// Horario: "10:00-17:00" (todos los dias) o items separados por ',' o ';' con
+// dias delante: "lun-vie 08:00-17:00; sab 09:00-13:00". Un rango que termina
+// antes de empezar sigue al dia siguiente. IPs: direcciones IPv4 o redes CIDR
+// separadas por ',' o espacios. Vacio o "*" no restringe.
+// ---------------------------------------------------------------------------
+
+#define MINUTOS_DIA 1440
+#define PALABRAS_DIA ((MINUTOS_DIA + 63) / 64)
+
+typedef struct {
+    uint32_t desde;
+    uint32_t hasta; // Inclusive
+} IntervaloIp;
+
+typedef struct ReglaAcceso {
+    char nombre[64];
+    int valida;                 // 0 si el horario o las IPs no se pudieron leer
+    int todo_horario;
+    uint64_t minutos[7][PALABRAS_DIA]; // Dia 0 = domingo, como tm_wday
+    int toda_ip;
+    IntervaloIp *ips;
+    int cant_ips;
+    struct ReglaAcceso *siguiente;
+} ReglaAcceso;
+
+static struct {
+    pthread_mutex_t mutex;
+    dev_t dispositivo;          // Base de usuarios con la que se compilaron
+    ino_t inodo;
+    struct timespec mtime;
+    ReglaAcceso *cubetas[HASH_REGLAS];
+} reglas_acceso = {.mutex = PTHREAD_MUTEX_INITIALIZER};
+
+static const char *nombres_dias[7] = {"dom", "lun", "mar", "mie", "jue", "vie", "sab"};
+
+static void marcar_minutos(ReglaAcceso *regla, int dia, int desde, int hasta) {
+    for (int m = desde; m < hasta; m++) {
+        regla->minutos[dia][m / 64] |= 1ULL << (m % 64);
+    }
+}
+
+static int leer_hora(const char **texto) {
+    int horas, minutos, usados;
+    if (sscanf(*texto, "%2d:%2d%n", &horas, &minutos, &usados) != 2 || horas < 0 || horas > 24 ||
+        minutos < 0 || minutos > 59 || (horas == 24 && minutos != 0)) {
+        return -1;
+    }
+    *texto += usados;
+    return horas * 60 + minutos;
+}
+
+static int leer_dia(const char **texto) {
+    for (int d = 0; d < 7; d++) {
+        if (strncmp(*texto, nombres_dias[d], 3) == 0) {
+            *texto += 3;
+            return d;
+        }
+    }
+    return -1;
+}
+
+// Compila un item "[dia[-dia] ]HH:MM-HH:MM"
+static int compilar_item_horario(ReglaAcceso *regla, const char *item) {
+    int dias[7] = {0};
+    while (*item == ' ') {
+        item++;
+    }
+    if (*item >= '0' && *item <= '9') {
+        for (int d = 0; d < 7; d++) {
+            dias[d] = 1;
+        }
+    } else {
+        int primero = leer_dia(&item), ultimo = primero;
+        if (primero < 0) {
+            return -1;
+        }
+        if (*item == '-') {
+            item++;
+            if ((ultimo = leer_dia(&item)) < 0) {
+                return -1;
+            }
+        }
+        for (int d = primero;; d = (d + 1) % 7) {
+            dias[d] = 1;
+            if (d == ultimo) {
+                break;
+            }
+        }
+        while (*item == ' ') {
+            item++;
+        }
+    }
+
+    int desde = leer_hora(&item);
+    if (desde < 0 || *item++ != '-') {
+        return -1;
+    }
+    int hasta = leer_hora(&item);
+    while (*item == ' ') {
+        item++;
+    }
+    if (hasta < 0 || *item != '\0') {
+        return -1;
+    }
+
+    for (int d = 0; d < 7; d++) {
+        if (!dias[d]) {
+            continue;
+        }
+        if (desde < hasta) {
+            marcar_minutos(regla, d, desde, hasta);
+        } else {
+            // Cruza la medianoche (o dura el dia entero si desde == hasta)
+            marcar_minutos(regla, d, desde, MINUTOS_DIA);
+            marcar_minutos(regla, (d + 1) % 7, 0, hasta);
+        }
+    }
+    return 0;
+}
+
+static int compilar_horario(ReglaAcceso *regla, const char *horario) {
+    char copia[sizeof(((Usuario *)0)->horario) + 1];
+    snprintf(copia, sizeof(copia), "%s", horario);
+    char *resto = copia, *item;
+    int items = 0;
+    while ((item = strsep(&resto, ",;")) != NULL) {
+        while (*item == ' ') {
+            item++;
+        }
+        if (*item == '\0') {
+            continue;
+        }
+        if (strcmp(item, "*") == 0) {
+            regla->todo_horario = 1;
+        } else if (compilar_item_horario(regla, item) != 0) {
+            return -1;
+        }
+        items++;
+    }
+    if (items == 0) {
+        regla->todo_horario = 1;
+    }
+    return 0;
+}
+
+static int comparar_intervalos(const void *a, const void *b) {
+    const IntervaloIp *x = a, *y = b;
+    return x->desde < y->desde ? -1 : x->desde > y->desde;
+}
+
+// Lee una IPv4 en orden de host. Acepta IPv4 mapeada en IPv6 (::ffff:a.b.c.d).
+static int leer_ipv4(const char *texto, uint32_t *ip) {
+    struct in_addr direccion;
+    if (strncmp(texto, "::ffff:", 7) == 0) {
+        texto += 7;
+    }
+    if (inet_pton(AF_INET, texto, &direccion) != 1) {
+        return -1;
+    }
+    *ip = ntohl(direccion.s_addr);
+    return 0;
+}
+
+static int compilar_ips(ReglaAcceso *regla, const char *ips) {
+    char copia[sizeof(((Usuario *)0)->ips) + 1];
+    snprintf(copia, sizeof(copia), "%s", ips);
+    char *resto = copia, *item;
+    int capacidad = 0;
+    while ((item = strsep(&resto, ", ;")) != NULL) {
+        if (*item == '\0') {
+            continue;
+        }
+        if (strcmp(item, "*") == 0) {
+            regla->toda_ip = 1;
+            continue;
+        }
+        int prefijo = 32;
+        char *barra = strchr(item, '/');
+        if (barra != NULL) {
+            *barra = '\0';
+            char *fin;
+            prefijo = strtol(barra + 1, &fin, 10);
+            if (*fin != '\0' || fin == barra + 1 || prefijo < 0 || prefijo > 32) {
+                return -1;
+            }
+        }
+        uint32_t ip;
+        if (leer_ipv4(item, &ip) != 0) {
+            return -1;
+        }
+        uint32_t mascara = prefijo == 0 ? 0 : 0xFFFFFFFFu << (32 - prefijo);
+        if (regla->cant_ips == capacidad) {
+            capacidad = capacidad ? capacidad * 2 : 4;
+            IntervaloIp *nuevos = realloc(regla->ips, capacidad * sizeof(IntervaloIp));
+            if (nuevos == NULL) {
+                return -1;
+            }
+            regla->ips = nuevos;
+        }
+        regla->ips[regla->cant_ips].desde = ip & mascara;
+        regla->ips[regla->cant_ips].hasta = (ip & mascara) | ~mascara;
+        regla->cant_ips++;
+    }
+    if (regla->cant_ips == 0) {
+        regla->toda_ip = 1;
+        return 0;
+    }
+
+    // Ordenar y fusionar los intervalos que se tocan
+    qsort(regla->ips, regla->cant_ips, sizeof(IntervaloIp), comparar_intervalos);
+    int n = 0;
+    for (int k = 1; k < regla->cant_ips; k++) {
+        if (regla->ips[k].desde <= regla->ips[n].hasta ||
+            (regla->ips[n].hasta != 0xFFFFFFFFu && regla->ips[k].desde == regla->ips[n].hasta + 1)) {
+            if (regla->ips[k].hasta > regla->ips[n].hasta) {
+                regla->ips[n].hasta = regla->ips[k].hasta;
+            }
+        } else {
+            regla->ips[++n] = regla->ips[k];
+        }
+    }
+    regla->cant_ips = n + 1;
+    return 0;
+}
+
+static ReglaAcceso *compilar_regla(const Usuario *usuario) {
+    ReglaAcceso *regla = calloc(1, sizeof(ReglaAcceso));
+    if (regla == NULL) {
+        return NULL;
+    }
+    copiar_campo(regla->nombre, sizeof(regla->nombre), usuario->nombre);
+    regla->valida = compilar_horario(regla, usuario->horario) == 0 && compilar_ips(regla, usuario->ips) == 0;
+    return regla;
+}
+
+static void reglas_vaciar() {
+    for (int k = 0; k < HASH_REGLAS; k++) {
+        ReglaAcceso *r = reglas_acceso.cubetas[k];
+        while (r != NULL) {
+            ReglaAcceso *sig = r->siguiente;
+            free(r->ips);
+            free(r);
+            r = sig;
+        }
+        reglas_acceso.cubetas[k] = NULL;
+    }
+}
+
+static int ip_permitida(const ReglaAcceso *regla, uint32_t ip) {
+    int izq = 0, der = regla->cant_ips - 1;
+    while (izq <= der) {
+        int medio = (izq + der) / 2;
+        if (ip < regla->ips[medio].desde) {
+            der = medio - 1;
+        } else if (ip > regla->ips[medio].hasta) {
+            izq = medio + 1;
+        } else {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// IP del cliente de la sesion, segun SSH_CLIENT o SSH_CONNECTION. NULL si es local.
+static const char *ip_cliente(char *ip, size_t tam) {
+    const char *ssh = getenv("SSH_CLIENT");
+    if (ssh == NULL) {
+        ssh = getenv("SSH_CONNECTION");
+    }
+    if (ssh == NULL || *ssh == '\0') {
+        return NULL;
+    }
+    size_t largo = strcspn(ssh, " ");
+    if (largo >= tam) {
+        largo = tam - 1;
+    }
+    memcpy(ip, ssh, largo);
+    ip[largo] = '\0';
+    return ip;
+}
+
+enum { ACCESO_PERMITIDO, ACCESO_HORARIO, ACCESO_IP, ACCESO_REGLA_INVALIDA, ACCESO_BASE_DANADA };
+
+static const char *motivos_acceso[] = {"permitido", "fuera de horario", "IP no permitida", "reglas ilegibles",
+                                       "base de usuarios dañada"};
+
+// Decide si 'nombre' puede entrar desde 'ip' (NULL = sesion local) en el instante
+// 'cuando'. Los usuarios que no estan en la base no tienen restricciones, y si
+// no hay base (o no se puede leer) no hay reglas. Una base que se lee pero esta
+// dañada niega el acceso.
+int verificar_acceso(const char *nombre, const char *ip, time_t cuando) {
+    struct stat st;
+    int hay_base = stat(USUARIOS_BD_FILE, &st) == 0;
+    unsigned cubeta = hash_cadena(nombre) & (HASH_REGLAS - 1);
+
+    pthread_mutex_lock(&reglas_acceso.mutex);
+    if (!hay_base || st.st_ino != reglas_acceso.inodo || st.st_dev != reglas_acceso.dispositivo ||
+        st.st_mtim.tv_sec != reglas_acceso.mtime.tv_sec || st.st_mtim.tv_nsec != reglas_acceso.mtime.tv_nsec) {
+        reglas_vaciar(); // La base cambio: las reglas compiladas pueden estar viejas
+        if (hay_base) {
+            reglas_acceso.dispositivo = st.st_dev;
+            reglas_acceso.inodo = st.st_ino;
+            reglas_acceso.mtime = st.st_mtim;
+        }
+    }
+    ReglaAcceso *regla = reglas_acceso.cubetas[cubeta];
+    while (regla != NULL && strcmp(regla->nombre, nombre) != 0) {
+        regla = regla->siguiente;
+    }
+    if (regla == NULL) {
+        Usuario usuario;
+        int encontrado = hay_base || access(USER_DATA_FILE, F_OK) == 0 ? buscar_usuario(nombre, &usuario) : -1;
+        if (encontrado == -2 && access(USUARIOS_BD_FILE, R_OK) != 0) {
+            registrar_en(LOG_SESIONES, ": No se pudo leer %s: %s; se entra sin reglas", USUARIOS_BD_FILE,
+                         strerror(errno));
+            encontrado = -1;
+        }
+        if (encontrado != 0) {
+            pthread_mutex_unlock(&reglas_acceso.mutex);
+            return encontrado == -1 ? ACCESO_PERMITIDO : ACCESO_BASE_DANADA;
+        }
+        regla = compilar_regla(&usuario);
+        if (regla == NULL) {
+            pthread_mutex_unlock(&reglas_acceso.mutex);
+            return ACCESO_REGLA_INVALIDA;
+        }
+        regla->siguiente = reglas_acceso.cubetas[cubeta];
+        reglas_acceso.cubetas[cubeta] = regla;
+    }
+
+    int resultado = ACCESO_PERMITIDO;
+    struct tm tm;
+    localtime_r(&cuando, &tm);
+    int minuto = tm.tm_hour * 60 + tm.tm_min;
+    uint32_t direccion;
+    if (!regla->valida) {
+        resultado = ACCESO_REGLA_INVALIDA;
+    } else if (!regla->todo_horario && !(regla->minutos[tm.tm_wday][minuto / 64] & (1ULL << (minuto % 64)))) {
+        resultado = ACCESO_HORARIO;
+    } else if (ip != NULL && !regla->toda_ip && (leer_ipv4(ip, &direccion) != 0 || !ip_permitida(regla, direccion))) {
+        resultado = ACCESO_IP;
+    }
+    pthread_mutex_unlock(&reglas_acceso.mutex);
+    return resultado;
+}
+
+// Implementación del comando 'acceso': prueba las reglas de un usuario
+int comando_acceso(int argc, char **args) {
+    char buffer[64];
+    const char *ip = argc > 2 ? args[2] : ip_cliente(buffer, sizeof(buffer));
+    double inicio = segundos_monotonicos();
+    int resultado = verificar_acceso(args[1], ip, time(NULL));
+    double duracion = segundos_monotonicos() - inicio;
+    printf("%s desde %s: %s (%.1f us)\n", args[1], ip != NULL ? ip : "local", motivos_acceso[resultado],
+           duracion * 1e6);
+    return 0;
+}
+
+int agregar_usuario(const char *nombre, const char *horario, const char *ips) {
+    char comando[256];
+    Usuario usuario;
+
+    memset(&usuario, 0, sizeof(usuario));
+    if (strlen(nombre) >= sizeof(usuario.nombre) || strlen(horario) >= sizeof(usuario.horario) ||
+        strlen(ips) >= sizeof(usuario.ips)) {
+        printf("Error: nombre, horario o IPs demasiado largos.\n");
+        return -1;
+    }
+    strcpy(usuario.nombre, nombre);
+    strcpy(usuario.horario, horario);
+    strcpy(usuario.ips, ips);
+
+    // Crear el usuario en el sistema
+    snprintf(comando, sizeof(comando), "useradd -m %s", nombre);
+    if (system(comando) != 0) {
+        printf("Error al crear el usuario '%s'.\n", nombre);
+        return -1;
+    }
+
+    // Establecer contraseña
+    printf("Estableciendo contraseña para '%s'.\n", nombre);
+    snprintf(comando, sizeof(comando), "passwd %s", nombre);
+    if (system(comando) != 0) {
+        printf("Error al establecer la contraseña para '%s'.\n", nombre);
+        return -1;
+    }
+
+    // Guardar los datos del usuario en la base
+    if (guardar_usuario(&usuario) != 0) {
+        registrar_error("Error al guardar los datos del usuario");
+        return -1;
+    }
+
+    informar("Usuario '%s' creado exitosamente con horario '%s' y acceso desde '%s'.\n",
+             nombre, horario, ips);
+    return 0;
+}
+
+// Ctrl+C corta las operaciones largas que la revisan (por ejemplo una transferencia)
+static volatile sig_atomic_t interrupcion_pedida = 0;
+
+void manejador_SIGINT(int sig) {
+    (void)sig;
+    bitacora_vaciar_ya = 1; // El hilo de la bitacora vacia el anillo y sincroniza
+    interrupcion_pedida = 1;
+    printf("\nSeñal SIGINT capturada.\n");
+    // No matamos el shell principal, pero podemos manejar interrupciones aquí
+}
+
+// ---------------------------------------------------------------------------
+// Cache de ubicacion de comandos externos (como 'hash' de bash).
+// Guarda nombre -> ruta completa. Se vacia si cambia PATH. Una entrada depende
+// del directorio donde se encontro y de todos los anteriores de PATH (alli
+// podria aparecer un ejecutable con el mismo nombre), asi que guarda el mtime
+// de cada uno y se revisa en cada acierto. Si alguno cambio, se vacia entera:
+// todas las entradas comparten esos mtimes.
+// ---------------------------------------------------------------------------
+
+#define MTIME_DESCONOCIDO -1 // tv_nsec de un directorio que todavia no se miro
+#define MTIME_INEXISTENTE -2 // tv_nsec de un directorio de PATH que no existe
+
+typedef struct EntradaRuta {
+    char *nombre;
+    char *ruta;
+    int directorio;          // Indice en cache_rutas.directorios
+    unsigned long usos;
+    struct EntradaRuta *siguiente;
+} EntradaRuta;
+
+static struct {
+    pthread_mutex_t mutex;
+    char *path;                 // PATH con el que se armo la cache
+    char **directorios;
+    struct timespec *mtimes;    // mtime de cada directorio con el que valen las entradas
+    int cant_directorios;
+    EntradaRuta *cubetas[HASH_RUTAS];
+    unsigned long aciertos;
+    unsigned long fallos;
+} cache_rutas = {.mutex = PTHREAD_MUTEX_INITIALIZER};
+
+static void cache_rutas_vaciar() {
+    for (int k = 0; k < HASH_RUTAS; k++) {
+        EntradaRuta *e = cache_rutas.cubetas[k];
+        while (e != NULL) {
+            EntradaRuta *sig = e->siguiente;
+            free(e->nombre);
+            free(e->ruta);
+            free(e);
+            e = sig;
+        }
+        cache_rutas.cubetas[k] = NULL;
+    }
+}
+
+// Vuelve a dividir PATH si cambio desde la ultima busqueda
+static void cache_rutas_revisar_path() {
+    const char *path = getenv("PATH");
+    if (path == NULL) {
+        path = "/bin:/usr/bin";
+    }
+    if (cache_rutas.path != NULL && strcmp(cache_rutas.path, path) == 0) {
+        return;
+    }
+
+    cache_rutas_vaciar();
+    for (int k = 0; k < cache_rutas.cant_directorios; k++) {
+        free(cache_rutas.directorios[k]);
+    }
+    free(cache_rutas.directorios);
+    free(cache_rutas.mtimes);
+    free(cache_rutas.path);
+
+    cache_rutas.path = strdup(path);
+    int cantidad = 1;
+    for (const char *c = path; *c; c++) {
+        cantidad += (*c == ':');
+    }
+    cache_rutas.directorios = calloc(cantidad, sizeof(char *));
+    cache_rutas.mtimes = calloc(cantidad, sizeof(struct timespec));
+    cache_rutas.cant_directorios = 0;
+    for (int k = 0; k < cantidad; k++) {
+        cache_rutas.mtimes[k].tv_nsec = MTIME_DESCONOCIDO;
+    }
+
+    char *copia = strdup(path), *resto = copia, *dir;
+    while ((dir = strsep(&resto, ":")) != NULL) {
+        // Un elemento vacio de PATH es el directorio actual
+        cache_rutas.directorios[cache_rutas.cant_directorios++] = strdup(*dir ? dir : ".");
+    }
+    free(copia);
+}
+
+static int mtime_igual(struct timespec a, struct timespec b) {
+    return a.tv_sec == b.tv_sec && a.tv_nsec == b.tv_nsec;
+}
+
+// Anota el mtime actual de directorios[d]. Devuelve 1 si cambio desde el que
+// tenian las entradas de la cache (un directorio que no existe cuenta como
+// MTIME_INEXISTENTE); la primera vez que se mira no hay entradas que dependan de el.
+static int cache_rutas_directorio_cambio(int d) {
+    struct stat st;
+    struct timespec ahora = {0, MTIME_INEXISTENTE};
+    if (stat(cache_rutas.directorios[d], &st) == 0) {
+        ahora = st.st_mtim;
+    }
+    int cambio = cache_rutas.mtimes[d].tv_nsec != MTIME_DESCONOCIDO && !mtime_igual(ahora, cache_rutas.mtimes[d]);
+    cache_rutas.mtimes[d] = ahora;
+    return cambio;
+}
+
+static int es_ejecutable(const char *ruta) {
+    struct stat st;
+    return stat(ruta, &st) == 0 && S_ISREG(st.st_mode) && access(ruta, X_OK) == 0;
+}
+
+// Busca 'nombre' en los directorios de PATH y lo agrega a la cache
+static EntradaRuta *cache_rutas_buscar_en_path(const char *nombre, unsigned cubeta) {
+    for (int d = 0; d < cache_rutas.cant_directorios; d++) {
+        if (cache_rutas_directorio_cambio(d)) {
+            cache_rutas_vaciar();
+        }
+        char *ruta = unir_ruta(cache_rutas.directorios[d], nombre);
+        if (ruta == NULL) {
+            return NULL;
+        }
+        if (!es_ejecutable(ruta)) {
+            free(ruta);
+            continue;
+        }
+        EntradaRuta *e = calloc(1, sizeof(EntradaRuta));
+        if (e == NULL || (e->nombre = strdup(nombre)) == NULL) {
+            free(e);
+            free(ruta);
+            return NULL;
+        }
+        e->ruta = ruta;
+        e->directorio = d;
+        e->siguiente = cache_rutas.cubetas[cubeta];
+        cache_rutas.cubetas[cubeta] = e;
+        return e;
+    }
+    return NULL;
+}
+
+// Resuelve el ejecutable de un comando externo. Devuelve 0 y copia la ruta en 'ruta'.
+int resolver_comando(const char *nombre, char *ruta, size_t tam) {
+    if (strchr(nombre, '/') != NULL) {
+        snprintf(ruta, tam, "%s", nombre);
+        return 0;
+    }
+
+    pthread_mutex_lock(&cache_rutas.mutex);
+    cache_rutas_revisar_path();
+    unsigned cubeta = hash_cadena(nombre) & (HASH_RUTAS - 1);
+    EntradaRuta **enlace = &cache_rutas.cubetas[cubeta];
+    EntradaRuta *e = NULL;
+    while (*enlace != NULL && strcmp((*enlace)->nombre, nombre) != 0) {
+        enlace = &(*enlace)->siguiente;
+    }
+
+    if (*enlace != NULL) {
+        e = *enlace;
+        for (int d = 0; e != NULL && d <= e->directorio; d++) {
+            if (cache_rutas_directorio_cambio(d)) {
+                cache_rutas_vaciar(); // Un directorio cambio: las entradas pueden estar vencidas
+                e = NULL;
+            }
+        }
+        if (e != NULL) {
+            cache_rutas.aciertos++;
+        }
+    }
+    if (e == NULL) {
+        cache_rutas.fallos++;
+        e = cache_rutas_buscar_en_path(nombre, cubeta);
+    }
+    if (e != NULL) {
+        e->usos++;
+        snprintf(ruta, tam, "%s", e->ruta);
+    }
+    pthread_mutex_unlock(&cache_rutas.mutex);
+    return e != NULL ? 0 : -1;
+}
+
+// Implementación del comando 'hash': muestra, vacia o carga la cache de comandos
+int comando_hash(int argc, char **args) {
+    if (argc == 2 && strcmp(args[1], "-r") == 0) {
+        pthread_mutex_lock(&cache_rutas.mutex);
+        cache_rutas_vaciar();
+        pthread_mutex_unlock(&cache_rutas.mutex);
+        printf("Cache de comandos vaciada.\n");
+        return 0;
+    }
+
+    int resultado = 0;
+    for (int k = 1; k < argc; k++) {
+        char ruta[PATH_MAX];
+        if (resolver_comando(args[k], ruta, sizeof(ruta)) != 0) {
+            printf("hash: %s: no encontrado\n", args[k]);
+            resultado = -1;
+        }
+    }
+    if (argc > 1) {
+        return resultado;
+    }
+
+    pthread_mutex_lock(&cache_rutas.mutex);
+    printf("usos\tcomando\n");
+    for (int k = 0; k < HASH_RUTAS; k++) {
+        for (EntradaRuta *e = cache_rutas.cubetas[k]; e != NULL; e = e->siguiente) {
+            printf("%4lu\t%s\n", e->usos, e->ruta);
+        }
+    }
+    printf("Aciertos: %lu, fallos: %lu\n", cache_rutas.aciertos, cache_rutas.fallos);
+    pthread_mutex_unlock(&cache_rutas.mutex);
+    return 0;
+}
+
+// Implementación del comando 'diagnostico': contadores de las caches internas
+int comando_diagnostico(int argc, char **args) {
+    if (argc == 2 && strcmp(args[1], "-r") == 0) {
+        pthread_mutex_lock(&mutex_identidades);
+        cache_identidades_vaciar(&cache_usuarios);
+        cache_identidades_vaciar(&cache_grupos);
+        pthread_mutex_unlock(&mutex_identidades);
+        printf("Caches de usuarios y grupos vaciadas.\n");
+        return 0;
+    }
+    if (argc > 1) {
+        printf("Uso: diagnostico [-r]\n");
+        return -1;
+    }
+
+    pthread_mutex_lock(&mutex_identidades);
+    mostrar_cache_identidades("Usuarios:", &cache_usuarios);
+    mostrar_cache_identidades("Grupos:", &cache_grupos);
+    pthread_mutex_unlock(&mutex_identidades);
+
+    pthread_mutex_lock(&cache_rutas.mutex);
+    printf("%-9s aciertos: %lu, fallos: %lu\n", "Comandos:", cache_rutas.aciertos, cache_rutas.fallos);
+    pthread_mutex_unlock(&cache_rutas.mutex);
+    return 0;
+}
+
+// ---------------------------------------------------------------------------
+// Instrumentacion de comandos. Cada comando interno o externo deja su tiempo
+// real, la CPU de usuario y de sistema, el RSS maximo (en los internos, lo
+// que crecio el RSS de la shell mientras corrian) y los bytes leidos y
+// escritos (rchar/wchar de /proc/.../io) en una tabla por nombre. Los tiempos
+// reales van a un histograma logaritmico con 8 subcubetas por potencia de dos
+// (error menor al 7%), del que salen los percentiles sin guardar cada muestra.
+// ---------------------------------------------------------------------------
+
+typedef struct {
+    double real;
+    double usuario;
+    double sistema;
+    long rss_kb;
+    unsigned long long leidos;
+    unsigned long long escritos;
+} MedicionComando;
+
+typedef struct EstadisticaComando {
+    char nombre[32];
+    int interno;
+    unsigned long cantidad;
+    unsigned long fallos;
+    double real_total;
+    double real_maximo;
+    double usuario_total;
+    double sistema_total;
+    long rss_maximo_kb;
+    unsigned long long leidos;
+    unsigned long long escritos;
+    uint32_t histograma[TIEMPOS_CUBETAS];
+    struct EstadisticaComando *siguiente;
+} EstadisticaComando;
+
+static EstadisticaComando *tabla_tiempos[HASH_TIEMPOS];
+static pthread_mutex_t mutex_tiempos = PTHREAD_MUTEX_INITIALIZER;
+
+// Cubeta del histograma para una duracion en microsegundos
+static int cubeta_tiempo(uint64_t us) {
+    if (us < 8) {
+        return (int)us;
+    }
+    int octava = 63 - __builtin_clzll(us);
+    int cubeta = (octava - 2) * 8 + (int)((us >> (octava - 3)) & 7);
+    return cubeta < TIEMPOS_CUBETAS ? cubeta : TIEMPOS_CUBETAS - 1;
+}
+
+// Limite inferior en microsegundos de una cubeta; el superior es el de la siguiente
+static uint64_t cubeta_inicio(int cubeta) {
+    if (cubeta < 8) {
+        return cubeta;
+    }
+    int octava = cubeta / 8 + 2;
+    return (uint64_t)(8 + cubeta % 8) << (octava - 3);
+}
+
+// Percentil p (0 a 1) en segundos, tomando el centro de la cubeta que lo contiene
+static double percentil_tiempo(const EstadisticaComando *e, double p) {
+    unsigned long objetivo = (unsigned long)(p * e->cantidad + 0.999999);
+    unsigned long acumulado = 0;
+    if (objetivo == 0) {
+        objetivo = 1;
+    }
+    for (int k = 0; k < TIEMPOS_CUBETAS; k++) {
+        acumulado += e->histograma[k];
+        if (acumulado >= objetivo) {
+            double centro = (cubeta_inicio(k) + cubeta_inicio(k + 1)) / 2e6;
+            return centro < e->real_maximo ? centro : e->real_maximo;
+        }
+    }
+    return e->real_maximo;
+}
+
+// Lee rchar y wchar de un archivo /proc/.../io
+static void leer_contadores_es(const char *ruta, unsigned long long *leidos, unsigned long long *escritos) {
+    char texto[512];
+    *leidos = *escritos = 0;
+    int fd = open(ruta, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return;
+    }
+    ssize_t n = read(fd, texto, sizeof(texto) - 1);
+    close(fd);
+    if (n <= 0) {
+        return;
+    }
+    texto[n] = '\0';
+    const char *p = strstr(texto, "rchar: ");
+    if (p != NULL) {
+        *leidos = strtoull(p + 7, NULL, 10);
+    }
+    p = strstr(texto, "wchar: ");
+    if (p != NULL) {
+        *escritos = strtoull(p + 7, NULL, 10);
+    }
+}
+
+// RSS actual de la shell en KiB (ru_maxrss es el pico de toda su vida)
+static long rss_actual_kb() {
+    char texto[128];
+    int fd = open("/proc/self/statm", O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return 0;
+    }
+    ssize_t n = read(fd, texto, sizeof(texto) - 1);
+    close(fd);
+    if (n <= 0) {
+        return 0;
+    }
+    texto[n] = '\0';
+    long total, residentes;
+    if (sscanf(texto, "%ld %ld", &total, &residentes) != 2) {
+        return 0;
+    }
+    return residentes * (sysconf(_SC_PAGESIZE) / 1024);
+}
+
+// Toma los contadores de la shell. En el hilo principal se mide el proceso
+// entero para incluir los hilos de los pools; en los hilos del modo lote, que
+// corren lineas a la vez, solo el propio hilo.
+static void medicion_tomar(MedicionComando *m) {
+    int principal = syscall(SYS_gettid) == getpid();
+    struct rusage ru;
+    getrusage(principal ? RUSAGE_SELF : RUSAGE_THREAD, &ru);
+    m->real = segundos_monotonicos();
+    m->usuario = ru.ru_utime.tv_sec + ru.ru_utime.tv_usec / 1e6;
+    m->sistema = ru.ru_stime.tv_sec + ru.ru_stime.tv_usec / 1e6;
+    m->rss_kb = rss_actual_kb();
+    leer_contadores_es(principal ? "/proc/self/io" : "/proc/thread-self/io", &m->leidos, &m->escritos);
+}
+
+// Suma una medicion a la estadistica del comando
+void tiempos_registrar(const char *nombre, const MedicionComando *m, int interno, int fallo) {
+    const char *base = strrchr(nombre, '/');
+    if (base != NULL && base[1] != '\0') {
+        nombre = base + 1;
+    }
+    unsigned cubeta = hash_cadena(nombre) & (HASH_TIEMPOS - 1);
+    pthread_mutex_lock(&mutex_tiempos);
+    EstadisticaComando *e = tabla_tiempos[cubeta];
+    while (e != NULL && strcmp(e->nombre, nombre) != 0) {
+        e = e->siguiente;
+    }
+    if (e == NULL && (e = calloc(1, sizeof(EstadisticaComando))) != NULL) {
+        copiar_campo(e->nombre, sizeof(e->nombre), nombre);
+        e->siguiente = tabla_tiempos[cubeta];
+        tabla_tiempos[cubeta] = e;
+    }
+    if (e != NULL) {
+        e->interno = interno;
+        e->cantidad++;
+        e->fallos += fallo != 0;
+        e->real_total += m->real;
+        if (m->real > e->real_maximo) {
+            e->real_maximo = m->real;
+        }
+        e->usuario_total += m->usuario;
+        e->sistema_total += m->sistema;
+        if (m->rss_kb > e->rss_maximo_kb) {
+            e->rss_maximo_kb = m->rss_kb;
+        }
+        e->leidos += m->leidos;
+        e->escritos += m->escritos;
+        e->histograma[cubeta_tiempo((uint64_t)(m->real * 1e6))]++;
+    }
+    pthread_mutex_unlock(&mutex_tiempos);
+}
+
+// Cierra la medicion de un comando interno empezada con medicion_tomar
+static void tiempos_registrar_interno(const char *nombre, const MedicionComando *antes, int resultado) {
+    MedicionComando despues;
+    medicion_tomar(&despues);
+    despues.real -= antes->real;
+    despues.usuario -= antes->usuario;
+    despues.sistema -= antes->sistema;
+    despues.leidos -= antes->leidos;
+    despues.escritos -= antes->escritos;
+    // Para un interno se guarda cuanto crecio el RSS, no el de la shell
+    despues.rss_kb = despues.rss_kb > antes->rss_kb ? despues.rss_kb - antes->rss_kb : 0;
+    tiempos_registrar(nombre, &despues, 1, resultado != 0);
+}
+
+static void tiempos_vaciar() {
+    for (int k = 0; k < HASH_TIEMPOS; k++) {
+        while (tabla_tiempos[k] != NULL) {
+            EstadisticaComando *e = tabla_tiempos[k];
+            tabla_tiempos[k] = e->siguiente;
+            free(e);
+        }
+    }
+}
+
+// Copia las estadisticas en un arreglo ordenado por tiempo real total. Se llama con el mutex tomado.
+static EstadisticaComando **tiempos_ordenados(int *cantidad) {
+    int n = 0;
+    for (int k = 0; k < HASH_TIEMPOS; k++) {
+        for (EstadisticaComando *e = tabla_tiempos[k]; e != NULL; e = e->siguiente) {
+            n++;
+        }
+    }
+    EstadisticaComando **lista = malloc((n + 1) * sizeof(EstadisticaComando *));
+    if (lista == NULL) {
+        *cantidad = 0;
+        return NULL;
+    }
+    n = 0;
+    for (int k = 0; k < HASH_TIEMPOS; k++) {
+        for (EstadisticaComando *e = tabla_tiempos[k]; e != NULL; e = e->siguiente) {
+            int j = n++;
+            while (j > 0 && lista[j - 1]->real_total < e->real_total) {
+                lista[j] = lista[j - 1];
+                j--;
+            }
+            lista[j] = e;
+        }
+    }
+    *cantidad = n;
+    return lista;
+}
+
+static void formatear_latencia(double segundos, char *texto, size_t tam) {
+    if (segundos < 1e-3) {
+        snprintf(texto, tam, "%.0fus", segundos * 1e6);
+    } else if (segundos < 1) {
+        snprintf(texto, tam, "%.1fms", segundos * 1e3);
+    } else {
+        snprintf(texto, tam, "%.2fs", segundos);
+    }
+}
+
+static void formatear_bytes(unsigned long long bytes, char *texto, size_t tam) {
+    static const char *unidades[] = {"B", "KiB", "MiB", "GiB", "TiB"};
+    double valor = bytes;
+    int u = 0;
+    while (valor >= 1024 && u < 4) {
+        valor /= 1024;
+        u++;
+    }
+    snprintf(texto, tam, u == 0 ? "%.0f%s" : "%.1f%s", valor, unidades[u]);
+}
+
+// Detalle de un comando con su histograma, agrupado por potencias de dos
+static void mostrar_histograma(const EstadisticaComando *e) {
+    char p50[16], p90[16], p99[16], maximo[16], promedio[16], leidos[16], escritos[16];
+    formatear_latencia(percentil_tiempo(e, 0.50), p50, sizeof(p50));
+    formatear_latencia(percentil_tiempo(e, 0.90), p90, sizeof(p90));
+    formatear_latencia(percentil_tiempo(e, 0.99), p99, sizeof(p99));
+    formatear_latencia(e->real_maximo, maximo, sizeof(maximo));
+    formatear_latencia(e->real_total / e->cantidad, promedio, sizeof(promedio));
+    formatear_bytes(e->leidos, leidos, sizeof(leidos));
+    formatear_bytes(e->escritos, escritos, sizeof(escritos));
+    printf("%s (%s): %lu ejecuciones, %lu fallidas\n", e->nombre, e->interno ? "interno" : "externo",
+           e->cantidad, e->fallos);
+    printf("  real: promedio %s, p50 %s, p90 %s, p99 %s, max %s\n", promedio, p50, p90, p99, maximo);
+    printf("  CPU: usuario %.3f s, sistema %.3f s; RSS max %ld KiB; leidos %s, escritos %s\n",
+           e->usuario_total, e->sistema_total, e->rss_maximo_kb, leidos, escritos);
+
+    uint32_t octavas[TIEMPOS_CUBETAS / 8 + 1] = {0}, mayor = 0;
+    int primera = -1, ultima = 0;
+    for (int k = 0; k < TIEMPOS_CUBETAS; k++) {
+        octavas[k / 8] += e->histograma[k];
+    }
+    for (int o = 0; o <= TIEMPOS_CUBETAS / 8; o++) {
+        if (octavas[o] > 0) {
+            primera = primera < 0 ? o : primera;
+            ultima = o;
+            mayor = octavas[o] > mayor ? octavas[o] : mayor;
+        }
+    }
+    for (int o = primera; o >= 0 && o <= ultima; o++) {
+        char desde[16], hasta[16], barra[41];
+        formatear_latencia(cubeta_inicio(o * 8) / 1e6, desde, sizeof(desde));
+        formatear_latencia(cubeta_inicio(o * 8 + 8) / 1e6, hasta, sizeof(hasta));
+        int largo = (int)((uint64_t)octavas[o] * 40 / mayor);
+        memset(barra, '#', largo);
+        barra[largo] = '\0';
+        printf("  %8s - %-8s %7u %s\n", desde, hasta, octavas[o], barra);
+    }
+}
+
+// Escribe un nombre entre comillas escapando lo que JSON y CSV no aceptan sueltos
+static void escribir_cadena_exportada(FILE *f, const char *texto, int json) {
+    fputc('"', f);
+    for (const unsigned char *p = (const unsigned char *)texto; *p != '\0'; p++) {
+        if (*p == '"') {
+            fputs(json ? "\\\"" : "\"\"", f);
+        } else if (json && *p == '\\') {
+            fputs("\\\\", f);
+        } else if (json && *p < 0x20) {
+            fprintf(f, "\\u%04x", *p);
+        } else {
+            fputc(*p, f);
+        }
+    }
+    fputc('"', f);
+}
+
+// Exporta las estadisticas a un archivo JSON (o CSV si termina en .csv).
+// Se escribe a un temporal y se renombra, asi quien lo lee nunca ve uno a medias.
+int tiempos_exportar(const char *ruta) {
+    const char *punto = strrchr(ruta, '.');
+    int json = punto == NULL || strcmp(punto, ".csv") != 0;
+    char temporal[PATH_MAX];
+    snprintf(temporal, sizeof(temporal), "%s.tmp%d", ruta, (int)getpid());
+    FILE *f = fopen(temporal, "w");
+    if (f == NULL) {
+        perror("Error al crear el archivo de tiempos");
+        return -1;
+    }
+
+    pthread_mutex_lock(&mutex_tiempos);
+    int n;
+    EstadisticaComando **lista = tiempos_ordenados(&n);
+    if (json) {
+        fprintf(f, "{\"generado\": %ld, \"pid\": %d, \"comandos\": [", (long)time(NULL), (int)getpid());
+    } else {
+        fprintf(f, "nombre,tipo,cantidad,fallos,real_total_s,real_max_s,p50_s,p90_s,p99_s,"
+                   "usuario_s,sistema_s,rss_max_kb,bytes_leidos,bytes_escritos\n");
+    }
+    for (int k = 0; k < n; k++) {
+        EstadisticaComando *e = lista[k];
+        double p50 = percentil_tiempo(e, 0.50), p90 = percentil_tiempo(e, 0.90), p99 = percentil_tiempo(e, 0.99);
+        if (!json) {
+            escribir_cadena_exportada(f, e->nombre, 0);
+            fprintf(f, ",%s,%lu,%lu,%.6f,%.6f,%.6f,%.6f,%.6f,%.6f,%.6f,%ld,%llu,%llu\n",
+                    e->interno ? "interno" : "externo", e->cantidad, e->fallos, e->real_total, e->real_maximo,
+                    p50, p90, p99, e->usuario_total, e->sistema_total, e->rss_maximo_kb, e->leidos, e->escritos);
+            continue;
+        }
+        fprintf(f, "%s\n  {\"nombre\": ", k ? "," : "");
+        escribir_cadena_exportada(f, e->nombre, 1);
+        fprintf(f, ", \"tipo\": \"%s\", \"cantidad\": %lu, \"fallos\": %lu, \"real_total_s\": %.6f, "
+                   "\"real_max_s\": %.6f, \"p50_s\": %.6f, \"p90_s\": %.6f, \"p99_s\": %.6f, "
+                   "\"usuario_s\": %.6f, \"sistema_s\": %.6f, \"rss_max_kb\": %ld, "
+                   "\"bytes_leidos\": %llu, \"bytes_escritos\": %llu, \"histograma_us\": [",
+                e->interno ? "interno" : "externo", e->cantidad, e->fallos, e->real_total, e->real_maximo,
+                p50, p90, p99, e->usuario_total, e->sistema_total, e->rss_maximo_kb, e->leidos, e->escritos);
+        int primera = 1;
+        for (int c = 0; c < TIEMPOS_CUBETAS; c++) {
+            if (e->histograma[c] > 0) {
+                // Cada par es [limite superior en us, cantidad]
+                fprintf(f, "%s[%llu, %u]", primera ? "" : ", ",
+                        (unsigned long long)cubeta_inicio(c + 1), e->histograma[c]);
+                primera = 0;
+            }
+        }
+        fprintf(f, "]}");
+    }
+    if (json) {
+        fprintf(f, "%s]}\n", n > 0 ? "\n" : "");
+    }
+    pthread_mutex_unlock(&mutex_tiempos);
+    free(lista);
+
+    int resultado = fflush(f) == 0 && fsync(fileno(f)) == 0 ? 0 : -1;
+    if (fclose(f) != 0 || resultado != 0 || rename(temporal, ruta) != 0) {
+        perror("Error al escribir el archivo de tiempos");
+        unlink(temporal);
+        return -1;
+    }
+    return 0;
+}
+
+// Exportacion automatica al salir si LFS_TIEMPOS_ARCHIVO indica el destino
+static void tiempos_exportar_al_salir() {
+    const char *ruta = getenv("LFS_TIEMPOS_ARCHIVO");
+    if (ruta != NULL && ruta[0] != '\0') {
+        tiempos_exportar(ruta);
+    }
+}
+
+void tiempos_iniciar() {
+    const char *ruta = getenv("LFS_TIEMPOS_ARCHIVO");
+    if (ruta != NULL && ruta[0] != '\0') {
+        atexit(tiempos_exportar_al_salir);
+    }
+}
+
+// Implementación del comando 'tiempos': resumen por comando, detalle con histograma,
+// vaciado de la tabla y exportacion para tableros
+int comando_tiempos(int argc, char **args) {
+    if (argc == 2 && strcmp(args[1], "-r") == 0) {
+        pthread_mutex_lock(&mutex_tiempos);
+        tiempos_vaciar();
+        pthread_mutex_unlock(&mutex_tiempos);
+        printf("Tiempos de comandos vaciados.\n");
+        return 0;
+    }
+    if (argc == 3 && strcmp(args[1], "exportar") == 0) {
+        if (tiempos_exportar(args[2]) != 0) {
+            return -1;
+        }
+        informar("Tiempos exportados a %s\n", args[2]);
+        return 0;
+    }
+    if (argc > 2) {
+        printf("Uso: tiempos [-r] [nombre_comando] | tiempos exportar <archivo.json|archivo.csv>\n");
+        return -1;
+    }
+
+    pthread_mutex_lock(&mutex_tiempos);
+    int n, encontrado = 0;
+    EstadisticaComando **lista = tiempos_ordenados(&n);
+    if (argc == 1 && n > 0) {
+        printf("%-16s %6s %5s %8s %8s %8s %8s %8s %8s %9s %9s %9s\n", "comando", "veces", "fallo",
+               "p50", "p90", "p99", "max", "usuario", "sistema", "RSS max", "leidos", "escritos");
+    }
+    for (int k = 0; k < n; k++) {
+        EstadisticaComando *e = lista[k];
+        if (argc == 2) {
+            if (strcmp(e->nombre, args[1]) == 0) {
+                mostrar_histograma(e);
+                encontrado = 1;
+            }
+            continue;
+        }
+        char p50[16], p90[16], p99[16], maximo[16], usuario[16], sistema[16], rss[16], leidos[16], escritos[16];
+        formatear_latencia(percentil_tiempo(e, 0.50), p50, sizeof(p50));
+        formatear_latencia(percentil_tiempo(e, 0.90), p90, sizeof(p90));
+        formatear_latencia(percentil_tiempo(e, 0.99), p99, sizeof(p99));
+        formatear_latencia(e->real_maximo, maximo, sizeof(maximo));
+        formatear_latencia(e->usuario_total, usuario, sizeof(usuario));
+        formatear_latencia(e->sistema_total, sistema, sizeof(sistema));
+        formatear_bytes((unsigned long long)e->rss_maximo_kb << 10, rss, sizeof(rss));
+        formatear_bytes(e->leidos, leidos, sizeof(leidos));
+        formatear_bytes(e->escritos, escritos, sizeof(escritos));
+        printf("%-16s %6lu %5lu %8s %8s %8s %8s %8s %8s %9s %9s %9s\n", e->nombre, e->cantidad, e->fallos,
+               p50, p90, p99, maximo, usuario, sistema, rss, leidos, escritos);
+    }
+    pthread_mutex_unlock(&mutex_tiempos);
+    free(lista);
+    if (argc == 1 && n == 0) {
+        printf("Todavia no se midio ningun comando.\n");
+    } else if (argc == 2 && !encontrado) {
+        printf("tiempos: %s no tiene mediciones\n", args[1]);
+        return -1;
+    }
+    return 0;
+}
+
+int listarDemonios() {
+    struct dirent *entry;
+    DIR *dp = opendir("/etc/init.d");
+
+    if (dp == NULL) {
+        perror("Error al abrir /etc/init.d");
+        return -1;
+    }
+
+    printf("Demonios disponibles:\n");
+    while ((entry = readdir(dp)) != NULL) {
+        if (entry->d_name[0] != '.') {
+            printf("  %s\n", entry->d_name);
+        }
+    }
+    closedir(dp);
+    return 0;
+}
+
+int obtenerPID(const char *nombre) {
+    char ruta[MAX_LFS_INPUT];
+    char buffer[128];
+    snprintf(ruta, sizeof(ruta), "/var/run/%s.pid", nombre);
+    int i = -1; // PID no encontrado
+
+    FILE *archivo = fopen(ruta, "r");
+    if (archivo == NULL) {
+        return -1;
+    }
+
+    if (fgets(buffer, sizeof(buffer), archivo) != NULL && atoi(buffer) > 0) {
+        i = atoi(buffer);
+    }
+
+    fclose(archivo);
+    return i;
+}
+
+// ---------------------------------------------------------------------------
+// Supervisor de demonios. Cada demonio iniciado desde la shell se sigue con un
+// pidfd (no se confunde con otro proceso que reuse su PID) registrado en un
+// epoll que atiende un hilo propio. Si el demonio muere sin que se lo haya
+// detenido y tiene reinicio automatico, se vuelve a iniciar con una espera que
+// se duplica en cada caida.
+// ---------------------------------------------------------------------------
+
+typedef enum {
+    SERVICIO_LIBRE,
+    SERVICIO_ACTIVO,
+    SERVICIO_DETENIENDO,
+    SERVICIO_ESPERANDO,   // Caido, esperando para reiniciarse
+    SERVICIO_CAIDO,
+    SERVICIO_DETENIDO
+} EstadoServicio;
+
+static const char *nombres_estado_servicio[] = {"", "activo", "deteniendo", "reiniciando", "caido", "detenido"};
+
+typedef struct {
+    char nombre[64];
+    EstadoServicio estado;
+    pid_t pid;
+    int pidfd;
+    double inicio;        // Segundos monotonicos del ultimo arranque
+    int reinicios;
+    int auto_reinicio;
+    double espera;        // Espera del proximo reinicio
+    double proximo;       // Cuando toca reiniciarlo
+} Servicio;
+
+static struct {
+    pthread_mutex_t mutex;
+    pthread_once_t una_vez;
+    int epoll;
+    int aviso[2];         // Despierta al hilo cuando cambia la tabla
+    Servicio tabla[MAX_SERVICIOS];
+} supervisor = {.mutex = PTHREAD_MUTEX_INITIALIZER, .una_vez = PTHREAD_ONCE_INIT, .epoll = -1};
+
+static int pidfd_abrir(pid_t pid) {
+    return syscall(SYS_pidfd_open, pid, 0);
+}
+
+static int pidfd_senal(int pidfd, int senal) {
+    return syscall(SYS_pidfd_send_signal, pidfd, senal, NULL, 0);
+}
+
+// Espera a que el proceso del pidfd termine. Devuelve 1 si termino, 0 si vencio el plazo.
+static int pidfd_esperar(int pidfd, double segundos) {
+    struct pollfd pfd = {.fd = pidfd, .events = POLLIN};
+    double limite = segundos_monotonicos() + segundos;
+    while (1) {
+        int resto = (int)((limite - segundos_monotonicos()) * 1000);
+        int r = poll(&pfd, 1, resto > 0 ? resto : 0);
+        if (r > 0) {
+            return 1;
+        }
+        if (r == 0 || errno != EINTR) {
+            return 0;
+        }
+    }
+}
+
+// Ejecuta '/etc/init.d/<nombre> <accion>' con un plazo maximo. Devuelve su codigo de salida.
+static int ejecutar_script_demonio(const char *nombre, const char *accion) {
+    char ruta[MAX_LFS_INPUT];
+    snprintf(ruta, sizeof(ruta), "/etc/init.d/%s", nombre);
+    if (access(ruta, X_OK) != 0) {
+        printf("El demonio '%s' no existe o no es ejecutable.\n", nombre);
+        return -1;
+    }
+
+    char *argv[] = {(char *)nombre, (char *)accion, NULL};
+    posix_spawnattr_t atributos;
+    sigset_t por_defecto;
+    posix_spawnattr_init(&atributos);
+    sigemptyset(&por_defecto);
+    sigaddset(&por_defecto, SIGINT);
+    sigaddset(&por_defecto, SIGCHLD);
+    sigaddset(&por_defecto, SIGPIPE);
+    posix_spawnattr_setsigdefault(&atributos, &por_defecto);
+    posix_spawnattr_setflags(&atributos, POSIX_SPAWN_SETSIGDEF);
+    pid_t pid;
+    int error = posix_spawn(&pid, ruta, NULL, &atributos, argv, environ);
+    posix_spawnattr_destroy(&atributos);
+    if (error != 0) {
+        errno = error;
+        perror("Error al ejecutar el script del demonio");
+        return -1;
+    }
+
+    int pidfd = pidfd_abrir(pid);
+    if (pidfd >= 0 && !pidfd_esperar(pidfd, DEMONIO_ESPERA_SCRIPT)) {
+        printf("El script de '%s' no termino en %d s; se cancela.\n", nombre, DEMONIO_ESPERA_SCRIPT);
+        kill(pid, SIGKILL);
+    }
+    if (pidfd >= 0) {
+        close(pidfd);
+    }
+    int status = 0;
+    pid_t esperado;
+    while ((esperado = waitpid(pid, &status, 0)) < 0 && errno == EINTR) {
+    }
+    if (esperado < 0) {
+        perror("Error al esperar el script del demonio");
+        return -1;
+    }
+    return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+}
+
+static Servicio *buscar_servicio(const char *nombre) {
+    for (int k = 0; k < MAX_SERVICIOS; k++) {
+        if (supervisor.tabla[k].estado != SERVICIO_LIBRE && strcmp(supervisor.tabla[k].nombre, nombre) == 0) {
+            return &supervisor.tabla[k];
+        }
+    }
+    return NULL;
+}
+
+static void supervisor_avisar() {
+    if (supervisor.aviso[1] >= 0) {
+        (void)write(supervisor.aviso[1], "", 1);
+    }
+}
+
+// Suelta el pidfd de un servicio. Se llama con el mutex tomado.
+static void servicio_soltar(Servicio *sv) {
+    if (sv->pidfd >= 0) {
+        epoll_ctl(supervisor.epoll, EPOLL_CTL_DEL, sv->pidfd, NULL);
+        close(sv->pidfd);
+        sv->pidfd = -1;
+    }
+}
+
+// Lee el PID del demonio recien iniciado y lo agrega al epoll. Se llama con el mutex tomado.
+static int servicio_vigilar(Servicio *sv) {
+    pid_t pid = obtenerPID(sv->nombre);
+    int pidfd = pid > 0 ? pidfd_abrir(pid) : -1;
+    if (pidfd < 0) {
+        return -1;
+    }
+    struct epoll_event evento = {.events = EPOLLIN, .data.u32 = (uint32_t)(sv - supervisor.tabla)};
+    if (epoll_ctl(supervisor.epoll, EPOLL_CTL_ADD, pidfd, &evento) != 0) {
+        close(pidfd);
+        return -1;
+    }
+    sv->pid = pid;
+    sv->pidfd = pidfd;
+    sv->inicio = segundos_monotonicos();
+    sv->estado = SERVICIO_ACTIVO;
+    return 0;
+}
+
+// El demonio termino sin que se lo pidiera. Se llama con el mutex tomado.
+static void servicio_caido(Servicio *sv, double ahora) {
+    registrar_en(LOG_GENERAL, " Demonio '%s' (PID %d) termino inesperadamente", sv->nombre, (int)sv->pid);
+    if (!sv->auto_reinicio) {
+        sv->estado = SERVICIO_CAIDO;
+        return;
+    }
+    if (ahora - sv->inicio >= REINICIO_ESTABLE || sv->espera < REINICIO_MINIMO) {
+        sv->espera = REINICIO_MINIMO;
+    } else {
+        sv->espera = sv->espera * 2 > REINICIO_MAXIMO ? REINICIO_MAXIMO : sv->espera * 2;
+    }
+    sv->proximo = ahora + sv->espera;
+    sv->estado = SERVICIO_ESPERANDO;
+}
+
+// Reinicia los demonios cuya espera vencio. Se llama con el mutex tomado y lo
+// suelta mientras corre cada script.
+static void reiniciar_vencidos(double ahora) {
+    for (int k = 0; k < MAX_SERVICIOS; k++) {
+        Servicio *sv = &supervisor.tabla[k];
+        if (sv->estado != SERVICIO_ESPERANDO || sv->proximo > ahora) {
+            continue;
+        }
+        char nombre[sizeof(sv->nombre)];
+        memcpy(nombre, sv->nombre, sizeof(nombre));
+        pthread_mutex_unlock(&supervisor.mutex);
+        int codigo = ejecutar_script_demonio(nombre, "start");
+        pthread_mutex_lock(&supervisor.mutex);
+        if (sv->estado != SERVICIO_ESPERANDO) {
+            continue; // Lo detuvieron mientras tanto
+        }
+        sv->reinicios++;
+        if (codigo == 0 && servicio_vigilar(sv) == 0) {
+            registrar_en(LOG_GENERAL, " Demonio '%s' reiniciado (PID %d)", sv->nombre, (int)sv->pid);
+        } else {
+            sv->inicio = segundos_monotonicos();
+            servicio_caido(sv, sv->inicio);
+        }
+    }
+}
+
+static void *hilo_supervisor(void *arg) {
+    (void)arg;
+    struct epoll_event eventos[16];
+    while (1) {
+        // Dormir hasta el proximo reinicio pendiente, si hay alguno
+        pthread_mutex_lock(&supervisor.mutex);
+        double ahora = segundos_monotonicos(), proximo = -1;
+        for (int k = 0; k < MAX_SERVICIOS; k++) {
+            Servicio *sv = &supervisor.tabla[k];
+            if (sv->estado == SERVICIO_ESPERANDO && (proximo < 0 || sv->proximo < proximo)) {
+                proximo = sv->proximo;
+            }
+        }
+        pthread_mutex_unlock(&supervisor.mutex);
+        int espera = proximo < 0 ? -1 : proximo <= ahora ? 0 : (int)((proximo - ahora) * 1000) + 1;
+
+        int n = epoll_wait(supervisor.epoll, eventos, 16, espera);
+        pthread_mutex_lock(&supervisor.mutex);
+        ahora = segundos_monotonicos();
+        for (int e = 0; e < n; e++) {
+            uint32_t indice = eventos[e].data.u32;
+            if (indice == MAX_SERVICIOS) {
+                char basura[64];
+                while (read(supervisor.aviso[0], basura, sizeof(basura)) > 0) {
+                }
+                continue;
+            }
+            Servicio *sv = &supervisor.tabla[indice];
+            if (sv->pidfd < 0) {
+                continue;
+            }
+            servicio_soltar(sv);
+            if (sv->estado == SERVICIO_ACTIVO) {
+                servicio_caido(sv, ahora);
+            }
+        }
+        reiniciar_vencidos(ahora);
+        pthread_mutex_unlock(&supervisor.mutex);
+    }
+    return NULL;
+}
+
+static void supervisor_iniciar_una_vez() {
+    supervisor.aviso[0] = supervisor.aviso[1] = -1;
+    supervisor.epoll = epoll_create1(EPOLL_CLOEXEC);
+    if (supervisor.epoll < 0 || pipe2(supervisor.aviso, O_CLOEXEC | O_NONBLOCK) != 0) {
+        perror("Error al crear el supervisor de demonios");
+        return;
+    }
+    for (int k = 0; k < MAX_SERVICIOS; k++) {
+        supervisor.tabla[k].pidfd = -1;
+    }
+    struct epoll_event evento = {.events = EPOLLIN, .data.u32 = MAX_SERVICIOS};
+    epoll_ctl(supervisor.epoll, EPOLL_CTL_ADD, supervisor.aviso[0], &evento);
+
+    pthread_t hilo;
+    pthread_attr_t atributos;
+    pthread_attr_init(&atributos);
+    pthread_attr_setdetachstate(&atributos, PTHREAD_CREATE_DETACHED);
+    if (pthread_create(&hilo, &atributos, hilo_supervisor, NULL) != 0) {
+        perror("Error al crear el hilo supervisor");
+    }
+    pthread_attr_destroy(&atributos);
+}
+
+static int supervisor_iniciar() {
+    pthread_once(&supervisor.una_vez, supervisor_iniciar_una_vez);
+    return supervisor.aviso[1] >= 0 ? 0 : -1;
+}
+
+enum { SERVICIO_HECHO, SERVICIO_VIGILADO, SERVICIO_YA_ESTABA };
+
+// Inicia un demonio con su script y lo deja bajo supervision. Devuelve
+// SERVICIO_VIGILADO, SERVICIO_HECHO (sin archivo de PID), SERVICIO_YA_ESTABA o -1.
+static int arrancar_servicio(const char *nombre, int auto_reinicio) {
+    if (strlen(nombre) >= sizeof(supervisor.tabla[0].nombre) || supervisor_iniciar() != 0) {
+        return -1;
+    }
+    pthread_mutex_lock(&supervisor.mutex);
+    Servicio *sv = buscar_servicio(nombre);
+    if (sv != NULL && (sv->estado == SERVICIO_ACTIVO || sv->estado == SERVICIO_DETENIENDO)) {
+        pthread_mutex_unlock(&supervisor.mutex);
+        return SERVICIO_YA_ESTABA;
+    }
+    pthread_mutex_unlock(&supervisor.mutex);
+
+    if (ejecutar_script_demonio(nombre, "start") != 0) {
+        return -1;
+    }
+
+    pthread_mutex_lock(&supervisor.mutex);
+    sv = buscar_servicio(nombre);
+    for (int k = 0; sv == NULL && k < MAX_SERVICIOS; k++) {
+        if (supervisor.tabla[k].estado == SERVICIO_LIBRE) {
+            sv = &supervisor.tabla[k];
+            memset(sv, 0, sizeof(*sv));
+            sv->pidfd = -1;
+            snprintf(sv->nombre, sizeof(sv->nombre), "%s", nombre);
+        }
+    }
+    int vigilado = sv != NULL;
+    if (vigilado) {
+        sv->auto_reinicio = auto_reinicio;
+        sv->espera = 0;
+        if (servicio_vigilar(sv) != 0) {
+            sv->estado = SERVICIO_LIBRE; // Sin archivo de PID no hay nada que seguir
+            vigilado = 0;
+        }
+    }
+    pthread_mutex_unlock(&supervisor.mutex);
+    supervisor_avisar();
+    return vigilado ? SERVICIO_VIGILADO : SERVICIO_HECHO;
+}
+
+int iniciarDemonio(const char *nombre, int auto_reinicio) {
+    switch (arrancar_servicio(nombre, auto_reinicio)) {
+    case SERVICIO_VIGILADO:
+        informar("Demonio '%s' iniciado exitosamente.\n", nombre);
+        return 0;
+    case SERVICIO_HECHO:
+        informar("Demonio '%s' iniciado exitosamente (sin supervision: no se encontro /var/run/%s.pid).\n",
+                 nombre, nombre);
+        return 0;
+    case SERVICIO_YA_ESTABA:
+        printf("El demonio '%s' ya esta en ejecucion.\n", nombre);
+        return -1;
+    default:
+        printf("Error al iniciar el demonio '%s'.\n", nombre);
+        return -1;
+    }
+}
+
+// Detiene un demonio y espera a que termine: SIGTERM y, si no alcanza, SIGKILL.
+// Devuelve SERVICIO_HECHO, SERVICIO_YA_ESTABA (no corria) o -1.
+static int parar_servicio(const char *nombre, int *forzado) {
+    int pidfd = -1;
+    pid_t pid = -1;
+    if (supervisor_iniciar() == 0) {
+        pthread_mutex_lock(&supervisor.mutex);
+        Servicio *sv = buscar_servicio(nombre);
+        if (sv != NULL && sv->pidfd >= 0) {
+            pid = sv->pid;
+            pidfd = dup(sv->pidfd);
+            sv->estado = SERVICIO_DETENIENDO;
+        } else if (sv != NULL) {
+            sv->estado = SERVICIO_DETENIDO; // Cancela un reinicio pendiente
+        }
+        pthread_mutex_unlock(&supervisor.mutex);
+    }
+    if (pidfd < 0) {
+        pid = obtenerPID(nombre);
+        if (pid == getpid()) {
+            printf("Error: Intento de detener la shell en lugar del demonio.\n");
+            return -1;
+        }
+        if (pid == -1 || (pidfd = pidfd_abrir(pid)) < 0) {
+            return SERVICIO_YA_ESTABA;
+        }
+    }
+
+    int resultado = SERVICIO_HECHO;
+    *forzado = 0;
+    if (pidfd_senal(pidfd, SIGTERM) != 0 && errno != ESRCH) {
+        perror("Error al detener el demonio");
+        resultado = -1;
+    } else if (!pidfd_esperar(pidfd, DEMONIO_ESPERA_TERM)) {
+        *forzado = 1;
+        if (pidfd_senal(pidfd, SIGKILL) != 0 || !pidfd_esperar(pidfd, DEMONIO_ESPERA_KILL)) {
+            printf("Error: el demonio %s (PID %d) sigue en ejecucion.\n", nombre, (int)pid);
+            resultado = -1;
+        }
+    }
+    close(pidfd);
+
+    pthread_mutex_lock(&supervisor.mutex);
+    Servicio *sv = buscar_servicio(nombre);
+    if (sv != NULL && sv->estado == SERVICIO_DETENIENDO) {
+        sv->estado = resultado == SERVICIO_HECHO ? SERVICIO_DETENIDO : SERVICIO_ACTIVO;
+    }
+    pthread_mutex_unlock(&supervisor.mutex);
+    return resultado;
+}
+
+int detenerDemonio(const char *nombre) {
+    int forzado;
+    double inicio = segundos_monotonicos();
+    switch (parar_servicio(nombre, &forzado)) {
+    case SERVICIO_HECHO:
+        informar("Demonio %s detenido%s (%.2f s).\n", nombre, forzado ? " con SIGKILL" : "",
+                 segundos_monotonicos() - inicio);
+        return 0;
+    case SERVICIO_YA_ESTABA:
+        printf("No se encontró el demonio %s en ejecucion.\n", nombre);
+        return -1;
+    default:
+        return -1;
+    }
+}
+
+static void formatear_duracion(double segundos, char *texto, size_t tam) {
+    long s = (long)segundos;
+    if (s >= 86400) {
+        snprintf(texto, tam, "%ldd%02ldh%02ldm", s / 86400, s % 86400 / 3600, s % 3600 / 60);
+    } else if (s >= 3600) {
+        snprintf(texto, tam, "%ldh%02ldm%02lds", s / 3600, s % 3600 / 60, s % 60);
+    } else {
+        snprintf(texto, tam, "%ldm%02lds", s / 60, s % 60);
+    }
+}
+
+// Implementación de 'demonio estado'
+int estadoDemonios() {
+    pthread_mutex_lock(&supervisor.mutex);
+    double ahora = segundos_monotonicos();
+    int cantidad = 0;
+    for (int k = 0; k < MAX_SERVICIOS; k++) {
+        Servicio *sv = &supervisor.tabla[k];
+        if (sv->estado == SERVICIO_LIBRE) {
+            continue;
+        }
+        if (cantidad++ == 0) {
+            printf("%-20s %-12s %8s %12s %10s %s\n", "Demonio", "Estado", "PID", "Activo", "Reinicios", "Auto");
+        }
+        char activo[32] = "-";
+        if (sv->estado == SERVICIO_ACTIVO || sv->estado == SERVICIO_DETENIENDO) {
+            formatear_duracion(ahora - sv->inicio, activo, sizeof(activo));
+        } else if (sv->estado == SERVICIO_ESPERANDO) {
+            snprintf(activo, sizeof(activo), "en %.0fs", sv->proximo > ahora ? sv->proximo - ahora : 0);
+        }
+        printf("%-20s %-12s %8d %12s %10d %s\n", sv->nombre, nombres_estado_servicio[sv->estado],
+               sv->estado == SERVICIO_ACTIVO ? (int)sv->pid : 0, activo, sv->reinicios,
+               sv->auto_reinicio ? "si" : "no");
+    }
+    pthread_mutex_unlock(&supervisor.mutex);
+    if (cantidad == 0) {
+        printf("No hay demonios bajo supervision.\n");
+    }
+    return 0;
+}
+
+
+
+// ---------------------------------------------------------------------------
+// 'demonio iniciar-todos' y 'demonio detener-todos'. Las dependencias salen de
+// la cabecera LSB de cada script (Provides, Required-Start, Should-Start). Los
+// servicios se reparten en olas: cada ola solo depende de las anteriores y sus
+// servicios se inician en paralelo. Para detener se recorren las olas al reves.
+// Si un servicio no arranca, los que lo tienen en Required-Start no se inician;
+// Should-Start solo ordena.
+// ---------------------------------------------------------------------------
+
+typedef struct {
+    char nombre[64];
+    char provee[256];     // Nombres de Provides separados por espacios
+    char requiere[512];   // Required-Start
+    char deseables[512];  // Should-Start
+    int usa_todos;        // Depende de $all
+    int *deps;            // Indices de los servicios de los que depende
+    int cant_deps;
+    int cant_duras;       // deps[0..cant_duras) vienen de Required-Start
+    int omitido;          // No se inicio porque fallo una dependencia requerida
+    int ola;
+    int resultado;
+    int forzado;
+    double latencia;
+    double fin;           // Fin del camino critico que termina en este servicio
+    int previo;           // Servicio anterior en ese camino
+} ServicioLsb;
+
+typedef struct {
+    ServicioLsb *sv;
+    int detener;
+} TareaServicio;
+
+static void agregar_campo_lsb(char *destino, size_t tam, const char *valor) {
+    size_t largo = strlen(destino);
+    snprintf(destino + largo, tam - largo, "%s%s", largo ? " " : "", valor);
+}
+
+// Lee la cabecera LSB de /etc/init.d/<nombre>. Devuelve 0 si la tiene y declara Provides.
+static int leer_cabecera_lsb(const char *nombre, ServicioLsb *sv) {
+    char ruta[MAX_LFS_INPUT], linea[512];
+    snprintf(ruta, sizeof(ruta), "/etc/init.d/%s", nombre);
+    if (access(ruta, X_OK) != 0) {
+        return -1;
+    }
+    FILE *archivo = fopen(ruta, "r");
+    if (archivo == NULL) {
+        return -1;
+    }
+    memset(sv, 0, sizeof(*sv));
+    snprintf(sv->nombre, sizeof(sv->nombre), "%s", nombre);
+    int dentro = 0;
+    while (fgets(linea, sizeof(linea), archivo) != NULL) {
+        linea[strcspn(linea, "\n")] = '\0';
+        if (strncmp(linea, "### BEGIN INIT INFO", 19) == 0) {
+            dentro = 1;
+        } else if (strncmp(linea, "### END INIT INFO", 17) == 0) {
+            break;
+        } else if (dentro && strncmp(linea, "# Provides:", 11) == 0) {
+            agregar_campo_lsb(sv->provee, sizeof(sv->provee), linea + 11);
+        } else if (dentro && strncmp(linea, "# Required-Start:", 17) == 0) {
+            agregar_campo_lsb(sv->requiere, sizeof(sv->requiere), linea + 17);
+        } else if (dentro && strncmp(linea, "# Should-Start:", 15) == 0) {
+            agregar_campo_lsb(sv->deseables, sizeof(sv->deseables), linea + 15);
+        }
+    }
+    fclose(archivo);
+    return sv->provee[0] != '\0' ? 0 : -1;
+}
+
+static int provee_nombre(const ServicioLsb *sv, const char *nombre) {
+    char copia[sizeof(sv->provee)];
+    snprintf(copia, sizeof(copia), "%s", sv->provee);
+    char *resto = copia, *palabra;
+    while ((palabra = strsep(&resto, " \t")) != NULL) {
+        if (strcmp(palabra, nombre) == 0) {
+            return 1;
+        }
+    }
+    return strcmp(sv->nombre, nombre) == 0;
+}
+
+// Agrega a servicios[i] los servicios que proveen los nombres de 'nombres'
+static void agregar_dependencias(ServicioLsb *servicios, int cantidad, int i, const char *nombres) {
+    ServicioLsb *sv = &servicios[i];
+    char copia[sizeof(sv->requiere)];
+    snprintf(copia, sizeof(copia), "%s", nombres);
+    char *resto = copia, *palabra;
+    while ((palabra = strsep(&resto, " \t")) != NULL) {
+        if (strcmp(palabra, "$all") == 0) {
+            sv->usa_todos = 1;
+            continue;
+        }
+        for (int j = 0; *palabra && j < cantidad; j++) {
+            int repetida = 0;
+            for (int d = 0; d < sv->cant_deps; d++) {
+                repetida |= sv->deps[d] == j;
+            }
+            if (j != i && !repetida && provee_nombre(&servicios[j], palabra)) {
+                sv->deps[sv->cant_deps++] = j;
+            }
+        }
+    }
+}
+
+// Convierte los nombres requeridos en indices. Las facilidades que ningun
+// script provee (por ejemplo $local_fs en un sistema sin ese script) se ignoran.
+// Un servicio cuyas dependencias no se pudieron resolver queda como fallido.
+static void resolver_dependencias(ServicioLsb *servicios, int cantidad) {
+    for (int i = 0; i < cantidad; i++) {
+        servicios[i].deps = calloc(cantidad, sizeof(int));
+        if (servicios[i].deps == NULL) {
+            fprintf(stderr, "Error de memoria al resolver las dependencias de '%s'\n", servicios[i].nombre);
+            servicios[i].omitido = 1;
+            servicios[i].resultado = -1;
+            continue;
+        }
+        agregar_dependencias(servicios, cantidad, i, servicios[i].requiere);
+        servicios[i].cant_duras = servicios[i].cant_deps;
+        agregar_dependencias(servicios, cantidad, i, servicios[i].deseables);
+    }
+    // $all: despues de todos los que no lo usan
+    for (int i = 0; i < cantidad; i++) {
+        for (int j = 0; servicios[i].deps != NULL && servicios[i].usa_todos && j < cantidad; j++) {
+            int repetida = 0;
+            for (int d = 0; d < servicios[i].cant_deps; d++) {
+                repetida |= servicios[i].deps[d] == j;
+            }
+            if (!servicios[j].usa_todos && !repetida) {
+                servicios[i].deps[servicios[i].cant_deps++] = j;
+            }
+        }
+    }
+}
+
+// Asigna a cada servicio su ola (la longitud del camino de dependencias mas
+// largo que llega a el). Devuelve la cantidad de olas; los servicios en un
+// ciclo quedan con ola -1.
+static int calcular_olas(ServicioLsb *servicios, int cantidad) {
+    for (int i = 0; i < cantidad; i++) {
+        servicios[i].ola = -1;
+    }
+    int asignados = 0, olas = 0;
+    while (asignados < cantidad) {
+        int nuevos = 0;
+        for (int i = 0; i < cantidad; i++) {
+            if (servicios[i].ola >= 0) {
+                continue;
+            }
+            int listo = 1;
+            for (int d = 0; d < servicios[i].cant_deps; d++) {
+                int ola_dep = servicios[servicios[i].deps[d]].ola;
+                listo &= ola_dep >= 0 && ola_dep < olas;
+            }
+            if (listo) {
+                servicios[i].ola = olas;
+                nuevos++;
+            }
+        }
+        if (nuevos == 0) {
+            break; // Lo que falta esta en un ciclo
+        }
+        asignados += nuevos;
+        olas++;
+    }
+    return olas;
+}
+
+static void tarea_servicio(void *arg) {
+    TareaServicio *tarea = arg;
+    double inicio = segundos_monotonicos();
+    tarea->sv->resultado = tarea->detener ? parar_servicio(tarea->sv->nombre, &tarea->sv->forzado)
+                                          : arrancar_servicio(tarea->sv->nombre, 0);
+    tarea->sv->latencia = segundos_monotonicos() - inicio;
+}
+
+// Implementación de 'demonio iniciar-todos' y 'demonio detener-todos'
+int todosDemonios(int detener) {
+    DIR *dp = opendir("/etc/init.d");
+    if (dp == NULL) {
+        perror("Error al abrir /etc/init.d");
+        return -1;
+    }
+    ServicioLsb *servicios = NULL;
+    int cantidad = 0, capacidad = 0;
+    struct dirent *entry;
+    while ((entry = readdir(dp)) != NULL) {
+        if (entry->d_name[0] == '.' || strlen(entry->d_name) >= sizeof(servicios->nombre)) {
+            continue;
+        }
+        if (cantidad == capacidad) {
+            int nueva = capacidad ? capacidad * 2 : 32;
+            ServicioLsb *mas = realloc(servicios, nueva * sizeof(ServicioLsb));
+            if (mas == NULL) {
+                perror("Error de memoria");
+                free(servicios);
+                closedir(dp);
+                return -1;
+            }
+            servicios = mas;
+            capacidad = nueva;
+        }
+        if (leer_cabecera_lsb(entry->d_name, &servicios[cantidad]) == 0) {
+            cantidad++;
+        }
+    }
+    closedir(dp);
+    if (cantidad == 0) {
+        printf("No hay scripts con cabecera LSB en /etc/init.d.\n");
+        free(servicios);
+        return 0;
+    }
+
+    resolver_dependencias(servicios, cantidad);
+    int olas = calcular_olas(servicios, cantidad);
+    PoolHilos *pool = pool_crear(cantidad < 32 ? cantidad : 32);
+    TareaServicio *tareas = calloc(cantidad, sizeof(TareaServicio));
+    if (pool == NULL || tareas == NULL) {
+        perror("Error al preparar los hilos de los demonios");
+        for (int i = 0; i < cantidad; i++) {
+            servicios[i].resultado = -1;
+        }
+    }
+    double inicio = segundos_monotonicos();
+    for (int w = 0; pool != NULL && tareas != NULL && w < olas; w++) {
+        int ola = detener ? olas - 1 - w : w;
+        for (int i = 0; i < cantidad; i++) {
+            if (servicios[i].ola == ola) {
+                // Las olas anteriores ya terminaron: si fallo algo requerido, este no se inicia
+                for (int d = 0; !detener && d < servicios[i].cant_duras; d++) {
+                    servicios[i].omitido |= servicios[servicios[i].deps[d]].resultado < 0;
+                }
+                if (servicios[i].omitido) {
+                    servicios[i].resultado = -1;
+                    continue;
+                }
+                tareas[i].sv = &servicios[i];
+                tareas[i].detener = detener;
+                pool_enviar(pool, tarea_servicio, &tareas[i]);
+            }
+        }
+        pool_esperar(pool);
+    }
+    double total = segundos_monotonicos() - inicio;
+    if (pool != NULL) {
+        pool_destruir(pool);
+    }
+
+    // Camino critico: al iniciar cada servicio espera a sus dependencias; al
+    // detener espera a los que dependen de el
+    int ultimo = -1, fallidos = 0;
+    for (int i = 0; i < cantidad; i++) {
+        servicios[i].previo = -1;
+        servicios[i].fin = 0;
+    }
+    for (int w = 0; w < olas; w++) {
+        int ola = detener ? olas - 1 - w : w;
+        for (int i = 0; i < cantidad; i++) {
+            ServicioLsb *sv = &servicios[i];
+            if (sv->ola != ola) {
+                continue;
+            }
+            for (int j = 0; j < cantidad; j++) {
+                int espera = 0;
+                if (servicios[j].ola < 0) {
+                    continue;
+                }
+                for (int d = 0; !detener && d < sv->cant_deps; d++) {
+                    espera |= sv->deps[d] == j;
+                }
+                for (int d = 0; detener && d < servicios[j].cant_deps; d++) {
+                    espera |= servicios[j].deps[d] == i;
+                }
+                if (espera && (sv->previo < 0 || servicios[j].fin > servicios[sv->previo].fin)) {
+                    sv->previo = j;
+                }
+            }
+            sv->fin = sv->latencia + (sv->previo >= 0 ? servicios[sv->previo].fin : 0);
+            if (ultimo < 0 || sv->fin > servicios[ultimo].fin) {
+                ultimo = i;
+            }
+        }
+    }
+
+    printf("%-4s %-20s %-22s %s\n", "Ola", "Demonio", "Resultado", "Tiempo");
+    for (int w = 0; w < olas; w++) {
+        int ola = detener ? olas - 1 - w : w;
+        for (int i = 0; i < cantidad; i++) {
+            ServicioLsb *sv = &servicios[i];
+            if (sv->ola != ola) {
+                continue;
+            }
+            const char *resultado;
+            if (sv->omitido) {
+                resultado = "dependencia fallida";
+                fallidos++;
+            } else if (sv->resultado < 0) {
+                resultado = "error";
+                fallidos++;
+            } else if (sv->resultado == SERVICIO_YA_ESTABA) {
+                resultado = detener ? "no estaba activo" : "ya estaba activo";
+            } else if (detener) {
+                resultado = sv->forzado ? "detenido con SIGKILL" : "detenido";
+            } else {
+                resultado = sv->resultado == SERVICIO_VIGILADO ? "iniciado" : "iniciado (sin PID)";
+            }
+            printf("%-4d %-20s %-22s %.3f s\n", w, sv->nombre, resultado, sv->latencia);
+        }
+    }
+    for (int i = 0; i < cantidad; i++) {
+        if (servicios[i].ola < 0) {
+            printf("%-4s %-20s %-22s\n", "-", servicios[i].nombre, "dependencia circular");
+            fallidos++;
+        }
+    }
+
+    printf("%d demonios en %d olas: %.3f s en total, camino critico %.3f s", cantidad, olas, total,
+           ultimo >= 0 ? servicios[ultimo].fin : 0.0);
+    for (int i = ultimo, primero = 1; i >= 0; i = servicios[i].previo, primero = 0) {
+        printf("%s%s", primero ? " (" : " <- ", servicios[i].nombre);
+        if (servicios[i].previo < 0) {
+            printf(")");
+        }
+    }
+    printf("\n");
+
+    for (int i = 0; i < cantidad; i++) {
+        free(servicios[i].deps);
+    }
+    free(servicios);
+    free(tareas);
+    return fallidos == 0 ? 0 : -1;
+}
+
+void procesarDemonio(const char *accion, const char *nombre) {
+    if (strcmp(accion, "listar") == 0) {
+        listarDemonios();
+    } else if (strcmp(accion, "iniciar") == 0) {
+        iniciarDemonio(nombre, 0);
+    } else if (strcmp(accion, "detener") == 0) {
+        detenerDemonio(nombre);
+    } else {
+        printf("Acción desconocida. Usa 'listar', 'iniciar <nombre>', o 'detener <nombre>'.\n");
+    }
+}
+
+//Función para registrar el inicio de cesion
+// Registra el inicio o cierre de sesion. Al iniciar aplica el horario y las IPs
+// permitidas del usuario: devuelve -1 si no puede entrar.
+int registrar_sesion(const char *usuario, const char *accion) {
+    if (strcmp(accion, "inició") == 0) {
+        char buffer[64];
+        const char *ip = ip_cliente(buffer, sizeof(buffer));
+        int resultado = verificar_acceso(usuario, ip, time(NULL));
+        if (resultado == ACCESO_BASE_DANADA && getuid() == 0) {
+            // root entra igual para poder reparar o borrar la base
+            fprintf(stderr, "Aviso: %s esta dañada; no se aplican reglas de acceso.\n", USUARIOS_BD_FILE);
+            registrar_en(LOG_SESIONES, ": Usuario '%s' entra sin reglas: base de usuarios dañada", usuario);
+        } else if (resultado != ACCESO_PERMITIDO) {
+            registrar_en(LOG_SESIONES, ": Usuario '%s' rechazado desde %s: %s", usuario,
+                         ip != NULL ? ip : "local", motivos_acceso[resultado]);
+            fprintf(stderr, "Acceso denegado para '%s': %s.\n", usuario, motivos_acceso[resultado]);
+            return -1;
+        }
+    }
+    registrar_en(LOG_SESIONES, ": Usuario '%s' %s sesión", usuario, accion);
+    return 0;
+}
+
+// Función para registrar en el log
+void registrar_log(const char *mensaje) {
+    registrar_en(LOG_GENERAL, " %s", mensaje);
+}
+
+// ---------------------------------------------------------------------------
+// Transferencias. Cada metodo implementa la misma funcion; 'local' es el motor
+// propio: copia en trozos de TRANSFERENCIA_TROZO con varios flujos en paralelo,
+// verifica cada trozo con CRC32C releyendolo del disco (fdatasync y sus paginas
+// fuera de la cache con POSIX_FADV_DONTNEED) y anota el avance en un manifiesto
+// al lado del destino. Si se corta (Ctrl+C, caida), volver a ejecutar la misma
+// transferencia solo copia los trozos que faltan.
+// ---------------------------------------------------------------------------
+
+#define MANIFIESTO_MAGIA "LFSTRF1"
+#define SUFIJO_MANIFIESTO ".lfsmanifiesto"
+#define SUFIJO_PARCIAL ".lfsparcial"
+#define TRANSFERENCIA_DELEGADA 1 // El metodo abrio una herramienta interactiva: no se sabe si se copio
+
+typedef struct {
+    int flujos;
+} OpcionesTransferencia;
+
+typedef struct MetodoTransferencia {
+    const char *nombre;
+    int (*transferir)(const struct MetodoTransferencia *metodo, const char *origen, const char *destino,
+                      const OpcionesTransferencia *op);
+} MetodoTransferencia;
+
+typedef struct {
+    char magia[8];
+    uint64_t tam;         // Tamano y mtime del origen: si cambian no se reanuda
+    int64_t mtime_seg;
+    int64_t mtime_nseg;
+    uint32_t trozo;
+    uint32_t cant_trozos;
+} CabeceraManifiesto;
+
+typedef struct {
+    uint32_t crc;
+    uint32_t hecho;
+} TrozoManifiesto;
+
+typedef struct {
+    int origen_fd;
+    int destino_fd;
+    int manifiesto_fd;
+    uint64_t tam;
+    uint32_t cant_trozos;
+    TrozoManifiesto *trozos;  // Copia en memoria del manifiesto
+    atomic_uint siguiente;
+    atomic_int fallo;         // errno del primer error, o -1 si se interrumpio
+    atomic_ulong copiados;
+    atomic_uint reanudados;
+    atomic_uint corregidos;   // Trozos anotados como hechos que no coincidian
+} Transferencia;
+
+// Un flujo: toma el siguiente trozo pendiente hasta que no quede ninguno
+static void tarea_flujo_transferencia(void *arg) {
+    Transferencia *t = arg;
+    char *buffer = aligned_alloc(COPIA_ALINEACION, TRANSFERENCIA_TROZO);
+    char *releido = aligned_alloc(COPIA_ALINEACION, TRANSFERENCIA_TROZO);
+    size_t tramo = control_es_tramo(TRANSFERENCIA_TROZO);
+    if (buffer == NULL || releido == NULL) {
+        int esperado = 0;
+        atomic_compare_exchange_strong(&t->fallo, &esperado, ENOMEM);
+        free(buffer);
+        free(releido);
+        return;
+    }
+
+    while (atomic_load(&t->fallo) == 0) {
+        if (interrupcion_pedida) {
+            int esperado = 0;
+            atomic_compare_exchange_strong(&t->fallo, &esperado, -1);
+            break;
+        }
+        uint32_t i = atomic_fetch_add(&t->siguiente, 1);
+        if (i >= t->cant_trozos) {
+            break;
+        }
+        off_t desde = (off_t)i * TRANSFERENCIA_TROZO;
+        size_t largo = t->tam - desde < TRANSFERENCIA_TROZO ? t->tam - desde : TRANSFERENCIA_TROZO;
+
+        // Un trozo ya hecho se comprueba contra el destino antes de darlo por bueno
+        if (t->trozos[i].hecho) {
+            if (leer_completo(t->destino_fd, releido, largo, desde) == 0 &&
+                crc32c(0, releido, largo) == t->trozos[i].crc) {
+                atomic_fetch_add(&t->reanudados, 1);
+                control_es_avanzar(largo);
+                continue;
+            }
+            atomic_fetch_add(&t->corregidos, 1);
+        }
+
+        // Con limite el trozo se mueve en tramos para que la cubeta descuente de a poco
+        int error = 0;
+        for (size_t hecho = 0, pedir; hecho < largo && error == 0; hecho += pedir) {
+            pedir = largo - hecho < tramo ? largo - hecho : tramo;
+            control_es_consumir(pedir);
+            if (leer_completo(t->origen_fd, buffer + hecho, pedir, desde + hecho) != 0 ||
+                escribir_completo(t->destino_fd, buffer + hecho, pedir, desde + hecho) != 0) {
+                error = errno ? errno : EIO;
+            }
+        }
+        // La relectura tiene que salir del disco: lo escrito sigue en la cache de paginas
+        if (error == 0 && (soltar_cache(t->destino_fd, desde, largo) != 0 ||
+                           leer_completo(t->destino_fd, releido, largo, desde) != 0)) {
+            error = errno ? errno : EIO;
+        }
+        if (error != 0) {
+            int esperado = 0;
+            atomic_compare_exchange_strong(&t->fallo, &esperado, error);
+            break;
+        }
+        uint32_t crc;
+        crc = crc32c(0, buffer, largo);
+        if (crc32c(0, releido, largo) != crc) {
+            int esperado = 0;
+            atomic_compare_exchange_strong(&t->fallo, &esperado, EIO);
+            break;
+        }
+
+        TrozoManifiesto entrada = {crc, 1};
+        t->trozos[i] = entrada;
+        off_t posicion = sizeof(CabeceraManifiesto) + (off_t)i * sizeof(TrozoManifiesto);
+        if (escribir_completo(t->manifiesto_fd, &entrada, sizeof(entrada), posicion) != 0) {
+            int esperado = 0;
+            atomic_compare_exchange_strong(&t->fallo, &esperado, errno);
+            break;
+        }
+        atomic_fetch_add(&t->copiados, largo);
+    }
+    free(buffer);
+    free(releido);
+}
+
+// Abre el manifiesto y lo carga si corresponde a este origen; si no, empieza
+// uno nuevo. Devuelve el fd o -1.
+static int abrir_manifiesto(const char *ruta, const struct stat *st, Transferencia *t, int *reanuda) {
+    int fd = open(ruta, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    if (fd < 0) {
+        return -1;
+    }
+    CabeceraManifiesto esperada;
+    memset(&esperada, 0, sizeof(esperada));
+    memcpy(esperada.magia, MANIFIESTO_MAGIA, sizeof(esperada.magia));
+    esperada.tam = st->st_size;
+    esperada.mtime_seg = st->st_mtim.tv_sec;
+    esperada.mtime_nseg = st->st_mtim.tv_nsec;
+    esperada.trozo = TRANSFERENCIA_TROZO;
+    esperada.cant_trozos = t->cant_trozos;
+
+    size_t tam_trozos = (size_t)t->cant_trozos * sizeof(TrozoManifiesto);
+    CabeceraManifiesto leida;
+    *reanuda = leer_completo(fd, &leida, sizeof(leida), 0) == 0 && memcmp(&leida, &esperada, sizeof(leida)) == 0 &&
+               (tam_trozos == 0 || leer_completo(fd, t->trozos, tam_trozos, sizeof(leida)) == 0);
+    if (!*reanuda) {
+        memset(t->trozos, 0, tam_trozos);
+        if (ftruncate(fd, 0) != 0 || escribir_completo(fd, &esperada, sizeof(esperada), 0) != 0 ||
+            (tam_trozos > 0 && escribir_completo(fd, t->trozos, tam_trozos, sizeof(esperada)) != 0) ||
+            fdatasync(fd) != 0) {
+            close(fd);
+            return -1;
+        }
+    }
+    return fd;
+}
+
+// Metodo 'local': el destino es una ruta de este sistema (un directorio
+// montado, por ejemplo)
+static int transferir_local(const MetodoTransferencia *metodo, const char *origen, const char *destino,
+                            const OpcionesTransferencia *op) {
+    (void)metodo;
+    char ruta_destino[PATH_MAX], ruta_parcial[PATH_MAX + 16], ruta_manifiesto[PATH_MAX + 16];
+    struct stat st, st_destino;
+    if (stat(destino, &st_destino) == 0 && S_ISDIR(st_destino.st_mode)) {
+        const char *base = strrchr(origen, '/');
+        snprintf(ruta_destino, sizeof(ruta_destino), "%s/%s", destino, base != NULL ? base + 1 : origen);
+    } else {
+        snprintf(ruta_destino, sizeof(ruta_destino), "%s", destino);
+    }
+    snprintf(ruta_parcial, sizeof(ruta_parcial), "%s%s", ruta_destino, SUFIJO_PARCIAL);
+    snprintf(ruta_manifiesto, sizeof(ruta_manifiesto), "%s%s", ruta_destino, SUFIJO_MANIFIESTO);
+
+    Transferencia t;
+    memset(&t, 0, sizeof(t));
+    t.origen_fd = open(origen, O_RDONLY | O_CLOEXEC);
+    if (t.origen_fd < 0 || fstat(t.origen_fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+        if (t.origen_fd >= 0) {
+            errno = EINVAL;
+            close(t.origen_fd);
+        }
+        perror("Error al abrir el archivo origen");
+        return -1;
+    }
+    t.tam = st.st_size;
+    t.cant_trozos = (t.tam + TRANSFERENCIA_TROZO - 1) / TRANSFERENCIA_TROZO;
+    t.trozos = calloc(t.cant_trozos ? t.cant_trozos : 1, sizeof(TrozoManifiesto));
+
+    int reanuda = 0;
+    t.manifiesto_fd = abrir_manifiesto(ruta_manifiesto, &st, &t, &reanuda);
+    t.destino_fd = t.manifiesto_fd < 0 ? -1 : open(ruta_parcial, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    if (t.destino_fd < 0 || (!reanuda && ftruncate(t.destino_fd, 0) != 0) || ftruncate(t.destino_fd, t.tam) != 0) {
+        perror("Error al preparar el destino");
+        if (t.destino_fd >= 0) {
+            close(t.destino_fd);
+        }
+        if (t.manifiesto_fd >= 0) {
+            close(t.manifiesto_fd);
+        }
+        close(t.origen_fd);
+        free(t.trozos);
+        return -1;
+    }
+
+    int flujos = op->flujos < 1 ? 1 : op->flujos;
+    if ((uint32_t)flujos > t.cant_trozos) {
+        flujos = t.cant_trozos > 0 ? t.cant_trozos : 1;
+    }
+    interrupcion_pedida = 0;
+    double inicio = segundos_monotonicos();
+    PoolHilos *pool = pool_crear(flujos);
+    if (pool == NULL) {
+        atomic_store(&t.fallo, ENOMEM);
+    } else {
+        for (int k = 0; k < flujos; k++) {
+            pool_enviar(pool, tarea_flujo_transferencia, &t);
+        }
+        pool_esperar(pool);
+        pool_destruir(pool);
+    }
+    double duracion = segundos_monotonicos() - inicio;
+
+    int fallo = atomic_load(&t.fallo);
+    if (fallo == 0 && (fdatasync(t.destino_fd) != 0 || rename(ruta_parcial, ruta_destino) != 0)) {
+        fallo = errno;
+    }
+    if (fallo == 0) {
+        conservar_metadatos(t.origen_fd, t.destino_fd);
+        unlink(ruta_manifiesto);
+    } else {
+        fdatasync(t.manifiesto_fd); // Lo anotado hasta aca sirve para reanudar
+    }
+    close(t.destino_fd);
+    close(t.manifiesto_fd);
+    close(t.origen_fd);
+    free(t.trozos);
+
+    double mib = atomic_load(&t.copiados) / (1024.0 * 1024.0);
+    char detalle[128] = "";
+    if (reanuda) {
+        snprintf(detalle, sizeof(detalle), ", %u trozos ya estaban%s", atomic_load(&t.reanudados),
+                 atomic_load(&t.corregidos) ? " (algunos se volvieron a copiar)" : "");
+    }
+    if (fallo == -1) {
+        printf("Transferencia interrumpida: %.1f MiB copiados; repita el comando para reanudar.\n", mib);
+        return -1;
+    }
+    if (fallo != 0) {
+        errno = fallo;
+        perror("Error en la transferencia");
+        printf("Repita el comando para reanudar desde el ultimo trozo verificado.\n");
+        return -1;
+    }
+    informar("Transferencia local a '%s': %.1f MiB en %.3f s (%.1f MiB/s), %u trozos, %d flujos%s\n", ruta_destino,
+             mib, duracion, duracion > 0 ? mib / duracion : 0.0, t.cant_trozos, flujos, detalle);
+    return 0;
+}
+
+int ejecutar_comando_sistema(char **args);
+
+// scp: delega en la herramienta del sistema
+static int transferir_scp(const MetodoTransferencia *metodo, const char *origen, const char *destino,
+                          const OpcionesTransferencia *op) {
+    (void)op;
+    char *args[] = {(char *)metodo->nombre, (char *)origen, (char *)destino, NULL};
+    return ejecutar_comando_sistema(args);
+}
+
+// ftp: la herramienta es interactiva; se abre y el usuario sigue desde ahi
+static int transferir_ftp(const MetodoTransferencia *metodo, const char *origen, const char *destino,
+                          const OpcionesTransferencia *op) {
+    (void)op;
+    printf("Se abre %s: transferir '%s' a '%s' desde ahi.\n", metodo->nombre, origen, destino);
+    char *args[] = {(char *)metodo->nombre, NULL};
+    return ejecutar_comando_sistema(args) == 0 ? TRANSFERENCIA_DELEGADA : -1;
+}
+
+static const MetodoTransferencia metodos_transferencia[] = {
+    {"local", transferir_local},
+    {"scp", transferir_scp},
+    {"ftp", transferir_ftp},
+};
+
+// Función para ejecutar la transferencia
+int transferencia_archivo(const char *origen, const char *destino, const char *metodo, const OpcionesTransferencia *op) {
+    for (size_t k = 0; k < sizeof(metodos_transferencia) / sizeof(metodos_transferencia[0]); k++) {
+        const MetodoTransferencia *m = &metodos_transferencia[k];
+        if (strcmp(metodo, m->nombre) != 0) {
+            continue;
+        }
+        registrar_en(LOG_TRANSFERENCIAS, ": Transferencia iniciada de '%s' a '%s' usando %s", origen, destino, metodo);
+        int resultado = m->transferir(m, origen, destino, op);
+        registrar_en(LOG_TRANSFERENCIAS, ": Transferencia de '%s' a '%s' %s", origen, destino,
+                     resultado == 0 ? "completada"
+                     : resultado == TRANSFERENCIA_DELEGADA ? "delegada al cliente interactivo (sin verificar)"
+                                                           : "fallida o interrumpida");
+        return resultado == TRANSFERENCIA_DELEGADA ? 0 : resultado;
+    }
+    registrar_en(LOG_TRANSFERENCIAS, ": Método de transferencia no soportado: '%s'", metodo);
+    printf("Método de transferencia no soportado: '%s' (local, scp o ftp).\n", metodo);
+    return -1;
+}
+
+// ---------------------------------------------------------------------------
+// 'verificar': CRC32C de archivos en el pool de hilos. Cada archivo es una
+// tarea; los mayores a VERIFICAR_TROZO se parten en trozos que calculan hilos
+// distintos y se juntan con crc32c_combinar. Con -g se guarda un manifiesto
+// de texto (crc, tamano y ruta por linea) y con -c se comprueban todos los
+// archivos de un manifiesto contra lo guardado.
+// ---------------------------------------------------------------------------
+
+typedef struct {
+    char *ruta;
+    off_t tam;
+    uint32_t crc;
+    atomic_int error;   // errno del primer error, 0 si no hubo
+    uint32_t esperado;  // Lo que dice el manifiesto (-c)
+    off_t tam_esperado;
+    uint32_t *crcs;     // CRC de cada trozo si el archivo se partio
+    int cant_trozos;
+} ArchivoVerificado;
+
+typedef struct {
+    PoolHilos *pool;
+    ArchivoVerificado *archivo;
+    int trozo;
+} TareaVerificacion;
+
+static void verificacion_error(ArchivoVerificado *a, int error) {
+    int esperado = 0;
+    atomic_compare_exchange_strong(&a->error, &esperado, error ? error : EIO);
+}
+
+static void tarea_verificar_trozo(void *arg) {
+    TareaVerificacion *t = arg;
+    ArchivoVerificado *a = t->archivo;
+    off_t desde = (off_t)t->trozo * VERIFICAR_TROZO;
+    off_t hasta = a->tam - desde < VERIFICAR_TROZO ? a->tam : desde + VERIFICAR_TROZO;
+    char *buffer = malloc(VERIFICAR_BUFFER);
+    int fd = open(a->ruta, O_RDONLY | O_CLOEXEC);
+    uint32_t crc = 0;
+    if (buffer == NULL || fd < 0 || crc_rango(fd, desde, hasta, buffer, VERIFICAR_BUFFER, &crc) != 0) {
+        verificacion_error(a, errno);
+    }
+    a->crcs[t->trozo] = crc;
+    if (fd >= 0) {
+        close(fd);
+    }
+    free(buffer);
+    free(t);
+}
+
+static void tarea_verificar_archivo(void *arg) {
+    TareaVerificacion *t = arg;
+    ArchivoVerificado *a = t->archivo;
+    struct stat st;
+    int fd = open(a->ruta, O_RDONLY | O_CLOEXEC);
+    if (fd < 0 || fstat(fd, &st) != 0) {
+        verificacion_error(a, errno);
+    } else if (!S_ISREG(st.st_mode)) {
+        verificacion_error(a, S_ISDIR(st.st_mode) ? EISDIR : EINVAL);
+    } else if (st.st_size > VERIFICAR_TROZO) {
+        a->tam = st.st_size;
+        a->cant_trozos = (int)((st.st_size + VERIFICAR_TROZO - 1) / VERIFICAR_TROZO);
+        a->crcs = calloc(a->cant_trozos, sizeof(uint32_t));
+        for (int k = 0; a->crcs != NULL && k < a->cant_trozos; k++) {
+            TareaVerificacion *trozo = malloc(sizeof(TareaVerificacion));
+            if (trozo == NULL) {
+                verificacion_error(a, ENOMEM);
+                break;
+            }
+            *trozo = (TareaVerificacion){t->pool, a, k};
+            pool_enviar(t->pool, tarea_verificar_trozo, trozo);
+        }
+        if (a->crcs == NULL) {
+            verificacion_error(a, ENOMEM);
+        }
+    } else {
+        char *buffer = malloc(VERIFICAR_BUFFER);
+        a->tam = st.st_size;
+        a->crc = 0;
+        if (buffer == NULL || crc_rango(fd, 0, st.st_size, buffer, VERIFICAR_BUFFER, &a->crc) != 0) {
+            verificacion_error(a, errno);
+        }
+        free(buffer);
+    }
+    if (fd >= 0) {
+        close(fd);
+    }
+}
+
+// Calcula el CRC32C de todos los archivos con 'hilos' hilos. Devuelve los bytes leidos.
+static unsigned long long verificar_archivos(ArchivoVerificado *archivos, size_t cantidad, int hilos) {
+    TareaVerificacion *tareas = calloc(cantidad + 1, sizeof(TareaVerificacion));
+    PoolHilos *pool = tareas != NULL ? pool_crear(hilos) : NULL;
+    unsigned long long total = 0;
+    for (size_t k = 0; k < cantidad; k++) {
+        tareas[k] = (TareaVerificacion){pool, &archivos[k], -1};
+        if (pool != NULL) {
+            pool_enviar(pool, tarea_verificar_archivo, &tareas[k]);
+        } else if (tareas != NULL) {
+            tarea_verificar_archivo(&tareas[k]);
+        } else {
+            verificacion_error(&archivos[k], ENOMEM);
+        }
+    }
+    if (pool != NULL) {
+        pool_esperar(pool);
+        pool_destruir(pool);
+    }
+    free(tareas);
+
+    for (size_t k = 0; k < cantidad; k++) {
+        ArchivoVerificado *a = &archivos[k];
+        if (a->crcs != NULL) {
+            a->crc = a->crcs[0];
+            for (int j = 1; j < a->cant_trozos; j++) {
+                off_t largo = a->tam - (off_t)j * VERIFICAR_TROZO;
+                a->crc = crc32c_combinar(a->crc, a->crcs[j], largo < VERIFICAR_TROZO ? largo : VERIFICAR_TROZO);
+            }
+            free(a->crcs);
+            a->crcs = NULL;
+        }
+        if (atomic_load(&a->error) == 0) {
+            total += a->tam;
+        }
+    }
+    return total;
+}
+
+// Lee un manifiesto de 'verificar -g'; las lineas con '#' se saltean
+static ArchivoVerificado *leer_manifiesto_crc(const char *ruta, size_t *cantidad) {
+    FILE *f = fopen(ruta, "r");
+    if (f == NULL) {
+        perror("Error al abrir el manifiesto");
+        return NULL;
+    }
+    ArchivoVerificado *archivos = NULL;
+    size_t capacidad = 0;
+    char *linea = NULL;
+    size_t tam = 0;
+    ssize_t largo;
+    int numero = 0;
+    *cantidad = 0;
+    while ((largo = getline(&linea, &tam, f)) >= 0) {
+        numero++;
+        if (largo > 0 && linea[largo - 1] == '\n') {
+            linea[--largo] = '\0';
+        }
+        if (linea[0] == '#' || linea[0] == '\0') {
+            continue;
+        }
+        unsigned crc;
+        long long bytes;
+        int inicio_ruta = 0;
+        if (sscanf(linea, "%8x %lld %n", &crc, &bytes, &inicio_ruta) != 2 || inicio_ruta == 0 ||
+            linea[inicio_ruta] == '\0') {
+            fprintf(stderr, "Manifiesto '%s', línea %d: formato inválido\n", ruta, numero);
+            continue;
+        }
+        if (*cantidad == capacidad) {
+            capacidad = capacidad ? capacidad * 2 : 256;
+            ArchivoVerificado *nuevos = realloc(archivos, capacidad * sizeof(ArchivoVerificado));
+            if (nuevos == NULL) {
+                break;
+            }
+            archivos = nuevos;
+        }
+        ArchivoVerificado *a = &archivos[(*cantidad)++];
+        memset(a, 0, sizeof(*a));
+        a->ruta = strdup(linea + inicio_ruta);
+        a->esperado = crc;
+        a->tam_esperado = bytes;
+    }
+    free(linea);
+    fclose(f);
+    return archivos;
+}
+
+// Escribe el manifiesto en un temporal y lo renombra, para no dejar uno a medias
+static int escribir_manifiesto_crc(const char *ruta, const ArchivoVerificado *archivos, size_t cantidad) {
+    char temporal[PATH_MAX];
+    snprintf(temporal, sizeof(temporal), "%s.tmp%d", ruta, (int)getpid());
+    FILE *f = fopen(temporal, "w");
+    if (f == NULL) {
+        perror("Error al crear el manifiesto");
+        return -1;
+    }
+    fprintf(f, "# crc32c tamano ruta\n");
+    for (size_t k = 0; k < cantidad; k++) {
+        if (atomic_load(&archivos[k].error) == 0) {
+            fprintf(f, "%08x %lld %s\n", archivos[k].crc, (long long)archivos[k].tam, archivos[k].ruta);
+        }
+    }
+    if (fclose(f) != 0 || rename(temporal, ruta) != 0) {
+        perror("Error al guardar el manifiesto");
+        unlink(temporal);
+        return -1;
+    }
+    return 0;
+}
+
+#define USO_VERIFICAR "verificar [-j hilos] <archivo1> [archivo2 ... archivoN] | verificar [-j hilos] -g <manifiesto> " \
+    "<archivo1> [archivo2 ... archivoN] | verificar [-j hilos] -c <manifiesto>"
+
+// Implementación del comando 'verificar'
+int comando_verificar(int argc, char **args) {
+    int hilos = hilos_por_defecto(), k = 1;
+    const char *generar = NULL, *comprobar = NULL;
+    while (k < argc && args[k][0] == '-') {
+        if (strcmp(args[k], "-j") == 0 && k + 1 < argc && atoi(args[k + 1]) > 0) {
+            hilos = atoi(args[++k]);
+        } else if (strcmp(args[k], "-g") == 0 && k + 1 < argc) {
+            generar = args[++k];
+        } else if (strcmp(args[k], "-c") == 0 && k + 1 < argc) {
+            comprobar = args[++k];
+        } else {
+            printf("Uso: %s\n", USO_VERIFICAR);
+            return -1;
+        }
+        k++;
+    }
+    if ((comprobar != NULL) == (k < argc) || (comprobar != NULL && generar != NULL)) {
+        printf("Uso: %s\n", USO_VERIFICAR);
+        return -1;
+    }
+
+    size_t cantidad = argc - k;
+    ArchivoVerificado *archivos;
+    if (comprobar != NULL) {
+        archivos = leer_manifiesto_crc(comprobar, &cantidad);
+    } else {
+        archivos = calloc(cantidad + 1, sizeof(ArchivoVerificado));
+        for (size_t j = 0; archivos != NULL && j < cantidad; j++) {
+            archivos[j].ruta = strdup(args[k + j]);
+        }
+    }
+    if (archivos == NULL) {
+        return -1;
+    }
+
+    double inicio = segundos_monotonicos();
+    unsigned long long bytes = verificar_archivos(archivos, cantidad, hilos);
+    double duracion = segundos_monotonicos() - inicio;
+
+    size_t distintos = 0, errores = 0;
+    for (size_t j = 0; j < cantidad; j++) {
+        ArchivoVerificado *a = &archivos[j];
+        int error = atomic_load(&a->error);
+        if (error != 0) {
+            fprintf(stderr, "%s: %s\n", a->ruta, strerror(error));
+            errores++;
+        } else if (comprobar != NULL && (a->crc != a->esperado || a->tam != a->tam_esperado)) {
+            printf("DISTINTO  %s (CRC32C %08x, esperado %08x; %lld bytes, esperados %lld)\n", a->ruta, a->crc,
+                   a->esperado, (long long)a->tam, (long long)a->tam_esperado);
+            distintos++;
+        } else if (comprobar == NULL && generar == NULL) {
+            printf("%08x  %12lld  %s\n", a->crc, (long long)a->tam, a->ruta);
+        }
+    }
+    int resultado = errores == 0 && distintos == 0 ? 0 : -1;
+    if (generar != NULL && escribir_manifiesto_crc(generar, archivos, cantidad) != 0) {
+        resultado = -1;
+    }
+
+    double mib = bytes / 1048576.0;
+    if (comprobar != NULL) {
+        printf("Verificados %zu archivos: %zu iguales, %zu distintos, %zu con error "
+               "(%.1f MiB en %.3f s, %.1f MiB/s, CRC32C por %s, %d hilos)\n",
+               cantidad, cantidad - distintos - errores, distintos, errores, mib, duracion,
+               duracion > 0 ? mib / duracion : 0.0, crc32c_implementacion, hilos);
+    } else {
+        informar("%zu archivos, %.1f MiB en %.3f s (%.1f MiB/s, CRC32C por %s, %d hilos)%s%s\n", cantidad - errores,
+                 mib, duracion, duracion > 0 ? mib / duracion : 0.0, crc32c_implementacion, hilos,
+                 generar != NULL ? "; manifiesto: " : "", generar != NULL ? generar : "");
+    }
+    for (size_t j = 0; j < cantidad; j++) {
+        free(archivos[j].ruta);
+    }
+    free(archivos);
+    return resultado;
+}
+
+// ---------------------------------------------------------------------------
+// Historial de comandos. Cada linea entra completa a un anillo en memoria con
+// las ultimas de la sesion y se agrega a HISTORIAL_FILE, que solo crece. Al
+// lado vive un indice de registros fijos (desplazamiento y segundo de cada
+// linea) que se pone al dia bajo flock antes de escribir, asi tambien cubre
+// lo que agregan otras shells. Las busquedas mapean ambos archivos: el rango
+// de fechas sale de una busqueda binaria en el indice y el texto se busca con
+// memmem sobre ese tramo del log, sin partirlo en lineas.
+// ---------------------------------------------------------------------------
+
+typedef struct {
+    uint64_t desplazamiento; // Inicio de la linea en el log
+    int64_t segundo;
+} EntradaIndice;
+
+typedef struct {
+    char magia[8];  // "LFSHIX1"
+    uint64_t inodo; // Log al que corresponde; si cambia se reconstruye
+} CabeceraIndice;
+
+typedef struct {
+    unsigned long numero; // Numero de linea en el log (el que usa !n)
+    time_t segundo;
+    char *texto;
+} LineaHistorial;
+
+static struct {
+    pthread_mutex_t mutex;
+    int iniciado;
+    int fd_log;
+    int fd_indice;
+    uint64_t fin_indexado; // Bytes del log cubiertos por el indice
+    uint64_t lineas;       // Entradas del indice
+    int64_t ultimo_segundo;
+    char hora_cache[14];   // "YYYY-mm-dd HH" de la ultima marca convertida
+    time_t hora_base;
+    LineaHistorial anillo[HISTORIAL_ANILLO];
+    unsigned long agregadas; // Lineas puestas en el anillo desde el inicio
+} historial = {.mutex = PTHREAD_MUTEX_INITIALIZER, .fd_log = -1, .fd_indice = -1};
+
+// Segundo de la marca al inicio de una linea. La conversion con mktime se
+// guarda por hora: en un log grande las lineas seguidas comparten la hora.
+// Si la linea no tiene marca se usa la de la anterior.
+static int64_t historial_segundo_linea(const char *linea, size_t largo) {
+    if (largo < HISTORIAL_MARCA - 2 || linea[4] != '-' || linea[10] != ' ' || linea[13] != ':' || linea[16] != ':') {
+        return historial.ultimo_segundo;
+    }
+    if (memcmp(linea, historial.hora_cache, 13) != 0) {
+        struct tm t;
+        memset(&t, 0, sizeof(t));
+        char hora[14];
+        memcpy(hora, linea, 13);
+        hora[13] = '\0';
+        if (strptime(hora, "%Y-%m-%d %H", &t) == NULL) {
+            return historial.ultimo_segundo;
+        }
+        t.tm_isdst = -1;
+        historial.hora_base = mktime(&t);
+        memcpy(historial.hora_cache, linea, 13);
+    }
+    historial.ultimo_segundo = historial.hora_base + atoi(linea + 14) * 60 + atoi(linea + 17);
+    return historial.ultimo_segundo;
+}
+
+// Deja el indice vacio, listo para reconstruirlo desde el principio del log
+static void historial_indice_vaciar(uint64_t inodo) {
+    CabeceraIndice cab;
+    memset(&cab, 0, sizeof(cab));
+    memcpy(cab.magia, "LFSHIX1", 8);
+    cab.inodo = inodo;
+    if (ftruncate(historial.fd_indice, 0) != 0 || pwrite(historial.fd_indice, &cab, sizeof(cab), 0) != sizeof(cab)) {
+        perror("Error al reiniciar el indice del historial");
+    }
+    historial.lineas = 0;
+    historial.fin_indexado = 0;
+    historial.ultimo_segundo = 0;
+}
+
+// Revisa la cabecera del indice y calcula hasta donde cubre el log
+static void historial_indice_cargar() {
+    struct stat log_st, ind_st;
+    CabeceraIndice cab;
+    if (fstat(historial.fd_log, &log_st) != 0 || fstat(historial.fd_indice, &ind_st) != 0 ||
+        ind_st.st_size < (off_t)sizeof(cab) ||
+        pread(historial.fd_indice, &cab, sizeof(cab), 0) != sizeof(cab) ||
+        memcmp(cab.magia, "LFSHIX1", 8) != 0 || cab.inodo != (uint64_t)log_st.st_ino) {
+        historial_indice_vaciar(log_st.st_ino);
+        return;
+    }
+    historial.lineas = (ind_st.st_size - sizeof(cab)) / sizeof(EntradaIndice);
+    historial.fin_indexado = 0;
+    if (historial.lineas == 0) {
+        return;
+    }
+
+    // El indice puede terminar en un registro a medias: se ignora
+    EntradaIndice ultima;
+    off_t pos = sizeof(cab) + (historial.lineas - 1) * sizeof(EntradaIndice);
+    if (ftruncate(historial.fd_indice, pos + sizeof(ultima)) != 0 ||
+        pread(historial.fd_indice, &ultima, sizeof(ultima), pos) != sizeof(ultima) ||
+        ultima.desplazamiento >= (uint64_t)log_st.st_size) {
+        historial_indice_vaciar(log_st.st_ino); // El log se corto por debajo del indice
+        return;
+    }
+    char buffer[4096];
+    uint64_t desde = ultima.desplazamiento;
+    ssize_t n;
+    while ((n = pread(historial.fd_log, buffer, sizeof(buffer), desde)) > 0) {
+        char *fin = memchr(buffer, '\n', n);
+        if (fin != NULL) {
+            historial.fin_indexado = desde + (fin - buffer) + 1;
+            break;
+        }
+        desde += n;
+    }
+    if (historial.fin_indexado == 0) {
+        historial.fin_indexado = ultima.desplazamiento; // La ultima linea todavia no termino
+        historial.lineas--;
+    }
+    historial.ultimo_segundo = ultima.segundo;
+}
+
+static void historial_abrir() {
+    historial.fd_log = open(HISTORIAL_FILE, O_RDWR | O_APPEND | O_CREAT | O_CLOEXEC, 0644);
+    if (historial.fd_log < 0) {
+        fprintf(stderr, "Error al abrir %s: %s\n", HISTORIAL_FILE, strerror(errno));
+        return;
+    }
+    historial.fd_indice = open(HISTORIAL_INDICE_FILE, O_RDWR | O_APPEND | O_CREAT | O_CLOEXEC, 0644);
+    if (historial.fd_indice < 0) {
+        fprintf(stderr, "Error al abrir %s: %s\n", HISTORIAL_INDICE_FILE, strerror(errno));
+        close(historial.fd_log);
+        historial.fd_log = -1;
+        return;
+    }
+    flock(historial.fd_indice, LOCK_EX);
+    historial_indice_cargar();
+    flock(historial.fd_indice, LOCK_UN);
+}
+
+// Agrega al indice las lineas completas del log que todavia no tiene, sean de
+// esta shell o de otras. Se llama con el flock exclusivo del indice tomado.
+static void historial_ponerse_al_dia() {
+    struct stat st, actual;
+    if (fstat(historial.fd_log, &st) != 0) {
+        return;
+    }
+    if (stat(HISTORIAL_FILE, &actual) == 0 && actual.st_ino != st.st_ino) {
+        // El log se roto: se sigue en el archivo nuevo con un indice nuevo
+        int fd = open(HISTORIAL_FILE, O_RDWR | O_APPEND | O_CLOEXEC);
+        if (fd >= 0) {
+            dup3(fd, historial.fd_log, O_CLOEXEC);
+            close(fd);
+            historial_indice_cargar();
+            st = actual;
+        }
+    }
+    if ((uint64_t)st.st_size < historial.fin_indexado) {
+        historial_indice_vaciar(st.st_ino);
+    }
+    if ((uint64_t)st.st_size == historial.fin_indexado) {
+        return;
+    }
+
+    char *buffer = malloc(HISTORIAL_BLOQUE);
+    EntradaIndice *lote = malloc(HISTORIAL_BLOQUE / 16 * sizeof(EntradaIndice));
+    if (buffer == NULL || lote == NULL) {
+        free(buffer);
+        free(lote);
+        return;
+    }
+    uint64_t pos = historial.fin_indexado;
+    int saltando = 0; // Dentro de una linea mas larga que el bloque: no se indexa
+    while (pos < (uint64_t)st.st_size) {
+        size_t pedir = st.st_size - pos < HISTORIAL_BLOQUE ? st.st_size - pos : HISTORIAL_BLOQUE;
+        ssize_t n = pread(historial.fd_log, buffer, pedir, pos);
+        if (n <= 0) {
+            break;
+        }
+        size_t k = 0, cantidad = 0;
+        char *fin;
+        while ((fin = memchr(buffer + k, '\n', n - k)) != NULL) {
+            if (!saltando) {
+                lote[cantidad].desplazamiento = pos + k;
+                lote[cantidad].segundo = historial_segundo_linea(buffer + k, fin - (buffer + k));
+                cantidad++;
+            }
+            saltando = 0;
+            k = fin - buffer + 1;
+            if (cantidad == HISTORIAL_BLOQUE / 16) {
+                break;
+            }
+        }
+        if (k == 0 && (size_t)n == HISTORIAL_BLOQUE) {
+            saltando = 1;
+            k = n;
+        }
+        if (cantidad > 0 && write(historial.fd_indice, lote, cantidad * sizeof(EntradaIndice)) !=
+                                (ssize_t)(cantidad * sizeof(EntradaIndice))) {
+            perror("Error al escribir el indice del historial");
+            break;
+        }
+        historial.lineas += cantidad;
+        pos += k;
+        if (k == 0) {
+            break; // Solo queda una linea sin terminar
+        }
+    }
+    historial.fin_indexado = pos;
+    free(buffer);
+    free(lote);
+}
+
+static void historial_anillo_agregar(unsigned long numero, time_t segundo, const char *texto, size_t largo) {
+    LineaHistorial *l = &historial.anillo[historial.agregadas % HISTORIAL_ANILLO];
+    free(l->texto);
+    l->texto = strndup(texto, largo);
+    l->numero = numero;
+    l->segundo = segundo;
+    historial.agregadas++;
+}
+
+// Carga en el anillo las ultimas lineas del log, para que la sesion empiece con
+// lo que se hizo antes. Se llama con el mutex tomado.
+static void historial_cargar_anillo() {
+    if (historial.lineas == 0) {
+        return;
+    }
+    uint64_t primera = historial.lineas > HISTORIAL_ANILLO ? historial.lineas - HISTORIAL_ANILLO : 0;
+    EntradaIndice entrada;
+    if (pread(historial.fd_indice, &entrada, sizeof(entrada),
+              sizeof(CabeceraIndice) + primera * sizeof(EntradaIndice)) != sizeof(entrada)) {
+        return;
+    }
+    size_t tam = historial.fin_indexado - entrada.desplazamiento;
+    char *texto = malloc(tam);
+    if (texto == NULL || pread(historial.fd_log, texto, tam, entrada.desplazamiento) != (ssize_t)tam) {
+        free(texto);
+        return;
+    }
+    int64_t guardado = historial.ultimo_segundo;
+    unsigned long numero = primera + 1;
+    for (char *p = texto, *fin; p < texto + tam && (fin = memchr(p, '\n', texto + tam - p)) != NULL; p = fin + 1) {
+        size_t marca = fin - p >= HISTORIAL_MARCA && p[19] == ':' ? HISTORIAL_MARCA : 0;
+        historial_anillo_agregar(numero++, historial_segundo_linea(p, fin - p), p + marca, fin - p - marca);
+    }
+    historial.ultimo_segundo = guardado;
+    free(texto);
+}
+
+static void historial_iniciar() {
+    if (historial.iniciado) {
+        return;
+    }
+    historial.iniciado = 1;
+    historial_abrir();
+    if (historial.fd_log >= 0) {
+        flock(historial.fd_indice, LOCK_EX);
+        historial_ponerse_al_dia();
+        flock(historial.fd_indice, LOCK_UN);
+        historial_cargar_anillo();
+    }
+}
+
+// Funcion para registrar en el historial: guarda la linea completa tal como se escribio
+void registrar_historial(const char *linea) {
+    while (*linea == ' ' || *linea == '\t') {
+        linea++;
+    }
+    size_t largo = strlen(linea);
+    while (largo > 0 && (linea[largo - 1] == '\n' || linea[largo - 1] == '\r' || linea[largo - 1] == ' ')) {
+        largo--;
+    }
+    if (largo == 0) {
+        return;
+    }
+
+    pthread_mutex_lock(&historial.mutex);
+    historial_iniciar();
+    unsigned long numero = historial.lineas + 1;
+    time_t ahora = time(NULL);
+    if (historial.fd_log >= 0 && flock(historial.fd_indice, LOCK_EX) == 0) {
+        historial_ponerse_al_dia();
+        char marca[64];
+        obtener_timestamp(marca, sizeof(marca));
+        char *registro = malloc(strlen(marca) + largo + 4);
+        if (registro != NULL) {
+            int n = sprintf(registro, "%s: %.*s\n", marca, (int)largo, linea);
+            // Con O_APPEND la posicion tras escribir es el nuevo fin del log
+            EntradaIndice entrada = {0, historial_segundo_linea(registro, n)};
+            off_t fin;
+            if (write(historial.fd_log, registro, n) == n && (fin = lseek(historial.fd_log, 0, SEEK_CUR)) >= n) {
+                entrada.desplazamiento = fin - n;
+                if (write(historial.fd_indice, &entrada, sizeof(entrada)) == sizeof(entrada)) {
+                    historial.lineas++;
+                    historial.fin_indexado = fin;
+                } else {
+                    historial_ponerse_al_dia();
+                }
+            } else {
+                perror("Error al escribir el historial");
+            }
+            free(registro);
+        }
+        numero = historial.lineas;
+        flock(historial.fd_indice, LOCK_UN);
+    } else {
+        historial.lineas++;
+    }
+    historial_anillo_agregar(numero, ahora, linea, largo);
+    pthread_mutex_unlock(&historial.mutex);
+}
+
+// Copia en 'destino' la linea numero 'numero' del historial. Devuelve 0 si existe.
+static int historial_leer_numero(unsigned long numero, char *destino, size_t tam) {
+    pthread_mutex_lock(&historial.mutex);
+    historial_iniciar();
+    int resultado = -1;
+    unsigned long cantidad = historial.agregadas < HISTORIAL_ANILLO ? historial.agregadas : HISTORIAL_ANILLO;
+    for (unsigned long k = 0; k < cantidad && resultado != 0; k++) {
+        LineaHistorial *l = &historial.anillo[(historial.agregadas - 1 - k) % HISTORIAL_ANILLO];
+        if (l->numero == numero) {
+            snprintf(destino, tam, "%s", l->texto);
+            resultado = 0;
+        }
+    }
+    EntradaIndice entrada[2];
+    if (resultado != 0 && historial.fd_log >= 0 && numero >= 1 && numero <= historial.lineas) {
+        ssize_t n = pread(historial.fd_indice, entrada, sizeof(entrada),
+                          sizeof(CabeceraIndice) + (numero - 1) * sizeof(EntradaIndice));
+        uint64_t fin = n == sizeof(entrada) ? entrada[1].desplazamiento : historial.fin_indexado;
+        size_t largo = fin - entrada[0].desplazamiento;
+        char *linea = n >= (ssize_t)sizeof(EntradaIndice) ? malloc(largo + 1) : NULL;
+        if (linea != NULL && pread(historial.fd_log, linea, largo, entrada[0].desplazamiento) == (ssize_t)largo) {
+            while (largo > 0 && linea[largo - 1] == '\n') {
+                largo--;
+            }
+            linea[largo] = '\0';
+            size_t marca = largo >= HISTORIAL_MARCA && linea[19] == ':' ? HISTORIAL_MARCA : 0;
+            snprintf(destino, tam, "%s", linea + marca);
+            resultado = 0;
+        }
+        free(linea);
+    }
+    pthread_mutex_unlock(&historial.mutex);
+    return resultado;
+}
+
+// Expande una referencia al historial al principio de la linea: !! (la ultima),
+// !n (la linea n), !-n (la n-esima desde el final) o !texto (la ultima que
+// empieza con texto). El resto de la linea se agrega despues. Devuelve 1 si
+// expandio, 0 si no habia referencia y -1 si no se encontro.
+int expandir_historial(const char *linea, char *destino, size_t tam) {
+    while (*linea == ' ' || *linea == '\t') {
+        linea++;
+    }
+    if (linea[0] != '!' || linea[1] == '\0' || linea[1] == ' ' || linea[1] == '=') {
+        return 0;
+    }
+    const char *p = linea + 1;
+    const char *resto = p + strcspn(p, " \t|<>&");
+    char evento[MAX_LFS_INPUT];
+    int encontrado = -1;
+
+    pthread_mutex_lock(&historial.mutex);
+    historial_iniciar();
+    unsigned long cantidad = historial.agregadas < HISTORIAL_ANILLO ? historial.agregadas : HISTORIAL_ANILLO;
+    pthread_mutex_unlock(&historial.mutex);
+
+    if (*p == '!' || (*p == '-' && p[1] >= '0' && p[1] <= '9')) {
+        unsigned long atras = *p == '!' ? 1 : strtoul(p + 1, NULL, 10);
+        resto = *p == '!' ? p + 1 : resto;
+        pthread_mutex_lock(&historial.mutex);
+        if (atras >= 1 && atras <= cantidad) {
+            snprintf(evento, sizeof(evento), "%s",
+                     historial.anillo[(historial.agregadas - atras) % HISTORIAL_ANILLO].texto);
+            encontrado = 0;
+        }
+        pthread_mutex_unlock(&historial.mutex);
+    } else if (*p >= '0' && *p <= '9') {
+        encontrado = historial_leer_numero(strtoul(p, NULL, 10), evento, sizeof(evento));
+    } else {
+        size_t largo = resto - p;
+        pthread_mutex_lock(&historial.mutex);
+        for (unsigned long k = 0; k < cantidad && encontrado != 0; k++) {
+            LineaHistorial *l = &historial.anillo[(historial.agregadas - 1 - k) % HISTORIAL_ANILLO];
+            if (strncmp(l->texto, p, largo) == 0) {
+                snprintf(evento, sizeof(evento), "%s", l->texto);
+                encontrado = 0;
+            }
+        }
+        pthread_mutex_unlock(&historial.mutex);
+    }
+
+    if (encontrado != 0) {
+        printf("%.*s: evento no encontrado\n", (int)(resto - linea), linea);
+        return -1;
+    }
+    snprintf(destino, tam, "%s%s", evento, resto);
+    return 1;
+}
+
+// Lee una fecha para buscar en el historial: "YYYY-mm-dd", "YYYY-mm-dd HH:MM[:SS]",
+// "HH:MM" (de hoy) o hace un tiempo: 30m, 2h, 7d. Una fecha sin hora usada como
+// limite superior cubre el dia entero.
+static int leer_fecha_historial(const char *texto, int hasta, time_t *resultado) {
+    char *fin;
+    long cantidad = strtol(texto, &fin, 10);
+    if (fin != texto && fin[0] != '\0' && fin[1] == '\0' && strchr("smhd", fin[0]) != NULL && cantidad >= 0) {
+        long unidad = fin[0] == 's' ? 1 : fin[0] == 'm' ? 60 : fin[0] == 'h' ? 3600 : 86400;
+        *resultado = time(NULL) - cantidad * unidad;
+        return 0;
+    }
+
+    struct tm t;
+    time_t ahora = time(NULL);
+    localtime_r(&ahora, &t);
+    t.tm_sec = 0;
+    const char *resto;
+    int solo_dia = 0;
+    if ((resto = strptime(texto, "%Y-%m-%d %H:%M:%S", &t)) == NULL || *resto != '\0') {
+        t.tm_sec = 0;
+        if ((resto = strptime(texto, "%Y-%m-%d %H:%M", &t)) == NULL || *resto != '\0') {
+            if ((resto = strptime(texto, "%Y-%m-%d", &t)) != NULL && *resto == '\0') {
+                t.tm_hour = t.tm_min = 0;
+                solo_dia = 1;
+            } else if ((resto = strptime(texto, "%H:%M", &t)) == NULL || *resto != '\0') {
+                return -1;
+            }
+        }
+    }
+    t.tm_isdst = -1;
+    *resultado = mktime(&t);
+    if (hasta && solo_dia) {
+        *resultado += 86400 - 1;
+    }
+    return 0;
+}
+
+// Primera entrada del indice con segundo >= objetivo (o > si 'despues')
+static uint64_t historial_buscar_segundo(const EntradaIndice *indice, uint64_t cantidad, time_t objetivo, int despues) {
+    uint64_t bajo = 0, alto = cantidad;
+    while (bajo < alto) {
+        uint64_t medio = bajo + (alto - bajo) / 2;
+        if (despues ? indice[medio].segundo <= objetivo : indice[medio].segundo < objetivo) {
+            bajo = medio + 1;
+        } else {
+            alto = medio;
+        }
+    }
+    return bajo;
+}
+
+// Linea que contiene el desplazamiento 'pos' dentro de [bajo, alto)
+static uint64_t historial_linea_de(const EntradaIndice *indice, uint64_t bajo, uint64_t alto, uint64_t pos) {
+    while (alto - bajo > 1) {
+        uint64_t medio = bajo + (alto - bajo) / 2;
+        if (indice[medio].desplazamiento <= pos) {
+            bajo = medio;
+        } else {
+            alto = medio;
+        }
+    }
+    return bajo;
+}
+
+// Busca en todo el log las lineas del rango de fechas que contienen 'texto'
+// (NULL: todas). Muestra las ultimas 'maximo' (0: todas).
+static int historial_buscar(const char *texto, time_t desde, time_t hasta, unsigned long maximo) {
+    pthread_mutex_lock(&historial.mutex);
+    historial_iniciar();
+    if (historial.fd_log < 0) {
+        pthread_mutex_unlock(&historial.mutex);
+        return -1;
+    }
+    flock(historial.fd_indice, LOCK_EX);
+    historial_ponerse_al_dia();
+    flock(historial.fd_indice, LOCK_UN);
+    // El log y el indice solo crecen: el tramo ya indexado no cambia mientras se busca
+    uint64_t lineas = historial.lineas, tam_log = historial.fin_indexado;
+    int fd_log = historial.fd_log, fd_indice = historial.fd_indice;
+    pthread_mutex_unlock(&historial.mutex);
+    if (lineas == 0) {
+        printf("El historial esta vacio.\n");
+        return 0;
+    }
+
+    size_t tam_indice = sizeof(CabeceraIndice) + lineas * sizeof(EntradaIndice);
+    char *mapa_indice = mmap(NULL, tam_indice, PROT_READ, MAP_SHARED, fd_indice, 0);
+    char *log = mmap(NULL, tam_log, PROT_READ, MAP_SHARED, fd_log, 0);
+    if (mapa_indice == MAP_FAILED || log == MAP_FAILED) {
+        perror("Error al mapear el historial");
+        if (mapa_indice != MAP_FAILED) {
+            munmap(mapa_indice, tam_indice);
+        }
+        if (log != MAP_FAILED) {
+            munmap(log, tam_log);
+        }
+        return -1;
+    }
+    const EntradaIndice *indice = (const EntradaIndice *)(mapa_indice + sizeof(CabeceraIndice));
+
+    uint64_t primera = historial_buscar_segundo(indice, lineas, desde, 0);
+    uint64_t ultima = historial_buscar_segundo(indice, lineas, hasta, 1);
+    uint64_t *hallazgos = NULL;
+    size_t cantidad = 0, capacidad = 0;
+    if (primera < ultima) {
+        const char *inicio = log + indice[primera].desplazamiento;
+        const char *fin = ultima < lineas ? log + indice[ultima].desplazamiento : log + tam_log;
+        char *alineado = log + (indice[primera].desplazamiento & ~(uint64_t)4095);
+        madvise(alineado, fin - alineado, MADV_SEQUENTIAL);
+        size_t largo_texto = texto != NULL ? strlen(texto) : 0;
+        const char *p = inicio;
+        uint64_t linea = primera;
+        while (p < fin) {
+            if (texto != NULL) {
+                const char *hallado = memmem(p, fin - p, texto, largo_texto);
+                if (hallado == NULL) {
+                    break;
+                }
+                linea = historial_linea_de(indice, linea, ultima, hallado - log);
+                const char *comienzo = log + indice[linea].desplazamiento;
+                const char *comando = comienzo + (fin - comienzo > HISTORIAL_MARCA && comienzo[19] == ':' ? HISTORIAL_MARCA : 0);
+                if (hallado < comando) {
+                    p = comando; // Coincidio en la marca de tiempo: se sigue desde el comando
+                    continue;
+                }
+            }
+            if (cantidad == capacidad) {
+                capacidad = capacidad ? capacidad * 2 : 1024;
+                uint64_t *nuevos = realloc(hallazgos, capacidad * sizeof(uint64_t));
+                if (nuevos == NULL) {
+                    break;
+                }
+                hallazgos = nuevos;
+            }
+            hallazgos[cantidad++] = linea;
+            linea++;
+            p = linea < lineas ? log + indice[linea].desplazamiento : fin;
+        }
+    }
+
+    size_t desde_k = maximo > 0 && cantidad > maximo ? cantidad - maximo : 0;
+    for (size_t k = desde_k; k < cantidad; k++) {
+        uint64_t n = hallazgos[k];
+        const char *comienzo = log + indice[n].desplazamiento;
+        const char *fin = n + 1 < lineas ? log + indice[n + 1].desplazamiento : log + tam_log;
+        while (fin > comienzo && fin[-1] == '\n') {
+            fin--;
+        }
+        printf("%6lu  %.*s\n", (unsigned long)n + 1, (int)(fin - comienzo), comienzo);
+    }
+    if (cantidad == 0) {
+        printf("Sin resultados en el historial.\n");
+    }
+    free(hallazgos);
+    munmap(mapa_indice, tam_indice);
+    munmap(log, tam_log);
+    return 0;
+}
+
+#define USO_HISTORIAL "historial [-n cantidad] | historial [-b texto] [-d desde] [-h hasta] [-n cantidad]\n" \
+    "Fechas: YYYY-mm-dd, \"YYYY-mm-dd HH:MM[:SS]\", HH:MM o hace un tiempo: 30m, 2h, 7d. !n, !-n, !! y !texto repiten una linea"
+
+// Implementación del comando 'historial': sin opciones muestra las ultimas lineas
+// de la sesion; -b busca texto y -d/-h limitan por fecha en todo el historial
+int comando_historial(int argc, char **args) {
+    const char *texto = NULL;
+    time_t desde = 0, hasta = (time_t)INT64_MAX;
+    unsigned long maximo = 0;
+    int buscar = 0;
+    for (int k = 1; k < argc; k++) {
+        if (k + 1 >= argc) {
+            printf("Uso: %s\n", USO_HISTORIAL);
+            return -1;
+        }
+        if (strcmp(args[k], "-b") == 0) {
+            texto = args[++k];
+            buscar = 1;
+        } else if (strcmp(args[k], "-d") == 0 || strcmp(args[k], "-h") == 0) {
+            int es_hasta = args[k][1] == 'h';
+            if (leer_fecha_historial(args[++k], es_hasta, es_hasta ? &hasta : &desde) != 0) {
+                printf("historial: fecha no valida: %s\n", args[k]);
+                return -1;
+            }
+            buscar = 1;
+        } else if (strcmp(args[k], "-n") == 0 && atol(args[k + 1]) > 0) {
+            maximo = atol(args[++k]);
+        } else {
+            printf("Uso: %s\n", USO_HISTORIAL);
+            return -1;
+        }
+    }
+    if (buscar) {
+        return historial_buscar(texto, desde, hasta, maximo);
+    }
+
+    pthread_mutex_lock(&historial.mutex);
+    historial_iniciar();
+    unsigned long cantidad = historial.agregadas < HISTORIAL_ANILLO ? historial.agregadas : HISTORIAL_ANILLO;
+    if (maximo == 0) {
+        maximo = HISTORIAL_MOSTRAR;
+    }
+    for (unsigned long k = cantidad > maximo ? cantidad - maximo : 0; k < cantidad; k++) {
+        LineaHistorial *l = &historial.anillo[(historial.agregadas - cantidad + k) % HISTORIAL_ANILLO];
+        char fecha[32];
+        struct tm t;
+        localtime_r(&l->segundo, &t);
+        strftime(fecha, sizeof(fecha), "%Y-%m-%d %H:%M:%S", &t);
+        printf("%6lu  %s  %s\n", l->numero, fecha, l->texto);
+    }
+    pthread_mutex_unlock(&historial.mutex);
+    return 0;
+}
+
+// ---------------------------------------------------------------------------
+// Comodines: *, ?, [...] y ** (cualquier cantidad de directorios). El patron
+// se recorre componente por componente con una sola pasada de getdents64 por
+// directorio y los directorios se abren relativos al fd del anterior. Los
+// componentes sin comodines no leen el directorio. Los comandos externos y
+// casi todos los internos reciben los nombres ya expandidos y ordenados; los
+// internos que trabajan sobre muchos archivos (permisos, propietario, copiar)
+// reciben el patron y lo recorren con recorrer_argumentos, que les pasa los
+// nombres de a lotes a medida que aparecen, sin armar un argv gigante.
+// ---------------------------------------------------------------------------
+
+// Devuelve 0 para seguir o distinto de 0 para cortar el recorrido
+typedef int (*VisitaGlob)(const char *ruta, void *ctx);
+
+typedef struct {
+    char **componentes;
+    int cantidad;
+    VisitaGlob visitar;
+    void *ctx;
+    int solo_directorios; // El patron terminaba en '/'
+    long hallados;
+    int cortar;
+    char ruta[PATH_MAX];
+} RecorridoGlob;
+
+// Formas con comodines de los argumentos del comando interno que corre en este
+// hilo (NULL si ninguno tiene); las deja ejecutar_etapa_interna
+static __thread char **patrones_del_hilo = NULL;
+
+// Hay un *, ? o [ sin escapar
+static int tiene_comodines(const char *texto) {
+    for (const char *c = texto; *c != '\0'; c++) {
+        if (*c == '\\' && c[1] != '\0') {
+            c++;
+        } else if (*c == '*' || *c == '?' || *c == '[') {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Quita las barras invertidas de un componente sin comodines
+static void quitar_escapes(const char *texto, char *destino, size_t tam) {
+    size_t n = 0;
+    for (const char *c = texto; *c != '\0' && n + 1 < tam; c++) {
+        if (*c == '\\' && c[1] != '\0') {
+            c++;
+        }
+        destino[n++] = *c;
+    }
+    destino[n] = '\0';
+}
+
+static int glob_visitar(RecorridoGlob *r) {
+    struct stat st;
+    size_t largo = strlen(r->ruta);
+    if (r->solo_directorios) {
+        if (stat(r->ruta, &st) != 0 || !S_ISDIR(st.st_mode) || largo + 1 >= sizeof(r->ruta)) {
+            return 0;
+        }
+        strcpy(r->ruta + largo, "/");
+    }
+    r->hallados++;
+    if (r->visitar(r->ruta, r->ctx) != 0) {
+        r->cortar = 1;
+    }
+    r->ruta[largo] = '\0';
+    return r->cortar;
+}
+
+// Agrega 'nombre' a la ruta actual; devuelve el largo anterior para volver atras
+static size_t glob_entrar(RecorridoGlob *r, const char *nombre) {
+    size_t largo = strlen(r->ruta);
+    snprintf(r->ruta + largo, sizeof(r->ruta) - largo, "%s%s",
+             largo > 0 && r->ruta[largo - 1] != '/' ? "/" : "", nombre);
+    return largo;
+}
+
+static int glob_es_directorio(int dir_fd, const char *nombre, unsigned char tipo) {
+    struct stat st;
+    if (tipo == DT_DIR) {
+        return 1;
+    }
+    // Los enlaces a directorios se siguen como en las demas shells, salvo con **
+    return (tipo == DT_UNKNOWN || tipo == DT_LNK) && fstatat(dir_fd, nombre, &st, 0) == 0 && S_ISDIR(st.st_mode);
+}
+
+static void glob_nivel(RecorridoGlob *r, int dir_fd, int indice);
+
+// 'nombre' coincide con el componente 'indice': lo entrega si es el ultimo o
+// sigue con el resto del patron dentro de el
+static void glob_coincide(RecorridoGlob *r, int dir_fd, const char *nombre, unsigned char tipo, int indice) {
+    size_t antes = glob_entrar(r, nombre);
+    if (indice == r->cantidad - 1) {
+        glob_visitar(r);
+    } else if (glob_es_directorio(dir_fd, nombre, tipo)) {
+        int sub_fd = openat(dir_fd, nombre, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (sub_fd >= 0) {
+            glob_nivel(r, sub_fd, indice + 1);
+            close(sub_fd);
+        }
+    }
+    r->ruta[antes] = '\0';
+}
+
+// Lee el directorio una sola vez. Sin 'recursivo' entrega las entradas que
+// coinciden con el componente 'indice'. Con 'recursivo' el componente es **:
+// en la misma pasada prueba el componente siguiente y baja a cada
+// subdirectorio no oculto (sin seguir enlaces, para no entrar en ciclos).
+static void glob_pasada(RecorridoGlob *r, int dir_fd, int indice, int recursivo) {
+    const char *componente = r->componentes[indice];
+    int ultimo = indice == r->cantidad - 1;
+    const char *siguiente = ultimo ? NULL : r->componentes[indice + 1];
+    int mezclar = recursivo && siguiente != NULL && strcmp(siguiente, "**") != 0 && tiene_comodines(siguiente);
+    char *buffer = malloc(GLOB_BUFFER);
+    if (buffer == NULL) {
+        return;
+    }
+    lseek(dir_fd, 0, SEEK_SET);
+    long leidos;
+    while (!r->cortar && (leidos = syscall(SYS_getdents64, dir_fd, buffer, GLOB_BUFFER)) > 0) {
+        for (long pos = 0; pos < leidos && !r->cortar; pos += ((struct linux_dirent64 *)(buffer + pos))->d_reclen) {
+            struct linux_dirent64 *d = (struct linux_dirent64 *)(buffer + pos);
+            if (strcmp(d->d_name, ".") == 0 || strcmp(d->d_name, "..") == 0) {
+                continue;
+            }
+            if (!recursivo) {
+                if (fnmatch(componente, d->d_name, FNM_PERIOD) == 0) {
+                    glob_coincide(r, dir_fd, d->d_name, d->d_type, indice);
+                }
+                continue;
+            }
+            if (mezclar && fnmatch(siguiente, d->d_name, FNM_PERIOD) == 0) {
+                glob_coincide(r, dir_fd, d->d_name, d->d_type, indice + 1);
+            }
+            if (r->cortar || d->d_name[0] == '.') {
+                continue;
+            }
+            size_t antes = glob_entrar(r, d->d_name);
+            if (ultimo) {
+                glob_visitar(r); // ** al final: todo lo que hay debajo
+            }
+            if (!r->cortar && d->d_type != DT_LNK && glob_es_directorio(dir_fd, d->d_name, d->d_type)) {
+                int sub_fd = openat(dir_fd, d->d_name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+                if (sub_fd >= 0) {
+                    if (!ultimo && !mezclar) {
+                        glob_nivel(r, sub_fd, indice + 1); // ** vale por este directorio
+                    }
+                    if (!r->cortar) {
+                        glob_pasada(r, sub_fd, indice, 1); // y por los de mas abajo
+                    }
+                    close(sub_fd);
+                }
+            }
+            r->ruta[antes] = '\0';
+        }
+    }
+    free(buffer);
+}
+
+// Resuelve los componentes desde 'indice' dentro del directorio dir_fd
+static void glob_nivel(RecorridoGlob *r, int dir_fd, int indice) {
+    if (r->cortar) {
+        return;
+    }
+    const char *componente = r->componentes[indice];
+    if (strcmp(componente, "**") == 0) {
+        const char *siguiente = indice + 1 < r->cantidad ? r->componentes[indice + 1] : NULL;
+        if (siguiente != NULL && (strcmp(siguiente, "**") == 0 || !tiene_comodines(siguiente))) {
+            glob_nivel(r, dir_fd, indice + 1); // Cero directorios; con comodines lo hace la pasada
+        }
+        if (!r->cortar) {
+            glob_pasada(r, dir_fd, indice, 1);
+        }
+        return;
+    }
+    if (tiene_comodines(componente)) {
+        glob_pasada(r, dir_fd, indice, 0);
+        return;
+    }
+
+    // Sin comodines: alcanza con abrir o comprobar el nombre
+    char nombre[NAME_MAX + 1];
+    struct stat st;
+    quitar_escapes(componente, nombre, sizeof(nombre));
+    size_t antes = glob_entrar(r, nombre);
+    if (indice == r->cantidad - 1) {
+        if (fstatat(dir_fd, nombre, &st, AT_SYMLINK_NOFOLLOW) == 0) {
+            glob_visitar(r);
+        }
+    } else {
+        int sub_fd = openat(dir_fd, nombre, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (sub_fd >= 0) {
+            glob_nivel(r, sub_fd, indice + 1);
+            close(sub_fd);
+        }
+    }
+    r->ruta[antes] = '\0';
+}
+
+// Recorre los nombres que coinciden con 'patron' llamando a 'visitar' con cada uno.
+// Devuelve cuantos encontro.
+long recorrer_glob(const char *patron, VisitaGlob visitar, void *ctx) {
+    RecorridoGlob r;
+    memset(&r, 0, sizeof(r));
+    r.visitar = visitar;
+    r.ctx = ctx;
+    char *copia = strdup(patron);
+    char *componentes[PATH_MAX / 2];
+    char *resto = copia, *parte;
+    while (copia != NULL && (parte = strsep(&resto, "/")) != NULL && r.cantidad < PATH_MAX / 2) {
+        if (*parte != '\0' || resto == NULL) {
+            componentes[r.cantidad++] = parte;
+        }
+    }
+    if (r.cantidad > 1 && *componentes[r.cantidad - 1] == '\0') {
+        r.cantidad--; // "dir/*/": la barra final solo pide directorios
+        r.solo_directorios = 1;
+    }
+    r.componentes = componentes;
+
+    int absoluto = patron[0] == '/';
+    int dir_fd = open(absoluto ? "/" : ".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (absoluto) {
+        strcpy(r.ruta, "/");
+    }
+    if (dir_fd >= 0 && copia != NULL) {
+        glob_nivel(&r, dir_fd, 0);
+    }
+    if (dir_fd >= 0) {
+        close(dir_fd);
+    }
+    free(copia);
+    return r.hallados;
+}
+
+typedef struct {
+    const char **rutas;
+    int cantidad;
+    char *arena;
+    size_t usado;
+    int (*procesar)(const char **rutas, int n, void *ctx);
+    void *ctx;
+    int resultado;
+} LoteArchivos;
+
+static void lote_vaciar(LoteArchivos *l) {
+    if (l->cantidad > 0 && l->procesar(l->rutas, l->cantidad, l->ctx) != 0) {
+        l->resultado = -1;
+    }
+    l->cantidad = 0;
+    l->usado = 0;
+}
+
+static int lote_agregar(const char *ruta, void *arg) {
+    LoteArchivos *l = arg;
+    size_t largo = strlen(ruta) + 1;
+    if (l->cantidad == GLOB_LOTE || l->usado + largo > GLOB_LOTE * 64) {
+        lote_vaciar(l);
+    }
+    if (l->usado + largo > GLOB_LOTE * 64) {
+        return 0; // Una ruta mas larga que todo el lote no puede existir (PATH_MAX)
+    }
+    memcpy(l->arena + l->usado, ruta, largo);
+    l->rutas[l->cantidad++] = l->arena + l->usado;
+    l->usado += largo;
+    return 0;
+}
+
+// Pasa a 'procesar' los archivos de args[desde..hasta) de a lotes de hasta
+// GLOB_LOTE. Los argumentos con comodines se expanden mientras se recorren;
+// si un patron no encuentra nada se pasa tal cual, como en las demas shells.
+// Devuelve -1 si algun lote fallo.
+int recorrer_argumentos(char **args, int desde, int hasta, int (*procesar)(const char **rutas, int n, void *ctx),
+                        void *ctx) {
+    LoteArchivos l = {malloc(GLOB_LOTE * sizeof(char *)), 0, malloc(GLOB_LOTE * 64), 0, procesar, ctx, 0};
+    if (l.rutas == NULL || l.arena == NULL) {
+        free(l.rutas);
+        free(l.arena);
+        return -1;
+    }
+    for (int k = desde; k < hasta; k++) {
+        const char *patron = patrones_del_hilo != NULL ? patrones_del_hilo[k] : NULL;
+        if (patron == NULL || recorrer_glob(patron, lote_agregar, &l) == 0) {
+            lote_agregar(args[k], &l);
+        }
+    }
+    lote_vaciar(&l);
+    free(l.rutas);
+    free(l.arena);
+    return l.resultado;
+}
+
+typedef struct {
+    char **nombres;
+    size_t cantidad;
+    size_t capacidad;
+} ListaGlob;
+
+static int lista_glob_agregar(const char *ruta, void *arg) {
+    ListaGlob *l = arg;
+    if (l->cantidad == l->capacidad) {
+        size_t capacidad = l->capacidad ? l->capacidad * 2 : 64;
+        char **nombres = realloc(l->nombres, capacidad * sizeof(char *));
+        if (nombres == NULL) {
+            return 1;
+        }
+        l->nombres = nombres;
+        l->capacidad = capacidad;
+    }
+    l->nombres[l->cantidad++] = strdup(ruta);
+    return 0;
+}
+
+static int comparar_cadenas(const void *a, const void *b) {
+    return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+// ---------------------------------------------------------------------------
+// Tabla de comandos internos.
+// Cada comando declara cuantos argumentos acepta (sin contar el nombre; -1 es
+// sin limite), y su mensaje de uso. La tabla se
+// indexa una sola vez en una tabla hash, asi cada comando se resuelve con una
+// busqueda y los comandos externos caen a ejecutar_comando_sistema enseguida.
+// ---------------------------------------------------------------------------
+
+typedef struct {
+    const char *nombre;
+    int min_args;
+    int max_args;
+    const char *uso;
+    const char *error;   // Mensaje para registrar_error si los argumentos no son validos
+    int (*funcion)(int argc, char **args);
+    int en_flujo;        // Recibe los comodines sin expandir y los recorre con recorrer_argumentos
+} ComandoInterno;
+
+#define SIN_LIMITE -1
+
+int comando_trabajos(int argc, char **args);
+int comando_paralelo(int argc, char **args);
+int comando_primer_plano(int argc, char **args);
+int comando_segundo_plano(int argc, char **args);
+#define HASH_COMANDOS 64 // Potencia de 2, mayor al doble de los comandos
+
+static int uso_incorrecto(const char *nombre);
+
+// Lee las opciones -R y -j N del principio; devuelve el indice del primer argumento
+static int opciones_recursivas(int argc, char **args, int *recursivo, int *hilos) {
+    int k = 1;
+    *recursivo = 0;
+    *hilos = hilos_por_defecto();
+    while (k < argc && args[k][0] == '-') {
+        if (strcmp(args[k], "-R") == 0) {
+            *recursivo = 1;
+        } else if (strcmp(args[k], "-j") == 0 && k + 1 < argc && atoi(args[k + 1]) > 0) {
+            *hilos = atoi(args[++k]);
+        } else {
+            return -1;
+        }
+        k++;
+    }
+    return k;
+}
+
+typedef struct {
+    const char *primero; // Modo, o usuario en 'propietario'
+    const char *grupo;
+    int recursivo;
+    int hilos;
+} LoteDueno;
+
+static int lote_propietario(const char **rutas, int n, void *ctx) {
+    LoteDueno *l = ctx;
+    return l->recursivo ? propietario_recursivo(l->primero, l->grupo, rutas, n, l->hilos)
+                        : cambiar_propietario(l->primero, l->grupo, rutas, n);
+}
+
+static int lote_permisos(const char **rutas, int n, void *ctx) {
+    LoteDueno *l = ctx;
+    return l->recursivo ? permisos_recursivo(l->primero, rutas, n, l->hilos) : permisos(l->primero, rutas, n);
+}
+
+static int cmd_propietario(int argc, char **args) {
+    int recursivo, hilos;
+    int k = opciones_recursivas(argc, args, &recursivo, &hilos);
+    if (k < 0 || argc - k < 2) {
+        return uso_incorrecto(args[0]);
+    }
+
+    // 'usuario:grupo' (o 'uid:gid') en un solo argumento
+    char dueno[256];
+    const char *usuario = args[k], *grupo;
+    char *separador = strchr(args[k], ':');
+    if (separador != NULL) {
+        snprintf(dueno, sizeof(dueno), "%s", args[k]);
+        dueno[separador - args[k]] = '\0';
+        usuario = dueno;
+        grupo = dueno + (separador - args[k]) + 1;
+        k += 1;
+    } else {
+        grupo = args[k + 1];
+        k += 2;
+    }
+    if (k >= argc) {
+        return uso_incorrecto(args[0]);
+    }
+    LoteDueno lote = {usuario, grupo, recursivo, hilos};
+    return recorrer_argumentos(args, k, argc, lote_propietario, &lote);
+}
+
+static int cmd_permisos(int argc, char **args) {
+    int recursivo, hilos;
+    int k = opciones_recursivas(argc, args, &recursivo, &hilos);
+    if (k < 0 || argc - k < 2) {
+        return uso_incorrecto(args[0]);
+    }
+    LoteDueno lote = {args[k], NULL, recursivo, hilos};
+    return recorrer_argumentos(args, k + 1, argc, lote_permisos, &lote);
+}
+
+// Trabajo de 'copiar' o 'transferencia' que corre bajo un ControlEs
+typedef struct {
+    ControlEs *control;
+    int (*funcion)(void *arg);
+    void *arg;
+    char **patrones;
+    int resultado;
+} TrabajoControlado;
+
+static void *hilo_controlado(void *arg) {
+    TrabajoControlado *t = arg;
+    control_es_prioridad(t->control);
+    control_es_del_hilo = t->control;
+    patrones_del_hilo = t->patrones;
+    t->resultado = t->funcion(t->arg);
+    return NULL;
+}
+
+// Ejecuta funcion(arg) con el control de E/S activo. Un usuario comun no puede
+// volver a bajar nice, asi que con --nice o --prioridad-es el trabajo va en un
+// hilo que muere al terminar y la shell conserva su prioridad.
+static int control_es_ejecutar(ControlEs *c, unsigned long long total, int (*funcion)(void *arg), void *arg) {
+    control_es_iniciar(c, total);
+    int resultado;
+    if (!c->clase_es && !c->cambiar_nice) {
+        resultado = funcion(arg);
+    } else {
+        TrabajoControlado t = {c, funcion, arg, patrones_del_hilo, -1};
+        pthread_t hilo;
+        if (pthread_create(&hilo, NULL, hilo_controlado, &t) != 0) {
+            perror("Error al crear el hilo de copia");
+        } else {
+            pthread_join(hilo, NULL);
+        }
+        resultado = t.resultado;
+    }
+    control_es_terminar(c);
+    return resultado;
+}
+
+typedef struct {
+    const char *destino; // Directorio que recibe los origenes
+    int recursivo;
+    int hilos;
+} LoteCopia;
+
+static int lote_copiar(const char **rutas, int n, void *ctx) {
+    LoteCopia *l = ctx;
+    int resultado = 0;
+    for (int k = 0; k < n; k++) {
+        const char *barra = strrchr(rutas[k], '/');
+        char *destino = unir_ruta(l->destino, barra != NULL && barra[1] != '\0' ? barra + 1 : rutas[k]);
+        if (destino == NULL) {
+            return -1;
+        }
+        if ((l->recursivo ? copiar_recursivo(rutas[k], destino, l->hilos) : copiar(rutas[k], destino)) != 0) {
+            resultado = -1;
+        }
+        free(destino);
+    }
+    return resultado;
+}
+
+// Lo que 'copiar' ejecuta despues de leer las opciones
+typedef struct {
+    char **args;
+    int desde;   // Origenes en args[desde..hasta); args[hasta] es el destino
+    int hasta;
+    int recursivo;
+    int hilos;
+    int varios;
+} PedidoCopia;
+
+static int ejecutar_pedido_copia(void *arg) {
+    PedidoCopia *p = arg;
+    if (p->varios) {
+        LoteCopia lote = {p->args[p->hasta], p->recursivo, p->hilos};
+        return recorrer_argumentos(p->args, p->desde, p->hasta, lote_copiar, &lote);
+    }
+    const char *origen = p->args[p->desde], *destino = p->args[p->hasta];
+    return p->recursivo ? copiar_recursivo(origen, destino, p->hilos) : copiar(origen, destino);
+}
+
+static int cmd_copiar(int argc, char **args) {
+    int recursivo = 0, hilos = hilos_por_defecto(), k = 1, opcion_es = 0;
+    ControlEs control;
+    memset(&control, 0, sizeof(control));
+    while (k < argc && args[k][0] == '-') {
+        if (strcmp(args[k], "-r") == 0) {
+            recursivo = 1;
+        } else if (strcmp(args[k], "-j") == 0 && k + 1 < argc) {
+            hilos = atoi(args[++k]);
+        } else if (strcmp(args[k], "--verificar") == 0) {
+            control.verificar = 1;
+        } else if ((opcion_es = leer_opcion_es(argc, args, &k, &control)) != 1) {
+            break;
+        }
+        k++;
+    }
+    if (argc - k < 2 || hilos <= 0 || opcion_es < 0) {
+        return uso_incorrecto(args[0]);
+    }
+
+    // Varios origenes, o uno con comodines: todos van adentro del directorio destino
+    struct stat st;
+    if (argc - k > 2 || (patrones_del_hilo != NULL && patrones_del_hilo[k] != NULL)) {
+        if (stat(args[argc - 1], &st) != 0 || !S_ISDIR(st.st_mode)) {
+            fprintf(stderr, "Error: con varios orígenes el destino '%s' debe ser un directorio\n", args[argc - 1]);
+            return -1;
+        }
+        PedidoCopia pedido = {args, k, argc - 1, recursivo, hilos, 1};
+        return control_es_ejecutar(&control, 0, ejecutar_pedido_copia, &pedido);
+    }
+
+    PedidoCopia pedido = {args, k, k + 1, recursivo, hilos, 0};
+    return control_es_ejecutar(&control, !recursivo && stat(args[k], &st) == 0 ? (unsigned long long)st.st_size : 0,
+                               ejecutar_pedido_copia, &pedido);
+}
+
+// Opciones de 'mover' y 'renombrar': -n no pisa el destino, -x intercambia, -j hilos
+static int opciones_mover(int argc, char **args, unsigned *flags, int *hilos) {
+    int k = 1;
+    *flags = 0;
+    *hilos = hilos_por_defecto();
+    while (k < argc && args[k][0] == '-') {
+        if (strcmp(args[k], "-n") == 0) {
+            *flags |= RENAME_NOREPLACE;
+        } else if (strcmp(args[k], "-x") == 0) {
+            *flags |= RENAME_EXCHANGE;
+        } else if (strcmp(args[k], "-j") == 0 && k + 1 < argc && atoi(args[k + 1]) > 0) {
+            *hilos = atoi(args[++k]);
+        } else {
+            return -1;
+        }
+        k++;
+    }
+    if (argc - k != 2 || *flags == (RENAME_NOREPLACE | RENAME_EXCHANGE)) {
+        return -1;
+    }
+    return k;
+}
+
+static int cmd_mover(int argc, char **args) {
+    unsigned flags;
+    int hilos, k = opciones_mover(argc, args, &flags, &hilos);
+    if (k < 0) {
+        return uso_incorrecto(args[0]);
+    }
+    return mover(args[k], args[k + 1], flags, hilos);
+}
+
+static int cmd_renombrar(int argc, char **args) {
+    unsigned flags;
+    int hilos, k = opciones_mover(argc, args, &flags, &hilos);
+    if (k < 0) {
+        return uso_incorrecto(args[0]);
+    }
+    return renombrar(args[k], args[k + 1], flags, hilos);
+}
+
+static int cmd_listar(int argc, char **args) {
+    OpcionesListado op = {0, ORDEN_NINGUNO, 0, NULL};
+    const char *directorio = ".";
+    for (int k = 1; k < argc; k++) {
+        if (strcmp(args[k], "-l") == 0) {
+            op.largo = 1;
+        } else if (strcmp(args[k], "-r") == 0) {
+            op.inverso = 1;
+            if (op.orden == ORDEN_NINGUNO) {
+                op.orden = ORDEN_NOMBRE;
+            }
+        } else if (strcmp(args[k], "-f") == 0 && k + 1 < argc) {
+            op.filtro = args[++k];
+        } else if (strcmp(args[k], "-o") == 0 && k + 1 < argc) {
+            k++;
+            if (strcmp(args[k], "nombre") == 0) {
+                op.orden = ORDEN_NOMBRE;
+            } else if (strcmp(args[k], "tamano") == 0) {
+                op.orden = ORDEN_TAMANO;
+            } else if (strcmp(args[k], "fecha") == 0) {
+                op.orden = ORDEN_FECHA;
+            } else {
+                return uso_incorrecto(args[0]);
+            }
+        } else if (args[k][0] == '-' || k != argc - 1) {
+            return uso_incorrecto(args[0]);
+        } else {
+            directorio = args[k];
+        }
+    }
+    return listar(directorio, &op);
+}
+
+static int cmd_creardir(int argc, char **args) {
+    (void)argc;
+    return creardir(args[1]);
+}
+
+static int cmd_ir(int argc, char **args) {
+    (void)argc;
+    return ir(args[1]);
+}
+
+static int cmd_mostrar(int argc, char **args) {
+    (void)argc;
+    (void)args;
+    return mostrar();
+}
+
+static int cmd_clave(int argc, char **args) {
+    (void)argc;
+    return cambiar_clave(args[1]);
+}
+
+static int cmd_demonio(int argc, char **args) {
+    if (strcmp(args[1], "listar") == 0) {
+        return listarDemonios();
+    } else if (argc == 2 && strcmp(args[1], "estado") == 0) {
+        return estadoDemonios();
+    } else if (argc == 2 && strcmp(args[1], "iniciar-todos") == 0) {
+        return todosDemonios(0);
+    } else if (argc == 2 && strcmp(args[1], "detener-todos") == 0) {
+        return todosDemonios(1);
+    } else if (argc == 3 && strcmp(args[1], "iniciar") == 0) {
+        return iniciarDemonio(args[2], 0);
+    } else if (argc == 4 && strcmp(args[1], "iniciar") == 0 && strcmp(args[2], "-r") == 0) {
+        return iniciarDemonio(args[3], 1);
+    } else if (argc == 3 && strcmp(args[1], "detener") == 0) {
+        return detenerDemonio(args[2]);
+    }
+    return uso_incorrecto(args[0]);
+}
+
+static int cmd_bitacora(int argc, char **args) {
+    comando_bitacora(args[1], argc >= 3 ? args[2] : NULL);
+    return 0;
+}
+
+static int cmd_exit(int argc, char **args) {
+    (void)argc;
+    (void)args;
+    exit(0);
+}
+
+static int cmd_usuario(int argc, char **args) {
+    if (argc == 2 && strcmp(args[1], "listar") == 0) {
+        return listar_usuarios();
+    }
+    if (argc == 3 && strcmp(args[1], "ver") == 0) {
+        return ver_usuario(args[2]);
+    }
+    if (argc != 4) {
+        return uso_incorrecto(args[0]);
+    }
+    return agregar_usuario(args[1], args[2], args[3]);
+}
+
+static int cmd_sesion(int argc, char **args) {
+    (void)argc;
+    (void)args;
+    return 0; // La linea ya quedo en el historial
+}
+
+typedef struct {
+    char **args; // origen, destino, método
+    OpcionesTransferencia *op;
+} PedidoTransferencia;
+
+static int ejecutar_pedido_transferencia(void *arg) {
+    PedidoTransferencia *p = arg;
+    return transferencia_archivo(p->args[0], p->args[1], p->args[2], p->op);
+}
+
+static int cmd_transferencia(int argc, char **args) {
+    OpcionesTransferencia op = {TRANSFERENCIA_FLUJOS};
+    ControlEs control;
+    memset(&control, 0, sizeof(control));
+    int k = 1, opcion_es = 0;
+    while (k < argc && args[k][0] == '-') {
+        if (strcmp(args[k], "-j") == 0 && k + 1 < argc) {
+            op.flujos = atoi(args[++k]);
+        } else if ((opcion_es = leer_opcion_es(argc, args, &k, &control)) != 1) {
+            break;
+        }
+        k++;
+    }
+    if (argc - k != 3 || op.flujos < 1 || opcion_es < 0) {
+        return uso_incorrecto(args[0]);
+    }
+
+    struct stat st;
+    PedidoTransferencia pedido = {args + k, &op};
+    return control_es_ejecutar(&control, stat(args[k], &st) == 0 ? (unsigned long long)st.st_size : 0,
+                               ejecutar_pedido_transferencia, &pedido);
+}
+
+static const ComandoInterno comandos_internos[] = {
+    {"acceso", 1, 2, "acceso <usuario> [ip]", NULL, comando_acceso, 0},
+    {"bitacora", 0, 2, "bitacora [durabilidad ninguna|periodica|registro] [politica descartar|bloquear]",
+     "No se pudo consultar la bitacora.", cmd_bitacora, 0},
+    {"clave", 1, 1, "clave <usuario>", "No se pudo cambiar la clave del usuario.", cmd_clave, 0},
+    {"copiar", 2, SIN_LIMITE, "copiar [-r] [-j hilos] [--verificar] [opciones de E/S] <archivo_origen> <archivo_destino> | copiar [...] <origen1> ... <origenN> <directorio>\n"
+     "Opciones de E/S: --limite 200M, --progreso, --prioridad-es idle|be[:0-7]|rt[:0-7], --nice n",
+     "No se pudo copiar.", cmd_copiar, 1},
+    {"creardir", 1, 1, "creardir <nombre_directorio>", "No se pudo crear el nuevo directorio.", cmd_creardir, 0},
+    {"demonio", 1, 3, "demonio listar | demonio estado | demonio iniciar [-r] <nombre_demonio> | demonio detener <nombre_demonio>"
+     " | demonio iniciar-todos | demonio detener-todos",
+     "No se pudo realizar la operacion del demonio.", cmd_demonio, 0},
+    {"diagnostico", 0, 1, "diagnostico [-r]", NULL, comando_diagnostico, 0},
+    {"exit", 0, SIN_LIMITE, "exit", NULL, cmd_exit, 0},
+    {"hash", 0, SIN_LIMITE, "hash [-r] [comando ...]", NULL, comando_hash, 0},
+    {"historial", 0, 6, USO_HISTORIAL, NULL, comando_historial, 0},
+    {"ir", 1, 1, "ir <nombre_directorio>", "Error: No se pudo ir al dorectorio sugerido", cmd_ir, 0},
+    {"listar", 0, 7, "listar [-l] [-o nombre|tamano|fecha] [-r] [-f patron] [directorio]",
+     "No se pudo listar el directorio.", cmd_listar, 0},
+    {"mostrar", 0, SIN_LIMITE, "mostrar", NULL, cmd_mostrar, 0},
+    {"mover", 2, 5, "mover [-n|-x] [-j hilos] <archivo_origen> <archivo_destino>", "No se pudo mover.", cmd_mover, 0},
+    {"paralelo", 1, SIN_LIMITE, "paralelo [-j N] [-k|-t] [--parar] <comando> [args con {}] [::: arg1 ... argN]\n"
+     "Sin ':::' los argumentos se leen de la entrada, uno por linea", NULL, comando_paralelo, 0},
+    {"permisos", 2, SIN_LIMITE, "permisos [-R] [-j hilos] <modo> <archivo1> [archivo2 ... archivoN]",
+     "No se pudo cambiar los permisos.", cmd_permisos, 1},
+    {"primer_plano", 0, 1, "primer_plano [%trabajo]", NULL, comando_primer_plano, 0},
+    {"propietario", 2, SIN_LIMITE, "propietario [-R] [-j hilos] <nuevo_propietario> <nuevo_grupo>|<usuario:grupo> <archivo1> [archivo2 ... archivoN]",
+     "No se pudo cambiar de propietario.", cmd_propietario, 1},
+    {"renombrar", 2, 5, "renombrar [-n|-x] [-j hilos] <archivo> <nuevo_nombre>", "No se pudo renombrar.", cmd_renombrar, 0},
+    {"segundo_plano", 0, 1, "segundo_plano [%trabajo]", NULL, comando_segundo_plano, 0},
+    {"sesion", 2, SIN_LIMITE, "sesion <usuario> <accion>", NULL, cmd_sesion, 0},
+    {"tiempos", 0, 2, "tiempos [-r] [nombre_comando] | tiempos exportar <archivo.json|archivo.csv>", NULL, comando_tiempos, 0},
+    {"trabajos", 0, 0, "trabajos", NULL, comando_trabajos, 0},
+    {"transferencia", 3, SIN_LIMITE, "transferencia [-j flujos] [opciones de E/S] <origen> <destino> <local|scp|ftp>\n"
+     "Opciones de E/S: --limite 200M, --progreso, --prioridad-es idle|be[:0-7]|rt[:0-7], --nice n",
+     "Error al relizar la transferencia", cmd_transferencia, 0},
+    {"usuario", 1, 3, "usuario <nombre> <horario> <ips> | usuario listar | usuario ver <nombre>",
+     "No se pudo iniciar", cmd_usuario, 0},
+    {"verificar", 1, SIN_LIMITE, USO_VERIFICAR, NULL, comando_verificar, 0},
+};
+
+#define CANT_COMANDOS ((int)(sizeof(comandos_internos) / sizeof(comandos_internos[0])))
+
+static signed char indice_comandos[HASH_COMANDOS];
+static pthread_once_t indice_comandos_listo = PTHREAD_ONCE_INIT;
+
+// FNV-1a de 32 bits
+static unsigned hash_cadena(const char *texto) {
+    unsigned h = 2166136261u;
+    while (*texto) {
+        h ^= (unsigned char)*texto++;
+        h *= 16777619u;
+    }
+    return h;
+}
+
+static void indexar_comandos() {
+    memset(indice_comandos, -1, sizeof(indice_comandos));
+    for (int k = 0; k < CANT_COMANDOS; k++) {
+        unsigned pos = hash_cadena(comandos_internos[k].nombre) & (HASH_COMANDOS - 1);
+        while (indice_comandos[pos] >= 0) {
+            pos = (pos + 1) & (HASH_COMANDOS - 1);
+        }
+        indice_comandos[pos] = (signed char)k;
+    }
+}
+
+// Busca un comando interno por nombre; NULL si es un comando externo
+const ComandoInterno *buscar_comando(const char *nombre) {
+    pthread_once(&indice_comandos_listo, indexar_comandos);
+    unsigned pos = hash_cadena(nombre) & (HASH_COMANDOS - 1);
+    while (indice_comandos[pos] >= 0) {
+        const ComandoInterno *cmd = &comandos_internos[(int)indice_comandos[pos]];
+        if (strcmp(cmd->nombre, nombre) == 0) {
+            return cmd;
+        }
+        pos = (pos + 1) & (HASH_COMANDOS - 1);
+    }
+    return NULL;
+}
+
+// Registra el error del comando y muestra su uso
+static int uso_incorrecto(const char *nombre) {
+    const ComandoInterno *cmd = buscar_comando(nombre);
+    if (cmd->error != NULL) {
+        errno = EINVAL;
+        registrar_error(cmd->error);
+    }
+    printf("Uso: %s\n", cmd->uso);
+    return -1;
+}
+
+// Ejecuta un comando ya dividido en argumentos. Devuelve 0 si tuvo exito.
+int ejecutar_args(int argc, char **args) {
+    const ComandoInterno *cmd = buscar_comando(args[0]);
+    if (cmd == NULL) {
+        // Si no es un comando interno, lo ejecutamos como un comando del sistema
+        return ejecutar_comando_sistema(args);
+    }
+
+    int cantidad = argc - 1;
+    if (cantidad < cmd->min_args || (cmd->max_args != SIN_LIMITE && cantidad > cmd->max_args)) {
+        return uso_incorrecto(cmd->nombre);
+    }
+    MedicionComando antes;
+    medicion_tomar(&antes);
+    int resultado = cmd->funcion(argc, args);
+    tiempos_registrar_interno(cmd->nombre, &antes, resultado);
+    return resultado;
+}
+
+// ---------------------------------------------------------------------------
+// Analisis de lineas: palabras con comillas, tuberias y redirecciones.
+// ---------------------------------------------------------------------------
+
+// Un comando de una tuberia con sus redirecciones
+typedef struct {
+    char *args[MAX_ARGS];
+    int argc;
+    char *entrada;  // < archivo
+    char *salida;   // > archivo o >> archivo
+    int anexar;
+    char *error;    // 2> archivo
+    char *patrones[MAX_ARGS]; // Forma con comodines de cada argumento (NULL si no tiene)
+    char **expandidos;        // Argumentos ya expandidos, si algun patron hizo falta
+    int cant_expandidos;
+} Etapa;
+
+typedef struct {
+    Etapa etapas[MAX_ETAPAS];
+    int cantidad;
+    int fondo;          // Terminaba en '&'
+    const char *linea;  // Texto original, para la tabla de trabajos
+    char texto[4 * MAX_LFS_INPUT + 4]; // Palabras ya sin comillas y formas con comodines, terminadas en '\0'
+} Tuberia;
+
+static int error_sintaxis(const char *mensaje) {
+    fprintf(stderr, "Error de sintaxis: %s\n", mensaje);
+    return -1;
+}
+
+// Divide una linea en etapas. Admite 'comillas simples', "dobles" con \" y \\,
+// barra invertida fuera de comillas, |, <, >, >>, 2> y & al final. Devuelve 0 si es valida.
+// Si una palabra tiene *, ? o [ fuera de comillas se guarda tambien su forma
+// para fnmatch, donde lo que venia entre comillas o escapado queda con '\'.
+int analizar_linea(const char *linea, Tuberia *t) {
+    char *escritura = t->texto;
+    char *limite = t->texto + sizeof(t->texto) - 1;
+    char **redireccion = NULL; // Redireccion que espera su archivo
+    const char *c = linea;
+
+    memset(t->etapas, 0, sizeof(t->etapas));
+    t->cantidad = 1;
+    t->fondo = 0;
+    t->linea = linea;
+    Etapa *etapa = &t->etapas[0];
+
+#define PONER(ch) do { if (escritura >= limite) return error_sintaxis("línea demasiado larga"); *escritura++ = (ch); } while (0)
+
+    for (;;) {
+        while (*c == ' ' || *c == '\t' || *c == '\n') {
+            c++;
+        }
+        if (*c == '\0' || *c == '#') {
+            break;
+        }
+        if (t->fondo) {
+            return error_sintaxis("'&' solo se admite al final de la línea");
+        }
+        if (*c == '&') {
+            if (redireccion != NULL || etapa->argc == 0) {
+                return error_sintaxis("comando vacío antes de '&'");
+            }
+            t->fondo = 1;
+            c++;
+            continue;
+        }
+        if (*c == '|' || *c == '<' || *c == '>' || (c[0] == '2' && c[1] == '>')) {
+            if (redireccion != NULL) {
+                return error_sintaxis("falta el archivo de la redirección");
+            }
+            if (*c == '|') {
+                if (etapa->argc == 0) {
+                    return error_sintaxis("comando vacío en la tubería");
+                }
+                if (t->cantidad == MAX_ETAPAS) {
+                    return error_sintaxis("demasiados comandos en la tubería");
+                }
+                etapa = &t->etapas[t->cantidad++];
+                c++;
+            } else if (*c == '<') {
+                redireccion = &etapa->entrada;
+                c++;
+            } else if (*c == '>') {
+                etapa->anexar = (c[1] == '>');
+                redireccion = &etapa->salida;
+                c += etapa->anexar ? 2 : 1;
+            } else {
+                redireccion = &etapa->error;
+                c += 2;
+            }
+            continue;
+        }
+
+        char *palabra = escritura;
+        char forma[2 * MAX_LFS_INPUT + 2];
+        size_t largo_forma = 0;
+        int comodin = 0;
+#define FORMA(ch, literal) do { if ((literal) && strchr("*?[]\\", (ch)) != NULL) forma[largo_forma++] = '\\'; \
+                                forma[largo_forma++] = (ch); } while (0)
+        while (*c != '\0' && strchr(" \t\n|<>&", *c) == NULL) {
+            if (*c == '\'') {
+                for (c++; *c != '\0' && *c != '\''; c++) {
+                    PONER(*c);
+                    FORMA(*c, 1);
+                }
+                if (*c == '\0') {
+                    return error_sintaxis("comilla simple sin cerrar");
+                }
+                c++;
+            } else if (*c == '"') {
+                for (c++; *c != '\0' && *c != '"'; c++) {
+                    if (*c == '\\' && (c[1] == '"' || c[1] == '\\')) {
+                        c++;
+                    }
+                    PONER(*c);
+                    FORMA(*c, 1);
+                }
+                if (*c == '\0') {
+                    return error_sintaxis("comilla doble sin cerrar");
+                }
+                c++;
+            } else if (*c == '\\' && c[1] != '\0') {
+                PONER(c[1]);
+                FORMA(c[1], 1);
+                c += 2;
+            } else {
+                comodin |= (*c == '*' || *c == '?' || *c == '[');
+                PONER(*c);
+                FORMA(*c, 0);
+                c++;
+            }
+        }
+        PONER('\0');
+
+        if (redireccion != NULL) {
+            *redireccion = palabra;
+            redireccion = NULL;
+        } else if (etapa->argc == MAX_ARGS - 1) {
+            return error_sintaxis("demasiados argumentos");
+        } else {
+            if (comodin) {
+                etapa->patrones[etapa->argc] = escritura;
+                for (size_t k = 0; k < largo_forma; k++) {
+                    PONER(forma[k]);
+                }
+                PONER('\0');
+            }
+            etapa->args[etapa->argc++] = palabra;
+        }
+    }
+#undef FORMA
+#undef PONER
+
+    if (redireccion != NULL) {
+        return error_sintaxis("falta el archivo de la redirección");
+    }
+    if (etapa->argc == 0) {
+        if (t->cantidad > 1 || etapa->entrada || etapa->salida || etapa->error) {
+            return error_sintaxis("comando vacío");
+        }
+        t->cantidad = 0; // Linea vacia
+    }
+    return 0;
+}
+
+static int tiene_redirecciones(const Etapa *e) {
+    return e->entrada != NULL || e->salida != NULL || e->error != NULL;
+}
+
+// Abre los archivos de las redirecciones de una etapa en fds[0..2] (-1 si no hay)
+static int abrir_redirecciones(const Etapa *e, int fds[3]) {
+    fds[0] = fds[1] = fds[2] = -1;
+    if (e->entrada != NULL && (fds[0] = open(e->entrada, O_RDONLY | O_CLOEXEC)) < 0) {
+        fprintf(stderr, "Error al abrir '%s': %s\n", e->entrada, strerror(errno));
+        return -1;
+    }
+    if (e->salida != NULL) {
+        int flags = O_WRONLY | O_CREAT | O_CLOEXEC | (e->anexar ? O_APPEND : O_TRUNC);
+        if ((fds[1] = open(e->salida, flags, 0644)) < 0) {
+            fprintf(stderr, "Error al abrir '%s': %s\n", e->salida, strerror(errno));
+            return -1;
+        }
+    }
+    if (e->error != NULL && (fds[2] = open(e->error, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644)) < 0) {
+        fprintf(stderr, "Error al abrir '%s': %s\n", e->error, strerror(errno));
+        return -1;
+    }
+    return 0;
+}
+
+static void cerrar_fds(int *fds, int cantidad) {
+    for (int k = 0; k < cantidad; k++) {
+        if (fds[k] >= 0) {
+            close(fds[k]);
+            fds[k] = -1;
+        }
+    }
+}
+
+// ---------------------------------------------------------------------------
+// Control de trabajos.
+// Cada tuberia en segundo plano (o detenida con Ctrl+Z) ocupa un lugar en la
+// tabla. Los hijos se recogen de forma asincronica: el manejador de SIGCHLD
+// escribe un byte en un self-pipe y el lazo principal lo vigila con poll.
+// ---------------------------------------------------------------------------
+
+typedef enum {
+    TRABAJO_LIBRE,
+    TRABAJO_CORRIENDO,
+    TRABAJO_DETENIDO
+} EstadoTrabajo;
+
+typedef struct {
+    int id;                    // Numero que ve el usuario: [id]
+    EstadoTrabajo estado;
+    pid_t pgid;                // Grupo de procesos (0 si comparte el de la shell)
+    pid_t pids[MAX_ETAPAS];    // 0 cuando el proceso ya termino
+    int cantidad;
+    int vivos;
+    int status_final;          // Estado de espera de la ultima etapa
+    char comando[128];
+    double inicio;
+    struct timeval usuario;    // CPU acumulada de los procesos ya recogidos
+    struct timeval sistema;
+    char nombres[MAX_ETAPAS][32]; // Nombre de cada etapa para la tabla de tiempos
+    unsigned long long leidos[MAX_ETAPAS]; // Bytes de E/S leidos antes de recoger el proceso
+    unsigned long long escritos[MAX_ETAPAS];
+} Trabajo;
+
+static Trabajo tabla_trabajos[MAX_TRABAJOS];
+static pthread_mutex_t mutex_trabajos = PTHREAD_MUTEX_INITIALIZER;
+static int tubo_sigchld[2] = {-1, -1};
+static int shell_interactiva = 0; // Tiene la terminal: usa grupos de procesos y tcsetpgrp
+static int ejecucion_concurrente = 0; // Hay lineas corriendo en paralelo: nada de dup2 sobre 0, 1 y 2
+
+static void manejador_SIGCHLD(int sig) {
+    (void)sig;
+    int guardado = errno;
+    if (write(tubo_sigchld[1], "x", 1) < 0) {
+        // El tubo lleno ya garantiza que se va a revisar
+    }
+    errno = guardado;
+}
+
+// Configura el self-pipe de SIGCHLD y, si hay terminal, el control de trabajos
+void trabajos_iniciar() {
+    if (pipe2(tubo_sigchld, O_CLOEXEC | O_NONBLOCK) != 0) {
+        perror("Error al crear el tubo de SIGCHLD");
+    }
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = manejador_SIGCHLD;
+    sigemptyset(&sa.sa_mask);
+    sa.sa_flags = SA_RESTART;
+    sigaction(SIGCHLD, &sa, NULL);
+
+    // Un interno que escribe en una tuberia sin lector recibe EPIPE en vez de
+    // matar a la shell; los hijos recuperan SIG_DFL al arrancar
+    signal(SIGPIPE, SIG_IGN);
+
+    shell_interactiva = isatty(STDIN_FILENO) && tcgetpgrp(STDIN_FILENO) == getpgrp();
+    if (shell_interactiva) {
+        // La shell no se detiene con Ctrl+Z ni al devolverse la terminal
+        signal(SIGTSTP, SIG_IGN);
+        signal(SIGTTOU, SIG_IGN);
+        signal(SIGTTIN, SIG_IGN);
+    }
+}
+
+static void sumar_tiempo(struct timeval *total, struct timeval parte) {
+    total->tv_sec += parte.tv_sec;
+    total->tv_usec += parte.tv_usec;
+    if (total->tv_usec >= 1000000) {
+        total->tv_sec++;
+        total->tv_usec -= 1000000;
+    }
+}
+
+static double segundos_tv(struct timeval tv) {
+    return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+// Lee los bytes de E/S de un hijo que termino sin recogerlo todavia, mientras
+// /proc/<pid>/io sigue existiendo. Con 'bloquear' espera a que termine o se detenga.
+static void trabajo_leer_es(Trabajo *tr, int k, int bloquear) {
+    siginfo_t info;
+    info.si_pid = 0;
+    int opciones = WEXITED | WNOWAIT | (bloquear ? WSTOPPED : WNOHANG);
+    while (waitid(P_PID, tr->pids[k], &info, opciones) != 0) {
+        if (errno != EINTR) {
+            return;
+        }
+    }
+    if (info.si_pid == tr->pids[k] && info.si_code != CLD_STOPPED && info.si_code != CLD_TRAPPED) {
+        char ruta[64];
+        snprintf(ruta, sizeof(ruta), "/proc/%d/io", (int)tr->pids[k]);
+        leer_contadores_es(ruta, &tr->leidos[k], &tr->escritos[k]);
+    }
+}
+
+// Anota el resultado de un proceso recogido con wait4
+static void trabajo_proceso_termino(Trabajo *tr, int k, int status, const struct rusage *ru) {
+    sumar_tiempo(&tr->usuario, ru->ru_utime);
+    sumar_tiempo(&tr->sistema, ru->ru_stime);
+    MedicionComando m = {segundos_monotonicos() - tr->inicio, segundos_tv(ru->ru_utime), segundos_tv(ru->ru_stime),
+                         ru->ru_maxrss, tr->leidos[k], tr->escritos[k]};
+    tiempos_registrar(tr->nombres[k], &m, 0, !WIFEXITED(status) || WEXITSTATUS(status) != 0);
+    if (k == tr->cantidad - 1) {
+        tr->status_final = status;
+    }
+    tr->pids[k] = 0;
+    tr->vivos--;
+}
+
+static void describir_status(int status, char *texto, size_t tam) {
+    if (WIFEXITED(status)) {
+        snprintf(texto, tam, "Hecho (estado %d)", WEXITSTATUS(status));
+    } else if (WIFSIGNALED(status)) {
+        snprintf(texto, tam, "Terminado (señal %d)", WTERMSIG(status));
+    } else {
+        snprintf(texto, tam, "Terminado");
+    }
+}
+
+static void informar_fin_trabajo(const Trabajo *tr) {
+    char estado[64];
+    describir_status(tr->status_final, estado, sizeof(estado));
+    printf("[%d] %s  %s  (real %.2f s, usuario %.2f s, sistema %.2f s)\n", tr->id, estado, tr->comando,
+           segundos_monotonicos() - tr->inicio, segundos_tv(tr->usuario), segundos_tv(tr->sistema));
+}
+
+// Recoge sin bloquear los procesos de los trabajos y avisa los que terminaron.
+// Devuelve cuantos trabajos terminaron.
+int revisar_trabajos() {
+    int terminados = 0;
+    char basura[64];
+    while (tubo_sigchld[0] >= 0 && read(tubo_sigchld[0], basura, sizeof(basura)) > 0) {
+    }
+
+    pthread_mutex_lock(&mutex_trabajos);
+    for (int j = 0; j < MAX_TRABAJOS; j++) {
+        Trabajo *tr = &tabla_trabajos[j];
+        if (tr->estado == TRABAJO_LIBRE) {
+            continue;
+        }
+        for (int k = 0; k < tr->cantidad; k++) {
+            int status;
+            struct rusage ru;
+            if (tr->pids[k] <= 0) {
+                continue;
+            }
+            trabajo_leer_es(tr, k, 0);
+            pid_t r = wait4(tr->pids[k], &status, WNOHANG | WUNTRACED | WCONTINUED, &ru);
+            if (r == 0) {
+                continue;
+            }
+            if (r < 0) {
+                tr->pids[k] = 0; // Ya no es hijo nuestro
+                tr->vivos--;
+            } else if (WIFSTOPPED(status)) {
+                tr->estado = TRABAJO_DETENIDO;
+            } else if (WIFCONTINUED(status)) {
+                tr->estado = TRABAJO_CORRIENDO;
+            } else {
+                trabajo_proceso_termino(tr, k, status, &ru);
+            }
+        }
+        if (tr->vivos == 0) {
+            if (terminados++ == 0 && shell_interactiva) {
+                printf("\n");
+            }
+            informar_fin_trabajo(tr);
+            tr->estado = TRABAJO_LIBRE;
+        }
+    }
+    pthread_mutex_unlock(&mutex_trabajos);
+    fflush(stdout);
+    return terminados;
+}
+
+// Guarda un trabajo en la tabla. Devuelve su numero o -1 si la tabla esta llena.
+static int agregar_trabajo(const Trabajo *tr) {
+    pthread_mutex_lock(&mutex_trabajos);
+    int libre = -1, mayor = 0;
+    for (int j = 0; j < MAX_TRABAJOS; j++) {
+        if (tabla_trabajos[j].estado == TRABAJO_LIBRE) {
+            if (libre < 0) {
+                libre = j;
+            }
+        } else if (tabla_trabajos[j].id > mayor) {
+            mayor = tabla_trabajos[j].id;
+        }
+    }
+    int id = -1;
+    if (libre >= 0) {
+        tabla_trabajos[libre] = *tr;
+        tabla_trabajos[libre].id = id = mayor + 1;
+    }
+    pthread_mutex_unlock(&mutex_trabajos);
+    return id;
+}
+
+static void dar_terminal(pid_t pgid) {
+    if (shell_interactiva && pgid > 0) {
+        tcsetpgrp(STDIN_FILENO, pgid);
+    }
+}
+
+static void recuperar_terminal() {
+    if (shell_interactiva) {
+        tcsetpgrp(STDIN_FILENO, getpgrp());
+    }
+}
+
+// Espera en primer plano a los procesos vivos del trabajo.
+// Si el trabajo se detiene (Ctrl+Z) pasa a la tabla y devuelve 1.
+static int esperar_trabajo(Trabajo *tr) {
+    for (int k = 0; k < tr->cantidad; k++) {
+        if (tr->pids[k] <= 0) {
+            continue;
+        }
+        int status;
+        struct rusage ru;
+        pid_t r;
+        trabajo_leer_es(tr, k, 1);
+        while ((r = wait4(tr->pids[k], &status, WUNTRACED, &ru)) == -1 && errno == EINTR) {
+        }
+        if (r < 0) {
+            tr->pids[k] = 0;
+            tr->vivos--;
+            continue;
+        }
+        if (WIFSTOPPED(status)) {
+            recuperar_terminal();
+            tr->estado = TRABAJO_DETENIDO;
+            int id = agregar_trabajo(tr);
+            printf("\n[%d] Detenido  %s\n", id, tr->comando);
+            return 1;
+        }
+        trabajo_proceso_termino(tr, k, status, &ru);
+    }
+    recuperar_terminal();
+    return 0;
+}
+
+static void trabajo_iniciar(Trabajo *tr, const char *comando) {
+    memset(tr, 0, sizeof(*tr));
+    tr->estado = TRABAJO_CORRIENDO;
+    tr->inicio = segundos_monotonicos();
+    snprintf(tr->comando, sizeof(tr->comando), "%s", comando);
+    size_t largo = strlen(tr->comando);
+    while (largo > 0 && (tr->comando[largo - 1] == '\n' || tr->comando[largo - 1] == ' ')) {
+        tr->comando[--largo] = '\0';
+    }
+}
+
+static void trabajo_agregar_pid(Trabajo *tr, pid_t pid, const char *nombre) {
+    if (pid > 0) {
+        tr->pids[tr->cantidad] = pid;
+        tr->vivos++;
+        copiar_campo(tr->nombres[tr->cantidad], sizeof(tr->nombres[0]), nombre);
+    }
+    tr->cantidad++;
+}
+
+// Busca un trabajo por "%n" o "n"; sin argumento, el de numero mas alto
+static Trabajo *buscar_trabajo(const char *texto) {
+    int id = texto != NULL ? atoi(texto[0] == '%' ? texto + 1 : texto) : 0;
+    Trabajo *elegido = NULL;
+    for (int j = 0; j < MAX_TRABAJOS; j++) {
+        Trabajo *tr = &tabla_trabajos[j];
+        if (tr->estado == TRABAJO_LIBRE) {
+            continue;
+        }
+        if (id > 0 ? tr->id == id : (elegido == NULL || tr->id > elegido->id)) {
+            elegido = tr;
+        }
+    }
+    return elegido;
+}
+
+// Implementación del comando 'trabajos'
+int comando_trabajos(int argc, char **args) {
+    (void)argc;
+    (void)args;
+    revisar_trabajos();
+    pthread_mutex_lock(&mutex_trabajos);
+    for (int j = 0; j < MAX_TRABAJOS; j++) {
+        Trabajo *tr = &tabla_trabajos[j];
+        if (tr->estado != TRABAJO_LIBRE) {
+            printf("[%d] %-10s %6d  %s  (%.1f s)\n", tr->id,
+                   tr->estado == TRABAJO_DETENIDO ? "Detenido" : "Corriendo", (int)tr->pgid,
+                   tr->comando, segundos_monotonicos() - tr->inicio);
+        }
+    }
+    pthread_mutex_unlock(&mutex_trabajos);
+    return 0;
+}
+
+static int continuar_trabajo(Trabajo *tr) {
+    pid_t destino = tr->pgid > 0 ? -tr->pgid : tr->pids[tr->cantidad - 1];
+    if (tr->pgid <= 0) {
+        // Sin grupo propio: se continua proceso por proceso
+        for (int k = 0; k < tr->cantidad; k++) {
+            if (tr->pids[k] > 0) {
+                kill(tr->pids[k], SIGCONT);
+            }
+        }
+        return 0;
+    }
+    if (kill(destino, SIGCONT) != 0) {
+        perror("Error al continuar el trabajo");
+        return -1;
+    }
+    return 0;
+}
+
+// Implementación del comando 'primer_plano': trae un trabajo y espera que termine
+int comando_primer_plano(int argc, char **args) {
+    revisar_trabajos();
+    pthread_mutex_lock(&mutex_trabajos);
+    Trabajo *encontrado = buscar_trabajo(argc > 1 ? args[1] : NULL);
+    Trabajo tr;
+    if (encontrado != NULL) {
+        tr = *encontrado;
+        encontrado->estado = TRABAJO_LIBRE; // Vuelve a la tabla si se detiene otra vez
+    }
+    pthread_mutex_unlock(&mutex_trabajos);
+    if (encontrado == NULL) {
+        printf("primer_plano: no existe ese trabajo\n");
+        return -1;
+    }
+
+    printf("%s\n", tr.comando);
+    fflush(stdout);
+    dar_terminal(tr.pgid);
+    continuar_trabajo(&tr);
+    tr.estado = TRABAJO_CORRIENDO;
+    if (esperar_trabajo(&tr)) {
+        return 0;
+    }
+    return (WIFEXITED(tr.status_final) && WEXITSTATUS(tr.status_final) == 0) ? 0 : -1;
+}
+
+// Implementación del comando 'segundo_plano': continua un trabajo detenido
+int comando_segundo_plano(int argc, char **args) {
+    revisar_trabajos();
+    pthread_mutex_lock(&mutex_trabajos);
+    Trabajo *tr = buscar_trabajo(argc > 1 ? args[1] : NULL);
+    int resultado = -1;
+    if (tr == NULL) {
+        printf("segundo_plano: no existe ese trabajo\n");
+    } else if (continuar_trabajo(tr) == 0) {
+        tr->estado = TRABAJO_CORRIENDO;
+        printf("[%d] %s &\n", tr->id, tr->comando);
+        resultado = 0;
+    }
+    pthread_mutex_unlock(&mutex_trabajos);
+    return resultado;
+}
+
+// El hijo vuelve a las acciones por defecto de las señales que la shell ignora o maneja
+static void preparar_atributos_hijo(posix_spawnattr_t *atributos, const pid_t *pgid) {
+    posix_spawnattr_init(atributos);
+    sigset_t senales;
+    sigemptyset(&senales);
+    int reiniciar[] = {SIGINT, SIGQUIT, SIGTSTP, SIGTTIN, SIGTTOU, SIGCHLD, SIGPIPE};
+    for (size_t k = 0; k < sizeof(reiniciar) / sizeof(reiniciar[0]); k++) {
+        sigaddset(&senales, reiniciar[k]);
+    }
+    posix_spawnattr_setsigdefault(atributos, &senales);
+    short flags = POSIX_SPAWN_SETSIGDEF;
+    if (pgid != NULL) {
+        posix_spawnattr_setpgroup(atributos, *pgid);
+        flags |= POSIX_SPAWN_SETPGROUP;
+    }
+    posix_spawnattr_setflags(atributos, flags);
+}
+
+// Lanza un comando externo de la tuberia con posix_spawn. Las redirecciones a
+// archivo tienen prioridad sobre los extremos de la tuberia. Si pgid no es NULL
+// el proceso entra al grupo *pgid (o crea uno nuevo si es 0).
+static pid_t lanzar_externo(Etapa *e, int entrada, int salida, pid_t *pgid) {
+    char ruta[PATH_MAX];
+    if (resolver_comando(e->args[0], ruta, sizeof(ruta)) != 0) {
+        fprintf(stderr, "Error al ejecutar el comando: %s: %s\n", e->args[0], strerror(ENOENT));
+        return -1;
+    }
+
+    posix_spawn_file_actions_t acciones;
+    posix_spawn_file_actions_init(&acciones);
+    if (entrada >= 0) {
+        posix_spawn_file_actions_adddup2(&acciones, entrada, STDIN_FILENO);
+    }
+    if (salida >= 0) {
+        posix_spawn_file_actions_adddup2(&acciones, salida, STDOUT_FILENO);
+    }
+    if (e->entrada != NULL) {
+        posix_spawn_file_actions_addopen(&acciones, STDIN_FILENO, e->entrada, O_RDONLY, 0);
+    }
+    if (e->salida != NULL) {
+        posix_spawn_file_actions_addopen(&acciones, STDOUT_FILENO, e->salida,
+                                         O_WRONLY | O_CREAT | (e->anexar ? O_APPEND : O_TRUNC), 0644);
+    }
+    if (e->error != NULL) {
+        posix_spawn_file_actions_addopen(&acciones, STDERR_FILENO, e->error, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    }
+
+    posix_spawnattr_t atributos;
+    preparar_atributos_hijo(&atributos, pgid);
+
+    pid_t pid;
+    int error = posix_spawn(&pid, ruta, &acciones, &atributos, e->expandidos != NULL ? e->expandidos : e->args, environ);
+    posix_spawn_file_actions_destroy(&acciones);
+    posix_spawnattr_destroy(&atributos);
+    if (error != 0) {
+        fprintf(stderr, "Error al ejecutar el comando: %s: %s\n", e->args[0], strerror(error));
+        return -1;
+    }
+    if (pgid != NULL && *pgid == 0) {
+        *pgid = pid;
+    }
+    return pid;
+}
+
+// Ejecuta el comando de una etapa en este hilo. Los internos que recorren
+// archivos (en_flujo) ven los patrones por patrones_del_hilo.
+static int ejecutar_etapa(Etapa *e) {
+    if (e->expandidos != NULL) {
+        return ejecutar_args(e->cant_expandidos, e->expandidos);
+    }
+    char **anteriores = patrones_del_hilo;
+    patrones_del_hilo = e->patrones;
+    int resultado = ejecutar_args(e->argc, e->args);
+    patrones_del_hilo = anteriores;
+    return resultado;
+}
+
+// Ejecuta un comando interno dentro de la shell con sus fds 0, 1 y 2 redirigidos
+static int ejecutar_interno_redirigido(Etapa *e, int entrada, int salida) {
+    int archivos[3];
+    if (abrir_redirecciones(e, archivos) != 0) {
+        cerrar_fds(archivos, 3);
+        return -1;
+    }
+    int nuevos[3] = {archivos[0] >= 0 ? archivos[0] : entrada,
+                     archivos[1] >= 0 ? archivos[1] : salida,
+                     archivos[2]};
+    int guardados[3] = {-1, -1, -1};
+
+    fflush(stdout);
+    fflush(stderr);
+    for (int fd = 0; fd < 3; fd++) {
+        if (nuevos[fd] >= 0) {
+            guardados[fd] = fcntl(fd, F_DUPFD_CLOEXEC, 10);
+            dup2(nuevos[fd], fd);
+        }
+    }
+
+    int resultado = ejecutar_etapa(e);
+
+    fflush(stdout);
+    fflush(stderr);
+    for (int fd = 0; fd < 3; fd++) {
+        if (guardados[fd] >= 0) {
+            dup2(guardados[fd], fd);
+            close(guardados[fd]);
+        }
+    }
+    cerrar_fds(archivos, 3);
+    return resultado;
+}
+
+// Ejecuta un comando interno en un proceso hijo (interno en medio de una tuberia
+// o en segundo plano). pgid tiene el mismo sentido que en lanzar_externo. El hijo
+// no hace exec, asi que cierra a mano los extremos de tubos[] que no son suyos
+// (O_CLOEXEC no lo cubre) para que las demas etapas vean EOF.
+static pid_t lanzar_interno_en_hijo(Etapa *e, int entrada, int salida, int (*tubos)[2], int cant_tubos, pid_t *pgid) {
+    fflush(stdout);
+    fflush(stderr);
+    pid_t pid = fork();
+    if (pid > 0 && pgid != NULL) {
+        setpgid(pid, *pgid); // Tambien en el padre, para no depender de quien llega primero
+        if (*pgid == 0) {
+            *pgid = pid;
+        }
+    }
+    if (pid == 0) {
+        if (pgid != NULL) {
+            setpgid(0, *pgid);
+        }
+        signal(SIGTSTP, SIG_DFL);
+        signal(SIGTTOU, SIG_DFL);
+        signal(SIGTTIN, SIG_DFL);
+        signal(SIGCHLD, SIG_DFL);
+        signal(SIGPIPE, SIG_DFL);
+        if (entrada >= 0) {
+            dup2(entrada, STDIN_FILENO);
+        }
+        if (salida >= 0) {
+            dup2(salida, STDOUT_FILENO);
+        }
+        for (int k = 0; k < cant_tubos; k++) {
+            cerrar_fds(tubos[k], 2);
+        }
+        int resultado = ejecutar_interno_redirigido(e, -1, -1);
+        fflush(stdout);
+        _exit(resultado == 0 ? EXIT_SUCCESS : EXIT_FAILURE);
+    }
+    if (pid < 0) {
+        perror("Error al bifurcar");
+    }
+    return pid;
+}
+
+// Ejecuta una tuberia: todas las etapas arrancan a la vez, unidas con pipe2.
+// En primer plano, un comando interno en un extremo corre dentro de la shell sin
+// fork (si ambos extremos son internos, el del final). En segundo plano todas las
+// etapas son procesos y la tuberia pasa a la tabla de trabajos.
+// Devuelve el estado de la ultima etapa.
+int ejecutar_tuberia(Tuberia *t) {
+    int n = t->cantidad;
+    if (n == 0) {
+        return 0;
+    }
+    if (n == 1 && !t->fondo && !tiene_redirecciones(&t->etapas[0])) {
+        return ejecutar_etapa(&t->etapas[0]);
+    }
+
+    int interna[MAX_ETAPAS] = {0};
+    for (int k = 0; k < n; k++) {
+        interna[k] = buscar_comando(t->etapas[k].args[0]) != NULL;
+    }
+    int en_shell = (t->fondo || ejecucion_concurrente) ? -1 : (interna[n - 1] ? n - 1 : (interna[0] ? 0 : -1));
+
+    // tubos[k] une la etapa k con la k + 1
+    int tubos[MAX_ETAPAS][2];
+    for (int k = 0; k < n - 1; k++) {
+        if (pipe2(tubos[k], O_CLOEXEC) != 0) {
+            perror("Error al crear la tubería");
+            for (int j = 0; j < k; j++) {
+                cerrar_fds(tubos[j], 2);
+            }
+            return -1;
+        }
+    }
+
+    // Grupo de procesos propio si hay terminal o si va a segundo plano
+    Trabajo tr;
+    trabajo_iniciar(&tr, t->linea != NULL ? t->linea : t->etapas[0].args[0]);
+    pid_t *grupo = (shell_interactiva || t->fondo) ? &tr.pgid : NULL;
+    for (int k = 0; k < n; k++) {
+        if (k == en_shell) {
+            trabajo_agregar_pid(&tr, 0, NULL);
+            continue;
+        }
+        int entrada = k > 0 ? tubos[k - 1][0] : -1;
+        int salida = k < n - 1 ? tubos[k][1] : -1;
+        pid_t pid = interna[k] ? lanzar_interno_en_hijo(&t->etapas[k], entrada, salida, tubos, n - 1, grupo)
+                               : lanzar_externo(&t->etapas[k], entrada, salida, grupo);
+        trabajo_agregar_pid(&tr, pid, t->etapas[k].args[0]);
+    }
+
+    // Los extremos que no usa la etapa de la shell se cierran para que llegue el EOF
+    int resultado = 0;
+    int entrada = en_shell > 0 ? tubos[en_shell - 1][0] : -1;
+    int salida = en_shell >= 0 && en_shell < n - 1 ? tubos[en_shell][1] : -1;
+    for (int k = 0; k < n - 1; k++) {
+        if (tubos[k][0] != entrada) {
+            close(tubos[k][0]);
+        }
+        if (tubos[k][1] != salida) {
+            close(tubos[k][1]);
+        }
+    }
+
+    if (t->fondo) {
+        if (tr.vivos == 0) {
+            return -1;
+        }
+        int id = agregar_trabajo(&tr);
+        if (id < 0) {
+            printf("Tabla de trabajos llena; se espera en primer plano.\n");
+        } else {
+            printf("[%d] %d\n", id, (int)tr.pgid);
+            return 0;
+        }
+    }
+
+    if (en_shell >= 0) {
+        resultado = ejecutar_interno_redirigido(&t->etapas[en_shell], entrada, salida);
+        if (entrada >= 0) {
+            close(entrada);
+        }
+        if (salida >= 0) {
+            close(salida);
+        }
+    } else {
+        dar_terminal(tr.pgid);
+    }
+
+    int ultima_viva = tr.pids[n - 1] > 0;
+    if (esperar_trabajo(&tr)) {
+        return 0; // Detenido: ya esta en la tabla
+    }
+    if (en_shell == n - 1) {
+        return resultado;
+    }
+    if (!ultima_viva) {
+        return -1; // La ultima etapa no pudo arrancar
+    }
+    if (!WIFEXITED(tr.status_final)) {
+        printf("El comando terminó de manera anormal: %s\n", t->etapas[n - 1].args[0]);
+        return -1;
+    }
+    return WEXITSTATUS(tr.status_final) == 0 ? 0 : -1;
+}
+
+//Fucnion para ejecutar comandos del sistema
+int ejecutar_comando_sistema(char **args) {
+    Etapa etapa;
+    memset(&etapa, 0, sizeof(etapa));
+    etapa.expandidos = args; // Puede venir de una expansion con mas de MAX_ARGS nombres
+    while (args[etapa.cant_expandidos] != NULL) {
+        etapa.cant_expandidos++;
+    }
+    etapa.argc = etapa.cant_expandidos < MAX_ARGS - 1 ? etapa.cant_expandidos : MAX_ARGS - 1;
+    memcpy(etapa.args, args, etapa.argc * sizeof(char *));
+
+    char comando[128] = "";
+    for (int k = 0; k < etapa.argc; k++) {
+        size_t largo = strlen(comando);
+        snprintf(comando + largo, sizeof(comando) - largo, k ? " %s" : "%s", args[k]);
+    }
+
+    Trabajo tr;
+    trabajo_iniciar(&tr, comando);
+    pid_t pid = lanzar_externo(&etapa, -1, -1, shell_interactiva ? &tr.pgid : NULL);
+    if (pid < 0) {
+        return -1;
+    }
+    trabajo_agregar_pid(&tr, pid, args[0]);
+    dar_terminal(tr.pgid);
+    if (esperar_trabajo(&tr)) {
+        return 0;
+    }
+
+    if (WIFEXITED(tr.status_final)) {
+        informar("Comando ejecutado con éxito: %s\n", args[0]);
+        return WEXITSTATUS(tr.status_final) == 0 ? 0 : -1;
+    } else {
+        printf("El comando terminó de manera anormal: %s\n", args[0]);
+        return -1;
+    }
+}
+
+// Reemplaza los argumentos con comodines por los nombres que coinciden, en
+// orden. No lo hace con los internos en_flujo, que los recorren por su cuenta.
+static void expandir_etapa(Etapa *e) {
+    int con_patrones = 0;
+    for (int k = 0; k < e->argc; k++) {
+        con_patrones |= e->patrones[k] != NULL;
+    }
+    const ComandoInterno *cmd = con_patrones ? buscar_comando(e->args[0]) : NULL;
+    if (!con_patrones || (cmd != NULL && cmd->en_flujo)) {
+        return;
+    }
+    ListaGlob l = {NULL, 0, 0};
+    for (int k = 0; k < e->argc; k++) {
+        size_t desde = l.cantidad;
+        if (e->patrones[k] == NULL || recorrer_glob(e->patrones[k], lista_glob_agregar, &l) == 0) {
+            lista_glob_agregar(e->args[k], &l);
+        }
+        qsort(l.nombres + desde, l.cantidad - desde, sizeof(char *), comparar_cadenas);
+    }
+    char **nombres = realloc(l.nombres, (l.cantidad + 1) * sizeof(char *));
+    if (nombres == NULL) {
+        for (size_t k = 0; k < l.cantidad; k++) {
+            free(l.nombres[k]);
+        }
+        free(l.nombres);
+        return; // Sin memoria: quedan los argumentos tal cual
+    }
+    nombres[l.cantidad] = NULL;
+    e->expandidos = nombres;
+    e->cant_expandidos = (int)l.cantidad;
+}
+
+static void liberar_expansiones(Tuberia *t) {
+    for (int k = 0; k < t->cantidad; k++) {
+        Etapa *e = &t->etapas[k];
+        for (int j = 0; e->expandidos != NULL && j < e->cant_expandidos; j++) {
+            free(e->expandidos[j]);
+        }
+        free(e->expandidos);
+    }
+}
+
+// Analiza y ejecuta una linea. Devuelve 0 si tuvo exito.
+int ejecutar_linea(const char *linea) {
+    Tuberia *t = malloc(sizeof(Tuberia));
+    if (t == NULL) {
+        perror("Error al ejecutar la linea");
+        return -1;
+    }
+    int resultado = -1;
+    if (analizar_linea(linea, t) == 0) {
+        for (int k = 0; k < t->cantidad; k++) {
+            expandir_etapa(&t->etapas[k]);
+        }
+        resultado = ejecutar_tuberia(t);
+        liberar_expansiones(t);
+    }
+    free(t);
+    return resultado;
+}
+
+//Procesar y Ejecutar Comandos
+int procesar_comando(char *input) {
+    input[strcspn(input, "\n")] = '\0';
+    char expandida[MAX_LFS_INPUT];
+    int expansion = expandir_historial(input, expandida, sizeof(expandida));
+    if (expansion < 0) {
+        return -1;
+    }
+    if (expansion > 0) {
+        printf("%s\n", expandida);
+        input = expandida;
+    }
+    registrar_historial(input);
+    return ejecutar_linea(input);
+}
+
+// ---------------------------------------------------------------------------
+// 'paralelo': corre el mismo comando sobre muchos argumentos con a lo sumo N a
+// la vez. Los argumentos van despues de ':::' o, si no estan, salen de la
+// entrada estandar (uno por linea). '{}' en el comando se reemplaza por el
+// argumento; si no aparece, el argumento va al final.
+// Los comandos externos se lanzan con posix_spawn y su salida (stdout y
+// stderr) se lee por un pipe desde este hilo con poll: se muestra en el orden
+// de los argumentos o, con -t, linea por linea con el argumento adelante.
+// Los comandos internos corren en los hilos del pool sin bifurcar; su salida
+// va directo a la terminal porque los fds 1 y 2 son unos solos para todo el
+// proceso, asi que con ellos -k y -t se rechazan en vez de ignorarse.
+// ---------------------------------------------------------------------------
+
+enum { PARALELO_PENDIENTE, PARALELO_CORRIENDO, PARALELO_OK, PARALELO_ERROR, PARALELO_OMITIDA };
+
+typedef struct Paralelo Paralelo;
+
+typedef struct {
+    Paralelo *p;
+    const char *argumento;
+    int estado;
+    pid_t pid;
+    int fd;              // Salida del proceso (-1 si ya llego el EOF o es interno)
+    char *salida;        // Salida guardada hasta su turno, o linea incompleta con -t
+    size_t largo;
+    size_t capacidad;
+    double inicio;
+    double duracion;
+} TareaParalela;
+
+struct Paralelo {
+    char **plantilla;   // Comando con '{}'
+    int cant_plantilla;
+    int con_marca;      // Alguna palabra tiene '{}'
+    TareaParalela *tareas;
+    size_t cantidad;
+    size_t mostradas;   // Tareas cuya salida ya se escribio (modo ordenado)
+    int hilos;
+    int etiquetar;
+    int parar;          // No lanzar mas tareas despues del primer error
+    atomic_int fallo;
+};
+
+// Reemplaza cada '{}' de 'palabra' por 'argumento'
+static char *paralelo_sustituir(const char *palabra, const char *argumento) {
+    size_t largo_arg = strlen(argumento), largo = 0, capacidad = strlen(palabra) + 1;
+    for (const char *c = strstr(palabra, "{}"); c != NULL; c = strstr(c + 2, "{}")) {
+        capacidad += largo_arg;
+    }
+    char *texto = malloc(capacidad);
+    if (texto == NULL) {
+        return NULL;
+    }
+    for (const char *c = palabra; *c != '\0';) {
+        if (c[0] == '{' && c[1] == '}') {
+            memcpy(texto + largo, argumento, largo_arg);
+            largo += largo_arg;
+            c += 2;
+        } else {
+            texto[largo++] = *c++;
+        }
+    }
+    texto[largo] = '\0';
+    return texto;
+}
+
+// Arma el argv de una tarea (terminado en NULL); se libera con liberar_argv
+static char **paralelo_armar(const Paralelo *p, const char *argumento, int *argc) {
+    char **args = calloc(p->cant_plantilla + 2, sizeof(char *));
+    if (args == NULL) {
+        return NULL;
+    }
+    int n = 0;
+    for (int k = 0; k < p->cant_plantilla; k++) {
+        args[n++] = paralelo_sustituir(p->plantilla[k], argumento);
+    }
+    if (!p->con_marca) {
+        args[n++] = strdup(argumento);
+    }
+    *argc = n;
+    return args;
+}
+
+static void liberar_argv(char **args) {
+    for (int k = 0; args != NULL && args[k] != NULL; k++) {
+        free(args[k]);
+    }
+    free(args);
+}
+
+static void paralelo_guardar(TareaParalela *t, const char *datos, size_t n) {
+    if (t->largo + n > t->capacidad) {
+        size_t capacidad = t->capacidad ? t->capacidad : 4096;
+        while (capacidad < t->largo + n) {
+            capacidad *= 2;
+        }
+        char *salida = realloc(t->salida, capacidad);
+        if (salida == NULL) {
+            return; // Sin memoria se pierde este pedazo de salida, no la tarea
+        }
+        t->salida = salida;
+        t->capacidad = capacidad;
+    }
+    memcpy(t->salida + t->largo, datos, n);
+    t->largo += n;
+}
+
+// Con -t escribe cada linea completa con el argumento adelante; el resto queda
+// guardado hasta que llegue el fin de linea (o el EOF, con 'final')
+static void paralelo_etiquetar(TareaParalela *t, const char *datos, size_t n, int final) {
+    paralelo_guardar(t, datos, n);
+    size_t inicio = 0;
+    for (size_t k = 0; k < t->largo; k++) {
+        if (t->salida[k] == '\n') {
+            printf("[%s] %.*s\n", t->argumento, (int)(k - inicio), t->salida + inicio);
+            inicio = k + 1;
+        }
+    }
+    if (final && inicio < t->largo) {
+        printf("[%s] %.*s\n", t->argumento, (int)(t->largo - inicio), t->salida + inicio);
+        inicio = t->largo;
+    }
+    if (inicio > 0) {
+        memmove(t->salida, t->salida + inicio, t->largo - inicio);
+        t->largo -= inicio;
+    }
+    fflush(stdout);
+}
+
+// Modo ordenado: escribe la salida de las tareas terminadas que ya tienen su turno
+static void paralelo_mostrar(Paralelo *p) {
+    while (p->mostradas < p->cantidad && p->tareas[p->mostradas].estado >= PARALELO_OK) {
+        TareaParalela *t = &p->tareas[p->mostradas++];
+        if (t->largo > 0) {
+            fwrite(t->salida, 1, t->largo, stdout);
+        }
+        free(t->salida);
+        t->salida = NULL;
+        t->largo = t->capacidad = 0;
+    }
+    fflush(stdout);
+}
+
+static void paralelo_lanzar(Paralelo *p, TareaParalela *t) {
+    int argc, tubo[2] = {-1, -1};
+    char **args = paralelo_armar(p, t->argumento, &argc);
+    char ruta[PATH_MAX];
+    t->inicio = segundos_monotonicos();
+    t->estado = PARALELO_ERROR;
+    if (args == NULL || resolver_comando(args[0], ruta, sizeof(ruta)) != 0) {
+        fprintf(stderr, "Error al ejecutar el comando: %s: %s\n", args != NULL ? args[0] : "", strerror(ENOENT));
+    } else if (pipe2(tubo, O_CLOEXEC) != 0) {
+        perror("Error al crear la tubería");
+    } else {
+        posix_spawn_file_actions_t acciones;
+        posix_spawn_file_actions_init(&acciones);
+        posix_spawn_file_actions_adddup2(&acciones, tubo[1], STDOUT_FILENO);
+        posix_spawn_file_actions_adddup2(&acciones, tubo[1], STDERR_FILENO);
+        posix_spawnattr_t atributos;
+        preparar_atributos_hijo(&atributos, NULL); // En el grupo de la shell: Ctrl+C les llega a todos
+        sigset_t senales;
+        sigemptyset(&senales);
+        sigaddset(&senales, SIGINT);
+        sigaddset(&senales, SIGQUIT);
+        sigaddset(&senales, SIGCHLD);
+        sigaddset(&senales, SIGPIPE);
+        posix_spawnattr_setsigdefault(&atributos, &senales); // Ctrl+Z no: nadie los podria reanudar
+        int error = posix_spawn(&t->pid, ruta, &acciones, &atributos, args, environ);
+        posix_spawn_file_actions_destroy(&acciones);
+        posix_spawnattr_destroy(&atributos);
+        close(tubo[1]);
+        if (error != 0) {
+            fprintf(stderr, "Error al ejecutar el comando: %s: %s\n", args[0], strerror(error));
+            close(tubo[0]);
+        } else {
+            t->fd = tubo[0];
+            t->estado = PARALELO_CORRIENDO;
+        }
+    }
+    liberar_argv(args);
+    if (t->estado == PARALELO_ERROR) {
+        atomic_store(&p->fallo, 1);
+    }
+}
+
+// Recoge el proceso de una tarea cuya salida ya cerro
+static void paralelo_recoger(Paralelo *p, TareaParalela *t) {
+    MedicionComando m;
+    memset(&m, 0, sizeof(m));
+    siginfo_t info;
+    while (waitid(P_PID, t->pid, &info, WEXITED | WNOWAIT) != 0 && errno == EINTR) {
+    }
+    char ruta[64];
+    snprintf(ruta, sizeof(ruta), "/proc/%d/io", (int)t->pid);
+    leer_contadores_es(ruta, &m.leidos, &m.escritos);
+
+    int status = 0;
+    struct rusage ru;
+    memset(&ru, 0, sizeof(ru));
+    while (wait4(t->pid, &status, 0, &ru) < 0 && errno == EINTR) {
+    }
+    t->duracion = segundos_monotonicos() - t->inicio;
+    int fallo = !WIFEXITED(status) || WEXITSTATUS(status) != 0;
+    m.real = t->duracion;
+    m.usuario = segundos_tv(ru.ru_utime);
+    m.sistema = segundos_tv(ru.ru_stime);
+    m.rss_kb = ru.ru_maxrss;
+    const char *nombre = strrchr(p->plantilla[0], '/');
+    tiempos_registrar(nombre != NULL ? nombre + 1 : p->plantilla[0], &m, 0, fallo);
+
+    if (p->etiquetar) {
+        paralelo_etiquetar(t, "", 0, 1);
+        if (fallo) {
+            printf("[%s] terminó con error\n", t->argumento);
+        }
+    }
+    t->estado = fallo ? PARALELO_ERROR : PARALELO_OK;
+    if (fallo) {
+        atomic_store(&p->fallo, 1);
+    }
+}
+
+static void paralelo_externos(Paralelo *p) {
+    size_t siguiente = 0;
+    unsigned activos = 0;
+    TareaParalela **corriendo = calloc(p->hilos, sizeof(TareaParalela *));
+    struct pollfd *fds = calloc(p->hilos, sizeof(struct pollfd));
+    char *buffer = malloc(PARALELO_BUFFER);
+    if (corriendo == NULL || fds == NULL || buffer == NULL) {
+        perror("Error de memoria");
+        atomic_store(&p->fallo, 1);
+        siguiente = p->cantidad;
+    }
+
+    for (;;) {
+        int detenido = p->parar && atomic_load(&p->fallo);
+        while (activos < (unsigned)p->hilos && siguiente < p->cantidad && !detenido) {
+            TareaParalela *t = &p->tareas[siguiente++];
+            paralelo_lanzar(p, t);
+            if (t->estado == PARALELO_CORRIENDO) {
+                corriendo[activos++] = t;
+            }
+            detenido = p->parar && atomic_load(&p->fallo);
+        }
+        if (!p->etiquetar) {
+            paralelo_mostrar(p);
+        }
+        if (activos == 0) {
+            break;
+        }
+
+        for (unsigned k = 0; k < activos; k++) {
+            fds[k].fd = corriendo[k]->fd;
+            fds[k].events = POLLIN;
+            fds[k].revents = 0;
+        }
+        if (poll(fds, activos, -1) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("Error en poll");
+            break;
+        }
+        for (unsigned k = activos; k-- > 0;) {
+            if (fds[k].revents == 0) {
+                continue;
+            }
+            TareaParalela *t = corriendo[k];
+            ssize_t n = read(t->fd, buffer, PARALELO_BUFFER);
+            if (n < 0 && errno == EINTR) {
+                continue;
+            }
+            if (n > 0) {
+                if (p->etiquetar) {
+                    paralelo_etiquetar(t, buffer, n, 0);
+                } else {
+                    paralelo_guardar(t, buffer, n);
+                }
+                continue;
+            }
+            close(t->fd);
+            t->fd = -1;
+            paralelo_recoger(p, t);
+            corriendo[k] = corriendo[--activos];
+        }
+    }
+    // Tras un corte por error, lo que ya termino igual se muestra
+    for (size_t k = p->mostradas; !p->etiquetar && k < p->cantidad; k++) {
+        if (p->tareas[k].estado == PARALELO_PENDIENTE) {
+            p->tareas[k].estado = PARALELO_OMITIDA; // Para que se muestren las que siguen
+        }
+    }
+    if (!p->etiquetar) {
+        paralelo_mostrar(p);
+    }
+    free(corriendo);
+    free(fds);
+    free(buffer);
+}
+
+static void tarea_paralela_interna(void *arg) {
+    TareaParalela *t = arg;
+    Paralelo *p = t->p;
+    if (p->parar && atomic_load(&p->fallo)) {
+        return;
+    }
+    int argc;
+    char **args = paralelo_armar(p, t->argumento, &argc);
+    t->inicio = segundos_monotonicos();
+    int resultado = args != NULL ? ejecutar_args(argc, args) : -1;
+    t->duracion = segundos_monotonicos() - t->inicio;
+    t->estado = resultado == 0 ? PARALELO_OK : PARALELO_ERROR;
+    if (resultado != 0) {
+        atomic_store(&p->fallo, 1);
+    }
+    liberar_argv(args);
+}
+
+static void paralelo_internos(Paralelo *p) {
+    int concurrente = ejecucion_concurrente;
+    PoolHilos *pool = pool_crear(p->hilos);
+    if (pool == NULL) {
+        atomic_store(&p->fallo, 1);
+        return;
+    }
+    ejecucion_concurrente = 1;
+    for (size_t k = 0; k < p->cantidad; k++) {
+        pool_enviar(pool, tarea_paralela_interna, &p->tareas[k]);
+    }
+    pool_esperar(pool);
+    pool_destruir(pool);
+    ejecucion_concurrente = concurrente;
+    fflush(stdout);
+}
+
+static int comparar_duraciones(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+static void paralelo_resumen(const Paralelo *p, double total, int internos) {
+    size_t ok = 0, errores = 0, corridas = 0;
+    double *duraciones = malloc((p->cantidad + 1) * sizeof(double));
+    for (size_t k = 0; k < p->cantidad; k++) {
+        const TareaParalela *t = &p->tareas[k];
+        if (t->estado == PARALELO_OK || t->estado == PARALELO_ERROR) {
+            ok += t->estado == PARALELO_OK;
+            errores += t->estado == PARALELO_ERROR;
+            if (duraciones != NULL) {
+                duraciones[corridas] = t->duracion;
+            }
+            corridas++;
+        }
+    }
+    char p50[32] = "-", p99[32] = "-", maximo[32] = "-";
+    if (duraciones != NULL && corridas > 0) {
+        qsort(duraciones, corridas, sizeof(double), comparar_duraciones);
+        formatear_latencia(duraciones[(corridas - 1) / 2], p50, sizeof(p50));
+        formatear_latencia(duraciones[(corridas - 1) * 99 / 100], p99, sizeof(p99));
+        formatear_latencia(duraciones[corridas - 1], maximo, sizeof(maximo));
+    }
+    free(duraciones);
+    fprintf(stderr, "Paralelo: %zu tareas, %zu ok, %zu con error, %zu sin ejecutar en %.3f s con %d %s "
+            "(%.1f tareas/s; por tarea p50 %s, p99 %s, max %s)\n",
+            p->cantidad, ok, errores, p->cantidad - corridas, total, p->hilos, internos ? "hilo(s)" : "proceso(s)",
+            total > 0 ? corridas / total : 0.0, p50, p99, maximo);
+}
+
+// Lee los argumentos de la entrada estandar, uno por linea
+static char **paralelo_leer_entrada(size_t *cantidad) {
+    int fd = dup(STDIN_FILENO);
+    FILE *entrada = fd >= 0 ? fdopen(fd, "r") : NULL;
+    char **lineas = NULL, *texto = NULL;
+    size_t capacidad = 0, tam = 0;
+    ssize_t largo;
+    *cantidad = 0;
+    if (entrada == NULL) {
+        if (fd >= 0) {
+            close(fd);
+        }
+        return NULL;
+    }
+    while ((largo = getline(&texto, &tam, entrada)) >= 0) {
+        while (largo > 0 && (texto[largo - 1] == '\n' || texto[largo - 1] == '\r')) {
+            texto[--largo] = '\0';
+        }
+        if (largo == 0) {
+            continue;
+        }
+        if (*cantidad == capacidad) {
+            capacidad = capacidad ? capacidad * 2 : 256;
+            char **nuevas = realloc(lineas, capacidad * sizeof(char *));
+            if (nuevas == NULL) {
+                break;
+            }
+            lineas = nuevas;
+        }
+        lineas[(*cantidad)++] = strdup(texto);
+    }
+    free(texto);
+    fclose(entrada);
+    return lineas;
+}
+
+// Implementación del comando 'paralelo'
+int comando_paralelo(int argc, char **args) {
+    Paralelo p;
+    memset(&p, 0, sizeof(p));
+    p.hilos = hilos_por_defecto();
+    int k = 1, orden_pedido = 0;
+    while (k < argc && args[k][0] == '-') {
+        if (strcmp(args[k], "-j") == 0 && k + 1 < argc && atoi(args[k + 1]) > 0) {
+            p.hilos = atoi(args[++k]);
+        } else if (strcmp(args[k], "-t") == 0) {
+            p.etiquetar = 1;
+            orden_pedido = 1;
+        } else if (strcmp(args[k], "-k") == 0) {
+            p.etiquetar = 0;
+            orden_pedido = 1;
+        } else if (strcmp(args[k], "--parar") == 0) {
+            p.parar = 1;
+        } else {
+            return uso_incorrecto(args[0]);
+        }
+        k++;
+    }
+    int separador = k;
+    while (separador < argc && strcmp(args[separador], ":::") != 0) {
+        separador++;
+    }
+    if (separador == k) {
+        return uso_incorrecto(args[0]);
+    }
+    const ComandoInterno *cmd = buscar_comando(args[k]);
+    if (cmd != NULL && (cmd->funcion == comando_paralelo || strcmp(cmd->nombre, "ir") == 0 ||
+                        strcmp(cmd->nombre, "exit") == 0)) {
+        fprintf(stderr, "Error: '%s' no se puede correr con paralelo\n", args[k]);
+        return -1;
+    }
+    if (cmd != NULL && orden_pedido) {
+        fprintf(stderr, "Error: -k y -t solo valen para comandos externos; la salida de '%s' no se puede "
+                "separar por tarea\n", args[k]);
+        return -1;
+    }
+    p.plantilla = &args[k];
+    p.cant_plantilla = separador - k;
+    for (int j = 0; j < p.cant_plantilla; j++) {
+        p.con_marca |= strstr(p.plantilla[j], "{}") != NULL;
+    }
+
+    char **leidos = NULL;
+    char **argumentos = &args[separador + 1];
+    size_t cantidad = separador < argc ? (size_t)(argc - separador - 1) : 0;
+    if (separador == argc) {
+        if (isatty(STDIN_FILENO)) {
+            return uso_incorrecto(args[0]);
+        }
+        leidos = argumentos = paralelo_leer_entrada(&cantidad);
+    }
+    p.cantidad = cantidad;
+    p.tareas = calloc(cantidad + 1, sizeof(TareaParalela));
+    if (p.tareas == NULL) {
+        perror("Error de memoria");
+        return -1;
+    }
+    for (size_t j = 0; j < cantidad; j++) {
+        p.tareas[j].p = &p;
+        p.tareas[j].argumento = argumentos[j];
+        p.tareas[j].fd = -1;
+    }
+
+    fflush(stdout);
+    double inicio = segundos_monotonicos();
+    if (cmd != NULL) {
+        paralelo_internos(&p);
+    } else {
+        paralelo_externos(&p);
+    }
+    paralelo_resumen(&p, segundos_monotonicos() - inicio, cmd != NULL);
+
+    int resultado = atomic_load(&p.fallo) ? -1 : 0;
+    for (size_t j = 0; j < cantidad; j++) {
+        free(p.tareas[j].salida);
+    }
+    free(p.tareas);
+    for (size_t j = 0; leidos != NULL && j < cantidad; j++) {
+        free(leidos[j]);
+    }
+    free(leidos);
+    return resultado;
+}
+
+// ---------------------------------------------------------------------------
+// Modo lote: ejecuta un guion sin prompt ni mensajes de exito. Con -j N las
+// lineas corren en paralelo en el pool de hilos; una linea "@barrera" espera a
+// que terminen todas las anteriores. 'ir' tambien actua como barrera porque
+// cambia el directorio de todo el proceso.
+// ---------------------------------------------------------------------------
+
+#define LOTE_BARRERA "@barrera"
+
+typedef struct {
+    int numero;
+    char *texto;
+    int ejecutada;
+    int resultado;
+    double duracion;
+} LineaLote;
+
+static void tarea_linea_lote(void *arg) {
+    LineaLote *linea = arg;
+    double inicio = segundos_monotonicos();
+    registrar_historial(linea->texto);
+    linea->resultado = ejecutar_linea(linea->texto);
+    linea->duracion = segundos_monotonicos() - inicio;
+    linea->ejecutada = 1;
+}
+
+// Primera palabra de la linea, para decidir barreras
+static int linea_empieza_con(const char *texto, const char *palabra) {
+    size_t largo = strlen(palabra);
+    while (*texto == ' ' || *texto == '\t') {
+        texto++;
+    }
+    return strncmp(texto, palabra, largo) == 0 &&
+           (texto[largo] == '\0' || texto[largo] == ' ' || texto[largo] == '\t');
+}
+
+// Ejecuta todas las lineas de 'entrada'. Informa el tiempo de cada linea por
+// stderr y devuelve 0 si todas tuvieron exito, 1 si alguna fallo.
+int ejecutar_lote(FILE *entrada, int hilos) {
+    LineaLote *lineas = NULL;
+    size_t cantidad = 0, capacidad = 0;
+    char *texto = NULL;
+    size_t tam = 0;
+    ssize_t largo;
+    int numero = 0;
+
+    while ((largo = getline(&texto, &tam, entrada)) >= 0) {
+        numero++;
+        while (largo > 0 && (texto[largo - 1] == '\n' || texto[largo - 1] == '\r')) {
+            texto[--largo] = '\0';
+        }
+        const char *c = texto + strspn(texto, " \t");
+        if (*c == '\0' || *c == '#') {
+            continue;
+        }
+        if (cantidad == capacidad) {
+            size_t nueva = capacidad ? capacidad * 2 : 256;
+            LineaLote *nuevas = realloc(lineas, nueva * sizeof(LineaLote));
+            if (nuevas == NULL) {
+                break;
+            }
+            lineas = nuevas;
+            capacidad = nueva;
+        }
+        lineas[cantidad].texto = strdup(c);
+        if (lineas[cantidad].texto == NULL) {
+            break;
+        }
+        lineas[cantidad].numero = numero;
+        lineas[cantidad].ejecutada = 0;
+        lineas[cantidad].resultado = 0;
+        lineas[cantidad].duracion = 0;
+        cantidad++;
+    }
+    free(texto);
+    if (largo >= 0 || ferror(entrada)) {
+        // No se ejecuta un guion a medias: sin memoria o con un error de lectura no corre nada
+        fprintf(stderr, "Error al leer el guion en la línea %d: %s\n", numero, strerror(errno));
+        for (size_t k = 0; k < cantidad; k++) {
+            free(lineas[k].texto);
+        }
+        free(lineas);
+        return 1;
+    }
+
+    modo_lote = 1;
+    PoolHilos *pool = hilos > 1 ? pool_crear(hilos) : NULL;
+    ejecucion_concurrente = pool != NULL;
+    double inicio = segundos_monotonicos();
+
+    for (size_t k = 0; k < cantidad; k++) {
+        LineaLote *linea = &lineas[k];
+        int barrera = linea_empieza_con(linea->texto, LOTE_BARRERA);
+        int sola = linea_empieza_con(linea->texto, "ir") || linea_empieza_con(linea->texto, "exit");
+        if ((barrera || sola) && pool != NULL) {
+            pool_esperar(pool);
+        }
+        if (barrera) {
+            continue;
+        }
+        if (linea_empieza_con(linea->texto, "exit")) {
+            break;
+        }
+        if (pool != NULL && !sola) {
+            pool_enviar(pool, tarea_linea_lote, linea);
+        } else {
+            tarea_linea_lote(linea);
+        }
+    }
+    if (pool != NULL) {
+        pool_esperar(pool);
+        pool_destruir(pool);
+    }
+    ejecucion_concurrente = 0;
+    double total = segundos_monotonicos() - inicio;
+    fflush(stdout);
+
+    int ejecutadas = 0, errores = 0;
+    fprintf(stderr, "línea  estado     tiempo (ms)  comando\n");
+    for (size_t k = 0; k < cantidad; k++) {
+        LineaLote *linea = &lineas[k];
+        if (linea->ejecutada) {
+            ejecutadas++;
+            errores += linea->resultado != 0;
+            fprintf(stderr, "%5d  %-6s %14.3f  %s\n", linea->numero, linea->resultado == 0 ? "ok" : "error",
+                    linea->duracion * 1000.0, linea->texto);
+        }
+        free(linea->texto);
+    }
+    free(lineas);
+    fprintf(stderr, "Lote: %d líneas, %d con error, %.3f s en total con %d hilo(s)\n",
+            ejecutadas, errores, total, hilos);
+    revisar_trabajos();
+    return errores == 0 ? 0 : 1;
+}
+
+// ---------------------------------------------------------------------------
+// Editor de linea. Con terminal la linea se lee en modo crudo: flechas para
+// moverse y recorrer el historial, atajos de emacs basicos y Tab para
+// completar. Los comandos salen de un trie con los internos y los ejecutables
+// de PATH, que se rearma si cambia PATH o algun directorio de PATH. Los
+// archivos salen de listados ordenados guardados por directorio (ruta
+// absoluta) e invalidados por su mtime: completar en un directorio enorme es
+// una busqueda binaria sobre el listado ya leido.
+// ---------------------------------------------------------------------------
+
+typedef struct {
+    int hijo;          // Primer hijo (-1 si no tiene); los hermanos van en orden
+    int hermano;
+    unsigned char letra;
+    unsigned char fin; // Aca termina un nombre
+} NodoTrie;
+
+static struct {
+    NodoTrie *nodos;
+    int cantidad;
+    int capacidad;
+    char *path;               // PATH con el que se armo
+    struct timespec *mtimes;  // mtime de cada directorio de PATH al armarlo
+    int cant_directorios;
+} trie_comandos;
+
+typedef struct {
+    char *ruta;           // Ruta absoluta del directorio
+    struct timespec mtime;
+    char *arena;          // Nombres seguidos, terminados en '\0'
+    uint32_t *nombres;    // Desplazamientos en la arena, en orden alfabetico
+    unsigned char *tipos; // d_type de cada nombre (en el mismo orden)
+    size_t cantidad;
+    unsigned long uso;    // Para descartar el menos usado
+} ListadoCacheado;
+
+static ListadoCacheado listados_cacheados[EDITOR_LISTADOS];
+static unsigned long listados_reloj = 0;
+
+static int trie_nodo_nuevo(unsigned char letra) {
+    if (trie_comandos.cantidad == trie_comandos.capacidad) {
+        int capacidad = trie_comandos.capacidad ? trie_comandos.capacidad * 2 : 4096;
+        NodoTrie *nodos = realloc(trie_comandos.nodos, capacidad * sizeof(NodoTrie));
+        if (nodos == NULL) {
+            return -1;
         }
+        trie_comandos.nodos = nodos;
+        trie_comandos.capacidad = capacidad;
     }
+    NodoTrie *n = &trie_comandos.nodos[trie_comandos.cantidad];
+    n->hijo = n->hermano = -1;
+    n->letra = letra;
+    n->fin = 0;
+    return trie_comandos.cantidad++;
 }
 
-//Función para cambiar la contraseña de un usuario
-void cambiar_clave(const char *usuario) {
-    registrar_historial(usuario);
-    if (usuario == NULL || strlen(usuario) == 0) {
-        printf("Error: Usuario no especificado.\n");
-        return;
+static void trie_insertar(const char *nombre) {
+    int nodo = 0;
+    for (const unsigned char *c = (const unsigned char *)nombre; *c != '\0'; c++) {
+        // Los hijos quedan ordenados por letra para listar en orden alfabetico
+        int *enlace = &trie_comandos.nodos[nodo].hijo;
+        while (*enlace >= 0 && trie_comandos.nodos[*enlace].letra < *c) {
+            enlace = &trie_comandos.nodos[*enlace].hermano;
+        }
+        if (*enlace < 0 || trie_comandos.nodos[*enlace].letra != *c) {
+            int nuevo = trie_nodo_nuevo(*c);
+            if (nuevo < 0) {
+                return;
+            }
+            // realloc pudo mover los nodos: se vuelve a buscar el enlace
+            enlace = &trie_comandos.nodos[nodo].hijo;
+            while (*enlace >= 0 && trie_comandos.nodos[*enlace].letra < *c) {
+                enlace = &trie_comandos.nodos[*enlace].hermano;
+            }
+            trie_comandos.nodos[nuevo].hermano = *enlace;
+            *enlace = nuevo;
+        }
+        nodo = *enlace;
     }
+    trie_comandos.nodos[nodo].fin = 1;
+}
 
-    // Construir el comando para cambiar la contraseña
-    char comando[MAX_LFS_INPUT];
-    snprintf(comando, sizeof(comando), "passwd %s", usuario);
-
-    // Ejecutar el comando
-    int resultado = system(comando);
-    if (resultado == -1) {
-        perror("Error al intentar cambiar la clave");
-    } else if (resultado == 0) {
-        printf("La clave para el usuario '%s' se cambió exitosamente.\n", usuario);
-    } else {
-        printf("Error: El comando 'passwd' devolvió un código de salida %d.\n", resultado);
+static int trie_buscar(const char *prefijo) {
+    int nodo = 0;
+    for (const unsigned char *c = (const unsigned char *)prefijo; *c != '\0' && nodo >= 0; c++) {
+        nodo = trie_comandos.nodos[nodo].hijo;
+        while (nodo >= 0 && trie_comandos.nodos[nodo].letra != *c) {
+            nodo = trie_comandos.nodos[nodo].hermano;
+        }
     }
+    return nodo;
 }
 
-//Funcion para agregar usuario con su ip y horario laboral
-void agregar_usuario(const char *nombre, const char *horario, const char *ips) {
-    FILE *archivo;
-    char comando[256];
-
-    // Crear el usuario en el sistema
-    snprintf(comando, sizeof(comando), "useradd -m %s", nombre);
-    if (system(comando) != 0) {
-        printf("Error al crear el usuario '%s'.\n", nombre);
-        return;
+// Rearma el trie si cambio PATH o algun directorio de PATH
+static void trie_comandos_revisar() {
+    pthread_mutex_lock(&cache_rutas.mutex);
+    cache_rutas_revisar_path();
+    int vigente = trie_comandos.path != NULL && strcmp(trie_comandos.path, cache_rutas.path) == 0;
+    for (int d = 0; vigente && d < cache_rutas.cant_directorios; d++) {
+        struct stat st;
+        vigente = stat(cache_rutas.directorios[d], &st) != 0 || mtime_igual(st.st_mtim, trie_comandos.mtimes[d]);
     }
-
-    // Establecer contraseña
-    printf("Estableciendo contraseña para '%s'.\n", nombre);
-    snprintf(comando, sizeof(comando), "passwd %s", nombre);
-    if (system(comando) != 0) {
-        printf("Error al establecer la contraseña para '%s'.\n", nombre);
+    if (vigente) {
+        pthread_mutex_unlock(&cache_rutas.mutex);
         return;
     }
 
-    // Guardar los datos del usuario en el archivo
-    archivo = fopen(USER_DATA_FILE, "a");
-    if (archivo == NULL) {
-        registrar_error("Error al abrir el archivo de datos de usuarios");
-        return;
+    free(trie_comandos.path);
+    free(trie_comandos.mtimes);
+    trie_comandos.path = strdup(cache_rutas.path);
+    trie_comandos.cant_directorios = cache_rutas.cant_directorios;
+    trie_comandos.mtimes = calloc(cache_rutas.cant_directorios, sizeof(struct timespec));
+    trie_comandos.cantidad = 0;
+    trie_nodo_nuevo(0);
+    for (int k = 0; k < CANT_COMANDOS; k++) {
+        trie_insertar(comandos_internos[k].nombre);
     }
+    for (int d = 0; d < cache_rutas.cant_directorios; d++) {
+        struct stat st;
+        DIR *dir = opendir(cache_rutas.directorios[d]);
+        if (dir == NULL) {
+            continue;
+        }
+        if (fstat(dirfd(dir), &st) == 0) {
+            trie_comandos.mtimes[d] = st.st_mtim;
+        }
+        struct dirent *e;
+        while ((e = readdir(dir)) != NULL) {
+            if (e->d_name[0] == '.' || (e->d_type != DT_REG && e->d_type != DT_LNK && e->d_type != DT_UNKNOWN)) {
+                continue;
+            }
+            if (faccessat(dirfd(dir), e->d_name, X_OK, 0) == 0 &&
+                (e->d_type == DT_REG || (fstatat(dirfd(dir), e->d_name, &st, 0) == 0 && S_ISREG(st.st_mode)))) {
+                trie_insertar(e->d_name);
+            }
+        }
+        closedir(dir);
+    }
+    pthread_mutex_unlock(&cache_rutas.mutex);
+}
 
-    fprintf(archivo, "Usuario: %s\n", nombre);
-    fprintf(archivo, "Horario: %s\n", horario);
-    fprintf(archivo, "IPs permitidas: %s\n", ips);
-    fprintf(archivo, "-----------------------------------\n");
-
-    fclose(archivo);
+static const char *arena_orden; // Arena del listado que se esta ordenando
 
-    printf("Usuario '%s' creado exitosamente con horario '%s' y acceso desde '%s'.\n",
-           nombre, horario, ips);
+static int comparar_nombres_listado(const void *a, const void *b) {
+    return strcmp(arena_orden + *(const uint32_t *)a, arena_orden + *(const uint32_t *)b);
 }
 
-void manejador_SIGINT(int sig) {
-    printf("\nSeñal SIGINT capturada.\n");
-    // No matamos el shell principal, pero podemos manejar interrupciones aquí
+static void listado_liberar(ListadoCacheado *l) {
+    free(l->ruta);
+    free(l->arena);
+    free(l->nombres);
+    free(l->tipos);
+    memset(l, 0, sizeof(*l));
 }
 
-//Fucnion para ejecutar comandos del sistema
-void ejecutar_comando_sistema(char **args) {
-    registrar_historial(args[0]);
-    pid_t pid = fork();
-    if (pid == -1) {
-        perror("Error al bifurcar");
-        return;
+// Lee el directorio con getdents64 y deja los nombres ordenados
+static int listado_leer(ListadoCacheado *l, int dir_fd) {
+    char *buffer = malloc(LISTAR_BUFFER);
+    size_t usado = 0, arena_cap = 0, capacidad = 0;
+    unsigned char *tipos_leidos = NULL;
+    if (buffer == NULL) {
+        return -1;
     }
-
-    if (pid == 0) {
-        // Proceso hijo
-        if (execvp(args[0], args) == -1) {
-            perror("Error al ejecutar el comando");
+    long leidos;
+    while ((leidos = syscall(SYS_getdents64, dir_fd, buffer, LISTAR_BUFFER)) > 0) {
+        for (long pos = 0; pos < leidos;) {
+            struct linux_dirent64 *d = (struct linux_dirent64 *)(buffer + pos);
+            pos += d->d_reclen;
+            if (strcmp(d->d_name, ".") == 0 || strcmp(d->d_name, "..") == 0) {
+                continue;
+            }
+            size_t largo = strlen(d->d_name) + 1;
+            if (usado + largo > arena_cap) {
+                size_t nueva = arena_cap ? arena_cap * 2 : (64 << 10);
+                char *arena = realloc(l->arena, nueva);
+                if (arena == NULL) {
+                    leidos = -1;
+                    break;
+                }
+                l->arena = arena;
+                arena_cap = nueva;
+            }
+            if (l->cantidad == capacidad) {
+                size_t nueva = capacidad ? capacidad * 2 : 1024;
+                uint32_t *nombres = realloc(l->nombres, nueva * sizeof(uint32_t));
+                if (nombres != NULL) {
+                    l->nombres = nombres;
+                }
+                unsigned char *tipos = nombres != NULL ? realloc(tipos_leidos, nueva) : NULL;
+                if (tipos == NULL) {
+                    leidos = -1;
+                    break;
+                }
+                tipos_leidos = tipos;
+                capacidad = nueva;
+            }
+            memcpy(l->arena + usado, d->d_name, largo);
+            l->nombres[l->cantidad] = usado;
+            tipos_leidos[l->cantidad] = d->d_type;
+            l->cantidad++;
+            usado += largo;
         }
-        exit(EXIT_FAILURE);
-    } else {
-        // Proceso padre
-        int status;
-
-        //Cambiar el maneajdor de selales para capturar Ctrl+C
-        struct sigaction sa;
-        sa.sa_handler = manejador_SIGINT;
-        sigemptyset(&sa.sa_mask);
-        sa.sa_flags = SA_RESTART;
-
-        waitpid(pid, &status, 0);
-        if (WIFEXITED(status)) {
-            printf("Comando ejecutado con éxito: %s\n", args[0]);
-        } else {
-            printf("El comando terminó de manera anormal: %s\n", args[0]);
+        if (leidos < 0) {
+            break;
         }
     }
-}
-
-void listarDemonios() {
-    //registrar_historial(args[0]);
-    struct dirent *entry;
-    DIR *dp = opendir("/etc/init.d");
-
-    if (dp == NULL) {
-        perror("Error al abrir /etc/init.d");
-        return;
+    free(buffer);
+    if (leidos < 0) {
+        free(tipos_leidos);
+        return -1; // El que llama libera lo que quedo en 'l'
     }
 
-    printf("Demonios disponibles:\n");
-    while ((entry = readdir(dp)) != NULL) {
-        if (entry->d_name[0] != '.') {
-            printf("  %s\n", entry->d_name);
+    // Se ordenan los desplazamientos; el tipo se recupera despues por desplazamiento
+    uint32_t *originales = malloc(l->cantidad * sizeof(uint32_t) + 1);
+    l->tipos = malloc(l->cantidad + 1);
+    if (originales != NULL && l->tipos != NULL) {
+        memcpy(originales, l->nombres, l->cantidad * sizeof(uint32_t));
+        arena_orden = l->arena;
+        qsort(l->nombres, l->cantidad, sizeof(uint32_t), comparar_nombres_listado);
+        for (size_t k = 0; k < l->cantidad; k++) {
+            // originales esta ordenado por desplazamiento: busqueda binaria
+            size_t bajo = 0, alto = l->cantidad;
+            while (alto - bajo > 1) {
+                size_t medio = (bajo + alto) / 2;
+                if (originales[medio] <= l->nombres[k]) {
+                    bajo = medio;
+                } else {
+                    alto = medio;
+                }
+            }
+            l->tipos[k] = tipos_leidos[bajo];
         }
     }
-    closedir(dp);
+    int resultado = originales != NULL && l->tipos != NULL ? 0 : -1;
+    free(originales);
+    free(tipos_leidos);
+    return resultado;
 }
 
-int obtenerPID(const char *nombre) {
-    //registrar_historial(nombre);
-    char ruta[MAX_LFS_INPUT];
-    char buffer[128];
-    snprintf(ruta, sizeof(ruta), "/var/run/%s.pid", nombre);
-    int i;
-
-    FILE *archivo = fopen(ruta, "r");
-    if (archivo == NULL) {
-        i = -1; // PID no encontrado
+// Listado ordenado del directorio; se vuelve a leer solo si cambio su mtime
+static ListadoCacheado *listado_obtener(const char *directorio) {
+    char cwd[PATH_MAX];
+    char *ruta = directorio[0] == '/' ? strdup(directorio)
+                 : getcwd(cwd, sizeof(cwd)) != NULL ? unir_ruta(cwd, directorio) : NULL;
+    int dir_fd = ruta != NULL ? open(ruta, O_RDONLY | O_DIRECTORY | O_CLOEXEC) : -1;
+    struct stat st;
+    if (dir_fd < 0 || fstat(dir_fd, &st) != 0) {
+        if (dir_fd >= 0) {
+            close(dir_fd);
+        }
+        free(ruta);
+        return NULL;
     }
 
-    if (fgets(buffer, sizeof(buffer), archivo) != NULL) {
-        fclose(archivo);
-        i = atoi(buffer);
+    ListadoCacheado *elegido = &listados_cacheados[0];
+    for (int k = 0; k < EDITOR_LISTADOS; k++) {
+        ListadoCacheado *l = &listados_cacheados[k];
+        if (l->ruta != NULL && strcmp(l->ruta, ruta) == 0) {
+            elegido = l;
+            break;
+        }
+        if (l->uso < elegido->uso) {
+            elegido = l;
+        }
+    }
+    if (elegido->ruta == NULL || strcmp(elegido->ruta, ruta) != 0 || !mtime_igual(elegido->mtime, st.st_mtim)) {
+        listado_liberar(elegido);
+        elegido->ruta = ruta;
+        ruta = NULL;
+        elegido->mtime = st.st_mtim;
+        if (listado_leer(elegido, dir_fd) != 0 || elegido->tipos == NULL) {
+            listado_liberar(elegido);
+            close(dir_fd);
+            return NULL;
+        }
     }
+    close(dir_fd);
+    free(ruta);
+    elegido->uso = ++listados_reloj;
+    return elegido;
+}
 
-    fclose(archivo);
-    return i;
+// Primer nombre del listado que no es menor que 'prefijo'
+static size_t listado_desde(const ListadoCacheado *l, const char *prefijo) {
+    size_t bajo = 0, alto = l->cantidad;
+    while (bajo < alto) {
+        size_t medio = (bajo + alto) / 2;
+        if (strcmp(l->arena + l->nombres[medio], prefijo) < 0) {
+            bajo = medio + 1;
+        } else {
+            alto = medio;
+        }
+    }
+    return bajo;
 }
 
-void iniciarDemonio(const char *nombre) {
-    //registrar_historial(args[0]);
-    char ruta[MAX_LFS_INPUT];
-    snprintf(ruta, sizeof(ruta), "/etc/init.d/%s", nombre);
+typedef struct {
+    char buffer[MAX_LFS_INPUT];
+    size_t largo;
+    size_t cursor;
+    int columnas;
+    int tabs_seguidos;
+} EditorLinea;
 
-    if (access(ruta, X_OK) != 0) {
-        printf("El demonio '%s' no existe o no es ejecutable.\n", nombre);
-        return;
+static struct termios terminal_cocida;
+
+static int columnas_terminal() {
+    struct winsize ws;
+    if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &ws) == 0 && ws.ws_col > 0) {
+        return ws.ws_col;
     }
+    return 80;
+}
 
-    pid_t pid = fork();
-    if (pid == -1) {
-        perror("Error al bifurcar");
-        return;
+// Columnas que ocupa un texto UTF-8 (un caracter por columna)
+static size_t columnas_texto(const char *texto, size_t largo) {
+    size_t columnas = 0;
+    for (size_t k = 0; k < largo; k++) {
+        columnas += ((unsigned char)texto[k] & 0xC0) != 0x80;
     }
+    return columnas;
+}
 
-    if (pid == 0) {
-        // Proceso hijo
-        execl(ruta, nombre, "start", (char *)NULL);
-        perror("Error al ejecutar el demonio");
-        exit(EXIT_FAILURE);
-    } else {
-        // Proceso padre
-        int status;
-        waitpid(pid, &status, 0);
-        if (WIFEXITED(status)) {
-            printf("Demonio '%s' iniciado exitosamente.\n", nombre);
-        } else {
-            printf("Error al iniciar el demonio '%s'.\n", nombre);
+static void escribir_terminal(const char *texto, size_t largo) {
+    while (largo > 0) {
+        ssize_t n = write(STDOUT_FILENO, texto, largo);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return;
         }
+        texto += n;
+        largo -= n;
     }
 }
 
-void detenerDemonio(const char *nombre) {
-    int pid = obtenerPID(nombre);
-    if (pid == -1) {
-        printf("No se encontró el demonio %s.\n", nombre);
-        return;
+// Redibuja el prompt y la linea. Si no entra se corre horizontalmente para que el cursor quede visible.
+static void editor_refrescar(EditorLinea *ed) {
+    size_t ancho_prompt = strlen(texto_prompt);
+    size_t disponible = ed->columnas > (int)ancho_prompt + 1 ? ed->columnas - ancho_prompt - 1 : 1;
+    size_t inicio = 0;
+    while (columnas_texto(ed->buffer + inicio, ed->cursor - inicio) > disponible) {
+        do {
+            inicio++;
+        } while (inicio < ed->cursor && ((unsigned char)ed->buffer[inicio] & 0xC0) == 0x80);
     }
-    if (pid == getpid()) {
-        printf("Error: Intento de detener la shell en lugar del demonio.\n");
-        return;
+    size_t fin = inicio;
+    while (fin < ed->largo && columnas_texto(ed->buffer + inicio, fin + 1 - inicio) <= disponible) {
+        fin++;
     }
-    if (kill(pid, SIGTERM) == 0) {
-        printf("Demonio %s detenido.\n", nombre);
-    } else {
-        perror("Error al detener el demonio");
+    while (fin < ed->largo && ((unsigned char)ed->buffer[fin] & 0xC0) == 0x80) {
+        fin++;
+    }
+
+    char salida[MAX_LFS_INPUT * 2 + 64];
+    int n = snprintf(salida, sizeof(salida), "\r%s%.*s\x1b[0K\r", texto_prompt, (int)(fin - inicio), ed->buffer + inicio);
+    size_t columna = ancho_prompt + columnas_texto(ed->buffer + inicio, ed->cursor - inicio);
+    if (columna > 0 && n < (int)sizeof(salida)) {
+        n += snprintf(salida + n, sizeof(salida) - n, "\x1b[%zuC", columna);
     }
+    escribir_terminal(salida, n < (int)sizeof(salida) ? (size_t)n : sizeof(salida) - 1);
 }
 
+static void editor_insertar(EditorLinea *ed, const char *texto, size_t largo) {
+    if (ed->largo + largo >= sizeof(ed->buffer)) {
+        largo = sizeof(ed->buffer) - 1 - ed->largo;
+    }
+    memmove(ed->buffer + ed->cursor + largo, ed->buffer + ed->cursor, ed->largo - ed->cursor);
+    memcpy(ed->buffer + ed->cursor, texto, largo);
+    ed->largo += largo;
+    ed->cursor += largo;
+    ed->buffer[ed->largo] = '\0';
+}
 
+static void editor_borrar(EditorLinea *ed, size_t desde, size_t hasta) {
+    memmove(ed->buffer + desde, ed->buffer + hasta, ed->largo - hasta);
+    ed->largo -= hasta - desde;
+    ed->cursor = desde;
+    ed->buffer[ed->largo] = '\0';
+}
 
-void procesarDemonio(const char *accion, const char *nombre) {
-    if (strcmp(accion, "listar") == 0) {
-        listarDemonios();
-    } else if (strcmp(accion, "iniciar") == 0) {
-        iniciarDemonio(nombre);
-    } else if (strcmp(accion, "detener") == 0) {
-        detenerDemonio(nombre);
-    } else {
-        printf("Acción desconocida. Usa 'listar', 'iniciar <nombre>', o 'detener <nombre>'.\n");
+// Posicion del caracter UTF-8 anterior o siguiente al cursor
+static size_t editor_anterior(const EditorLinea *ed, size_t pos) {
+    while (pos > 0 && ((unsigned char)ed->buffer[--pos] & 0xC0) == 0x80) {
     }
+    return pos;
 }
 
-//Función para registrar el inicio de cesion
-void registrar_sesion(const char *usuario, const char *accion) {
-    const char *DATA_FILE = "/usr/local/bin/usuario_horarios.log";
-    FILE *archivo = fopen(DATA_FILE, "a");
-    if (archivo == NULL) {
-        registrar_error("Error al abrir usuario_horarios.log");
-        return;
+static size_t editor_siguiente(const EditorLinea *ed, size_t pos) {
+    while (pos < ed->largo && ((unsigned char)ed->buffer[++pos] & 0xC0) == 0x80) {
     }
+    return pos;
+}
 
-    char timestamp[64];
-    obtener_timestamp(timestamp, sizeof(timestamp));
+// Copia la linea 'atras' desde el final del historial (1 es la ultima)
+static int historial_reciente(unsigned long atras, char *destino, size_t tam) {
+    pthread_mutex_lock(&historial.mutex);
+    historial_iniciar();
+    unsigned long cantidad = historial.agregadas < HISTORIAL_ANILLO ? historial.agregadas : HISTORIAL_ANILLO;
+    int resultado = -1;
+    if (atras >= 1 && atras <= cantidad) {
+        snprintf(destino, tam, "%s", historial.anillo[(historial.agregadas - atras) % HISTORIAL_ANILLO].texto);
+        resultado = 0;
+    }
+    pthread_mutex_unlock(&historial.mutex);
+    return resultado;
+}
 
-    fprintf(archivo, "%s: Usuario '%s' %s sesión\n", timestamp, usuario, accion);
-    fclose(archivo);
+// Agrega un nombre completado escapando lo que el analizador trataria como especial
+static void editor_insertar_escapado(EditorLinea *ed, const char *texto, size_t largo) {
+    for (size_t k = 0; k < largo; k++) {
+        if (strchr(" \t|<>&'\"\\", texto[k]) != NULL) {
+            editor_insertar(ed, "\\", 1);
+        }
+        editor_insertar(ed, texto + k, 1);
+    }
 }
 
-// Función para registrar en el log
-void registrar_log(const char *mensaje) {
-    FILE *archivo_log = fopen("/var/log/shell/Shell_transferencias", "a");
-    if (archivo_log == NULL) {
-        perror("No se pudo abrir el archivo de log");
-        return;
+// Muestra las posibilidades en columnas debajo de la linea
+static void editor_mostrar_candidatos(EditorLinea *ed, char **candidatos, size_t cantidad, size_t total) {
+    size_t ancho = 0;
+    for (size_t k = 0; k < cantidad; k++) {
+        size_t c = columnas_texto(candidatos[k], strlen(candidatos[k]));
+        ancho = c > ancho ? c : ancho;
+    }
+    ancho += 2;
+    size_t por_fila = ed->columnas / ancho > 0 ? ed->columnas / ancho : 1;
+    escribir_terminal("\n", 1);
+    for (size_t k = 0; k < cantidad; k++) {
+        char celda[PATH_MAX + 8];
+        int n = snprintf(celda, sizeof(celda), "%s", candidatos[k]);
+        size_t c = columnas_texto(candidatos[k], strlen(candidatos[k]));
+        while (c++ < ancho && n < (int)sizeof(celda) - 1) {
+            celda[n++] = ' ';
+        }
+        escribir_terminal(celda, n);
+        if ((k + 1) % por_fila == 0 || k + 1 == cantidad) {
+            escribir_terminal("\n", 1);
+        }
     }
+    if (total > cantidad) {
+        char aviso[64];
+        int n = snprintf(aviso, sizeof(aviso), "... y %zu mas\n", total - cantidad);
+        escribir_terminal(aviso, n);
+    }
+}
 
-    // Obtener la fecha y hora actual
-    time_t t = time(NULL);
-    struct tm tm = *localtime(&t);
-    fprintf(archivo_log, "[%04d-%02d-%02d %02d:%02d:%02d] %s\n", 
-            tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday, 
-            tm.tm_hour, tm.tm_min, tm.tm_sec, mensaje);
-    
-    fclose(archivo_log);
+// Junta hasta EDITOR_CANDIDATOS nombres del trie bajo 'nodo'; 'nombre' trae el prefijo
+static void trie_juntar(int nodo, char *nombre, size_t largo, char **candidatos, size_t *cantidad, size_t *total) {
+    if (trie_comandos.nodos[nodo].fin) {
+        if (*cantidad < EDITOR_CANDIDATOS) {
+            candidatos[(*cantidad)++] = strndup(nombre, largo);
+        }
+        (*total)++;
+    }
+    for (int h = trie_comandos.nodos[nodo].hijo; h >= 0 && largo + 1 < PATH_MAX; h = trie_comandos.nodos[h].hermano) {
+        nombre[largo] = trie_comandos.nodos[h].letra;
+        trie_juntar(h, nombre, largo + 1, candidatos, cantidad, total);
+    }
 }
 
-// Función para ejecutar la transferencia FTP
-void transferencia_archivo(const char *origen, const char *destino, const char *metodo) {
-    char log_path[PATH_MAX] = "/var/log/shell/Shell_transferencias.log";
-    FILE *archivo = fopen(log_path, "a");
-    if (archivo == NULL) {
-        registrar_error("Error al abrir Shell_transferencias.log");
-        return;
+// Tab: completa la palabra bajo el cursor con lo que tengan en comun todas las
+// posibilidades; con un segundo Tab seguido las muestra.
+static void editor_completar(EditorLinea *ed) {
+    size_t inicio = ed->cursor;
+    while (inicio > 0 && strchr(" \t|<>&", ed->buffer[inicio - 1]) == NULL) {
+        inicio--;
+    }
+    while (inicio > 1 && ed->buffer[inicio - 1] == ' ' && ed->buffer[inicio - 2] == '\\') {
+        inicio -= 2; // Espacio escapado: sigue siendo la misma palabra
+        while (inicio > 0 && strchr(" \t|<>&", ed->buffer[inicio - 1]) == NULL) {
+            inicio--;
+        }
+    }
+    char palabra[PATH_MAX];
+    size_t largo = 0;
+    for (size_t k = inicio; k < ed->cursor && largo < sizeof(palabra) - 1; k++) {
+        if (ed->buffer[k] == '\\' && k + 1 < ed->cursor) {
+            k++;
+        }
+        palabra[largo++] = ed->buffer[k];
     }
+    palabra[largo] = '\0';
+    size_t antes = inicio;
+    while (antes > 0 && (ed->buffer[antes - 1] == ' ' || ed->buffer[antes - 1] == '\t')) {
+        antes--;
+    }
+    int es_comando = (antes == 0 || strchr("|&", ed->buffer[antes - 1]) != NULL) && strchr(palabra, '/') == NULL;
 
-    char timestamp[64];
-    obtener_timestamp(timestamp, sizeof(timestamp));
+    char *candidatos[EDITOR_CANDIDATOS];
+    size_t cantidad = 0, total = 0;
+    const char *prefijo = palabra;
+    char comun[PATH_MAX] = "";
+    size_t largo_comun = 0;
+    int unico_directorio = 0;
 
-    if (strcmp(metodo, "scp") == 0 || strcmp(metodo, "ftp") == 0) {
-        fprintf(archivo, "%s: Transferencia iniciada de '%s' a '%s' usando %s\n", timestamp, origen, destino, metodo);
-        fclose(archivo);
-        ejecutar_comando(metodo);  // Ejemplo para delegar en herramientas como SCP
+    if (es_comando) {
+        trie_comandos_revisar();
+        int nodo = trie_buscar(palabra);
+        if (nodo >= 0) {
+            // Se baja mientras el camino no se divida: eso es lo comun a todos
+            largo_comun = snprintf(comun, sizeof(comun), "%s", palabra);
+            while (!trie_comandos.nodos[nodo].fin && trie_comandos.nodos[nodo].hijo >= 0 &&
+                   trie_comandos.nodos[trie_comandos.nodos[nodo].hijo].hermano < 0 && largo_comun + 1 < sizeof(comun)) {
+                nodo = trie_comandos.nodos[nodo].hijo;
+                comun[largo_comun++] = trie_comandos.nodos[nodo].letra;
+            }
+            comun[largo_comun] = '\0';
+            char nombre[PATH_MAX];
+            memcpy(nombre, comun, largo_comun);
+            trie_juntar(nodo, nombre, largo_comun, candidatos, &cantidad, &total);
+        }
     } else {
-        fprintf(archivo, "%s: Método de transferencia no soportado: '%s'\n", timestamp, metodo);
-        fclose(archivo);
+        char *barra = strrchr(palabra, '/');
+        char directorio[PATH_MAX];
+        if (barra != NULL) {
+            snprintf(directorio, sizeof(directorio), "%.*s", (int)(barra - palabra + 1), palabra);
+            prefijo = barra + 1;
+        } else {
+            snprintf(directorio, sizeof(directorio), ".");
+        }
+        ListadoCacheado *l = listado_obtener(directorio);
+        size_t largo_prefijo = strlen(prefijo);
+        for (size_t k = l != NULL ? listado_desde(l, prefijo) : 0; l != NULL && k < l->cantidad; k++) {
+            const char *nombre = l->arena + l->nombres[k];
+            if (strncmp(nombre, prefijo, largo_prefijo) != 0) {
+                break;
+            }
+            if (nombre[0] == '.' && prefijo[0] != '.') {
+                continue; // Los ocultos solo si se pidieron
+            }
+            if (total == 0) {
+                largo_comun = snprintf(comun, sizeof(comun), "%s", nombre);
+            } else {
+                size_t c = largo_prefijo;
+                while (c < largo_comun && comun[c] == nombre[c]) {
+                    c++;
+                }
+                largo_comun = c;
+                comun[c] = '\0';
+            }
+            if (cantidad < EDITOR_CANDIDATOS) {
+                candidatos[cantidad++] = strdup(nombre);
+            }
+            if (total++ == 0) {
+                struct stat st;
+                char ruta[PATH_MAX];
+                snprintf(ruta, sizeof(ruta), "%s/%s", l->ruta, nombre);
+                unico_directorio = l->tipos[k] == DT_DIR ||
+                                   (l->tipos[k] != DT_REG && stat(ruta, &st) == 0 && S_ISDIR(st.st_mode));
+            }
+        }
     }
-}
-
-
-//Procesar y Ejecutar Comandos
-void procesar_comando(char *input) {
-    char *args[MAX_ARGS];
-    char *token = strtok(input, " \t\n");
-    int i = 0;
 
-    registrar_historial(input);
+    size_t ya_escrito = strlen(prefijo);
+    if (total > 0 && largo_comun > ya_escrito) {
+        editor_insertar_escapado(ed, comun + ya_escrito, largo_comun - ya_escrito);
+    }
+    if (total == 1) {
+        editor_insertar(ed, !es_comando && unico_directorio ? "/" : " ", 1);
+    } else if (total > 1 && largo_comun <= ya_escrito && ed->tabs_seguidos > 0) {
+        editor_mostrar_candidatos(ed, candidatos, cantidad, total);
+    } else if (total == 0 || largo_comun <= ya_escrito) {
+        escribir_terminal("\a", 1);
+    }
+    for (size_t k = 0; k < cantidad; k++) {
+        free(candidatos[k]);
+    }
+}
 
-    while (token != NULL && i < MAX_ARGS - 1) {
-        args[i++] = token;
-        token = strtok(NULL, " \t\n");
+// Lee una secuencia de escape de las flechas y teclas de edicion. Devuelve la
+// letra final (A, B, C, D, H, F) o '3' para Supr; 0 si no se reconoce.
+static int editor_leer_escape() {
+    char seq[3];
+    if (read(STDIN_FILENO, &seq[0], 1) != 1 || read(STDIN_FILENO, &seq[1], 1) != 1) {
+        return 0;
+    }
+    if (seq[0] == '[' && seq[1] >= '0' && seq[1] <= '9') {
+        if (read(STDIN_FILENO, &seq[2], 1) != 1 || seq[2] != '~') {
+            return 0;
+        }
+        return seq[1] == '1' || seq[1] == '7' ? 'H' : seq[1] == '4' || seq[1] == '8' ? 'F' : seq[1];
     }
-    args[i] = NULL;
+    return seq[0] == '[' || seq[0] == 'O' ? seq[1] : 0;
+}
 
-    if (args[0] == NULL){
-        return;
+// Lee una linea con edicion. Devuelve NULL con Ctrl+D sobre la linea vacia.
+static char *editor_leer_linea(char *destino, int tam) {
+    struct termios cruda;
+    if (tcgetattr(STDIN_FILENO, &terminal_cocida) != 0) {
+        return NULL;
     }
+    cruda = terminal_cocida;
+    cruda.c_iflag &= ~(BRKINT | ICRNL | INPCK | ISTRIP | IXON);
+    cruda.c_lflag &= ~(ECHO | ICANON | IEXTEN | ISIG);
+    cruda.c_cc[VMIN] = 1;
+    cruda.c_cc[VTIME] = 0;
+    tcsetattr(STDIN_FILENO, TCSADRAIN, &cruda);
 
-    // Comandos implementados
-    if (strcmp(args[0], "propietario") == 0) {
-        if (i >= 4) {
-            cambiar_propietario(args[1],args[2], (const char **)&args[3], i - 3);
-        } else {
-            registrar_error("No se pudo cambiar de propietario.");
-            printf("Uso: propietario <nuevo_propietario> <archivo1> [archivo2 ... archivoN]\n");
-        }
-    } else if (strcmp(args[0], "permisos") == 0) {
-        if (i >= 3) {
-            permisos(args[1], (const char **)&args[2], i - 2);
-        } else {
-            registrar_error("No se pudo cambiar los permisos.");
-            printf("Uso: permisos <modo> <archivo1> [archivo2 ... archivoN]\n");
-        }
-    } else if (strcmp(args[0], "copiar") == 0) {
-        if (i == 3) {
-            copiar(args[1], args[2]);
-        } else {
-            registrar_error("No se pudo copiar.");
-            printf("Uso: copiar <archivo_origen> <archivo_destino>\n");
+    EditorLinea ed;
+    memset(&ed, 0, sizeof(ed));
+    ed.columnas = columnas_terminal();
+    char guardada[MAX_LFS_INPUT] = "";
+    unsigned long atras = 0; // Posicion en el historial: 0 es la linea que se esta escribiendo
+    int terminada = 0, fin_entrada = 0;
+
+    while (!terminada) {
+        struct pollfd fds[2] = {{STDIN_FILENO, POLLIN, 0}, {tubo_sigchld[0], POLLIN, 0}};
+        if (poll(fds, tubo_sigchld[0] >= 0 ? 2 : 1, -1) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            break;
         }
-    } else if (strcmp(args[0], "mover") == 0) {
-        if (i == 3) {
-            mover(args[1], args[2]);
-        } else {
-            registrar_error("No se pudo mover.");
-            printf("Uso: mover <archivo_origen> <archivo_destino>\n");
+        if (!fds[0].revents) {
+            if (fds[1].revents && revisar_trabajos() > 0) {
+                editor_refrescar(&ed);
+            }
+            continue;
         }
-    } else if (strcmp(args[0], "renombrar") == 0) {
-        if (i == 3) {
-            renombrar(args[1], args[2]);
-        } else {
-            registrar_error("No se pudo renombrar.");
-            printf("Uso: renombrar <archivo> <nuevo_nombre>\n");
+
+        unsigned char c;
+        ssize_t n = read(STDIN_FILENO, &c, 1);
+        if (n < 0 && errno == EINTR) {
+            continue;
         }
-    } else if (strcmp(args[0], "listar") == 0) {
-        const char *directorio = (i == 2) ? args[1] : ".";
-        listar(directorio);
-    } else if (strcmp(args[0], "creardir") == 0) {
-        if (i == 2) {
-            creardir(args[1]);
-        } else {
-            registrar_error("No se pudo crear el nuevo directorio.");
-            printf("Uso: creardir <nombre_directorio>\n");
+        if (n <= 0) {
+            fin_entrada = 1;
+            break;
         }
-    } else if (strcmp(args[0], "ir") == 0) {
-        if (i == 2) {
-            ir(args[1]);
-        } else {
-            registrar_error("Error: No se pudo ir al dorectorio sugerido");
-            printf("Uso: ir <nombre_directorio>\n");
+        ed.columnas = columnas_terminal();
+        int tab = c == '\t';
+        switch (c) {
+        case '\r':
+        case '\n':
+            terminada = 1;
+            break;
+        case 3: // Ctrl+C: descarta la linea
+            escribir_terminal("^C\n", 3);
+            ed.largo = ed.cursor = 0;
+            ed.buffer[0] = '\0';
+            atras = 0;
+            break;
+        case 4: // Ctrl+D: fin de entrada con la linea vacia, si no borra adelante
+            if (ed.largo == 0) {
+                fin_entrada = 1;
+                terminada = 1;
+            } else if (ed.cursor < ed.largo) {
+                editor_borrar(&ed, ed.cursor, editor_siguiente(&ed, ed.cursor));
+            }
+            break;
+        case '\t':
+            editor_completar(&ed);
+            break;
+        case 127:
+        case 8:
+            if (ed.cursor > 0) {
+                editor_borrar(&ed, editor_anterior(&ed, ed.cursor), ed.cursor);
+            }
+            break;
+        case 1: // Ctrl+A
+            ed.cursor = 0;
+            break;
+        case 5: // Ctrl+E
+            ed.cursor = ed.largo;
+            break;
+        case 11: // Ctrl+K
+            editor_borrar(&ed, ed.cursor, ed.largo);
+            break;
+        case 21: // Ctrl+U
+            editor_borrar(&ed, 0, ed.cursor);
+            break;
+        case 23: { // Ctrl+W: borra la palabra anterior
+            size_t desde = ed.cursor;
+            while (desde > 0 && ed.buffer[desde - 1] == ' ') {
+                desde--;
+            }
+            while (desde > 0 && ed.buffer[desde - 1] != ' ') {
+                desde--;
+            }
+            editor_borrar(&ed, desde, ed.cursor);
+            break;
         }
-    } else if (strcmp(args[0], "mostrar") == 0) {
-        mostrar();
-    } else if (strcmp(args[0], "clave") == 0) {
-        if (i == 2) {
-            cambiar_clave(args[1]);
-        } else {
-            registrar_error("No se pudo cambiar la clave del usuario.");
-            printf("Uso: clave <usuario>\n");
+        case 12: // Ctrl+L
+            escribir_terminal("\x1b[H\x1b[2J", 7);
+            break;
+        case 27: {
+            int tecla = editor_leer_escape();
+            if (tecla == 'A' || tecla == 'B') {
+                char linea[MAX_LFS_INPUT];
+                unsigned long nueva = tecla == 'A' ? atras + 1 : atras - (atras > 0);
+                if (nueva == atras || (nueva > 0 && historial_reciente(nueva, linea, sizeof(linea)) != 0)) {
+                    break;
+                }
+                if (atras == 0) {
+                    snprintf(guardada, sizeof(guardada), "%s", ed.buffer);
+                }
+                atras = nueva;
+                ed.largo = snprintf(ed.buffer, sizeof(ed.buffer), "%s", atras > 0 ? linea : guardada);
+                ed.largo = ed.largo < sizeof(ed.buffer) ? ed.largo : sizeof(ed.buffer) - 1;
+                ed.cursor = ed.largo;
+            } else if (tecla == 'C') {
+                ed.cursor = editor_siguiente(&ed, ed.cursor);
+            } else if (tecla == 'D') {
+                ed.cursor = editor_anterior(&ed, ed.cursor);
+            } else if (tecla == 'H') {
+                ed.cursor = 0;
+            } else if (tecla == 'F') {
+                ed.cursor = ed.largo;
+            } else if (tecla == '3' && ed.cursor < ed.largo) {
+                editor_borrar(&ed, ed.cursor, editor_siguiente(&ed, ed.cursor));
+            }
+            break;
         }
-    } else if (strcmp(args[0], "demonio") == 0) {
-        if (i >= 2) {
-            if (strcmp(args[1], "listar") == 0) {
-                listarDemonios();
-            } else if (i == 3 && strcmp(args[1], "iniciar") == 0) {
-                iniciarDemonio(args[2]);
-            } else if (i == 3 && strcmp(args[1], "detener") == 0) {
-                detenerDemonio(args[2]);
-            } else if (strcmp(args[0], "transferir") == 0) {
-	        } else {
-                registrar_error("No se pudo realizar la operacion del demonio.");
-                printf("Uso: demonio listar | demonio iniciar <nombre_demonio> | demonio detener <nombre_demonio>\n");
+        default:
+            if (c >= 32) {
+                char letra = c;
+                editor_insertar(&ed, &letra, 1);
             }
-        } else {
-            registrar_error("No se pudo realizar la operacion del demonio.");
-            printf("Uso: demonio listar | demonio iniciar <nombre_demonio> | demonio detener <nombre_demonio>\n");
+            break;
         }
-    } else if (strcmp(args[0], "exit") == 0) {
-        exit(0);
-    }else if (strcmp(args[0], "usuario") == 0) {
-        if (args[1] && args[2] && args[3]) {
-            agregar_usuario(args[1], args[2], args[3]);
-        } else {
-            registrar_error("No se pudo iniciar");
-            printf("Uso: usuario <nombre> <horario> <ips>\n");
+        ed.tabs_seguidos = tab ? ed.tabs_seguidos + 1 : 0;
+        struct pollfd mas = {STDIN_FILENO, POLLIN, 0};
+        if (!terminada && poll(&mas, 1, 0) <= 0) {
+            editor_refrescar(&ed); // Al pegar texto se redibuja una vez al final
         }
-    } else if (strcmp(args[0], "sesion") == 0){
-        if (args[1] == NULL || args[2] == NULL) {
-        printf("Uso: sesion <usuario> <accion>\n");
-    } else {
-        registrar_historial(args[0]);
     }
-    }else if (strcmp(args[0], "transferencia") == 0){
-        if (args[1] == NULL || args[2] == NULL || args[3] == NULL) {
-        registrar_error("Error al relizar la transferencia");
-        printf("Uso: transferencia <origen> <destino> <metodo>\n");
-    } else {
-        registrar_historial(args[0]);
-        transferencia_archivo(args[1], args[2], args[3]); // args[1]: origen, args[2]: destino, args[3]: método (scp o ftp)
+
+    tcsetattr(STDIN_FILENO, TCSADRAIN, &terminal_cocida);
+    if (fin_entrada && ed.largo == 0) {
+        escribir_terminal("\n", 1);
+        return NULL;
     }
-    } else {
-        // Si no es uno de los comandos anteriores, lo ejecutamos como un comando del sistema
-        ejecutar_comando_sistema(args);
+    ed.cursor = ed.largo;
+    editor_refrescar(&ed);
+    escribir_terminal("\n", 1);
+    snprintf(destino, tam, "%s\n", ed.buffer);
+    return destino;
+}
+
+// Lee una linea de la entrada. Con terminal usa el editor de linea; sin
+// terminal igual espera con poll tambien en el tubo de SIGCHLD, asi los
+// trabajos que terminan se informan aunque nadie escriba.
+static char *leer_linea(char *buffer, int tam) {
+    if (shell_interactiva && isatty(STDOUT_FILENO)) {
+        return editor_leer_linea(buffer, tam);
+    }
+    while (shell_interactiva && tubo_sigchld[0] >= 0) {
+        struct pollfd fds[2] = {{STDIN_FILENO, POLLIN, 0}, {tubo_sigchld[0], POLLIN, 0}};
+        if (poll(fds, 2, -1) < 0 && errno != EINTR) {
+            break;
+        }
+        if (fds[0].revents) {
+            break;
+        }
+        if (fds[1].revents && revisar_trabajos() > 0) {
+            prompt();
+        }
     }
+    return fgets(buffer, tam, stdin);
 }
 
 // Función principal de la shell
-int main() {
+int main(int argc, char **argv) {
+    int lote = 0, hilos = 1;
+    const char *guion = NULL;
+    for (int k = 1; k < argc; k++) {
+        if (strcmp(argv[k], "-j") == 0 && k + 1 < argc) {
+            hilos = atoi(argv[++k]);
+        } else if (strcmp(argv[k], "-b") == 0 || strcmp(argv[k], "-") == 0) {
+            lote = 1;
+        } else if (argv[k][0] != '-' && guion == NULL) {
+            guion = argv[k];
+            lote = 1;
+        } else {
+            hilos = 0;
+        }
+    }
+    if (hilos < 1) {
+        fprintf(stderr, "Uso: %s [-b] [-j hilos] [guion|-]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
     // Configurar el manejador de señales
     struct sigaction sa;
     sa.sa_handler = manejador_SIGINT;
@@ -662,12 +9708,40 @@ int main() {
     
     char input[MAX_LFS_INPUT];
 
-    registrar_sesion("root", "inició");
+    bitacora_iniciar();
+    tiempos_iniciar();
+    trabajos_iniciar();
+    if (shell_interactiva && !lote) {
+        setvbuf(stdin, NULL, _IONBF, 0); // poll ve exactamente lo que falta leer
+    }
+    // La sesion es del usuario que ejecuta la shell
+    char usuario[64] = "root";
+    struct passwd pw, *info;
+    char buf_pw[4096];
+    if (getpwuid_r(getuid(), &pw, buf_pw, sizeof(buf_pw), &info) == 0 && info != NULL) {
+        snprintf(usuario, sizeof(usuario), "%s", info->pw_name);
+    }
+    if (registrar_sesion(usuario, "inició") != 0) {
+        return EXIT_FAILURE;
+    }
+
+    if (lote) {
+        shell_interactiva = 0; // Los comandos del guion no toman la terminal
+        FILE *entrada = guion != NULL ? fopen(guion, "r") : stdin;
+        if (entrada == NULL) {
+            perror("Error al abrir el guion");
+            return EXIT_FAILURE;
+        }
+        int resultado = ejecutar_lote(entrada, hilos);
+        registrar_sesion(usuario, "cerró");
+        return resultado;
+    }
 
     while (1) {
+        revisar_trabajos();
         prompt();
-        if (fgets(input, MAX_LFS_INPUT, stdin) == NULL) {
-            registrar_sesion("root", "cerró");
+        if (leer_linea(input, MAX_LFS_INPUT) == NULL) {
+            registrar_sesion(usuario, "cerró");
             break; // Salir con Ctrl+D
         }
         procesar_comando(input);